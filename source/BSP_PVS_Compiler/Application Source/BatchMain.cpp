@@ -0,0 +1,578 @@
+//-----------------------------------------------------------------------------
+// File: BatchMain.cpp
+//
+// Desc: Headless command line entry point for the compiler. Compiles one or
+//       more maps with no console window or user interaction, writing the log
+//       to stdout and returning a non-zero exit code if any map fails, so that
+//       levels may be built by scripts and build machines.
+//
+//       Usage : compiler [options] <file.map> [<file.map> ...]
+//
+//       Every compiler option may be set with '-<process>.<option> <value>',
+//       run with no arguments for the full list.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Main Module Includes
+//-----------------------------------------------------------------------------
+#include "../Compiler Source/CCompiler.h"
+#include "../Compiler Source/MemoryPool.h"
+#include "ConsoleLogger.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Miscellaneous Definitions
+//-----------------------------------------------------------------------------
+#define EXIT_OK         0       // Every map was compiled and saved
+#define EXIT_FAILED     1       // At least one map failed to compile or save
+#define EXIT_USAGE      2       // The command line was invalid
+
+//-----------------------------------------------------------------------------
+// Typedefs, Structures and Enumerators
+//-----------------------------------------------------------------------------
+enum OPTIONTYPE
+{
+    OPT_BOOL    = 0,
+    OPT_UCHAR   = 1,
+    OPT_UINT    = 2,
+    OPT_ULONG   = 3,
+    OPT_FLOAT   = 4,
+    OPT_PATH    = 5
+};
+
+typedef struct _BATCHSETTINGS {         // Options passed to every compiler
+    MAPOPTIONS      MAP;
+    HSROPTIONS      HSR;
+    BSPOPTIONS      BSP;
+    PRTOPTIONS      PRT;
+    PVSOPTIONS      PVS;
+    TJROPTIONS      TJR;
+    LIGHTMAPOPTIONS LMP;
+} BATCHSETTINGS;
+
+typedef struct _BATCHOPTION {           // A single command line compiler option
+    LPCSTR          Name;               // Switch name, without the leading '-'
+    OPTIONTYPE      Type;               // Type of the value that follows the switch
+    size_t          Offset;             // Offset of the value within BATCHSETTINGS
+    LPCSTR          Desc;               // Description printed by the usage text
+} BATCHOPTION;
+
+typedef struct _BATCHJOB {              // A single map to compile
+    std::string     Input;              // The .map file
+    std::string     Output;             // The compiled level file
+    std::string     Name;               // File name used to tag the log output
+    std::string     LightFolder;        // Folder receiving the light / cluster maps
+    bool            Succeeded;          // Compiled and saved ?
+    double          StageTime[PROCESS_COUNT]; // Seconds spent in each process
+    double          TotalTime;          // Seconds spent compiling and saving
+} BATCHJOB;
+
+#define BATCH_OPTION(Name, Type, Member, Desc) { Name, Type, offsetof(BATCHSETTINGS, Member), Desc }
+
+//-----------------------------------------------------------------------------
+// Module Local Variables
+//-----------------------------------------------------------------------------
+static const BATCHOPTION g_Options[] =
+{
+    BATCH_OPTION( "map.cache"         , OPT_BOOL , MAP.BrushCache          , "Read / write the parsed brushes from a cache file next to the map" ),
+    BATCH_OPTION( "map.threads"       , OPT_ULONG, MAP.ThreadCount         , "Brush polygon and CSG worker threads (0 = one per hardware thread)" ),
+
+    BATCH_OPTION( "hsr"               , OPT_BOOL , HSR.Enabled             , "Hidden surface removal between the world and func_wall meshes" ),
+    BATCH_OPTION( "hsr.threads"       , OPT_ULONG, HSR.ThreadCount         , "Mesh clipping worker threads (0 = one per hardware thread)" ),
+
+    BATCH_OPTION( "bsp"               , OPT_BOOL , BSP.Enabled             , "Binary space partition compilation" ),
+    BATCH_OPTION( "bsp.type"          , OPT_ULONG, BSP.TreeType            , "Tree type (0 = non-split, 1 = split)" ),
+    BATCH_OPTION( "bsp.split"         , OPT_FLOAT, BSP.SplitHeuristic      , "Split vs balance importance" ),
+    BATCH_OPTION( "bsp.sample"        , OPT_ULONG, BSP.SplitterSample      , "Number of splitters to sample" ),
+    BATCH_OPTION( "bsp.heuristic"     , OPT_ULONG, BSP.Heuristic           , "Splitter selection (0 = balance, 1 = traversal cost)" ),
+    BATCH_OPTION( "bsp.traversalcost" , OPT_FLOAT, BSP.TraversalCost       , "Cost of stepping through a node relative to testing a face" ),
+    BATCH_OPTION( "bsp.compare"       , OPT_BOOL , BSP.CompareHeuristics   , "Also build the tree with the other heuristic and log both" ),
+    BATCH_OPTION( "bsp.backleaves"    , OPT_BOOL , BSP.RemoveBackLeaves    , "Remove illegal back leaves" ),
+    BATCH_OPTION( "bsp.boundingpolys" , OPT_BOOL , BSP.AddBoundingPolys    , "Add inverted scene bounding polygons" ),
+    BATCH_OPTION( "bsp.threads"       , OPT_ULONG, BSP.ThreadCount         , "Subtree build threads (0 = one per hardware thread)" ),
+    BATCH_OPTION( "bsp.forkthreshold" , OPT_ULONG, BSP.ForkThreshold       , "Minimum faces in a subtree built on another thread" ),
+    BATCH_OPTION( "bsp.scorethreshold", OPT_ULONG, BSP.ScoreThreshold      , "Minimum vertex tests before splitter scoring is threaded (0 = never)" ),
+
+    BATCH_OPTION( "prt"               , OPT_BOOL , PRT.Enabled             , "Portal compilation" ),
+    BATCH_OPTION( "prt.threads"       , OPT_ULONG, PRT.ThreadCount         , "Portal clipping worker threads (0 = one per hardware thread)" ),
+    BATCH_OPTION( "prt.merge"         , OPT_BOOL , PRT.MergeCoplanar       , "Merge adjacent coplanar portals" ),
+    BATCH_OPTION( "prt.mergetolerance", OPT_FLOAT, PRT.MergeTolerance      , "Distance within which merged portal vertices are equal" ),
+
+    BATCH_OPTION( "pvs"               , OPT_BOOL , PVS.Enabled             , "Potential visibility set compilation" ),
+    BATCH_OPTION( "pvs.full"          , OPT_BOOL , PVS.FullCompile         , "Perform the full PVS compile" ),
+    BATCH_OPTION( "pvs.cliptests"     , OPT_UCHAR, PVS.ClipTestCount       , "Number of portal clip tests (1 = loose and fast, 4 = tightest)" ),
+    BATCH_OPTION( "pvs.threads"       , OPT_ULONG, PVS.ThreadCount         , "Full compile worker threads (0 = one per hardware thread)" ),
+    BATCH_OPTION( "pvs.flowdepth"     , OPT_ULONG, PVS.MaxFlowDepth        , "Draft vis, max portal hops (0 = unlimited)" ),
+    BATCH_OPTION( "pvs.flowdistance"  , OPT_FLOAT, PVS.MaxFlowDistance     , "Draft vis, max distance from the source portal (0 = unlimited)" ),
+    BATCH_OPTION( "pvs.cluster"       , OPT_BOOL , PVS.ClusterLeaves       , "Group adjacent leaves into vis clusters" ),
+    BATCH_OPTION( "pvs.clustersize"   , OPT_FLOAT, PVS.ClusterSize         , "Maximum extents of a vis cluster along any axis" ),
+
+    BATCH_OPTION( "tjr"               , OPT_BOOL , TJR.Enabled             , "T-Junction repair" ),
+    BATCH_OPTION( "tjr.grid"          , OPT_BOOL , TJR.SpatialGrid         , "Find neighbouring polygons with a uniform grid" ),
+    BATCH_OPTION( "tjr.validate"      , OPT_BOOL , TJR.Validate            , "Check the repair against the engine's load time repair" ),
+
+    BATCH_OPTION( "lmp"               , OPT_BOOL , LMP.Enabled             , "Light and cluster map generation" ),
+    BATCH_OPTION( "lmp.resfactor"     , OPT_UINT , LMP.lightmap_res_factor , "World units are divided by this to size each polygon's light map" ),
+    BATCH_OPTION( "lmp.clusterfactor" , OPT_UINT , LMP.clustermap_lightmap_factor, "Cluster maps are the light map size divided by this" ),
+    BATCH_OPTION( "lmp.width"         , OPT_UINT , LMP.lm_width            , "Light map width" ),
+    BATCH_OPTION( "lmp.height"        , OPT_UINT , LMP.lm_height           , "Light map height" ),
+    BATCH_OPTION( "lmp.samples"       , OPT_UINT , LMP.sampleCount         , "Number of jittered light samples" ),
+    BATCH_OPTION( "lmp.sampledistance", OPT_FLOAT, LMP.sampleDistanceFactor, "Radius of the jittered light samples" ),
+    BATCH_OPTION( "lmp.dir"           , OPT_PATH , LMP.OutputFolder        , "Light / cluster map folder (one sub folder per map when compiling several)" ),
+};
+
+static const ULONG g_OptionCount = sizeof(g_Options) / sizeof(g_Options[0]);
+
+//-----------------------------------------------------------------------------
+// Name : FixSeparators () (Local)
+// Desc : Converts the Windows path separators used by the compiler's default
+//        paths for the platform we are running on.
+//-----------------------------------------------------------------------------
+static std::string FixSeparators( const std::string & Path )
+{
+    std::string Result = Path;
+#ifndef _WIN32
+    for ( size_t i = 0; i < Result.size(); ++i ) if ( Result[i] == '\\' ) Result[i] = '/';
+#endif
+    return Result;
+}
+
+//-----------------------------------------------------------------------------
+// Name : CreateFolder () (Local)
+// Desc : Creates the specified folder, along with any missing parents.
+//-----------------------------------------------------------------------------
+static bool CreateFolder( const std::string & Folder )
+{
+    for ( size_t i = 1; i <= Folder.size(); ++i )
+    {
+        if ( i < Folder.size() && Folder[i] != '/' && Folder[i] != '\\' ) continue;
+        if ( Folder[i - 1] == ':' ) continue;  // Drive letter
+        std::string Parent = Folder.substr( 0, i );
+
+#ifdef _WIN32
+        int Result = _mkdir( Parent.c_str() );
+#else
+        int Result = mkdir( Parent.c_str(), 0755 );
+#endif
+        if ( Result != 0 && errno != EEXIST ) return false;
+
+    } // Next Separator
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name : ParseCount () (Local)
+// Desc : Converts a command line value to an unsigned integer.
+//-----------------------------------------------------------------------------
+static bool ParseCount( LPCSTR Value, unsigned long & Result )
+{
+    char *pEnd = NULL;
+
+    if ( Value[0] == '-' ) return false;
+    errno  = 0;
+    Result = strtoul( Value, &pEnd, 10 );
+    return ( !errno && pEnd != Value && !*pEnd );
+}
+
+//-----------------------------------------------------------------------------
+// Name : ParseValue () (Local)
+// Desc : Converts the command line value for the option specified, storing
+//        it in the settings structure.
+//-----------------------------------------------------------------------------
+static bool ParseValue( const BATCHOPTION & Option, LPCSTR Value, BATCHSETTINGS & Settings )
+{
+    char       *pEnd  = NULL;
+    UCHAR      *pData = (UCHAR*)&Settings + Option.Offset;
+    unsigned long ulValue;
+
+    switch ( Option.Type )
+    {
+        case OPT_BOOL:
+            if ( !strcmp( Value, "1" ) || !strcmp( Value, "on" ) || !strcmp( Value, "true" ) )
+                *((bool*)pData) = true;
+            else if ( !strcmp( Value, "0" ) || !strcmp( Value, "off" ) || !strcmp( Value, "false" ) )
+                *((bool*)pData) = false;
+            else
+                return false;
+            return true;
+
+        case OPT_UCHAR:
+        case OPT_UINT:
+        case OPT_ULONG:
+            if ( !ParseCount( Value, ulValue ) ) return false;
+            if ( Option.Type == OPT_UCHAR ) { if ( ulValue > 255 ) return false; *((unsigned char*)pData) = (unsigned char)ulValue; }
+            if ( Option.Type == OPT_UINT  ) *((unsigned int*)pData)  = (unsigned int)ulValue;
+            if ( Option.Type == OPT_ULONG ) *((unsigned long*)pData) = ulValue;
+            return true;
+
+        case OPT_FLOAT:
+            *((float*)pData) = (float)strtod( Value, &pEnd );
+            return ( pEnd != Value && !*pEnd );
+
+        case OPT_PATH:
+            if ( strlen( Value ) >= MAX_PATH ) return false;
+            strcpy( (char*)pData, Value );
+            return true;
+
+    } // End Switch
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Name : FormatValue () (Local)
+// Desc : Writes the current value of the specified option, for the usage text.
+//-----------------------------------------------------------------------------
+static std::string FormatValue( const BATCHOPTION & Option, const BATCHSETTINGS & Settings )
+{
+    const UCHAR *pData = (const UCHAR*)&Settings + Option.Offset;
+    char         Buffer[MAX_PATH + 32];
+
+    switch ( Option.Type )
+    {
+        case OPT_BOOL : return *((const bool*)pData) ? "1" : "0";
+        case OPT_UCHAR: sprintf( Buffer, "%u", (unsigned int)*((const unsigned char*)pData) ); break;
+        case OPT_UINT : sprintf( Buffer, "%u", *((const unsigned int*)pData) ); break;
+        case OPT_ULONG: sprintf( Buffer, "%lu", *((const unsigned long*)pData) ); break;
+        case OPT_FLOAT: sprintf( Buffer, "%g", *((const float*)pData) ); break;
+        case OPT_PATH : return (const char*)pData;
+        default       : return "";
+
+    } // End Switch
+
+    return Buffer;
+}
+
+//-----------------------------------------------------------------------------
+// Name : PrintUsage () (Local)
+// Desc : Writes the command line help, along with the default option values.
+//-----------------------------------------------------------------------------
+static void PrintUsage( const BATCHSETTINGS & Defaults )
+{
+    static LPCSTR TypeNames[] = { "0|1", "<n>", "<n>", "<n>", "<f>", "<dir>" };
+
+    printf( "Solid Leaf BSP Tree Compiler v1.0.0\n\n" );
+    printf( "Usage : compiler [options] <file.map> [<file.map> ...]\n\n" );
+    printf( "  -o <file>        Output file (a single map only, default <map>.bsp)\n" );
+    printf( "  -outdir <dir>    Folder receiving the compiled files (default next to each map)\n" );
+    printf( "  -jobs <n>        Maps compiled at once (0 = one per hardware thread, default 1)\n" );
+    printf( "  -threads <n>     Worker threads for every process (0 = one per hardware thread).\n" );
+    printf( "                   When several maps compile at once, processes left at 0 share\n" );
+    printf( "                   the hardware threads between the jobs.\n\n" );
+    printf( "Compiler options (default in brackets) :\n" );
+
+    for ( ULONG i = 0; i < g_OptionCount; ++i )
+    {
+        const BATCHOPTION & Option = g_Options[i];
+        char Switch[64];
+        sprintf( Switch, "-%s %s", Option.Name, TypeNames[ Option.Type ] );
+        printf( "  %-26s %s (%s)\n", Switch, Option.Desc, FormatValue( Option, Defaults ).c_str() );
+
+    } // Next Option
+
+    printf( "\nExit code is 0 when every map compiled, 1 when any map failed and 2 for\n" );
+    printf( "an invalid command line.\n" );
+}
+
+//-----------------------------------------------------------------------------
+// Name : CompileJob () (Local)
+// Desc : Compiles and saves a single map with its own compiler and logger.
+//-----------------------------------------------------------------------------
+static void CompileJob( const BATCHSETTINGS & Settings, BATCHJOB & Job )
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    CConsoleLogger  Logger( Job.Name.c_str() );
+    CCompiler       Compiler;
+    BATCHSETTINGS   Options = Settings;
+
+    // Each map writes its light maps to its own folder
+    strcpy( Options.LMP.OutputFolder, Job.LightFolder.c_str() );
+
+    Compiler.SetOptions( PROCESS_MAP, &Options.MAP );
+    Compiler.SetOptions( PROCESS_HSR, &Options.HSR );
+    Compiler.SetOptions( PROCESS_BSP, &Options.BSP );
+    Compiler.SetOptions( PROCESS_PRT, &Options.PRT );
+    Compiler.SetOptions( PROCESS_PVS, &Options.PVS );
+    Compiler.SetOptions( PROCESS_TJR, &Options.TJR );
+    Compiler.SetOptions( PROCESS_LMP, &Options.LMP );
+    Compiler.SetLogger( &Logger );
+    Compiler.SetFile( Job.Input.c_str() );
+
+    Clock::time_point Start = Clock::now();
+    Job.Succeeded = false;
+
+    try
+    {
+        // Create the light map folder if required
+        if ( Options.LMP.Enabled && !CreateFolder( Job.LightFolder ) )
+        {
+            Logger.LogWrite( LOG_GENERAL, LOGF_ERROR, true, _T("Unable to create light map folder '%s'"), Job.LightFolder.c_str() );
+
+        } // End if failed
+        else if ( Compiler.CompileScene() )
+        {
+            // Save the compiled scene
+            Job.Succeeded = Compiler.SaveScene( Job.Output.c_str() );
+            if ( Job.Succeeded )
+                Logger.LogWrite( LOG_GENERAL, 0, true, _T("Saved '%s'"), Job.Output.c_str() );
+            else
+                Logger.LogWrite( LOG_GENERAL, LOGF_ERROR, true, _T("Failed to save '%s'"), Job.Output.c_str() );
+
+        } // End if compiled
+
+    } // End Try Block
+
+    catch (...)
+    {
+        Logger.LogWrite( LOG_GENERAL, LOGF_ERROR, true, _T("Compilation failed with an unhandled exception") );
+        Job.Succeeded = false;
+
+    } // End Catch Block
+
+    // Store the timing information
+    Job.TotalTime = std::chrono::duration<double>( Clock::now() - Start ).count();
+    for ( ULONG i = 0; i < PROCESS_COUNT; ++i ) Job.StageTime[i] = Compiler.GetStageTime( i );
+    Logger.Flush();
+}
+
+//-----------------------------------------------------------------------------
+// Name : main() (Application Entry Point)
+// Desc : Entry point for the command line compiler, App flow starts here.
+//-----------------------------------------------------------------------------
+int main( int argc, char * argv[] )
+{
+    BATCHSETTINGS           Defaults, Settings;
+    std::vector<BATCHJOB>   Jobs;
+    std::string             OutputFile, OutputFolder;
+    unsigned long           JobCount = 1, ThreadCount = 0;
+    bool                    bThreadsSet = false;
+    int                     i;
+
+    // Start from the compiler's own defaults
+    {
+        CCompiler Compiler;
+        Compiler.GetOptions( PROCESS_MAP, &Defaults.MAP );
+        Compiler.GetOptions( PROCESS_HSR, &Defaults.HSR );
+        Compiler.GetOptions( PROCESS_BSP, &Defaults.BSP );
+        Compiler.GetOptions( PROCESS_PRT, &Defaults.PRT );
+        Compiler.GetOptions( PROCESS_PVS, &Defaults.PVS );
+        Compiler.GetOptions( PROCESS_TJR, &Defaults.TJR );
+        Compiler.GetOptions( PROCESS_LMP, &Defaults.LMP );
+    }
+    Settings = Defaults;
+
+    // Parse the command line
+    for ( i = 1; i < argc; ++i )
+    {
+        LPCSTR Arg   = argv[i];
+        LPCSTR Value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        // Anything that isn't a switch is a map to compile
+        if ( Arg[0] != '-' )
+        {
+            BATCHJOB Job;
+            Job.Input = Arg;
+            Jobs.push_back( Job );
+            continue;
+
+        } // End if map
+
+        if ( !strcmp( Arg, "-h" ) || !strcmp( Arg, "-help" ) || !strcmp( Arg, "--help" ) )
+        {
+            PrintUsage( Defaults );
+            return EXIT_OK;
+
+        } // End if help
+
+        // Every remaining switch takes a value
+        if ( !Value )
+        {
+            fprintf( stderr, "error: missing value for '%s'\n", Arg );
+            return EXIT_USAGE;
+
+        } // End if no value
+        ++i;
+
+        if ( !strcmp( Arg, "-o" ) )
+        {
+            OutputFile = Value;
+        }
+        else if ( !strcmp( Arg, "-outdir" ) )
+        {
+            OutputFolder = Value;
+        }
+        else if ( !strcmp( Arg, "-jobs" ) || !strcmp( Arg, "-threads" ) )
+        {
+            unsigned long ulValue;
+            if ( !ParseCount( Value, ulValue ) )
+            {
+                fprintf( stderr, "error: invalid value '%s' for '%s'\n", Value, Arg );
+                return EXIT_USAGE;
+
+            } // End if invalid
+
+            if ( Arg[1] == 'j' ) JobCount = ulValue; else { ThreadCount = ulValue; bThreadsSet = true; }
+        }
+        else
+        {
+            // Find the compiler option
+            ULONG j;
+            for ( j = 0; j < g_OptionCount; ++j ) if ( !strcmp( Arg + 1, g_Options[j].Name ) ) break;
+
+            if ( j == g_OptionCount )
+            {
+                fprintf( stderr, "error: unknown option '%s' (run with -help for the list)\n", Arg );
+                return EXIT_USAGE;
+
+            } // End if unknown
+
+            if ( !ParseValue( g_Options[j], Value, Settings ) )
+            {
+                fprintf( stderr, "error: invalid value '%s' for '%s'\n", Value, Arg );
+                return EXIT_USAGE;
+
+            } // End if invalid
+
+        } // End if compiler option
+
+    } // Next Argument
+
+    // Validate the command line
+    if ( Jobs.empty() )
+    {
+        PrintUsage( Defaults );
+        return EXIT_USAGE;
+
+    } // End if nothing to do
+
+    if ( !OutputFile.empty() && (Jobs.size() > 1 || !OutputFolder.empty()) )
+    {
+        fprintf( stderr, "error: -o can only be used with a single map and without -outdir\n" );
+        return EXIT_USAGE;
+
+    } // End if ambiguous output
+
+    // Bound the number of maps compiled at once
+    ULONG HardwareThreads = std::thread::hardware_concurrency();
+    if ( HardwareThreads == 0 ) HardwareThreads = 1;
+    if ( JobCount == 0 ) JobCount = HardwareThreads;
+    if ( JobCount > Jobs.size() ) JobCount = (ULONG)Jobs.size();
+
+    // Share the hardware threads out between the jobs, unless told otherwise
+    if ( !bThreadsSet && JobCount > 1 ) ThreadCount = (std::max)( 1UL, HardwareThreads / JobCount );
+    if ( bThreadsSet || JobCount > 1 )
+    {
+        unsigned long * pCounts[] = { &Settings.MAP.ThreadCount, &Settings.HSR.ThreadCount, &Settings.BSP.ThreadCount,
+                                      &Settings.PRT.ThreadCount, &Settings.PVS.ThreadCount };
+        for ( ULONG j = 0; j < sizeof(pCounts) / sizeof(pCounts[0]); ++j )
+        {
+            // An explicit -threads overrides everything, otherwise only fill in the defaults
+            if ( bThreadsSet || *pCounts[j] == 0 ) *pCounts[j] = ThreadCount;
+
+        } // Next Process
+
+    } // End if setting thread counts
+
+    // Work out the output files for each map
+    std::string LightFolder = FixSeparators( Settings.LMP.OutputFolder );
+    for ( size_t j = 0; j < Jobs.size(); ++j )
+    {
+        BATCHJOB & Job = Jobs[j];
+        size_t Slash = Job.Input.find_last_of( "/\\" );
+        size_t Start = (Slash == std::string::npos) ? 0 : Slash + 1;
+        size_t Dot   = Job.Input.find_last_of( '.' );
+        if ( Dot == std::string::npos || Dot < Start ) Dot = Job.Input.size();
+
+        Job.Name = Job.Input.substr( Start );
+        std::string Title = Job.Input.substr( Start, Dot - Start );
+
+        if ( !OutputFile.empty() )
+            Job.Output = OutputFile;
+        else if ( !OutputFolder.empty() )
+            Job.Output = OutputFolder + "/" + Title + ".bsp";
+        else
+            Job.Output = Job.Input.substr( 0, Dot ) + ".bsp";
+
+        // Light maps from different maps must not overwrite each other
+        Job.LightFolder = (Jobs.size() > 1) ? LightFolder + "/" + Title : LightFolder;
+        if ( Job.LightFolder.size() >= MAX_PATH )
+        {
+            fprintf( stderr, "error: light map folder '%s' is too long\n", Job.LightFolder.c_str() );
+            return EXIT_USAGE;
+
+        } // End if too long
+
+        Job.Succeeded = false;
+        Job.TotalTime = 0.0;
+        memset( Job.StageTime, 0, sizeof(Job.StageTime) );
+
+    } // Next Job
+
+    if ( !OutputFolder.empty() && !CreateFolder( OutputFolder ) )
+    {
+        fprintf( stderr, "error: unable to create output folder '%s'\n", OutputFolder.c_str() );
+        return EXIT_FAILED;
+
+    } // End if failed
+
+    printf( "Compiling %lu map(s), %lu at a time\n", (ULONG)Jobs.size(), JobCount );
+    fflush( stdout );
+
+    // The compilers share the memory pools, which may not be trimmed while
+    // another compiler is still using them, and whose statistics would mix
+    // the stages of different maps.
+    CMemoryPool::SetTrimEnabled( JobCount <= 1 );
+    CMemoryPool::SetStatsEnabled( JobCount <= 1 );
+
+    // Compile the maps, each worker claiming the next map in turn
+    std::atomic<size_t>       NextJob( 0 );
+    std::vector<std::thread>  Workers;
+    auto Worker = [&]()
+    {
+        for ( size_t j = NextJob++; j < Jobs.size(); j = NextJob++ ) CompileJob( Settings, Jobs[j] );
+    };
+
+    for ( ULONG j = 1; j < JobCount; ++j ) Workers.push_back( std::thread( Worker ) );
+    Worker();
+    for ( size_t j = 0; j < Workers.size(); ++j ) Workers[j].join();
+
+    CMemoryPool::SetTrimEnabled( true );
+    CMemoryPool::SetStatsEnabled( true );
+
+    // Write the timing summary
+    static const ULONG SummaryProcesses[] = { PROCESS_MAP, PROCESS_BSP, PROCESS_PRT, PROCESS_PVS, PROCESS_TJR, PROCESS_LMP };
+    ULONG Failures = 0;
+
+    printf( "\n%-32s %8s %8s %8s %8s %8s %8s %8s  %s\n", "Map", "Load", "BSP", "PRT", "PVS", "TJR", "LMP", "Total", "Result" );
+    for ( size_t j = 0; j < Jobs.size(); ++j )
+    {
+        const BATCHJOB & Job = Jobs[j];
+        printf( "%-32s", Job.Name.c_str() );
+        for ( ULONG k = 0; k < sizeof(SummaryProcesses) / sizeof(SummaryProcesses[0]); ++k ) printf( " %8.3f", Job.StageTime[ SummaryProcesses[k] ] );
+        printf( " %8.3f  %s\n", Job.TotalTime, Job.Succeeded ? "ok" : "FAILED" );
+        if ( !Job.Succeeded ) Failures++;
+
+    } // Next Job
+
+    printf( "\n%lu of %lu map(s) compiled successfully\n", (ULONG)(Jobs.size() - Failures), (ULONG)Jobs.size() );
+    fflush( stdout );
+
+    // Build machines only need to know if anything failed
+    return Failures ? EXIT_FAILED : EXIT_OK;
+}
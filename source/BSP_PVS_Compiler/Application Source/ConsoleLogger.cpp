@@ -0,0 +1,228 @@
+//-----------------------------------------------------------------------------
+// Main Module Includes
+//-----------------------------------------------------------------------------
+#include "ConsoleLogger.h"
+#include <stdio.h>
+#include <stdarg.h>
+
+//-----------------------------------------------------------------------------
+// Static Member Definitions
+//-----------------------------------------------------------------------------
+std::mutex CConsoleLogger::m_OutputLock;
+
+//-----------------------------------------------------------------------------
+// Name : GetChannelName () (Static, Local)
+// Desc : Returns the short tag written at the start of a channel's lines.
+//-----------------------------------------------------------------------------
+static LPCSTR GetChannelName( unsigned long Channel )
+{
+    switch ( Channel )
+    {
+        case LOG_HSR: return "HSR";
+        case LOG_BSP: return "BSP";
+        case LOG_PRT: return "PRT";
+        case LOG_PVS: return "PVS";
+        case LOG_TJR: return "TJR";
+        case LOG_LMP: return "LMP";
+
+    } // End Switch
+
+    return "GEN";
+}
+
+//-----------------------------------------------------------------------------
+// CConsoleLogger member functions
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// Name : CConsoleLogger () (Constructor)
+// Desc : Creates everything we need to
+//-----------------------------------------------------------------------------
+CConsoleLogger::CConsoleLogger( LPCSTR Prefix /* = NULL */ )
+{
+    // Reset vars to sensible values
+    if ( Prefix && Prefix[0] ) m_Prefix = std::string( "[" ) + Prefix + "] ";
+    m_bLineError     = false;
+    m_RewindMarker   = std::string::npos;
+    m_CurrentChannel = LOG_GENERAL;
+}
+
+//-----------------------------------------------------------------------------
+// Name : ~CConsoleLogger () (Destructor)
+// Desc : Writes out any unfinished line
+//-----------------------------------------------------------------------------
+CConsoleLogger::~CConsoleLogger()
+{
+    Flush();
+}
+
+//-----------------------------------------------------------------------------
+// Name : Flush ()
+// Desc : Writes out the line currently being built, if any.
+//-----------------------------------------------------------------------------
+void CConsoleLogger::Flush( )
+{
+    std::lock_guard<std::mutex> Lock( m_OutputLock );
+    EndLine();
+    fflush( stdout );
+}
+
+//-----------------------------------------------------------------------------
+// Name : EndLine () (Private)
+// Desc : Writes out the current line and starts a new one.
+// Note : The output lock must be held by the caller.
+//-----------------------------------------------------------------------------
+void CConsoleLogger::EndLine( )
+{
+    // Empty lines (used by the compiler purely for spacing) are dropped
+    if ( !m_Line.empty() )
+    {
+        printf( "%s%s: %s%s\n", m_Prefix.c_str(), GetChannelName( m_CurrentChannel ),
+                m_bLineError ? "error: " : "", m_Line.c_str() );
+
+    } // End if any text
+
+    // Start the next line
+    m_Line.clear();
+    m_bLineError   = false;
+    m_RewindMarker = std::string::npos;
+}
+
+//-----------------------------------------------------------------------------
+// Name : Append () (Private)
+// Desc : Adds the specified text to the current line, writing out each line
+//        as it is completed.
+// Note : The output lock must be held by the caller.
+//-----------------------------------------------------------------------------
+void CConsoleLogger::Append( unsigned long Channel, unsigned long Flags, bool NewMessage, LPCSTR Text )
+{
+    // A new message, or a switch of channel, always begins a new line
+    if ( NewMessage || Channel != m_CurrentChannel ) EndLine();
+    m_CurrentChannel = Channel;
+
+    for ( LPCSTR pChar = Text; *pChar; ++pChar )
+    {
+        if ( *pChar == '\r' ) continue;
+        if ( *pChar == '\n' ) { EndLine(); continue; }
+
+        // Skip the indentation used to align text in the log window
+        if ( *pChar == '\t' && (m_Line.empty() || m_Line.back() == ' ') ) continue;
+        m_Line += (*pChar == '\t') ? ' ' : *pChar;
+        if ( Flags & LOGF_ERROR ) m_bLineError = true;
+
+    } // Next Character
+}
+
+//-----------------------------------------------------------------------------
+// Name : LogWrite()
+// Desc : Adds the specified text (post-formatting) to the output
+// Note : The NewMessage param notifies this function that this is not a
+//        continuation of an old line.
+//-----------------------------------------------------------------------------
+void CConsoleLogger::LogWrite( unsigned long Channel, unsigned long Flags, bool NewMessage, LPCTSTR Format, ... )
+{
+    char Buffer[1024];
+
+    // Build the text string
+    va_list ap;
+    va_start( ap, Format );
+    vsnprintf( Buffer, sizeof(Buffer), Format, ap );
+    va_end( ap );
+
+    std::lock_guard<std::mutex> Lock( m_OutputLock );
+    Append( Channel, Flags, NewMessage, Buffer );
+}
+
+//-----------------------------------------------------------------------------
+// Name : SetRewindMarker()
+// Desc : Marks the current position in the line being built, so that text
+//        written after it (progress percentages etc) may later be removed.
+//-----------------------------------------------------------------------------
+void CConsoleLogger::SetRewindMarker( unsigned long Channel )
+{
+    std::lock_guard<std::mutex> Lock( m_OutputLock );
+    if ( Channel != m_CurrentChannel ) EndLine();
+    m_CurrentChannel = Channel;
+    m_RewindMarker   = m_Line.size();
+}
+
+//-----------------------------------------------------------------------------
+// Name : Rewind()
+// Desc : Removes any text written to the current line since the rewind marker.
+//        Text already written out can not be rewound.
+//-----------------------------------------------------------------------------
+void CConsoleLogger::Rewind( unsigned long Channel )
+{
+    std::lock_guard<std::mutex> Lock( m_OutputLock );
+    RewindLine( Channel );
+}
+
+//-----------------------------------------------------------------------------
+// Name : RewindLine() (Private)
+// Desc : Truncates the current line back to its rewind marker, if it belongs
+//        to the channel specified.
+// Note : The output lock must be held by the caller.
+//-----------------------------------------------------------------------------
+void CConsoleLogger::RewindLine( unsigned long Channel )
+{
+    if ( Channel != m_CurrentChannel || m_RewindMarker == std::string::npos ) return;
+    if ( m_RewindMarker < m_Line.size() ) m_Line.resize( m_RewindMarker );
+}
+
+//-----------------------------------------------------------------------------
+// Name : Clear()
+// Desc : Nothing written to stdout can be cleared, this simply finishes the
+//        current line.
+//-----------------------------------------------------------------------------
+void CConsoleLogger::Clear( unsigned long Channel )
+{
+    std::lock_guard<std::mutex> Lock( m_OutputLock );
+    EndLine();
+}
+
+//-----------------------------------------------------------------------------
+// Name : GetCurrentChannel ()
+// Desc : Return the currently active channel index.
+//-----------------------------------------------------------------------------
+ULONG CConsoleLogger::GetCurrentChannel() const
+{
+    return m_CurrentChannel;
+}
+
+//-----------------------------------------------------------------------------
+// Name : SetProgressRange(), SetProgressValue(), UpdateProgress()
+// Desc : Progress percentages are not written, build logs only record the
+//        outcome of each step (see ProgressSuccess / ProgressFailure).
+//-----------------------------------------------------------------------------
+void CConsoleLogger::SetProgressRange( long Maximum )
+{
+}
+
+void CConsoleLogger::SetProgressValue( long Value )
+{
+}
+
+void CConsoleLogger::UpdateProgress( long Amount )
+{
+}
+
+//-----------------------------------------------------------------------------
+// Name : ProgressSuccess()
+// Desc : Denotes that the progress of 'N' was successful
+//-----------------------------------------------------------------------------
+void CConsoleLogger::ProgressSuccess( unsigned long Channel )
+{
+    std::lock_guard<std::mutex> Lock( m_OutputLock );
+    RewindLine( Channel );
+    Append( Channel, 0, false, "Success" );
+}
+
+//-----------------------------------------------------------------------------
+// Name : ProgressFailure()
+// Desc : Denotes that the progress of 'N' was a failure
+//-----------------------------------------------------------------------------
+void CConsoleLogger::ProgressFailure( unsigned long Channel )
+{
+    std::lock_guard<std::mutex> Lock( m_OutputLock );
+    RewindLine( Channel );
+    Append( Channel, LOGF_ERROR, false, "Failure!" );
+}
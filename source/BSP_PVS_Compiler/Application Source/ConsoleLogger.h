@@ -0,0 +1,69 @@
+#ifndef _CCONSOLELOGGER_H_
+#define _CCONSOLELOGGER_H_
+
+//-----------------------------------------------------------------------------
+// CConsoleLogger Specific Includes
+//-----------------------------------------------------------------------------
+#include "../Support Source/Common.h"
+#include <mutex>
+#include <string>
+
+//-----------------------------------------------------------------------------
+// Main Class Declarations
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// Name : CConsoleLogger (Class)
+// Desc : Writes compiler output to stdout one complete line at a time, with
+//        no console window or user interaction. Each line is tagged with the
+//        log channel and, optionally, the name of the map being compiled, so
+//        that several compilers may share the same output.
+//-----------------------------------------------------------------------------
+class CConsoleLogger : public ILogger
+{
+public:
+    //-------------------------------------------------------------------------
+    // Constructors & Destructors
+    //-------------------------------------------------------------------------
+             CConsoleLogger( LPCSTR Prefix = NULL );
+    virtual ~CConsoleLogger();
+
+    //-------------------------------------------------------------------------
+    // Public Functions for This Class
+    //-------------------------------------------------------------------------
+    void                Flush               ( );
+
+    //-------------------------------------------------------------------------
+    // Public Functions for This Class (ILogger)
+    //-------------------------------------------------------------------------
+    virtual void        LogWrite            ( unsigned long Channel, unsigned long Flags, bool NewMessage, LPCTSTR Format, ... );
+    virtual void        SetRewindMarker     ( unsigned long Channel );
+    virtual void        Rewind              ( unsigned long Channel );
+    virtual void        Clear               ( unsigned long Channel );
+    virtual ULONG       GetCurrentChannel   ( ) const;
+    virtual void        SetProgressRange    ( long Maximum );
+    virtual void        SetProgressValue    ( long Value );
+    virtual void        UpdateProgress      ( long Amount = 1 );
+    virtual void        ProgressSuccess     ( unsigned long Channel );
+    virtual void        ProgressFailure     ( unsigned long Channel );
+
+private:
+    //-------------------------------------------------------------------------
+    // Private Functions for This Class
+    //-------------------------------------------------------------------------
+    void                Append              ( unsigned long Channel, unsigned long Flags, bool NewMessage, LPCSTR Text );
+    void                EndLine             ( );
+    void                RewindLine          ( unsigned long Channel );
+
+    //-------------------------------------------------------------------------
+    // Private Variables for This Class
+    //-------------------------------------------------------------------------
+    std::string         m_Prefix;               // Text written at the start of every line
+    std::string         m_Line;                 // The line currently being built
+    bool                m_bLineError;           // Was any part of the current line an error ?
+    size_t              m_RewindMarker;         // Position in the current line to rewind to (npos = none)
+    unsigned long       m_CurrentChannel;       // Channel the current line was written to
+
+    static std::mutex   m_OutputLock;           // Serialises output from every logger
+};
+
+#endif // _CCONSOLELOGGER_H_
@@ -13,13 +13,95 @@
 //-----------------------------------------------------------------------------
 #include <algorithm>
 #include <stack>
+#include <float.h>
 
 #include "CBSPTree.h"
 #include "CCompiler.h"
-#include "..\\Support Source\\CPlane.h"
-#include "..\\Support Source\\CVector.h"
-#include "..\\Support Source\\CCollision.h"
+#include "../Support Source/CPlane.h"
+#include "../Support Source/CVector.h"
+#include "../Support Source/CCollision.h"
+#include "VisBits.h"
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define BSP_SIMD_X86 1
+    #include <emmintrin.h>
+    #if defined(_MSC_VER)
+        #define BSP_TARGET_SSE2
+    #else
+        #define BSP_TARGET_SSE2 __attribute__((target("sse2")))
+    #endif
+#endif
+
+//-----------------------------------------------------------------------------
+// Local Helper Functions
+//-----------------------------------------------------------------------------
+#if defined(BSP_SIMD_X86)
+
+//-----------------------------------------------------------------------------
+// Name : ClassifyVerticesSSE2 () (Local)
+// Desc : SSE2 vertex classification used by CBSPTree::ClassifyVertices, four
+//        vertices at a time. Returns the number of vertices classified.
+//-----------------------------------------------------------------------------
+BSP_TARGET_SSE2 static ULONG ClassifyVerticesSSE2( const float X[], const float Y[], const float Z[], ULONG Count, const CPlane3 & Plane, UCHAR Sides[] )
+{
+    // Spreads a four bit movemask across four bytes, one bit per byte
+    static const unsigned int Spread[16] =
+    {
+        0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+        0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101
+    };
+    const __m128 NX = _mm_set1_ps( Plane.Normal.x ), NY = _mm_set1_ps( Plane.Normal.y ), NZ = _mm_set1_ps( Plane.Normal.z );
+    const __m128 D  = _mm_set1_ps( Plane.Distance ), Front = _mm_set1_ps( EPSILON ), Behind = _mm_set1_ps( -EPSILON );
+    ULONG i;
+
+    for ( i = 0; i + 4 <= Count; i += 4 )
+    {
+        // ((x * nx + y * ny) + z * nz) + d, as CVector3::Dot then adding the distance
+        __m128 Result = _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( X + i ), NX ), _mm_mul_ps( _mm_loadu_ps( Y + i ), NY ) );
+        Result = _mm_add_ps( _mm_add_ps( Result, _mm_mul_ps( _mm_loadu_ps( Z + i ), NZ ) ), D );
+
+        unsigned int Bits = Spread[ _mm_movemask_ps( _mm_cmpgt_ps( Result, Front ) ) ] |
+                           (Spread[ _mm_movemask_ps( _mm_cmplt_ps( Result, Behind ) ) ] << 1);
+        memcpy( Sides + i, &Bits, 4 );
+
+    } // Next 4 Vertices
+
+    return i;
+}
+
+#endif // BSP_SIMD_X86
+
+//-----------------------------------------------------------------------------
+// Name : GrowBox () (Local)
+// Desc : Grows the box described by the min / max arrays to contain the point.
+//-----------------------------------------------------------------------------
+static inline void GrowBox( float Min[3], float Max[3], float x, float y, float z )
+{
+    if ( x < Min[0] ) Min[0] = x;
+    if ( x > Max[0] ) Max[0] = x;
+    if ( y < Min[1] ) Min[1] = y;
+    if ( y > Max[1] ) Max[1] = y;
+    if ( z < Min[2] ) Min[2] = z;
+    if ( z > Max[2] ) Max[2] = z;
+}
+
+//-----------------------------------------------------------------------------
+// Name : BoxArea () (Local)
+// Desc : Returns the surface area of the box (0 if it is empty).
+//-----------------------------------------------------------------------------
+static inline float BoxArea( const float Min[3], const float Max[3] )
+{
+    if ( Min[0] > Max[0] || Min[1] > Max[1] || Min[2] > Max[2] ) return 0.0f;
+    float x = Max[0] - Min[0], y = Max[1] - Min[1], z = Max[2] - Min[2];
+    return 2.0f * (x * y + y * z + z * x);
+}
+
+
+//-----------------------------------------------------------------------------
+// Static Member Definitions
+//-----------------------------------------------------------------------------
+CMemoryPool CBSPFace::m_Pool  ( _T("BSP Faces"),   sizeof(CBSPFace) );
+CMemoryPool CBSPPortal::m_Pool( _T("BSP Portals"), sizeof(CBSPPortal) );
 
 //-----------------------------------------------------------------------------
 // Desc : CBSPFace member functions
@@ -70,6 +152,27 @@ CBSPFace::CBSPFace( const CFace * pFace )
     memcpy( Vertices, pFace->Vertices, VertexCount * sizeof(CVertex));
 }
 
+//-----------------------------------------------------------------------------
+// Name : operator new () (Static)
+// Desc : Allocates storage for a face from the face pool.
+// Note : Any derived class too large for the pool falls back to the heap.
+//-----------------------------------------------------------------------------
+void * CBSPFace::operator new( size_t Size )
+{
+    if ( Size > m_Pool.GetItemSize() ) return ::operator new( Size );
+    return m_Pool.Alloc();
+}
+
+//-----------------------------------------------------------------------------
+// Name : operator delete () (Static)
+// Desc : Returns the face's storage to the face pool.
+//-----------------------------------------------------------------------------
+void CBSPFace::operator delete( void * pFace, size_t Size )
+{
+    if ( Size > m_Pool.GetItemSize() ) { ::operator delete( pFace ); return; }
+    m_Pool.Free( pFace );
+}
+
 bool CBSPFace::RayIntersect(const XMFLOAT3 &rayOrigin, const XMFLOAT3 &rayDir)
 {
 	if (VertexCount < 3) return false;
@@ -313,6 +416,28 @@ CBSPPortal::CBSPPortal()
     OwnerNode       = -1;
 }
 
+//-----------------------------------------------------------------------------
+// Name : operator new () (Static)
+// Desc : Allocates storage for a portal from the portal pool.
+// Note : Any derived class too large for the pool falls back to the heap.
+//-----------------------------------------------------------------------------
+void * CBSPPortal::operator new( size_t Size )
+{
+    if ( Size > m_Pool.GetItemSize() ) return ::operator new( Size );
+    return m_Pool.Alloc();
+}
+
+//-----------------------------------------------------------------------------
+// Name : operator delete () (Static)
+// Desc : Returns the portal's storage to the portal pool.
+//-----------------------------------------------------------------------------
+void CBSPPortal::operator delete( void * pPortal, size_t Size )
+{
+    if ( Size > m_Pool.GetItemSize() ) { ::operator delete( pPortal ); return; }
+    m_Pool.Free( pPortal );
+}
+
+
 //-----------------------------------------------------------------------------
 // Name : Split ()
 // Desc : This function splits the current portal, against the plane. The two
@@ -365,7 +490,12 @@ CBSPTree::CBSPTree()
     m_pPVSData          = NULL;
     m_lPVSDataSize      = 0;
     m_bPVSCompressed    = false;
+    m_bPVSFullRuns      = false;
+    m_lClusterCount     = 0;
+    m_bTJRepaired       = false;
     m_pParent           = NULL;
+    m_pBuildState       = NULL;
+    m_BuildResult       = BC_OK;
 }
 
 //-----------------------------------------------------------------------------
@@ -394,21 +524,26 @@ void CBSPTree::ReleaseTree()
     for ( i = 0; i < GetPortalCount(); i++ ) if ( GetPortal(i) ) delete GetPortal(i);
     
     // Free Garbage Collection faces
-    for ( i = 0; i < m_vpGarbage.size(); i++ ) if ( m_vpGarbage[i] ) delete m_vpGarbage[i];
+    for ( auto Iterator = m_Garbage.begin(); Iterator != m_Garbage.end(); ++Iterator ) delete *Iterator;
 
     // Clear Vectors
     m_vpNodes.clear();
     m_vpPlanes.clear();
+    m_vPlaneOpposite.clear();
+    m_PlaneBuckets.clear();
     m_vpLeaves.clear();
     m_vpFaces.clear();
     m_vpPortals.clear();
-    m_vpGarbage.clear();
+    m_Garbage.clear();
+    m_vLeafClusters.clear();
     
     // Clear variables
     m_pPVSData      = NULL;
     m_pFaceList     = NULL;
     m_lActiveFaces  = 0;
     m_lPVSDataSize  = 0;
+    m_lClusterCount = 0;
+    m_bTJRepaired   = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -417,7 +552,9 @@ void CBSPTree::ReleaseTree()
 //-----------------------------------------------------------------------------
 HRESULT CBSPTree::CompileTree( )
 {
-    HRESULT ErrCode;
+    HRESULT       ErrCode, JoinCode;
+    BSPBUILDSTATE BuildState;
+    ULONG         ThreadCount, FaceBase;
 
     // Validate values
     if (!m_pFaceList) return BCERR_INVALIDPARAMS;
@@ -443,8 +580,32 @@ HRESULT CBSPTree::CompileTree( )
     // *    End of Logging     *
     // *************************
     
+    // Determine how many threads we are going to build with
+    ThreadCount = m_OptionSet.ThreadCount;
+    if ( ThreadCount == 0 ) ThreadCount = std::thread::hardware_concurrency();
+    if ( ThreadCount == 0 ) ThreadCount = 1;
+
+    // Subtrees above the fork threshold may be built on other threads, the
+    // calling thread always counts as one of those available.
+    FaceBase = GetFaceCount();
+    if ( ThreadCount > 1 )
+    {
+        BuildState.FreeThreads = (long)ThreadCount - 1;
+        m_pBuildState = &BuildState;
+
+    } // End if parallel
+
     // Compile the BSP Tree
-    if (FAILED(ErrCode = BuildBSPTree(0, m_pFaceList))) return ErrCode;
+    ErrCode = BuildBSPTree(0, m_pFaceList);
+
+    // Wait for any subtrees still being built and bring them into this tree
+    JoinCode = JoinSubtrees();
+    if ( SUCCEEDED(ErrCode) ) ErrCode = JoinCode;
+
+    // Number everything exactly as the serial build would have done
+    if ( m_pBuildState && SUCCEEDED(ErrCode) && !RenumberTree( FaceBase ) ) ErrCode = BCERR_OUTOFMEMORY;
+    m_pBuildState = NULL;
+    if (FAILED(ErrCode)) return ErrCode;
 
     // Did we cancel ?
     if ( m_pParent && m_pParent->GetCompileStatus() == CS_CANCELLED )
@@ -470,7 +631,16 @@ HRESULT CBSPTree::CompileTree( )
     // *************************
     // * Write Log Information *
     // *************************
-    if ( m_pLogger ) m_pLogger->ProgressSuccess( LOG_BSP );
+    if ( m_pLogger )
+    {
+        BSPTREESTATS Stats;
+        GetTreeStats( Stats );
+        m_pLogger->ProgressSuccess( LOG_BSP );
+        m_pLogger->LogWrite( LOG_BSP, 0, true, _T("%s heuristic tree: %i nodes, %i leaves, depth max %i avg %.2f, average point traversal %.2f nodes"),
+                             (m_OptionSet.Heuristic == BSP_HEURISTIC_COST) ? _T("Cost") : _T("Balance"), Stats.NodeCount, Stats.LeafCount,
+                             Stats.MaxDepth, Stats.AverageDepth, Stats.AverageSteps );
+
+    } // End if logger
     // *************************
     // *    End of Logging     *
     // *************************
@@ -684,9 +854,11 @@ HRESULT CBSPTree::AddBoundingPolys( bool BackupOriginals )
 HRESULT CBSPTree::BuildPlaneArray()
 {
     CBSPFace * Iterator = NULL;
-    CPlane3    Plane, * TestPlane;
+    CPlane3    Plane;
     CVector3   Normal, CentrePoint;
-    int        i, PlaneCount;
+    int        i;
+    long       PlaneIndex;
+    ULONG      FaceCount = 0;
     float      Distance;
 
     // *************************
@@ -717,33 +889,16 @@ HRESULT CBSPTree::BuildPlaneArray()
         // Calculate polygons plane
         Plane = CPlane3( Iterator->Normal, CentrePoint );
 
-        // Search through plane list to see if one already exists (must use small tolerances)
-        PlaneCount = GetPlaneCount();
-        for ( i = 0; i < PlaneCount; i++ )
-        {
-            // Retrieve the plane details
-            TestPlane = GetPlane(i);
-            
-            // Test the plane details
-            if ( fabsf(TestPlane->Distance - Plane.Distance) < 1e-5f &&
-                 Plane.Normal.FuzzyCompare( TestPlane->Normal, 1e-5f )) break;
-
-        } // Next Plane
-
-        // Add plane if none found
-        if ( i == PlaneCount )
-        {
-            if (!IncreasePlaneCount()) return BCERR_OUTOFMEMORY;
-            *GetPlane( PlaneCount ) = Plane;
-
-        } // End if no plane found
+        // Retrieve the matching plane from the plane pool (adding it if none exists)
+        if ( (PlaneIndex = AddPlane( Plane )) < 0 ) return BCERR_OUTOFMEMORY;
 
         // Store this plane index
-        Iterator->Plane = i;
+        Iterator->Plane = PlaneIndex;
+        FaceCount++;
 
         // Retrieve the plane details
-        Normal   = GetPlane(i)->Normal;
-        Distance = GetPlane(i)->Distance;
+        Normal   = GetPlane(PlaneIndex)->Normal;
+        Distance = GetPlane(PlaneIndex)->Distance;
 
         // Ensure that all vertices are on the selected plane
         for ( unsigned long v = 0; v < Iterator->VertexCount; v++ )
@@ -760,11 +915,209 @@ HRESULT CBSPTree::BuildPlaneArray()
     } // Next Face
 
     // Success
-    if ( m_pLogger ) m_pLogger->ProgressSuccess( LOG_BSP );
+    if ( m_pLogger )
+    {
+        m_pLogger->ProgressSuccess( LOG_BSP );
+        m_pLogger->LogWrite( LOG_BSP, 0, true, _T("%i faces share %i unique planes"), FaceCount, GetPlaneCount() );
+
+    } // End if logger
     return BC_OK;
     
 }
 
+//-----------------------------------------------------------------------------
+// Name : AddPlane ()
+// Desc : Adds a plane to the plane pool, returning its index. Should a
+//        matching plane (facing the same way) already exist, no new plane
+//        is added and the existing plane's index is returned instead.
+// Note : Returns -1 if there was not enough memory to add the plane.
+//-----------------------------------------------------------------------------
+long CBSPTree::AddPlane( const CPlane3 & Plane )
+{
+    CPlane3  Canonical, * pNewPlane = NULL;
+    uint64_t Keys[16];
+    long     Same, Opposite;
+    ULONG    Index = GetPlaneCount();
+
+    // Does this plane already exist ?
+    MatchPlane( Plane, Same, Opposite );
+    if ( Same >= 0 ) return Same;
+
+    // Add it to its home bucket
+    GetCanonicalPlane( Plane, Canonical );
+    GetPlaneKeys( Canonical, Keys );
+    try
+    {
+        if (!(pNewPlane = new CPlane3( Plane ))) throw std::bad_alloc();
+        m_vpPlanes.push_back( pNewPlane );
+        m_vPlaneOpposite.push_back( Opposite );
+        m_PlaneBuckets.insert( std::make_pair( Keys[0], Index ) );
+
+    } // End Try Block
+
+    catch ( std::bad_alloc )
+    {
+        // Undo anything we managed to add
+        if ( m_vpPlanes.size() > Index ) m_vpPlanes.pop_back();
+        if ( m_vPlaneOpposite.size() > Index ) m_vPlaneOpposite.pop_back();
+        if ( pNewPlane ) delete pNewPlane;
+        return -1;
+
+    } // End Catch Block
+
+    // Link the two planes if they face opposite ways
+    if ( Opposite >= 0 ) m_vPlaneOpposite[ Opposite ] = (long)Index;
+
+    // Success
+    return (long)Index;
+}
+
+//-----------------------------------------------------------------------------
+// Name : FindPlane ()
+// Desc : Searches the plane pool for a plane matching the one specified in
+//        either orientation, returning its index or -1 if there is none.
+//        Flipped is set if the plane found faces the opposite way.
+//-----------------------------------------------------------------------------
+long CBSPTree::FindPlane( const CPlane3 & Plane, bool & Flipped ) const
+{
+    long Same, Opposite;
+
+    MatchPlane( Plane, Same, Opposite );
+    Flipped = ( Same < 0 && Opposite >= 0 );
+    return ( Same >= 0 ) ? Same : Opposite;
+}
+
+//-----------------------------------------------------------------------------
+// Name : MatchPlane () (Private)
+// Desc : Searches the plane pool for the planes matching the one specified,
+//        facing both the same and the opposite way (-1 if not found).
+// Note : Planes are bucketed by their canonical form, so both orientations
+//        of a plane share a bucket. A neighbouring bucket is only searched
+//        when the plane lies within the match tolerance of its boundary.
+//        When the two largest normal components are within the tolerance of
+//        one another, a matching plane may have been canonicalised about the
+//        other axis, and so the opposite orientation is searched as well.
+//-----------------------------------------------------------------------------
+void CBSPTree::MatchPlane( const CPlane3 & Plane, long & Same, long & Opposite ) const
+{
+    CPlane3  Probe[2], TestCanonical;
+    bool     ProbeFlipped[2];
+    uint64_t Keys[16];
+    ULONG    ProbeCount = 1, KeyCount, i, j;
+    float    X = fabsf( Plane.Normal.x ), Y = fabsf( Plane.Normal.y ), Z = fabsf( Plane.Normal.z );
+    float    Largest = max( X, max( Y, Z ) ), Second = X + Y + Z - Largest - min( X, min( Y, Z ) );
+
+    Same = Opposite = -1;
+
+    // Probe the canonical plane, and the opposite orientation if near a tie
+    ProbeFlipped[0] = GetCanonicalPlane( Plane, Probe[0] );
+    if ( Largest - Second < 2.0f * BSP_PLANE_NORMAL_EPSILON )
+    {
+        Probe[1].Normal   = -Probe[0].Normal;
+        Probe[1].Distance = -Probe[0].Distance;
+        ProbeFlipped[1]   = !ProbeFlipped[0];
+        ProbeCount        = 2;
+
+    } // End if near a tie
+
+    for ( j = 0; j < ProbeCount; j++ )
+    {
+        // Search the home bucket and any neighbours we are close to
+        KeyCount = GetPlaneKeys( Probe[j], Keys );
+        for ( i = 0; i < KeyCount; i++ )
+        {
+            auto Range = m_PlaneBuckets.equal_range( Keys[i] );
+            for ( auto Iterator = Range.first; Iterator != Range.second; ++Iterator )
+            {
+                long Index       = (long)Iterator->second;
+                bool TestFlipped = GetCanonicalPlane( *GetPlane( Index ), TestCanonical );
+
+                // Test the plane details
+                if ( fabsf( TestCanonical.Distance - Probe[j].Distance ) >= BSP_PLANE_DIST_EPSILON ) continue;
+                if ( !TestCanonical.Normal.FuzzyCompare( Probe[j].Normal, BSP_PLANE_NORMAL_EPSILON ) ) continue;
+
+                // Always prefer the earliest match, so the result never depends on bucket order
+                long & Match = ( TestFlipped == ProbeFlipped[j] ) ? Same : Opposite;
+                if ( Match < 0 || Index < Match ) Match = Index;
+
+            } // Next Plane
+
+        } // Next Bucket
+
+    } // Next Probe
+}
+
+//-----------------------------------------------------------------------------
+// Name : GetCanonicalPlane () (Private, Static)
+// Desc : Orients the plane so that the largest component of its normal is
+//        positive, returning true if the plane had to be flipped.
+//-----------------------------------------------------------------------------
+bool CBSPTree::GetCanonicalPlane( const CPlane3 & Plane, CPlane3 & Canonical )
+{
+    float Axis = Plane.Normal.x;
+
+    // Find the dominant axis
+    if ( fabsf( Plane.Normal.y ) > fabsf( Axis ) ) Axis = Plane.Normal.y;
+    if ( fabsf( Plane.Normal.z ) > fabsf( Axis ) ) Axis = Plane.Normal.z;
+
+    // Flip if required
+    Canonical = Plane;
+    if ( Axis >= 0.0f ) return false;
+    Canonical.Normal   = -Plane.Normal;
+    Canonical.Distance = -Plane.Distance;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name : GetPlaneKeys () (Private, Static)
+// Desc : Builds the plane pool bucket keys which must be searched for the
+//        canonical plane specified, returning the number of keys built. The
+//        normal and distance are each quantized, and where any lies within
+//        the match tolerance of a bucket boundary the neighbouring bucket
+//        across that boundary is included too.
+// Note : Keys[0] is always the plane's home bucket, Keys must have room for
+//        16 entries.
+//-----------------------------------------------------------------------------
+ULONG CBSPTree::GetPlaneKeys( const CPlane3 & Canonical, uint64_t Keys[] )
+{
+    float Values[4]  = { Canonical.Normal.x * BSP_PLANE_NORMAL_CELLS, Canonical.Normal.y * BSP_PLANE_NORMAL_CELLS,
+                         Canonical.Normal.z * BSP_PLANE_NORMAL_CELLS, Canonical.Distance / BSP_PLANE_DIST_CELL };
+    float Epsilon[4] = { BSP_PLANE_NORMAL_EPSILON * BSP_PLANE_NORMAL_CELLS, BSP_PLANE_NORMAL_EPSILON * BSP_PLANE_NORMAL_CELLS,
+                         BSP_PLANE_NORMAL_EPSILON * BSP_PLANE_NORMAL_CELLS, BSP_PLANE_DIST_EPSILON / BSP_PLANE_DIST_CELL };
+    long  Cell[4], Neighbour[4];
+    ULONG i, j, KeyCount = 0;
+
+    // Quantize each value, and find any neighbouring cell we are close to
+    for ( i = 0; i < 4; i++ )
+    {
+        float Fraction;
+        Cell[i]      = (long)floorf( Values[i] );
+        Fraction     = Values[i] - (float)Cell[i];
+        Neighbour[i] = Cell[i];
+        if ( Fraction < Epsilon[i] ) Neighbour[i] = Cell[i] - 1;
+        else if ( Fraction > 1.0f - Epsilon[i] ) Neighbour[i] = Cell[i] + 1;
+
+    } // Next Value
+
+    // Build a key for every combination of home and neighbouring cells (home first)
+    for ( j = 0; j < 16; j++ )
+    {
+        uint64_t Key = 0;
+        for ( i = 0; i < 4; i++ )
+        {
+            bool UseNeighbour = ((j >> i) & 1) != 0;
+            if ( UseNeighbour && Neighbour[i] == Cell[i] ) break;
+            Key = (Key << 16) | (uint16_t)( UseNeighbour ? Neighbour[i] : Cell[i] );
+
+        } // Next Value
+
+        if ( i == 4 ) Keys[ KeyCount++ ] = Key;
+
+    } // Next Combination
+
+    return KeyCount;
+}
+
 //-----------------------------------------------------------------------------
 // Name : BuildBSPTree () (Private, Recursive)
 // Desc : Build's the entire BSP Tree using the already initialized poly data
@@ -783,10 +1136,10 @@ HRESULT CBSPTree::BuildBSPTree( unsigned long Node, CBSPFace * pFaceList )
     int           v;
 
     // Check for pause / cancelled state
-    if ( m_pParent && !m_pParent->TestCompilerState() ) { ErrCode = BC_CANCELLED; goto BuildError; }
+    if ( !TestBuildState() ) { ErrCode = BC_CANCELLED; goto BuildError; }
     
     // Write Log Information
-    if ( m_pLogger ) m_pLogger->UpdateProgress();
+    UpdateBuildProgress();
 
     // Select the best splitter from the list of faces passed
     Splitter = SelectBestSplitter( pFaceList, m_OptionSet.SplitterSample, m_OptionSet.SplitHeuristic);
@@ -808,7 +1161,7 @@ HRESULT CBSPTree::BuildBSPTree( unsigned long Node, CBSPFace * pFaceList )
 		NextFace = TestFace->Next;
 
         // Classify the polygon
-        if ( TestFace->Plane == Splitter->Plane )
+        if ( TestFace->Plane == Splitter->Plane || TestFace->Plane == GetOppositePlane( Splitter->Plane ) )
         {
             Result = CLASSIFY_ONPLANE;
         
@@ -833,8 +1186,8 @@ HRESULT CBSPTree::BuildBSPTree( unsigned long Node, CBSPFace * pFaceList )
                         TestFace->UsedAsSplitter = true;
 
                         // Also Update progress info (Removed a potential splitter)
-                        if ( m_pParent && !m_pParent->TestCompilerState() ) { ErrCode = BC_CANCELLED; goto BuildError; }
-                        if ( m_pLogger ) m_pLogger->UpdateProgress( 1 );
+                        if ( !TestBuildState() ) { ErrCode = BC_CANCELLED; goto BuildError; }
+                        UpdateBuildProgress( 1 );
 
                     } // End if !UsedAsSplitter
 
@@ -891,16 +1244,16 @@ HRESULT CBSPTree::BuildBSPTree( unsigned long Node, CBSPFace * pFaceList )
                 } // Next Vertex
 
                 // Update Progress Details (Added new potential splitters ??)
-                if ( m_pParent && !m_pParent->TestCompilerState() ) { ErrCode = BC_CANCELLED; goto BuildError; }
-                if ( !FrontSplit->UsedAsSplitter && m_pLogger ) m_pLogger->UpdateProgress( -1 );
-                if ( !BackSplit->UsedAsSplitter  && m_pLogger ) m_pLogger->UpdateProgress( -1 );
+                if ( !TestBuildState() ) { ErrCode = BC_CANCELLED; goto BuildError; }
+                if ( !FrontSplit->UsedAsSplitter ) UpdateBuildProgress( -1 );
+                if ( !BackSplit->UsedAsSplitter  ) UpdateBuildProgress( -1 );
 
                 // + 2 Fragments - 1 Original
                 m_lActiveFaces++; 
 
                 // Free up original face (Also update progress info (Removed a potential Splitter?))
-                if ( m_pParent && !m_pParent->TestCompilerState() ) { ErrCode = BC_CANCELLED; goto BuildError; }
-                if ( !TestFace->UsedAsSplitter && m_pLogger ) m_pLogger->UpdateProgress( 1 );
+                if ( !TestBuildState() ) { ErrCode = BC_CANCELLED; goto BuildError; }
+                if ( !TestFace->UsedAsSplitter ) UpdateBuildProgress( 1 );
 			    delete TestFace;
                 
 			    break;
@@ -948,7 +1301,7 @@ HRESULT CBSPTree::BuildBSPTree( unsigned long Node, CBSPFace * pFaceList )
         // Allocate a new node and step into it
         if (!IncreaseNodeCount()) { ErrCode = BCERR_OUTOFMEMORY; goto BuildError; }
 	    GetNode(Node)->Front = GetNodeCount() - 1;
-	    ErrCode = BuildBSPTree( GetNode(Node)->Front, FrontList );
+	    ErrCode = BuildSubtree( GetNode(Node)->Front, FrontList );
 
     } // End If FrontList
 
@@ -979,7 +1332,7 @@ HRESULT CBSPTree::BuildBSPTree( unsigned long Node, CBSPFace * pFaceList )
             // Allocate a new node and step into it
             if (!IncreaseNodeCount()) { ErrCode = BCERR_OUTOFMEMORY; goto BuildError; }
 	        GetNode(Node)->Back = GetNodeCount() - 1;
-	        ErrCode = BuildBSPTree( GetNode(Node)->Back, BackList);
+	        ErrCode = BuildSubtree( GetNode(Node)->Back, BackList);
 
         } // End if remaining splitters
 
@@ -1002,6 +1355,355 @@ BuildError:
     return ErrCode;
 }
 
+//-----------------------------------------------------------------------------
+// Name : BuildSubtree () (Private)
+// Desc : Builds the subtree below the specified (already allocated) node. When
+//        building in parallel, large face lists are handed off to another
+//        thread and built into a separate tree, to be spliced back into this
+//        one by JoinSubtrees.
+// Note : The front and back lists of a node share no faces, so once handed
+//        off the subtree needs nothing from this tree other than the (read
+//        only) plane array.
+//-----------------------------------------------------------------------------
+HRESULT CBSPTree::BuildSubtree( unsigned long Node, CBSPFace * pFaceList )
+{
+    CBSPFace *Iterator  = NULL;
+    CBSPTree *pSubtree  = NULL;
+    ULONG     FaceCount = 0;
+
+    // Building serially ?
+    if ( !m_pBuildState ) return BuildBSPTree( Node, pFaceList );
+
+    // Small lists are not worth the overhead of another thread
+    for ( Iterator = pFaceList; Iterator && FaceCount < m_OptionSet.ForkThreshold; Iterator = Iterator->Next ) FaceCount++;
+    if ( FaceCount < m_OptionSet.ForkThreshold ) return BuildBSPTree( Node, pFaceList );
+
+    // Claim a thread, if none are free we simply build it on this one
+    if ( m_pBuildState->FreeThreads.fetch_sub( 1 ) <= 0 )
+    {
+        m_pBuildState->FreeThreads++;
+        return BuildBSPTree( Node, pFaceList );
+
+    } // End if no threads free
+
+    try
+    {
+        // Allocate the tree to build into, it shares our planes for the duration
+        if (!(pSubtree = new CBSPTree)) throw std::bad_alloc();
+        pSubtree->SetOptions( m_OptionSet );
+        pSubtree->SetLogger( m_pLogger );
+        pSubtree->SetParent( m_pParent );
+        pSubtree->m_pBuildState = m_pBuildState;
+        pSubtree->m_vpPlanes    = m_vpPlanes;
+        pSubtree->m_vPlaneOpposite = m_vPlaneOpposite;
+        if (!pSubtree->IncreaseNodeCount()) throw std::bad_alloc();
+
+        // Record the subtree, then start it building
+        BSPSUBTREE Subtree;
+        Subtree.Node  = Node;
+        Subtree.pTree = pSubtree;
+        m_vSubtrees.push_back( std::move( Subtree ) );
+        m_vSubtrees.back().Thread = std::thread( &CBSPTree::SubtreeThread, pSubtree, pFaceList );
+
+    } // End Try Block
+
+    catch (...)
+    {
+        // Could not start the thread, build it on this one instead
+        if ( !m_vSubtrees.empty() && m_vSubtrees.back().pTree == pSubtree ) m_vSubtrees.pop_back();
+        if ( pSubtree ) { pSubtree->m_vpPlanes.clear(); delete pSubtree; }
+        m_pBuildState->FreeThreads++;
+        return BuildBSPTree( Node, pFaceList );
+
+    } // End Catch Block
+
+    // Success
+    return BC_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Name : SubtreeThread () (Private)
+// Desc : Thread entry point used to build this tree as a subtree of another.
+//-----------------------------------------------------------------------------
+void CBSPTree::SubtreeThread( CBSPFace * pFaceList )
+{
+    HRESULT ErrCode;
+
+    // Build the tree, our root node was allocated before the thread started
+    m_BuildResult = BuildBSPTree( 0, pFaceList );
+
+    // Our own work is done, let another subtree have this thread while we
+    // wait for any we handed off ourselves.
+    m_pBuildState->FreeThreads++;
+    ErrCode = JoinSubtrees();
+    if ( SUCCEEDED(m_BuildResult) ) m_BuildResult = ErrCode;
+}
+
+//-----------------------------------------------------------------------------
+// Name : JoinSubtrees () (Private)
+// Desc : Waits for every subtree handed off by this tree to complete, and
+//        splices each into this tree in the order they were handed off.
+//-----------------------------------------------------------------------------
+HRESULT CBSPTree::JoinSubtrees( )
+{
+    HRESULT ErrCode = BC_OK;
+
+    for ( ULONG i = 0; i < m_vSubtrees.size(); i++ )
+    {
+        BSPSUBTREE & Subtree = m_vSubtrees[i];
+
+        // Wait for it to finish
+        Subtree.Thread.join();
+
+        // Bring it into this tree (on failure we keep going, all threads must be joined)
+        if ( SUCCEEDED(ErrCode) )
+        {
+            ErrCode = Subtree.pTree->m_BuildResult;
+            if ( SUCCEEDED(ErrCode) && !SpliceSubtree( Subtree.Node, Subtree.pTree ) ) ErrCode = BCERR_OUTOFMEMORY;
+
+        } // End if no errors
+
+        // The planes belong to us, anything else left is released with the subtree
+        Subtree.pTree->m_vpPlanes.clear();
+        delete Subtree.pTree;
+
+    } // Next Subtree
+
+    m_vSubtrees.clear();
+    return ErrCode;
+}
+
+//-----------------------------------------------------------------------------
+// Name : SpliceSubtree () (Private)
+// Desc : Moves the nodes, leaves and faces of the subtree passed into this tree.
+//        The subtree's root replaces the specified node, everything else is
+//        added to the end of our arrays.
+// Note : The result is numbered in the order that subtrees completed, rather
+//        than the order the serial build would use, RenumberTree fixes this.
+//-----------------------------------------------------------------------------
+bool CBSPTree::SpliceSubtree( unsigned long Node, CBSPTree * pSubtree )
+{
+    ULONG NodeBase = GetNodeCount() - 1;
+    ULONG LeafBase = GetLeafCount();
+    ULONG FaceBase = GetFaceCount();
+    ULONG i, j;
+    bool  SplitType = ( m_OptionSet.TreeType == BSP_TYPE_SPLIT );
+
+    try
+    {
+        // Reserve everything up front, nothing below this can then fail
+        m_vpNodes.reserve( m_vpNodes.size() + pSubtree->GetNodeCount() - 1 );
+        m_vpLeaves.reserve( m_vpLeaves.size() + pSubtree->GetLeafCount() );
+        m_vpFaces.reserve( m_vpFaces.size() + pSubtree->GetFaceCount() );
+        m_Garbage.reserve( m_Garbage.size() + pSubtree->m_Garbage.size() );
+
+    } // End Try Block
+
+    catch ( std::bad_alloc ) { return false; }
+
+    // Move the nodes over, offsetting their children
+    for ( i = 0; i < pSubtree->GetNodeCount(); i++ )
+    {
+        CBSPNode * pNode = pSubtree->GetNode(i);
+        long     * Child[2] = { &pNode->Front, &pNode->Back };
+
+        for ( j = 0; j < 2; j++ )
+        {
+            if ( *Child[j] == (long)BSP_SOLID_LEAF ) continue;
+            if ( *Child[j] < 0 ) *Child[j] -= (long)LeafBase; else *Child[j] += (long)NodeBase;
+
+        } // Next Child
+
+        // The subtree root replaces our placeholder node
+        if ( i == 0 ) { delete m_vpNodes[ Node ]; m_vpNodes[ Node ] = pNode; }
+        else m_vpNodes.push_back( pNode );
+
+    } // Next Node
+
+    // Move the leaves over, split trees index into the face array which moves too
+    for ( i = 0; i < pSubtree->GetLeafCount(); i++ )
+    {
+        CBSPLeaf * pLeaf = pSubtree->GetLeaf(i);
+        if ( SplitType ) for ( j = 0; j < pLeaf->FaceIndices.size(); j++ ) pLeaf->FaceIndices[j] += FaceBase;
+        m_vpLeaves.push_back( pLeaf );
+
+    } // Next Leaf
+
+    // Move the faces over
+    for ( i = 0; i < pSubtree->GetFaceCount(); i++ )
+    {
+        CBSPFace * pFace = pSubtree->GetFace(i);
+        if ( SplitType ) pFace->OriginalIndex += FaceBase;
+        m_vpFaces.push_back( pFace );
+
+    } // Next Face
+
+    // Take over anything left for garbage collection (should this fail the rest are leaked)
+    try { m_Garbage.insert( pSubtree->m_Garbage.begin(), pSubtree->m_Garbage.end() ); }
+    catch ( std::bad_alloc ) { }
+    m_lActiveFaces += pSubtree->m_lActiveFaces;
+
+    // The subtree no longer owns any of these
+    pSubtree->m_vpNodes.clear();
+    pSubtree->m_vpLeaves.clear();
+    pSubtree->m_vpFaces.clear();
+    pSubtree->m_Garbage.clear();
+
+    // Success
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name : RenumberTree () (Private)
+// Desc : Renumbers the nodes, leaves and (for split trees) the faces added by
+//        the build, in the order that a serial build would have allocated
+//        them, so that the compiled output never depends on the thread count.
+// Note : The serial build numbers each node's front side in its entirety
+//        before its back side, with the faces of each leaf following in leaf
+//        order. Faces prior to FaceBase existed before the build began.
+//-----------------------------------------------------------------------------
+bool CBSPTree::RenumberTree( unsigned long FaceBase )
+{
+    std::vector<ULONG>     NodeMap, LeafMap, FaceMap;
+    std::vector<ULONG>     Stack;
+    std::vector<UCHAR>     Side;
+    vectorNode             Nodes;
+    vectorLeaf             Leaves;
+    vectorBSPFace          Faces;
+    ULONG                  i, j, NextNode = 1, NextLeaf = 0, NextFace = FaceBase;
+
+    try
+    {
+        NodeMap.assign( GetNodeCount(), 0 );
+        LeafMap.assign( GetLeafCount(), 0 );
+        Nodes.resize( GetNodeCount() );
+        Leaves.resize( GetLeafCount() );
+
+        // Walk the tree front first, numbering nodes and leaves as we meet them
+        Stack.push_back( 0 );
+        Side.push_back( 0 );
+        while ( !Stack.empty() )
+        {
+            // Both sides of this node done ?
+            if ( Side.back() == 2 ) { Stack.pop_back(); Side.pop_back(); continue; }
+
+            CBSPNode * pNode = GetNode( Stack.back() );
+            long Child = ( Side.back()++ == 0 ) ? pNode->Front : pNode->Back;
+            if ( Child == (long)BSP_SOLID_LEAF ) continue;
+
+            if ( Child < 0 )
+            {
+                LeafMap[ -(Child + 1) ] = NextLeaf++;
+
+            } // End if leaf
+            else
+            {
+                NodeMap[ Child ] = NextNode++;
+                Stack.push_back( (ULONG)Child );
+                Side.push_back( 0 );
+
+            } // End if node
+
+        } // Next Step
+
+        // Reorder the nodes and leaves
+        for ( i = 0; i < GetNodeCount(); i++ )
+        {
+            CBSPNode * pNode = GetNode(i);
+            long     * Child[2] = { &pNode->Front, &pNode->Back };
+
+            for ( j = 0; j < 2; j++ )
+            {
+                if ( *Child[j] == (long)BSP_SOLID_LEAF ) continue;
+                if ( *Child[j] < 0 ) *Child[j] = -((long)LeafMap[ -(*Child[j] + 1) ] + 1); else *Child[j] = (long)NodeMap[ *Child[j] ];
+
+            } // Next Child
+            Nodes[ NodeMap[i] ] = pNode;
+
+        } // Next Node
+        for ( i = 0; i < GetLeafCount(); i++ ) Leaves[ LeafMap[i] ] = GetLeaf(i);
+        m_vpNodes.swap( Nodes );
+        m_vpLeaves.swap( Leaves );
+
+        // Split trees store the faces themselves in leaf order
+        if ( m_OptionSet.TreeType != BSP_TYPE_SPLIT ) return true;
+
+        FaceMap.assign( GetFaceCount(), (ULONG)-1 );
+        for ( i = 0; i < FaceBase; i++ ) FaceMap[i] = i;
+        for ( i = 0; i < GetLeafCount(); i++ )
+        {
+            CBSPLeaf * pLeaf = GetLeaf(i);
+            for ( j = 0; j < pLeaf->FaceIndices.size(); j++ )
+            {
+                ULONG Face = (ULONG)pLeaf->FaceIndices[j];
+                if ( FaceMap[ Face ] == (ULONG)-1 ) FaceMap[ Face ] = NextFace++;
+                pLeaf->FaceIndices[j] = (long)FaceMap[ Face ];
+
+            } // Next Face Index
+
+        } // Next Leaf
+
+        // Any face not referenced by a leaf simply follows on
+        Faces.resize( GetFaceCount() );
+        for ( i = 0; i < GetFaceCount(); i++ )
+        {
+            if ( FaceMap[i] == (ULONG)-1 ) FaceMap[i] = NextFace++;
+            GetFace(i)->OriginalIndex = (long)FaceMap[i];
+            Faces[ FaceMap[i] ] = GetFace(i);
+
+        } // Next Face
+        m_vpFaces.swap( Faces );
+
+    } // End Try Block
+
+    catch ( std::bad_alloc ) { return false; }
+
+    // Success
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name : UpdateBuildProgress () (Private)
+// Desc : Updates the logger's progress, other threads may be building subtrees
+//        at the same time.
+//-----------------------------------------------------------------------------
+void CBSPTree::UpdateBuildProgress( long Amount /* = 1 */ )
+{
+    if ( !m_pLogger ) return;
+
+    if ( m_pBuildState )
+    {
+        std::lock_guard<std::mutex> Lock( m_pBuildState->ProgressLock );
+        m_pLogger->UpdateProgress( Amount );
+
+    } // End if parallel
+    else
+    {
+        m_pLogger->UpdateProgress( Amount );
+
+    } // End if serial
+}
+
+//-----------------------------------------------------------------------------
+// Name : TestBuildState () (Private)
+// Desc : Checks the compiler's pause / cancelled state, other threads may be
+//        building subtrees at the same time. Returns false if cancelled.
+// Note : A paused compiler holds the lock, so the other threads wait on it.
+//-----------------------------------------------------------------------------
+bool CBSPTree::TestBuildState( )
+{
+    if ( !m_pParent ) return true;
+
+    if ( m_pBuildState )
+    {
+        std::lock_guard<std::mutex> Lock( m_pBuildState->ProgressLock );
+        return m_pParent->TestCompilerState();
+
+    } // End if parallel
+
+    return m_pParent->TestCompilerState();
+}
+
 //-----------------------------------------------------------------------------
 // Name : ProcessLeafFaces () (Private)
 // Desc : This function decides what to do with the faces, intended for use
@@ -1074,66 +1776,94 @@ unsigned long CBSPTree::CountSplitters( CBSPFace * pFaceList ) const
 // Desc : Picks the next face in the list to be used as the Splitting plane.
 // Note : You can pass a value to SplitHeuristic, the higher the value
 //        the higher the importance is put on reducing splits.
+//        The node's faces are flattened once, and each candidate plane then
+//        classifies every vertex in a single pass. Large nodes may score their
+//        candidates across several threads, the result is always the same as
+//        scoring them one by one.
 //-----------------------------------------------------------------------------   
 CBSPFace * CBSPTree::SelectBestSplitter( CBSPFace * pFaceList, unsigned long SplitterSample, float SplitHeuristic )
 {
-    unsigned long Score, Splits, BackFaces, FrontFaces;
-	unsigned long BestScore = 10000000, SplitterCount = 0;
-    CBSPFace *Splitter = pFaceList, *CurrentFace = NULL, *SelectedFace = NULL;
-	
-	// Traverse the Face Linked List
-	while ( Splitter != NULL ) 
+    unsigned long   SampleCount, ThreadCount = 1, PerThread, i;
+    float           BestScore = 10000000.0f;
+    CBSPFace       *Iterator = NULL, *SelectedFace = NULL;
+    std::vector<std::thread> Threads;
+
+    try
     {
-		
-        // If this has NOT been used as a splitter then
-		if ( !Splitter->UsedAsSplitter && Splitter->Flags == FACE_WORLD)
+        // Collect the faces which have NOT been used as a splitter
+        m_vpSplitters.clear();
+        for ( Iterator = pFaceList; Iterator != NULL; Iterator = Iterator->Next )
         {
-			
-            // Create testing splitter plane
-			CPlane3 SplittersPlane( Splitter->Normal, Splitter->Vertices[0] );
-			
-            // Test against the other poly's and count the score
-			Score = Splits = BackFaces = FrontFaces = 0;
-			for (CurrentFace = pFaceList; CurrentFace != NULL; CurrentFace = CurrentFace->Next)
-            {
-				if (CurrentFace->Flags != FACE_WORLD) continue;
-                CLASSIFYTYPE Result = SplittersPlane.ClassifyPoly( CurrentFace->Vertices, CurrentFace->VertexCount, sizeof(CVertex) );
-				switch ( Result ) 
-                {
-                    case CLASSIFY_INFRONT:
-				        FrontFaces++;
-					    break;
+            if ( !Iterator->UsedAsSplitter && Iterator->Flags == FACE_WORLD ) m_vpSplitters.push_back( Iterator );
 
-                    case CLASSIFY_BEHIND:
-					    BackFaces++;
-					    break;
+        } // Next Face
+        if ( m_vpSplitters.empty() ) return NULL;
 
-				    case CLASSIFY_SPANNING:
-					    Splits++;
-					    break;
+        // Flatten the faces we are going to classify
+        FlattenFaces( pFaceList, m_SplitterSet );
+        m_vSplitterScores.resize( m_vpSplitters.size() );
 
-				    default:
-					    break;
+        // How many splitters are we sampling ?
+        SampleCount = m_vpSplitters.size();
+        if ( SplitterSample != 0 && SplitterSample < SampleCount ) SampleCount = SplitterSample;
 
-				} // switch
-				
-            } // Next Face
-			
-            // Tally the score (modify the splits * n )
-			Score = (unsigned long)((long)abs( (long)(FrontFaces - BackFaces) ) + (Splits * SplitHeuristic));
-			// Is this the best score ?
-			if ( Score < BestScore) 
+        // Claim any threads available to share the work of a large node
+        if ( m_pBuildState && m_OptionSet.ScoreThreshold > 0 &&
+             (ULONGLONG)SampleCount * m_SplitterSet.X.size() >= m_OptionSet.ScoreThreshold )
+        {
+            while ( ThreadCount < SampleCount )
             {
-				BestScore	 = Score;
-				SelectedFace = Splitter;
-            } // End if better score
+                if ( m_pBuildState->FreeThreads.fetch_sub( 1 ) <= 0 ) { m_pBuildState->FreeThreads++; break; }
+                ThreadCount++;
 
-            SplitterCount++;
-		} // End if this splitter has not been used yet
+            } // Next Thread
 
-		Splitter = Splitter->Next;
-        // Break if we reached our splitter sample limit.
-        if (SplitterSample != 0 && SplitterCount >= SplitterSample && SelectedFace) break;
+        } // End if large node
+
+        // Each thread needs its own classification scratch
+        if ( m_vSplitterSides.size() < ThreadCount ) m_vSplitterSides.resize( ThreadCount );
+        for ( i = 0; i < ThreadCount; i++ ) m_vSplitterSides[i].resize( m_SplitterSet.X.size() + 1 );
+
+    } // End Try Block
+
+    catch ( std::bad_alloc ) { return NULL; }
+
+    // Score the sample, the calling thread takes the first share
+    PerThread = (SampleCount + ThreadCount - 1) / ThreadCount;
+    for ( i = 1; i < ThreadCount; i++ )
+    {
+        ULONG First = i * PerThread;
+        if ( First >= SampleCount ) break;
+        ULONG Count = min( PerThread, SampleCount - First );
+
+        // If the thread can't be started, we'll just have to score it ourselves
+        try { Threads.push_back( std::thread( &CBSPTree::ScoreSplitters, this, First, Count, SplitHeuristic, &m_vSplitterSides[i][0] ) ); }
+        catch (...) { ScoreSplitters( First, Count, SplitHeuristic, &m_vSplitterSides[0][0] ); }
+
+    } // Next Thread
+    ScoreSplitters( 0, min( PerThread, SampleCount ), SplitHeuristic, &m_vSplitterSides[0][0] );
+
+    // Wait for the other threads and release them
+    for ( i = 0; i < Threads.size(); i++ ) Threads[i].join();
+    if ( ThreadCount > 1 ) m_pBuildState->FreeThreads += (long)ThreadCount - 1;
+
+    // Select the best score, the first found wins a tie
+    for ( i = 0; i < SampleCount; i++ )
+    {
+        if ( m_vSplitterScores[i] < BestScore )
+        {
+            BestScore    = m_vSplitterScores[i];
+            SelectedFace = m_vpSplitters[i];
+
+        } // End if better score
+
+    } // Next Splitter
+
+    // If nothing in the sample was acceptable, keep going until we find one
+    for ( ; !SelectedFace && i < m_vpSplitters.size(); i++ )
+    {
+        ScoreSplitters( i, 1, SplitHeuristic, &m_vSplitterSides[0][0] );
+        if ( m_vSplitterScores[i] < BestScore ) SelectedFace = m_vpSplitters[i];
 
     } // Next Splitter
 
@@ -1141,6 +1871,148 @@ CBSPFace * CBSPTree::SelectBestSplitter( CBSPFace * pFaceList, unsigned long Spl
     return SelectedFace;
 }
 
+//-----------------------------------------------------------------------------
+// Name : FlattenFaces () (Private)
+// Desc : Copies the vertices of every world face in the list into the set's
+//        structure of arrays, ready for classification.
+//-----------------------------------------------------------------------------
+void CBSPTree::FlattenFaces( CBSPFace * pFaceList, BSPSPLITTERSET & Set ) const
+{
+    CBSPFace * Iterator;
+    ULONG      v;
+
+    Set.X.clear();
+    Set.Y.clear();
+    Set.Z.clear();
+    Set.FaceStart.clear();
+
+    for ( Iterator = pFaceList; Iterator != NULL; Iterator = Iterator->Next )
+    {
+        if ( Iterator->Flags != FACE_WORLD ) continue;
+
+        Set.FaceStart.push_back( (ULONG)Set.X.size() );
+        for ( v = 0; v < Iterator->VertexCount; v++ )
+        {
+            Set.X.push_back( Iterator->Vertices[v].x );
+            Set.Y.push_back( Iterator->Vertices[v].y );
+            Set.Z.push_back( Iterator->Vertices[v].z );
+
+        } // Next Vertex
+
+    } // Next Face
+
+    // Final entry marks the end of the last face
+    Set.FaceStart.push_back( (ULONG)Set.X.size() );
+
+    // The cost heuristic weighs each side by its share of our surface area
+    Set.Area = 0.0f;
+    if ( m_OptionSet.Heuristic == BSP_HEURISTIC_COST && !Set.X.empty() )
+    {
+        float Min[3] = { Set.X[0], Set.Y[0], Set.Z[0] }, Max[3] = { Set.X[0], Set.Y[0], Set.Z[0] };
+        for ( ULONG v = 1; v < Set.X.size(); v++ ) GrowBox( Min, Max, Set.X[v], Set.Y[v], Set.Z[v] );
+        Set.Area = BoxArea( Min, Max );
+
+    } // End if cost heuristic
+}
+
+//-----------------------------------------------------------------------------
+// Name : ScoreSplitters () (Private)
+// Desc : Scores the specified range of potential splitters against the
+//        flattened faces, storing the result in the score array.
+// Note : May be called from several threads at once, each on its own range
+//        and with its own classification scratch.
+//-----------------------------------------------------------------------------
+void CBSPTree::ScoreSplitters( unsigned long First, unsigned long Count, float SplitHeuristic, UCHAR Sides[] )
+{
+    unsigned long Splits, BackFaces, FrontFaces, f, v;
+    unsigned long FaceCount = (ULONG)m_SplitterSet.FaceStart.size() - 1;
+    const ULONG * FaceStart = &m_SplitterSet.FaceStart[0];
+
+    for ( unsigned long i = First; i < First + Count; i++ )
+    {
+        CBSPFace * Splitter = m_vpSplitters[i];
+
+        // Create testing splitter plane and classify every vertex against it
+        CPlane3 SplittersPlane( Splitter->Normal, Splitter->Vertices[0] );
+        ClassifyVertices( m_SplitterSet, SplittersPlane, Sides );
+
+        // Reduce to a classification per face, exactly as CPlane3::ClassifyPoly
+        // would (a face with no vertex on either side is on plane).
+        Splits = BackFaces = FrontFaces = 0;
+        for ( f = 0; f < FaceCount; f++ )
+        {
+            UCHAR Side = 0;
+            for ( v = FaceStart[f]; v < FaceStart[f + 1]; v++ ) Side |= Sides[v];
+
+            switch ( Side )
+            {
+                case 1: FrontFaces++; break;
+                case 2: BackFaces++;  break;
+                case 3: Splits++;     break;
+
+            } // End Switch
+
+        } // Next Face
+
+        if ( m_OptionSet.Heuristic == BSP_HEURISTIC_COST )
+        {
+            // Bound the vertices on each side (those on the plane belong to both)
+            float FrontMin[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX }, BackMin[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+            float FrontMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX }, BackMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for ( v = 0; v < m_SplitterSet.X.size(); v++ )
+            {
+                if ( Sides[v] != 2 ) GrowBox( FrontMin, FrontMax, m_SplitterSet.X[v], m_SplitterSet.Y[v], m_SplitterSet.Z[v] );
+                if ( Sides[v] != 1 ) GrowBox( BackMin,  BackMax,  m_SplitterSet.X[v], m_SplitterSet.Y[v], m_SplitterSet.Z[v] );
+
+            } // Next Vertex
+
+            // Expected cost of stepping through this node and then testing the faces on
+            // whichever side a query lands (split faces end up on both), plus the split
+            // penalty since every split adds geometry to the level.
+            float Area = (m_SplitterSet.Area > 0.0f) ? m_SplitterSet.Area : 1.0f;
+            m_vSplitterScores[i] = m_OptionSet.TraversalCost +
+                                   ( BoxArea( FrontMin, FrontMax ) * (FrontFaces + Splits) +
+                                     BoxArea( BackMin,  BackMax  ) * (BackFaces  + Splits) ) / Area +
+                                   Splits * SplitHeuristic;
+
+        } // End if cost heuristic
+        else
+        {
+            // Tally the score (modify the splits * n )
+            m_vSplitterScores[i] = (float)(unsigned long)((long)abs( (long)(FrontFaces - BackFaces) ) + (Splits * SplitHeuristic));
+
+        } // End if balance heuristic
+
+    } // Next Splitter
+}
+
+//-----------------------------------------------------------------------------
+// Name : ClassifyVertices () (Private, Static)
+// Desc : Classifies every vertex in the set against the plane, writing 1 for
+//        each vertex in front, 2 for each behind, or 0 if on the plane.
+// Note : Distances are calculated in the same order as CPlane3::ClassifyPoly
+//        so that results match exactly. Where supported, SSE2 is used to
+//        classify four vertices at a time.
+//-----------------------------------------------------------------------------
+void CBSPTree::ClassifyVertices( const BSPSPLITTERSET & Set, const CPlane3 & Plane, UCHAR Sides[] )
+{
+    ULONG         i = 0, Count = (ULONG)Set.X.size();
+    const float * X = Count ? &Set.X[0] : NULL, * Y = Count ? &Set.Y[0] : NULL, * Z = Count ? &Set.Z[0] : NULL;
+
+#if defined(BSP_SIMD_X86)
+    static const bool UseSSE2 = CVisBits::IsSupported( VBK_SSE2 );
+    if ( UseSSE2 ) i = ClassifyVerticesSSE2( X, Y, Z, Count, Plane, Sides );
+#endif
+
+    // Scalar remainder
+    for ( ; i < Count; i++ )
+    {
+        float Result = X[i] * Plane.Normal.x + Y[i] * Plane.Normal.y + Z[i] * Plane.Normal.z + Plane.Distance;
+        Sides[i] = (Result > EPSILON) ? 1 : ((Result < -EPSILON) ? 2 : 0);
+
+    } // Next Vertex
+}
+
 //-----------------------------------------------------------------------------
 // Name : ClipTree ()
 // Desc : Used to clip the BSP Tree passed in, against this tree.
@@ -1158,8 +2030,9 @@ HRESULT CBSPTree::ClipTree( CBSPTree * pTree, bool ClipSolid, bool RemoveCoPlana
     // Validate Params
     if (!pTree) return BCERR_INVALIDPARAMS;
 
-    // Did Someone use or pass in a silly tree ?
-	if (pTree->GetFaceCount() < 1 || GetFaceCount() < 1 ) return BCERR_BSP_INVALIDGEOMETRY;
+    // Did Someone use or pass in a silly tree ? (Only the nodes of this tree are
+    // tested, its faces may be being clipped by another thread at the same time)
+	if (pTree->GetFaceCount() < 1 || GetNodeCount() < 1 ) return BCERR_BSP_INVALIDGEOMETRY;
 
 	// If this is the first call to ClipTree, then we must build our 
 	// lists to work with (this just takes some work away from the caller)
@@ -1506,18 +2379,89 @@ bool CBSPTree::RayIntersectRecurse(long iNode, XMFLOAT3 rayOrigin, XMFLOAT3 rayD
 	} // End if either point behind
 }
 
+//-----------------------------------------------------------------------------
+// Name : GetTreeStats ()
+// Desc : Gathers statistics describing the shape of the compiled tree, used to
+//        compare the trees produced by each of the splitter heuristics.
+// Note : The average step count is measured by locating a fixed sequence of
+//        pseudo random points within the root node's bounds, so it is
+//        repeatable from one compile to the next.
+//-----------------------------------------------------------------------------
+void CBSPTree::GetTreeStats( BSPTREESTATS & Stats ) const
+{
+    std::vector<ULONG> Stack, Depth;
+    ULONG              i, Leaves = 0, Steps = 0, DepthTotal = 0;
+    unsigned int       Seed = 0x1234567;
+
+    ZeroMemory( &Stats, sizeof(BSPTREESTATS) );
+    Stats.NodeCount = GetNodeCount();
+    Stats.LeafCount = GetLeafCount();
+    Stats.FaceCount = GetFaceCount();
+    if ( GetNodeCount() == 0 ) return;
+
+    try
+    {
+        // Walk the tree to find the depth of every leaf
+        Stack.push_back( 0 );
+        Depth.push_back( 1 );
+        while ( !Stack.empty() )
+        {
+            CBSPNode * pNode = GetNode( Stack.back() );
+            ULONG      NodeDepth = Depth.back();
+            long       Child[2]  = { pNode->Front, pNode->Back };
+            Stack.pop_back();
+            Depth.pop_back();
+
+            for ( i = 0; i < 2; i++ )
+            {
+                if ( Child[i] == (long)BSP_SOLID_LEAF ) continue;
+                if ( Child[i] >= 0 ) { Stack.push_back( (ULONG)Child[i] ); Depth.push_back( NodeDepth + 1 ); continue; }
+
+                // Empty leaf
+                if ( NodeDepth > Stats.MaxDepth ) Stats.MaxDepth = NodeDepth;
+                DepthTotal += NodeDepth;
+                Leaves++;
+
+            } // Next Child
+
+        } // Next Node
+
+    } // End Try Block
+
+    catch ( std::bad_alloc ) { return; }
+
+    if ( Leaves ) Stats.AverageDepth = (float)DepthTotal / (float)Leaves;
+
+    // Locate points within the tree bounds, counting the nodes visited
+    const CBounds3 & Bounds = GetNode(0)->Bounds;
+    CVector3 Size = Bounds.GetDimensions();
+    for ( i = 0; i < BSP_STATS_SAMPLES; i++ )
+    {
+        CVector3 Point;
+        Seed = Seed * 1664525 + 1013904223; Point.x = Bounds.Min.x + Size.x * ((Seed >> 8) / 16777216.0f);
+        Seed = Seed * 1664525 + 1013904223; Point.y = Bounds.Min.y + Size.y * ((Seed >> 8) / 16777216.0f);
+        Seed = Seed * 1664525 + 1013904223; Point.z = Bounds.Min.z + Size.z * ((Seed >> 8) / 16777216.0f);
+        FindLeaf( Point, &Steps );
+
+    } // Next Sample
+
+    Stats.AverageSteps = (float)Steps / (float)BSP_STATS_SAMPLES;
+}
+
 //-----------------------------------------------------------------------------
 // Name : FindLeaf () 
 // Desc : Given a position, this function attempts to determine which leaf
 //        that point falls into.
+// Note : If pSteps is passed, the number of nodes visited is added to it.
 //-----------------------------------------------------------------------------
-long CBSPTree::FindLeaf( const CVector3& Position ) const
+long CBSPTree::FindLeaf( const CVector3& Position, unsigned long * pSteps /* = NULL */ ) const
 {
     long Node = 0, Leaf = 0;
 	
 	for (;;)
     {
         CBSPNode * pNode = GetNode( Node );
+        if ( pSteps ) (*pSteps)++;
 
 		switch ( GetPlane( pNode->Plane )->ClassifyPoint( Position ) ) 
         {
@@ -1577,15 +2521,26 @@ std::vector<unsigned long> CBSPTree::FindPVSLeafIndices(const CBSPLeaf *pCurrent
 		return pvsLeavesIndices;
 	}
 
-	// We are in a valid leaf, let's test its PVS.
+	// We are in a valid leaf, let's test its PVS. Each bit is a leaf, or a vis
+	// cluster if the leaves were clustered during the PVS compile.
 	UCHAR *pPVS = &m_pPVSData[pCurrentLeaf->PVSIndex];
-	size_t LeafCount = GetLeafCount();
+	bool Clustered = !m_vLeafClusters.empty();
+	size_t SetCount = (Clustered) ? m_lClusterCount : GetLeafCount();
+	std::vector<bool> SetVisible(SetCount, false);
 
 	// Loop through and render applicable leaves
-	for (size_t LeafIndex = 0; LeafIndex < LeafCount; )
+	for (size_t SetIndex = 0; SetIndex < SetCount; )
 	{
+		// Is this a compressed run of fully visible bytes ?
+		if (*pPVS == 0xFF && m_bPVSFullRuns)
+		{
+			// Step to the run length byte, and flag run length * 8 leaves
+			pPVS++;
+			size_t RunEnd = min(SetIndex + (*pPVS) * 8, SetCount);
+			for (; SetIndex < RunEnd; ++SetIndex) SetVisible[SetIndex] = true;
+		} // End if full run
 		// Is this a non 0 PVS byte (or ZRLE not used) ?
-		if (*pPVS != 0)
+		else if (*pPVS != 0)
 		{
 			// Check the 8 bits in this byte
 			for (int i = 0; i < 8; i++)
@@ -1596,14 +2551,14 @@ std::vector<unsigned long> CBSPTree::FindPVSLeafIndices(const CBSPLeaf *pCurrent
 				// Is this leaf visible ?
 				if (Data & Mask)
 				{
-					pvsLeavesIndices.push_back(LeafIndex);
+					SetVisible[SetIndex] = true;
 				} // End if leaf visible
 
 				  // Move on to the next leaf
-				LeafIndex++;
+				SetIndex++;
 
 				// Break out if we are about to overflow
-				if (LeafIndex == LeafCount) break;
+				if (SetIndex == SetCount) break;
 
 			} // Next Leaf in Byte
 
@@ -1618,12 +2573,12 @@ std::vector<unsigned long> CBSPTree::FindPVSLeafIndices(const CBSPLeaf *pCurrent
 				// This is a ZRLE Compressed Packet, read run length * 8 leaves (8 bits per byte)
 				size_t RunLength = (*pPVS) * 8;
 				// Skip this amount of leaves
-				LeafIndex += RunLength;
+				SetIndex += RunLength;
 			} // Compressed
 			else
 			{
 				// Simply skip 8 leaves
-				LeafIndex += 8;
+				SetIndex += 8;
 			} // Uncompressed
 		} // End if ZRLE Packet
 
@@ -1631,6 +2586,13 @@ std::vector<unsigned long> CBSPTree::FindPVSLeafIndices(const CBSPLeaf *pCurrent
 		pPVS++;
 	}
 
+	// Collect the visible leaves (in leaf order)
+	size_t LeafCount = GetLeafCount();
+	for (size_t LeafIndex = 0; LeafIndex < LeafCount; ++LeafIndex)
+	{
+		if (SetVisible[(Clustered) ? m_vLeafClusters[LeafIndex] : LeafIndex]) pvsLeavesIndices.push_back(LeafIndex);
+	}
+
 	return pvsLeavesIndices;
 }
 
@@ -1638,7 +2600,7 @@ std::vector<unsigned long> CBSPTree::FindPVSLeafIndices(const CBSPLeaf *pCurrent
 // Name : SetPVSData ()
 // Desc : Allocate and store any passed PVS Data associated with this tree.
 //-----------------------------------------------------------------------------   
-HRESULT CBSPTree::SetPVSData( UCHAR PVSData[], unsigned long PVSSize, bool PVSCompressed )
+HRESULT CBSPTree::SetPVSData( UCHAR PVSData[], unsigned long PVSSize, bool PVSCompressed, bool PVSFullRuns /* = false */ )
 {
     // Release any previous data
     if (m_pPVSData) delete[] m_pPVSData;
@@ -1663,11 +2625,23 @@ HRESULT CBSPTree::SetPVSData( UCHAR PVSData[], unsigned long PVSSize, bool PVSCo
     // Store Values
     m_lPVSDataSize      = PVSSize;
     m_bPVSCompressed    = PVSCompressed;
+    m_bPVSFullRuns      = PVSCompressed && PVSFullRuns;
 
     // Success
     return BC_OK;
 }
 
+//-----------------------------------------------------------------------------
+// Name : SetPVSClusters ()
+// Desc : Store the vis cluster to which each leaf belongs. An empty table means
+//        the PVS data holds one row per leaf.
+//-----------------------------------------------------------------------------
+void CBSPTree::SetPVSClusters( const std::vector<unsigned long>& LeafClusters, unsigned long ClusterCount )
+{
+    m_vLeafClusters = LeafClusters;
+    m_lClusterCount = (LeafClusters.empty()) ? 0 : ClusterCount;
+}
+
 //-----------------------------------------------------------------------------
 // Name : FreeFaceList () (Private)
 // Desc : Frees the face linked list passed to the function
@@ -1694,34 +2668,15 @@ void CBSPTree::FreeFaceList( CBSPFace * pFaceList )
 //-----------------------------------------------------------------------------   
 void CBSPTree::TrashFaceList( CBSPFace * pFaceList )
 {
-    CBSPFace * Iterator = pFaceList;
-
-    while ( Iterator != NULL ) 
+    try 
     {
-        // If it doesn't already exist then add it to the list
-        if (std::find(m_vpGarbage.begin(), m_vpGarbage.end(), Iterator) == m_vpGarbage.end()) 
-        {
-           
-            try 
-            {
-                // Resize the vector if we need to
-                if (m_vpGarbage.size() >= (m_vpGarbage.capacity() - 1)) 
-                {
-                    m_vpGarbage.reserve( m_vpGarbage.size() + BSP_ARRAY_THRESHOLD );
-                } // End If
-                // Push back this new item
-                m_vpGarbage.push_back(Iterator);
-            
-            } // End Try
+        // Add each face to the set, any already there are ignored
+        for ( CBSPFace * Iterator = pFaceList; Iterator != NULL; Iterator = Iterator->Next ) m_Garbage.insert( Iterator );
 
-            // On exception, we can do nothing but bail and leak
-            catch (std::exception&) { return; }
-        
-        } // End If Exists
-
-        Iterator = Iterator->Next;
+    } // End Try
 
-    } // Next Face
+    // On exception, we can do nothing but bail and leak
+    catch (std::exception&) { return; }
 }
 
 //-----------------------------------------------------------------------------
@@ -1822,13 +2777,16 @@ bool CBSPTree::IncreasePlaneCount()
         // Note : VC++ new does not throw an exception on failure (easily ;)
         if (!(NewPlane = new CPlane3)) throw std::bad_alloc();
 
-        // Push back this new plane
+        // Push back this new plane (it has no known opposite)
+        m_vPlaneOpposite.push_back(-1);
         m_vpPlanes.push_back(NewPlane);
     } // Try vector ops
 
     // Catch Failures
     catch (std::bad_alloc) 
     { 
+        if (m_vPlaneOpposite.size() > m_vpPlanes.size()) m_vPlaneOpposite.pop_back();
+        if (NewPlane) delete NewPlane;
         return false; 
     } 
     catch (...) 
@@ -1904,6 +2862,42 @@ bool CBSPTree::IncreasePortalCount()
     return true;
 }
 
+//-----------------------------------------------------------------------------
+// Name : CompactPortals ()
+// Desc : Removes any portal slots which have been set to NULL, closing up the
+//        portal array and renumbering the portal indices held by each leaf.
+// Note : The relative order of the remaining portals is unchanged.
+//-----------------------------------------------------------------------------
+void CBSPTree::CompactPortals()
+{
+    std::vector<long> Remap( m_vpPortals.size(), -1 );
+    unsigned long     i, j, Count = 0;
+
+    // Close up the portal array
+    for ( i = 0; i < m_vpPortals.size(); i++ )
+    {
+        if ( !m_vpPortals[i] ) continue;
+        Remap[i] = (long)Count;
+        m_vpPortals[Count++] = m_vpPortals[i];
+
+    } // Next Portal
+    m_vpPortals.resize( Count );
+
+    // Renumber the leaf portal indices, dropping any to removed portals
+    for ( i = 0; i < m_vpLeaves.size(); i++ )
+    {
+        std::vector<long> & Indices = m_vpLeaves[i]->PortalIndices;
+        for ( j = 0, Count = 0; j < Indices.size(); j++ )
+        {
+            if ( Remap[ Indices[j] ] < 0 ) continue;
+            Indices[Count++] = Remap[ Indices[j] ];
+
+        } // Next Portal Index
+        Indices.resize( Count );
+
+    } // Next Leaf
+}
+
 //-----------------------------------------------------------------------------
 // Name : AllocBSPFace () (Static)
 // Desc : Simply allocate a brand new CBSPFace object and return it.
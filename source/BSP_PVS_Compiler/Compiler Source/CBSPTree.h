@@ -5,22 +5,39 @@
 // CBSPTree Specific Includes
 //-----------------------------------------------------------------------------
 #include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include "CompilerTypes.h"
-#include "..\\Support Source\\Common.h"
-#include "..\\Support Source\\CBounds.h"
-#include "..\\Support Source\\CCollision.h"
+#include "../Support Source/Common.h"
+#include "../Support Source/CBounds.h"
+#include "../Support Source/CCollision.h"
 
 //-----------------------------------------------------------------------------
 // Forward Declarations
 //-----------------------------------------------------------------------------
 class CPlane3;
 class CCompiler;
+class CBSPTree;
 
 //-----------------------------------------------------------------------------
 // Miscellaneous Definitions
 //-----------------------------------------------------------------------------
 #define BSP_ARRAY_THRESHOLD     100
-#define BSP_SOLID_LEAF          0x80000000
+#define BSP_SOLID_LEAF          (-0x7FFFFFFFL - 1)  // 0x80000000, negative whatever the width of long
+#define BSP_STATS_SAMPLES       4096    // Points located when measuring average tree traversal
+
+#define BSP_PLANE_NORMAL_EPSILON 1e-5f  // Plane normals closer than this are considered identical
+#define BSP_PLANE_DIST_EPSILON  1e-3f   // Plane distances closer than this are considered identical
+#define BSP_PLANE_NORMAL_CELLS  256.0f  // Plane pool buckets per unit along each normal axis
+#define BSP_PLANE_DIST_CELL     8.0f    // Plane pool bucket size along the plane distance
+
+#define PVS_FLAG_COMPRESSED     0x01    // PVS rows are ZRLE compressed
+#define PVS_FLAG_CLUSTERED      0x02    // PVS rows are per vis cluster, leaf to cluster table follows
+#define PVS_FLAG_FULLRUNS       0x04    // Runs of 0xFF bytes are also compressed (as zero runs are)
+#define PVS_FLAG_TJR_REPAIRED   0x08    // Faces are already T-Junction repaired, no repair is required at load
 
 // Global Definitions
 double SquaredDistPointAABB(const CVector3 & p, const CBounds3 & aabb);
@@ -40,6 +57,12 @@ public:
 	//------------------------------------------------------------
     CBSPFace( );
     CBSPFace( const CFace * pFace );
+
+    //-------------------------------------------------------------------------
+	// Allocation Operators (faces are allocated from the face pool)
+	//-------------------------------------------------------------------------
+    static void *operator new   ( size_t Size );
+    static void  operator delete( void * pFace, size_t Size );
     
     //------------------------------------------------------------
 	// Public Variables for This Class
@@ -57,6 +80,12 @@ public:
 	// Public Virtual Functions for This Class
 	//-------------------------------------------------------------------------
     virtual HRESULT Split( const CPlane3& Plane, CBSPFace * FrontSplit, CBSPFace * BackSplit, bool bReturnNoSplit = false );
+
+private:
+    //-------------------------------------------------------------------------
+	// Private Static Variables for This Class
+	//-------------------------------------------------------------------------
+    static CMemoryPool m_Pool;          // Pool from which all faces are allocated
 };
 
 //-----------------------------------------------------------------------------
@@ -131,6 +160,12 @@ public:
 	//------------------------------------------------------------
     CBSPPortal( );
 
+    //------------------------------------------------------------
+	// Allocation Operators (portals are allocated from the portal pool)
+	//------------------------------------------------------------
+    static void *operator new   ( size_t Size );
+    static void  operator delete( void * pPortal, size_t Size );
+
     //------------------------------------------------------------
 	// Public Variables for This Class
 	//------------------------------------------------------------
@@ -144,6 +179,12 @@ public:
 	//------------------------------------------------------------
     virtual HRESULT Split( const CPlane3& Plane, CBSPPortal * FrontSplit, CBSPPortal * BackSplit );
 
+private:
+    //------------------------------------------------------------
+	// Private Static Variables for This Class
+	//------------------------------------------------------------
+    static CMemoryPool m_Pool;          // Pool from which all portals are allocated
+
 };
 
 //-----------------------------------------------------------------------------
@@ -155,6 +196,39 @@ typedef std::vector<CBSPLeaf*>   vectorLeaf;
 typedef std::vector<CBSPFace*>   vectorBSPFace;
 typedef std::vector<CBSPPortal*> vectorBSPPortal;
 
+//-----------------------------------------------------------------------------
+// Typedefs, structures & enumerators
+//-----------------------------------------------------------------------------
+typedef struct _BSPBUILDSTATE           // State shared by every tree taking part in a parallel build
+{
+    std::mutex          ProgressLock;   // Serializes logger progress updates
+    std::atomic<long>   FreeThreads;    // Threads still available for building subtrees
+} BSPBUILDSTATE;
+
+typedef struct _BSPSPLITTERSET          // A node's world faces flattened for splitter scoring
+{
+    std::vector<float>  X, Y, Z;        // Vertex positions (structure of arrays)
+    std::vector<ULONG>  FaceStart;      // First vertex of each face, plus a final end entry
+    float               Area;           // Surface area of the bounding box of all vertices
+} BSPSPLITTERSET;
+
+typedef struct _BSPTREESTATS            // Statistics describing a compiled tree
+{
+    unsigned long       NodeCount;      // Number of nodes
+    unsigned long       LeafCount;      // Number of (non solid) leaves
+    unsigned long       FaceCount;      // Number of faces stored
+    unsigned long       MaxDepth;       // Deepest leaf (in nodes)
+    float               AverageDepth;   // Average leaf depth
+    float               AverageSteps;   // Average nodes visited by FindLeaf for points within the tree bounds
+} BSPTREESTATS;
+
+typedef struct _BSPSUBTREE              // A subtree being built on another thread
+{
+    unsigned long       Node;           // Node which the subtree's root will replace
+    CBSPTree           *pTree;          // Tree that the subtree is being built into
+    std::thread         Thread;         // Thread building the subtree
+} BSPSUBTREE;
+
 //-----------------------------------------------------------------------------
 // Name : CBSPTree (Class)
 // Desc : 'Binary Space Partition Tree' compiler class. This class accepts a
@@ -198,7 +272,8 @@ public:
     void            SetFace   ( unsigned long Index, CBSPFace   * pFace   ) { if (Index < m_vpFaces.size())   m_vpFaces[Index]   = pFace  ; }
     void            SetPortal ( unsigned long Index, CBSPPortal * pPortal ) { if (Index < m_vpPortals.size()) m_vpPortals[Index] = pPortal; }
     
-    HRESULT         SetPVSData( UCHAR PVSData[], unsigned long PVSSize, bool PVSCompressed );
+    HRESULT         SetPVSData( UCHAR PVSData[], unsigned long PVSSize, bool PVSCompressed, bool PVSFullRuns = false );
+    void            SetPVSClusters( const std::vector<unsigned long>& LeafClusters, unsigned long ClusterCount );
 
     void            SetOptions( const BSPOPTIONS& Options ) { m_OptionSet = Options; }
     void            SetLogger ( ILogger * pLogger )         { m_pLogger = pLogger; }
@@ -209,11 +284,17 @@ public:
     bool            IncreaseLeafCount();
     bool            IncreasePlaneCount();
     bool            IncreasePortalCount();
+    void            CompactPortals();
+
+    long            AddPlane        ( const CPlane3 & Plane );
+    long            FindPlane       ( const CPlane3 & Plane, bool & Flipped ) const;
+    long            GetOppositePlane( unsigned long Index ) const { return (Index < m_vPlaneOpposite.size()) ? m_vPlaneOpposite[Index] : -1; }
 
     HRESULT         ClipTree( CBSPTree * pTree, bool ClipSolid, bool RemoveCoPlanar, ULONG CurrentNode = 0, CBSPFace * pFaceList = NULL );
     void            RepairSplits( );
 
-    long            FindLeaf( const CVector3& Position ) const;
+    long            FindLeaf( const CVector3& Position, unsigned long * pSteps = NULL ) const;
+    void            GetTreeStats( BSPTREESTATS & Stats ) const;
 	std::vector<unsigned long> FindPVSLeafIndices(const CBSPLeaf *pCurrentLeaf) const;
 
     bool            IntersectedByTree  ( const CBSPTree * pTree ) const;
@@ -233,6 +314,10 @@ public:
     UCHAR          *m_pPVSData;             // PVS Data set (array)
     unsigned long   m_lPVSDataSize;         // Size of the PVS data set
     bool            m_bPVSCompressed;       // Is the PVS data compressed
+    bool            m_bPVSFullRuns;         // Are runs of 0xFF bytes compressed too
+    std::vector<unsigned long> m_vLeafClusters; // Vis cluster of each leaf (empty = one row per leaf)
+    unsigned long   m_lClusterCount;        // Number of vis clusters (rows) in the PVS data
+    bool            m_bTJRepaired;          // Have all T-Junctions in the tree faces been repaired
 
 private:
     //-------------------------------------------------------------------------
@@ -240,15 +325,32 @@ private:
     //-------------------------------------------------------------------------
     HRESULT         BuildPlaneArray( );
     HRESULT         BuildBSPTree( unsigned long lNode, CBSPFace * pFaceList );
+    HRESULT         BuildSubtree( unsigned long Node, CBSPFace * pFaceList );
+    void            SubtreeThread( CBSPFace * pFaceList );
+    HRESULT         JoinSubtrees( );
+    bool            SpliceSubtree( unsigned long Node, CBSPTree * pSubtree );
+    bool            RenumberTree( unsigned long FaceBase );
+    void            UpdateBuildProgress( long Amount = 1 );
+    bool            TestBuildState( );
     HRESULT         ProcessLeafFaces( CBSPLeaf * pLeaf, CBSPFace * pFaceList );
     CBSPFace       *SelectBestSplitter( CBSPFace * pFaceList, unsigned long SplitterSample, float SplitHeuristic );
+    void            FlattenFaces( CBSPFace * pFaceList, BSPSPLITTERSET & Set ) const;
+    void            ScoreSplitters( unsigned long First, unsigned long Count, float SplitHeuristic, UCHAR Sides[] );
     
     unsigned long   CountSplitters( CBSPFace * pFaceList ) const;
     void            FreeFaceList( CBSPFace * pFaceList );
     void            TrashFaceList( CBSPFace * pFaceList );
+    void            MatchPlane( const CPlane3 & Plane, long & Same, long & Opposite ) const;
 
 	bool			RayIntersectRecurse(long iNode, XMFLOAT3 rayOrigin, XMFLOAT3 rayDir);
 
+    //-------------------------------------------------------------------------
+    // Private Static Functions for This Class.
+    //-------------------------------------------------------------------------
+    static void     ClassifyVertices( const BSPSPLITTERSET & Set, const CPlane3 & Plane, UCHAR Sides[] );
+    static bool     GetCanonicalPlane( const CPlane3 & Plane, CPlane3 & Canonical );
+    static ULONG    GetPlaneKeys    ( const CPlane3 & Canonical, uint64_t Keys[] );
+
     //-------------------------------------------------------------------------
     // Private Variables for This Class.
     //-------------------------------------------------------------------------
@@ -256,16 +358,27 @@ private:
     unsigned long   m_lActiveFaces;     // Number of active faces in the pre-compiled list    
     vectorNode      m_vpNodes;          // Nodes created by the BSP compiler
     vectorPlane     m_vpPlanes;         // Node planes created by the BSP compiler
+    std::vector<long> m_vPlaneOpposite; // For each plane, the plane facing the opposite way (or -1)
+    std::unordered_multimap<uint64_t, ULONG> m_PlaneBuckets; // Plane pool, canonical plane bucket to plane index
     vectorLeaf      m_vpLeaves;         // Leaves created by the BSP compiler
     vectorBSPFace   m_vpFaces;          // Resulting faces. Either the originals or split versions.
     vectorBSPPortal m_vpPortals;        // A set of portals built by the CProcessPRT compiler.
-    vectorBSPFace   m_vpGarbage;        // Garabage collection for releasing faces on error.
+    std::unordered_set<CBSPFace*> m_Garbage; // Garbage collection for releasing faces on error.
     CBounds3        m_Bounds;           // BSP Trees Bounding Box
     
     BSPOPTIONS      m_OptionSet;        // The option set for BSP Compilation.
     ILogger        *m_pLogger;          // Just our logging interface used to log progress etc.
     CCompiler      *m_pParent;          // Parent Compiler Pointer
 
+    BSPBUILDSTATE  *m_pBuildState;      // Shared parallel build state (NULL when building serially)
+    std::vector<BSPSUBTREE> m_vSubtrees;// Subtrees of this tree still being built on other threads
+    HRESULT         m_BuildResult;      // Result of building this tree as another tree's subtree
+
+    BSPSPLITTERSET  m_SplitterSet;      // Faces of the node currently selecting a splitter
+    vectorBSPFace   m_vpSplitters;      // Potential splitters of that node, in list order
+    std::vector<float> m_vSplitterScores;// Score of each potential splitter
+    std::vector<std::vector<UCHAR> > m_vSplitterSides; // Per thread vertex classification scratch
+
 };
 
 #endif // _CBSPTREE_H_
\ No newline at end of file
@@ -8,11 +8,14 @@
 // CCompiler Specific Includes
 //-----------------------------------------------------------------------------
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <memory>
+#include <random>
 #include <cstdint>
 #include <cstdio>
 #include <cwchar>
-#include "..\\Support Source\\Common.h"
+#include "../Support Source/Common.h"
 #include "CCompiler.h"
 #include "CompilerTypes.h"
 #include "ProcessHSR.h"
@@ -21,10 +24,10 @@
 #include "ProcessTJR.h"
 #include "CBSPTree.h"
 //lightmapping
-#include "..\\LightMapper Source\\Vector.h"
-#include "..\\LightMapper Source\\TexturePacker.h"
-#include "..\\LightMapper Source\\BSP.h"
-#include "..\\LightMapper Source\\Imaging\\Image.h"
+#include "../LightMapper Source/Vector.h"
+#include "../LightMapper Source/TexturePacker.h"
+#include "../LightMapper Source/BSP.h"
+#include "../LightMapper Source/Imaging/Image.h"
 
 #define LIGHT_CLUSTER_MAPS_FOLDER "Content\\LightClusterMaps"
 
@@ -39,27 +42,48 @@ float clamp(const float v, const float c0, const float c1) {
 //-----------------------------------------------------------------------------
 CCompiler::CCompiler()
 {
+    // Set up default map loading options
+    m_OptionsMAP.BrushCache         = false; // Opt in, the cache is written next to the map
+    m_OptionsMAP.ThreadCount        = 0; // 0 = use all hardware threads, 1 = serial
+
     // Set up default HSR options
-    m_OptionsHSR.Enabled            = true;
+    m_OptionsHSR.Enabled            = false; // Keep the world and func_wall meshes apart
+    m_OptionsHSR.ThreadCount        = 0; // 0 = use all hardware threads, 1 = serial
 
     // Set up default BSP options
     m_OptionsBSP.Enabled            = true;
     m_OptionsBSP.TreeType           = BSP_TYPE_SPLIT;
     m_OptionsBSP.SplitHeuristic     = 3.0f;
     m_OptionsBSP.SplitterSample     = 60;
+    m_OptionsBSP.Heuristic          = BSP_HEURISTIC_BALANCE;
+    m_OptionsBSP.TraversalCost      = 1.0f;
+    m_OptionsBSP.CompareHeuristics  = false;
     m_OptionsBSP.RemoveBackLeaves   = true;
     m_OptionsBSP.AddBoundingPolys   = false;
+    m_OptionsBSP.ThreadCount        = 0; // 0 = use all hardware threads, 1 = serial
+    m_OptionsBSP.ForkThreshold      = 2000;
+    m_OptionsBSP.ScoreThreshold     = 500000;
 
     // Set up default Portal Compile Options
 	m_OptionsPRT.Enabled			= true; //true;
+    m_OptionsPRT.ThreadCount        = 0; // 0 = use all hardware threads, 1 = serial
+    m_OptionsPRT.MergeCoplanar      = false; // Finds nothing to merge on the bundled maps
+    m_OptionsPRT.MergeTolerance     = EPSILON;
 
     // Set up default PVS Options
 	m_OptionsPVS.Enabled			= true;//true;
     m_OptionsPVS.FullCompile        = true;//true
     m_OptionsPVS.ClipTestCount      = 3; // 3 //1(loose PVS,fast),4(tightest PVS,slooow)
+    m_OptionsPVS.ThreadCount        = 0; // 0 = use all hardware threads, 1 = serial
+    m_OptionsPVS.MaxFlowDepth       = 0; // 0 = exact PVS, otherwise a conservative 'draft' PVS
+    m_OptionsPVS.MaxFlowDistance    = 0.0f;
+    m_OptionsPVS.ClusterLeaves      = false;
+    m_OptionsPVS.ClusterSize        = 128.0f;
 
     // Set up default TJR Options
     m_OptionsTJR.Enabled            = true;
+    m_OptionsTJR.SpatialGrid        = true;
+    m_OptionsTJR.Validate           = false;
 
 	// Lightmapping options
 	m_OptionLightmapping.Enabled = true;
@@ -69,12 +93,14 @@ CCompiler::CCompiler()
 	m_OptionLightmapping.lm_height = 1024; // 1024;
 	m_OptionLightmapping.sampleCount = 150; // 250
 	m_OptionLightmapping.sampleDistanceFactor = 150.f;// 150.f;// 50.f; // 50.f;
+	strcpy(m_OptionLightmapping.OutputFolder, LIGHT_CLUSTER_MAPS_FOLDER);
 
     // Reset Vars
     m_strFileName = NULL;
     m_pBSPTree    = NULL;
     m_pLogger     = NULL;
     m_Status      = CS_IDLE;
+    memset( m_StageTime, 0, sizeof(m_StageTime) );
     
 }
 
@@ -188,7 +214,11 @@ bool CCompiler::TestCompilerState( )
 //-----------------------------------------------------------------------------
 bool CCompiler::CompileScene( )
 {
+    typedef std::chrono::high_resolution_clock Clock;
+    bool bResult = true;
+
 	m_Level.ClearObjects();
+    memset( m_StageTime, 0, sizeof(m_StageTime) );
 
     // Validate Data
     if (!m_strFileName) return false;
@@ -208,7 +238,12 @@ bool CCompiler::CompileScene( )
         m_Status = CS_INPROGRESS;
 
         // Load the specified file
+        Clock::time_point Start = Clock::now();
+		m_Level.SetBrushCache( m_OptionsMAP.BrushCache );
+		m_Level.SetThreadCount( m_OptionsMAP.ThreadCount );
+		m_Level.SetLogger( m_pLogger );
 		m_Level.Load( m_strFileName );
+        m_StageTime[ PROCESS_MAP ] = std::chrono::duration<double>( Clock::now() - Start ).count();
 
         // Obtain ownership of the objects loaded
         m_vpMeshList     = m_Level.m_vpMeshList;
@@ -270,29 +305,32 @@ bool CCompiler::CompileScene( )
 
     } // End if Logger
 
-    // Start compiling by removing all hidden surfaces
-	// note here: we have world mesh and a brushes world mesh. don't perform hsr (don't want only one mesh)
-    //m_CurrentLog = LOG_HSR;
-    //if ( m_OptionsHSR.Enabled && m_Status != CS_CANCELLED) PerformHSR();
+    // Memory statistics logged by each stage cover only that stage
+    CMemoryPool::LogStatistics( NULL, 0 );
+
+    // Start compiling by removing all hidden surfaces. Off by default, it would
+	// merge the world mesh and the func_wall meshes into one.
+    m_CurrentLog = LOG_HSR;
+    if ( m_OptionsHSR.Enabled && m_Status != CS_CANCELLED) bResult &= TimeStage( PROCESS_HSR, &CCompiler::PerformHSR );
     
     // Build the BSP Tree if requested
     m_CurrentLog = LOG_BSP;
-    if ( m_OptionsBSP.Enabled && m_Status != CS_CANCELLED) PerformBSP();
+    if ( m_OptionsBSP.Enabled && m_Status != CS_CANCELLED) bResult &= TimeStage( PROCESS_BSP, &CCompiler::PerformBSP );
     
     // Build the portals if requested
     m_CurrentLog = LOG_PRT;
-    if ( m_OptionsPRT.Enabled && m_Status != CS_CANCELLED) PerformPRT();
+    if ( m_OptionsPRT.Enabled && m_Status != CS_CANCELLED) bResult &= TimeStage( PROCESS_PRT, &CCompiler::PerformPRT );
 
     // Build the PVS if requested
     m_CurrentLog = LOG_PVS;
-    if ( m_OptionsPVS.Enabled && m_Status != CS_CANCELLED) PerformPVS();
+    if ( m_OptionsPVS.Enabled && m_Status != CS_CANCELLED) bResult &= TimeStage( PROCESS_PVS, &CCompiler::PerformPVS );
 
     // Repair any T-Juncs if requested
     m_CurrentLog = LOG_TJR;
-    if ( m_OptionsTJR.Enabled && m_Status != CS_CANCELLED) PerformTJR();
+    if ( m_OptionsTJR.Enabled && m_Status != CS_CANCELLED) bResult &= TimeStage( PROCESS_TJR, &CCompiler::PerformTJR );
     
 	m_CurrentLog = LOG_LMP;
-	if (m_OptionLightmapping.Enabled && m_Status != CS_CANCELLED) PerformLMP();
+	if (m_OptionLightmapping.Enabled && m_Status != CS_CANCELLED) bResult &= TimeStage( PROCESS_LMP, &CCompiler::PerformLMP );
 
     // Clean up if required
     if ( m_Status == CS_CANCELLED ) Release();
@@ -301,10 +339,41 @@ bool CCompiler::CompileScene( )
     m_Status = CS_IDLE;
 
     // Write end of compilation message (We use warning just to make it blue ;)
-    if ( m_pLogger ) m_pLogger->LogWrite( LOG_GENERAL, LOGF_WARNING | LOGF_ITALIC, false, _T("Success") );
+    if ( m_pLogger )
+    {
+        if ( bResult )
+            m_pLogger->LogWrite( LOG_GENERAL, LOGF_WARNING | LOGF_ITALIC, false, _T("Success") );
+        else
+            m_pLogger->LogWrite( LOG_GENERAL, LOGF_ERROR, false, _T("Failed") );
 
-    // Success!
-    return true;
+    } // End if Logger
+
+    // A failed stage fails the whole run
+    return bResult;
+}
+
+//-----------------------------------------------------------------------------
+// Name : TimeStage () (Private)
+// Desc : Runs a single compilation stage, recording the time it took.
+//-----------------------------------------------------------------------------
+bool CCompiler::TimeStage( UINT Process, bool (CCompiler::*pfnStage)() )
+{
+    typedef std::chrono::high_resolution_clock Clock;
+
+    // Run the stage
+    Clock::time_point Start = Clock::now();
+    bool bResult = (this->*pfnStage)();
+    m_StageTime[ Process ] = std::chrono::duration<double>( Clock::now() - Start ).count();
+
+    // Write Log Information
+    if ( m_pLogger )
+    {
+        m_pLogger->LogWrite( m_CurrentLog, 0, true, _T("Stage time: %.3f seconds."), m_StageTime[ Process ] );
+
+    } // End if Logger Available
+
+    // Return the stage result
+    return bResult;
 }
 
 //-----------------------------------------------------------------------------
@@ -406,6 +475,7 @@ bool CCompiler::PerformHSR()
     // One time compile process
     CProcessHSR ProcessHSR;
     ULONG       i, MeshCount = 0;
+    HRESULT     hRet = BC_OK;
 
     // Set our processor options
     ProcessHSR.SetOptions( m_OptionsHSR );
@@ -435,7 +505,7 @@ bool CCompiler::PerformHSR()
     // How many meshes ?
     if ( MeshCount <= 1 )
     {
-        m_pLogger->LogWrite( LOG_HSR, LOGF_WARNING, true, _T("Zero or Single mesh scene found. Skipping HSR process."));
+        if ( m_pLogger ) m_pLogger->LogWrite( LOG_HSR, LOGF_WARNING, true, _T("Zero or Single mesh scene found. Skipping HSR process."));
 
     } // End if single mesh
     else
@@ -451,8 +521,8 @@ bool CCompiler::PerformHSR()
 
         } // Next Mesh
 
-        // Begin the HSR Process
-        ProcessHSR.Process();
+        // Begin the HSR Process, on failure the meshes are compiled as they were
+        hRet = ProcessHSR.Process();
 
         // Make way for our result if there is one
         if ( ProcessHSR.GetResultMesh() != NULL )
@@ -494,10 +564,16 @@ bool CCompiler::PerformHSR()
     // Write Log Information
     if ( m_pLogger )
     {
-        if ( m_Status != CS_CANCELLED )
-            m_pLogger->LogWrite( LOG_HSR, 0, true, _T("Hidden-surface removal completed successfully."));
-        else
+        if ( m_Status == CS_CANCELLED )
             m_pLogger->LogWrite( LOG_HSR, 0, true, _T("Hidden-surface removal cancelled."));
+        else if ( FAILED(hRet) )
+            m_pLogger->LogWrite( LOG_HSR, LOGF_WARNING, true, _T("Hidden-surface removal failed, the meshes are left unchanged."));
+        else
+            m_pLogger->LogWrite( LOG_HSR, 0, true, _T("Hidden-surface removal completed successfully."));
+
+        // Log the memory used by this stage
+        CMemoryPool::LogStatistics( m_pLogger, LOG_HSR );
+
     } // End if Logger Available
 
     // Success!!
@@ -512,8 +588,10 @@ bool CCompiler::PerformBSP()
 {
     ULONG       i;
 
-    // Destroy any old BSP Tree
+    // Destroy any old BSP Tree, and return its memory
     if ( m_pBSPTree ) delete m_pBSPTree;
+    m_pBSPTree = NULL;
+    CMemoryPool::TrimAll();
 
     // Allocate a new BSP Tree
     m_pBSPTree = new CBSPTree;
@@ -548,6 +626,9 @@ bool CCompiler::PerformBSP()
     // Compile the BSP Tree
     m_pBSPTree->CompileTree();
 
+    // Build the same scene with the other splitter heuristic for comparison
+    if ( m_OptionsBSP.CompareHeuristics && m_pLogger && m_Status != CS_CANCELLED ) CompareBSPHeuristics();
+
     // Destroy any loaded scene meshes
     for ( i = 0; i < m_vpMeshList.size(); i++ )
     {
@@ -569,12 +650,71 @@ bool CCompiler::PerformBSP()
             m_pLogger->LogWrite( LOG_BSP, 0, true, _T("BSP compilation completed successfully."));
         else
             m_pLogger->LogWrite( LOG_BSP, 0, true, _T("BSP compilation cancelled."));
+
+        // Log the memory used by this stage
+        CMemoryPool::LogStatistics( m_pLogger, LOG_BSP );
+
     } // End if Logger Available
         
     // Success!!
     return true;
 }
 
+//-----------------------------------------------------------------------------
+// Name : CompareBSPHeuristics () (Private)
+// Desc : Compiles a second tree from the scene meshes using the splitter
+//        heuristic not selected, and logs the statistics for both trees so that
+//        the runtime traversal cost of each can be compared.
+// Note : The second tree is only used for its statistics and is discarded.
+//-----------------------------------------------------------------------------
+void CCompiler::CompareBSPHeuristics()
+{
+    BSPOPTIONS   Options = m_OptionsBSP;
+    BSPTREESTATS Stats[2];
+    CBSPTree   * pTree   = NULL;
+    ULONG        i, Selected = (m_OptionsBSP.Heuristic == BSP_HEURISTIC_COST) ? 1 : 0;
+
+    try
+    {
+        // Build the alternative tree silently
+        Options.Heuristic = (Selected == 1) ? BSP_HEURISTIC_BALANCE : BSP_HEURISTIC_COST;
+        pTree = new CBSPTree;
+        pTree->SetOptions( Options );
+        pTree->SetParent( this );
+        for ( i = 0; i < m_vpMeshList.size(); i++ )
+        {
+            CMesh * pMesh = m_vpMeshList[i];
+            if ( !pMesh ) continue;
+            pTree->AddFaces( pMesh->Faces, pMesh->FaceCount );
+
+        } // Next Mesh
+        if ( Options.AddBoundingPolys ) pTree->AddBoundingPolys( true );
+        if ( FAILED( pTree->CompileTree() ) ) { delete pTree; return; }
+
+        // Gather the statistics for both trees
+        m_pBSPTree->GetTreeStats( Stats[ Selected ] );
+        pTree->GetTreeStats( Stats[ 1 - Selected ] );
+        delete pTree;
+
+    } // End Try Block
+
+    catch ( std::bad_alloc )
+    {
+        if ( pTree ) delete pTree;
+        return;
+
+    } // End Catch Block
+
+    // Log them side by side
+    m_pLogger->LogWrite( LOG_BSP, 0, true, _T("Heuristic comparison      Balance      Cost"));
+    m_pLogger->LogWrite( LOG_BSP, 0, true, _T("  Nodes                   %-12i %i"), Stats[0].NodeCount, Stats[1].NodeCount );
+    m_pLogger->LogWrite( LOG_BSP, 0, true, _T("  Leaves                  %-12i %i"), Stats[0].LeafCount, Stats[1].LeafCount );
+    m_pLogger->LogWrite( LOG_BSP, 0, true, _T("  Faces                   %-12i %i"), Stats[0].FaceCount, Stats[1].FaceCount );
+    m_pLogger->LogWrite( LOG_BSP, 0, true, _T("  Maximum depth           %-12i %i"), Stats[0].MaxDepth, Stats[1].MaxDepth );
+    m_pLogger->LogWrite( LOG_BSP, 0, true, _T("  Average depth           %-12.2f %.2f"), Stats[0].AverageDepth, Stats[1].AverageDepth );
+    m_pLogger->LogWrite( LOG_BSP, 0, true, _T("  Average point traversal %-12.2f %.2f"), Stats[0].AverageSteps, Stats[1].AverageSteps );
+}
+
 //-----------------------------------------------------------------------------
 // Name : PerformPRT () (Private)
 // Desc : Perform the portal compilation tasks.
@@ -608,6 +748,10 @@ bool CCompiler::PerformPRT()
             m_pLogger->LogWrite( LOG_PRT, 0, true, _T("Portal compilation completed successfully."));
         else
             m_pLogger->LogWrite( LOG_PRT, 0, true, _T("Portal compilation cancelled."));
+
+        // Log the memory used by this stage
+        CMemoryPool::LogStatistics( m_pLogger, LOG_PRT );
+
     } // End if Logger Available
 
     // Success!!
@@ -647,6 +791,10 @@ bool CCompiler::PerformPVS()
             m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Visibility determination completed successfully."));
         else
             m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Visibility determination cancelled."));
+
+        // Log the memory used by this stage
+        CMemoryPool::LogStatistics( m_pLogger, LOG_PVS );
+
     } // End if Logger Available
 
     // Success!!
@@ -660,7 +808,8 @@ bool CCompiler::PerformPVS()
 //-----------------------------------------------------------------------------
 bool CCompiler::PerformTJR()
 {
-    ULONG i, k;
+    ULONG   i, k, Mismatches;
+    HRESULT hRet;
 
     // One time compile process
     CProcessTJR ProcessTJR;
@@ -672,8 +821,9 @@ bool CCompiler::PerformTJR()
 
     // The TJunction processor simply accepts a bunch of separate polys
     // We can use this to compile BSP Tree or Mesh polys as we see fit
-    ULONG       PolyCount = 0, Counter = 0;
-    CPolygon ** ppPolys   = NULL;
+    ULONG       PolyCount  = 0, Counter = 0;
+    CPolygon ** ppPolys    = NULL;
+    CPolygon ** ppOriginal = NULL;
 
     // Write Log Information
     if ( m_pLogger )
@@ -729,10 +879,55 @@ bool CCompiler::PerformTJR()
         // Loop through faces and add
         for ( k = 0; k < PolyCount; k++ ) ppPolys[ k ] = m_pBSPTree->GetFace( k );
 
+        // Keep an unrepaired copy of the faces if we are to validate the result
+        if ( m_OptionsTJR.Validate )
+        {
+            if (!(ppOriginal = new CPolygon*[PolyCount])) { delete []ppPolys; return false; }
+            ZeroMemory( ppOriginal, PolyCount * sizeof(CPolygon*) );
+
+            for ( k = 0; k < PolyCount; k++ )
+            {
+                if (!(ppOriginal[ k ] = new CPolygon)) break;
+                if ( ppPolys[ k ]->VertexCount == 0 ) continue;
+                if ( ppOriginal[ k ]->AddVertices( ppPolys[ k ]->VertexCount ) < 0 ) break;
+                memcpy( ppOriginal[ k ]->Vertices, ppPolys[ k ]->Vertices, ppPolys[ k ]->VertexCount * sizeof(CVertex) );
+
+            } // Next Face
+
+            // Skip validation if we ran out of memory
+            if ( k < PolyCount )
+            {
+                for ( k = 0; k < PolyCount; k++ ) if ( ppOriginal[ k ] ) delete ppOriginal[ k ];
+                delete []ppOriginal;
+                ppOriginal = NULL;
+
+            } // End if failed
+
+        } // End if validating
+
     } // End if BSP Tree
 
     // Repair any T-Junctions
-    ProcessTJR.Process( ppPolys, PolyCount );
+    hRet = ProcessTJR.Process( ppPolys, PolyCount );
+
+    // The engine need not repair the tree faces again when the level is loaded
+    if ( m_pBSPTree && hRet == BC_OK ) m_pBSPTree->m_bTJRepaired = true;
+
+    // Confirm that the engine's own repair would produce the same faces
+    if ( ppOriginal )
+    {
+        if ( m_pBSPTree->m_bTJRepaired )
+        {
+            hRet = ProcessTJR.Validate( m_pBSPTree, ppOriginal, PolyCount, Mismatches );
+            if ( hRet != BC_OK || Mismatches > 0 ) m_pBSPTree->m_bTJRepaired = false;
+
+        } // End if repaired
+
+        // Release the copies
+        for ( k = 0; k < PolyCount; k++ ) if ( ppOriginal[ k ] ) delete ppOriginal[ k ];
+        delete []ppOriginal;
+
+    } // End if validating
 
     // Release the poly pointer array
     if (ppPolys) delete []ppPolys;
@@ -744,6 +939,10 @@ bool CCompiler::PerformTJR()
             m_pLogger->LogWrite( LOG_TJR, 0, true, _T("T-Junction repair completed successfully."));
         else
             m_pLogger->LogWrite( LOG_TJR, 0, true, _T("T-Junction repair cancelled."));
+
+        // Log the memory used by this stage
+        CMemoryPool::LogStatistics( m_pLogger, LOG_TJR );
+
     } // End if Logger Available
 
     // Success!!
@@ -760,6 +959,13 @@ bool CCompiler::PerformLMP()
 		m_pLogger->LogWrite(LOG_LMP, 0, true, _T("Beginning Light/Cluster Maps generation process."));
 	}
 
+	// Light and cluster maps are built from the compiled tree
+	if (!m_pBSPTree)
+	{
+		if (m_pLogger) m_pLogger->LogWrite(LOG_LMP, LOGF_ERROR, true, _T("No BSP tree was compiled, light mapping requires the BSP stage."));
+		return false;
+	}
+
 	/*************************************/
 
 	struct LightData {
@@ -867,7 +1073,7 @@ bool CCompiler::PerformLMP()
 		do {
 			if (polygonData->indices.size() == index) {
 				m_Status = CS_CANCELLED;
-				LightMapper::ErrorMsg("tangent space setup failed.\n");
+				if (m_pLogger) m_pLogger->LogWrite(LOG_LMP, LOGF_ERROR, true, _T("Tangent space setup failed."));
 				return false;
 				//return 
 				//break;
@@ -1006,7 +1212,7 @@ bool CCompiler::PerformLMP()
 
 	if (!texPacker.assignCoords(&lm_width, &lm_height, LightMapper::widthComp))
 	{
-		LightMapper::ErrorMsg("Lightmap too small");
+		if (m_pLogger) m_pLogger->LogWrite(LOG_LMP, LOGF_ERROR, true, _T("Lightmap too small."));
 		return false;
 	}
 
@@ -1057,16 +1263,21 @@ bool CCompiler::PerformLMP()
 	std::vector<LightMapper::vec3> p_samples(numSamples);
 	std::vector<LightMapper::vec2> t_samples(numSamples);
 
+	// Each compile has its own generator, so the samples do not depend on any
+	// other map compiled by the same process
+	std::minstd_rand rng(1);
+	const float rngMax = float((rng.max)());
+
 	for (unsigned int s = 0; s < numSamples; s++)
 	{
 		LightMapper::vec3 p;
 		do
 		{
-			p = LightMapper::vec3(float(rand()), float(rand()), float(rand())) * (2.0f / RAND_MAX) - 1.0f;
+			p = LightMapper::vec3(float(rng()), float(rng()), float(rng())) * (2.0f / rngMax) - 1.0f;
 		} while (LightMapper::dot(p,p) > 1.0f);
 		p_samples[s] = p * m_OptionLightmapping.sampleDistanceFactor;
 		
-		t_samples[s] = LightMapper::vec2(float(rand()), float(rand())) * (1.0f / RAND_MAX) - 0.5f; //LightMapper::vec2(0, 0);//
+		t_samples[s] = LightMapper::vec2(float(rng()), float(rng())) * (1.0f / rngMax) - 0.5f; //LightMapper::vec2(0, 0);//
 	}
 
 	/* Cluster Map setup up */
@@ -1101,7 +1312,7 @@ bool CCompiler::PerformLMP()
 		uint8_t* lMap = new uint8_t[lm_width * lm_height];
 		memset(lMap, 0, lm_width * lm_height);
 
-		std::vector<unsigned long> &pvsLightLeafIndices = m_pBSPTree->FindPVSLeafIndices(lightData.leaf);
+		std::vector<unsigned long> pvsLightLeafIndices = m_pBSPTree->FindPVSLeafIndices(lightData.leaf);
 		// sort leaves by light distance ? to avoid excluding lights (when #leaves is >16) from near leaves then	
 		CBSPTree *bspTree = m_pBSPTree;
 		///*
@@ -1231,8 +1442,8 @@ bool CCompiler::PerformLMP()
 
 		LightMapper::Image image;
 		image.loadFromMemory(lMap, LightMapper::FORMAT_I8, lm_width, lm_height, 1, 1, true);
-		char fileName[256];
-		sprintf(fileName, "%s//LightMap%d.dds", LIGHT_CLUSTER_MAPS_FOLDER, light_index);
+		char fileName[MAX_PATH + 32];
+		sprintf(fileName, "%s/LightMap%d.dds", m_OptionLightmapping.OutputFolder, light_index);
 		image.saveImage(fileName);
 
 		if (m_pLogger) m_pLogger->UpdateProgress();
@@ -1251,8 +1462,8 @@ bool CCompiler::PerformLMP()
 
 		LightMapper::Image image;
 		image.loadFromMemory(leaf->lightClusters, LightMapper::FORMAT_R16UI, cm_width, cm_height, 1, 1, true);
-		char fileName[256];
-		sprintf(fileName, "%s//ClustersLeaf%d.dds", LIGHT_CLUSTER_MAPS_FOLDER, i);
+		char fileName[MAX_PATH + 32];
+		sprintf(fileName, "%s/ClustersLeaf%lu.dds", m_OptionLightmapping.OutputFolder, i);
 		image.saveImage(fileName);
 		
 		//leaf->lightClusters = nullptr;
@@ -1339,6 +1550,9 @@ void CCompiler::Release()
     // Destroy any compiled BSP Tree
     if (m_pBSPTree) delete m_pBSPTree;
     m_pBSPTree = NULL;
+
+    // Return any pooled memory no longer in use
+    CMemoryPool::TrimAll();
 }
 
 //-----------------------------------------------------------------------------
@@ -1364,6 +1578,10 @@ void CCompiler::SetOptions( UINT Process, const LPVOID Options )
 {
     switch (Process)
     {
+        case PROCESS_MAP:
+            m_OptionsMAP = *((MAPOPTIONS*)Options);
+            break;
+
         case PROCESS_HSR:
             m_OptionsHSR = *((HSROPTIONS*)Options);
             break;
@@ -1384,6 +1602,10 @@ void CCompiler::SetOptions( UINT Process, const LPVOID Options )
             m_OptionsTJR = *((TJROPTIONS*)Options);
             break;
 
+        case PROCESS_LMP:
+            m_OptionLightmapping = *((LIGHTMAPOPTIONS*)Options);
+            break;
+
     } // End Switch
 }
 
@@ -1395,6 +1617,10 @@ void CCompiler::GetOptions( UINT Process, LPVOID Options ) const
 {
     switch (Process)
     {
+        case PROCESS_MAP:
+            *((MAPOPTIONS*)Options) = m_OptionsMAP;
+            break;
+
         case PROCESS_HSR:
             *((HSROPTIONS*)Options) = m_OptionsHSR;
             break;
@@ -1415,5 +1641,9 @@ void CCompiler::GetOptions( UINT Process, LPVOID Options ) const
             *((TJROPTIONS*)Options) = m_OptionsTJR;
             break;
 
+        case PROCESS_LMP:
+            *((LIGHTMAPOPTIONS*)Options) = m_OptionLightmapping;
+            break;
+
     } // End Switch
 }
\ No newline at end of file
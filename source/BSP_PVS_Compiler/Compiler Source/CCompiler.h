@@ -4,8 +4,8 @@
 //-----------------------------------------------------------------------------
 // CCompiler Specific Includes
 //-----------------------------------------------------------------------------
-#include "..\\Support Source\\Common.h"
-#include "..\\Compiler Source\\CompilerTypes.h"
+#include "../Support Source/Common.h"
+#include "../Compiler Source/CompilerTypes.h"
 #include "CLevelFile.h"
 #include <vector>
 
@@ -54,6 +54,7 @@ public:
     void            SetLogger        ( ILogger * pLogger ) { m_pLogger = pLogger; }
     CBSPTree       *GetBSPTree       ( ) const { return m_pBSPTree;   }
     bool            SaveScene        ( LPCTSTR FileName );
+    double          GetStageTime     ( UINT Process ) const { return (Process < PROCESS_COUNT) ? m_StageTime[Process] : 0.0; }
     
     void            PauseCompiler    ( );
     void            ResumeCompiler   ( );
@@ -79,13 +80,16 @@ private:
     //-------------------------------------------------------------------------
     bool            PerformHSR( );      // Hidden Surface Removal
     bool            PerformBSP( );      // Binary Space Partition Compilation
+    void            CompareBSPHeuristics( ); // Log statistics for the alternative BSP heuristic
     bool            PerformPRT( );      // Portal Compilation
     bool            PerformPVS( );      // Potential Visibility Set Compilation
     bool            PerformTJR( );      // T-Junction Repair
 	bool			PerformLMP();		// LightMapping
+    bool            TimeStage ( UINT Process, bool (CCompiler::*pfnStage)() ); // Run and time a single stage
     //-------------------------------------------------------------------------
     // Private Variables for This Class.
     //-------------------------------------------------------------------------
+    MAPOPTIONS      m_OptionsMAP;       // Map Loading Options
     HSROPTIONS      m_OptionsHSR;       // Hidden Surface Removal Options
     BSPOPTIONS      m_OptionsBSP;       // BSP Compilation Options
     PRTOPTIONS      m_OptionsPRT;       // Portal Compilation Options
@@ -97,6 +101,7 @@ private:
     LPTSTR          m_strFileName;      // The file used for compilation
     COMPILESTATUS   m_Status;           // The current status of the compile run
     ULONG           m_CurrentLog;       // Current logging channel for messages.
+    double          m_StageTime[PROCESS_COUNT]; // Seconds spent in each process during the last compile run
 
     CBSPTree       *m_pBSPTree;         // Our compiled BSP Tree.
 
@@ -1,20 +1,36 @@
 #include "CLevelFile.h"
 
 #include "CompilerTypes.h"
-#include "..\\Support Source\\Common.h"
+#include "../Support Source/Common.h"
 #include <cstdint>
 #include "CBSPTree.h"
-#include "..\\Support Source\\CPlane.h"
+#include "../Support Source/CPlane.h"
 
 CLevelFile::CLevelFile()
 {
-	
+	// The brush cache is opt in (see SetBrushCache)
+	m_mapParser.SetBrushCache(false);
 }
 
 CLevelFile::~CLevelFile()
 {
 }
 
+//-----------------------------------------------------------------------------
+// Name : LogParserMessage () (Static, Local)
+// Desc : Forwards a message written by the .MAP parser to the compiler's log.
+//-----------------------------------------------------------------------------
+static void LogParserMessage(void * pContext, bool Error, const char * Message)
+{
+	((ILogger*)pContext)->LogWrite(LOG_GENERAL, Error ? LOGF_ERROR : 0, true, _T("%s"), Message);
+}
+
+void CLevelFile::SetLogger(ILogger * pLogger)
+{
+	// Without a logger the parser writes to cout
+	m_mapParser.SetMessageHandler(pLogger ? LogParserMessage : NULL, pLogger);
+}
+
 void CLevelFile::Load(LPCTSTR FileName)
 {
 	m_vpMeshList.clear();
@@ -297,9 +313,26 @@ void CLevelFile::SaveTree(FILE * file, CBSPTree * pTree)
 		for (uint32_t j = 0; j < portalCount; j++) fwrite(&pLeaf->PortalIndices[j], sizeof(uint32_t), 1, file);
 	}
 
-	// write pvs
+	// write pvs (the flags byte used to be a single 'compressed' bool)
+	uint8_t pvsFlags = 0;
+	if (pTree->m_bPVSCompressed) pvsFlags |= PVS_FLAG_COMPRESSED;
+	if (!pTree->m_vLeafClusters.empty()) pvsFlags |= PVS_FLAG_CLUSTERED;
+	if (pTree->m_bPVSFullRuns) pvsFlags |= PVS_FLAG_FULLRUNS;
+	if (pTree->m_bTJRepaired) pvsFlags |= PVS_FLAG_TJR_REPAIRED;
+
 	fwrite(&pTree->m_lPVSDataSize, sizeof(uint32_t), 1, file);
-	fwrite(&pTree->m_bPVSCompressed, sizeof(bool), 1, file);
+	fwrite(&pvsFlags, sizeof(uint8_t), 1, file);
+
+	// write the leaf to vis cluster table
+	if (pvsFlags & PVS_FLAG_CLUSTERED) {
+		uint32_t numClusters = pTree->m_lClusterCount;
+		fwrite(&numClusters, sizeof(uint32_t), 1, file);
+		for (uint32_t i = 0; i != numLeaves; ++i) {
+			uint32_t cluster = pTree->m_vLeafClusters[i];
+			fwrite(&cluster, sizeof(uint32_t), 1, file);
+		}
+	}
+
 	fwrite(pTree->m_pPVSData, pTree->m_lPVSDataSize, 1, file);
 
 }
@@ -11,8 +11,11 @@
 //-----------------------------------------------------------------------------
 // Specific Includes
 //-----------------------------------------------------------------------------
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 #include <vector>
+#include "../Support Source/Common.h"
 #include "../Map Parser Source/ParserMapFile.h"
 
 //-----------------------------------------------------------------------------
@@ -106,6 +109,9 @@ public:
 	void            Load(LPCTSTR FileName);
 	void            Save(LPCTSTR FileName, CBSPTree * pTree);
 	void            ClearObjects();
+	void            SetBrushCache(bool Enabled) { m_mapParser.SetBrushCache(Enabled); }
+	void            SetThreadCount(ULONG ThreadCount) { m_mapParser.SetThreadCount(ThreadCount); }
+	void            SetLogger(ILogger * pLogger);
 
 	//-------------------------------------------------------------------------
 	// Public Variables for This Class.
@@ -10,9 +10,21 @@
 //-----------------------------------------------------------------------------
 #include <new>
 #include "CompilerTypes.h"
-#include "..\\Support Source\\CPlane.h"
-#include "..\\Support Source\\CBounds.h"
-#include "..\\Compiler Source\\CBSPTree.h"
+#include "../Support Source/CPlane.h"
+#include "../Support Source/CBounds.h"
+#include "../Compiler Source/CBSPTree.h"
+
+//-----------------------------------------------------------------------------
+// Static Member Definitions
+//-----------------------------------------------------------------------------
+CMemoryPool CPolygon::m_VertexPools[ POLY_VERTEX_POOLS ] =
+{
+    { _T("Vertex Arrays 4"),   4 * sizeof(CVertex) },
+    { _T("Vertex Arrays 8"),   8 * sizeof(CVertex) },
+    { _T("Vertex Arrays 16"), 16 * sizeof(CVertex) },
+    { _T("Vertex Arrays 32"), 32 * sizeof(CVertex) },
+    { _T("Vertex Arrays 64"), 64 * sizeof(CVertex) }
+};
 
 //-----------------------------------------------------------------------------
 // Desc : CMesh member functions
@@ -136,8 +148,10 @@ void CMesh::ReleaseFaces()
 //-----------------------------------------------------------------------------
 // Name : BuildFromBSPTree ()
 // Desc : Rebuild this mesh based on the BSP Tree information passed
+// Note : Pass false for CalcBounds when appending many trees in turn, and
+//        calculate the bounding box once at the end instead.
 //-----------------------------------------------------------------------------
-bool CMesh::BuildFromBSPTree( const CBSPTree * pTree, bool Reset /* = false */ )
+bool CMesh::BuildFromBSPTree( const CBSPTree * pTree, bool Reset /* = false */, bool CalcBounds /* = true */ )
 {
     ULONG Counter = 0, i;
 
@@ -190,7 +204,7 @@ bool CMesh::BuildFromBSPTree( const CBSPTree * pTree, bool Reset /* = false */ )
     } // Next BSP Face
 
     // Calculate out bounding box
-    CalculateBoundingBox();
+    if ( CalcBounds ) CalculateBoundingBox();
 
     // Success
     return true;
@@ -229,6 +243,7 @@ CPolygon::CPolygon()
 	// Initialise anything we need
 	Vertices			= NULL;
     VertexCount			= 0;
+    VertexCapacity      = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -249,47 +264,112 @@ CPolygon::~CPolygon()
 //-----------------------------------------------------------------------------
 long CPolygon::AddVertices( unsigned long nVertexCount )
 {
-    CVertex *VertexBuffer = NULL;
-
     // Validate Requirements
 	if ( nVertexCount == 0 ) return -1;
-	
+
+    // Make sure there is room for them
+    if ( !ReserveVertices( nVertexCount ) ) return -1;
+
+    // Initialize the new vertices
+    for ( unsigned long i = VertexCount; i < VertexCount + nVertexCount; i++ ) new ( &Vertices[i] ) CVertex;
+
+	// Increment vertex count
+	VertexCount += nVertexCount;
+
+	// Return the base vertex
+	return VertexCount - nVertexCount;
+
+}
+
+//-----------------------------------------------------------------------------
+// Name : ReserveVertices()
+// Desc : Ensures that the vertex array has room for the specified number of
+//        vertices beyond those it already holds, without adding them.
+// Note : Arrays are allocated from the vertex pools in fixed sizes, so a
+//        polygon may often grow by a vertex or two without reallocating.
+//-----------------------------------------------------------------------------
+bool CPolygon::ReserveVertices( unsigned long nVertexCount )
+{
+    CVertex      *VertexBuffer = NULL;
+    unsigned long Capacity     = VertexCount + nVertexCount;
+
+    // Is there already room?
+    if ( Capacity <= VertexCapacity ) return true;
+
 	// Allocate brand new buffer
     try 
     {
-        VertexBuffer = new CVertex[ VertexCount + nVertexCount ];
-        if (!VertexBuffer) throw std::bad_alloc(); // VC++ Compat
-
-        // If any old data
-	    if (Vertices) 
-        {    
-            // Copy over old data
-		    memcpy( VertexBuffer, Vertices, VertexCount * sizeof(CVertex));
-		    
-            // Release the memory allocated for the original vertex array
-            delete []Vertices;
-		    
-	    } // End if old vertices created
-    
+        VertexBuffer = AllocVertexArray( Capacity );
+
     } // End try block
 
     // Was an exception thrown?
-    catch (...)
-    {
-        if (VertexBuffer) delete []VertexBuffer;
-        return -1;
+    catch (...) { return false; }
 
-    } // End catch block
+    // If any old data
+    if (Vertices) 
+    {    
+        // Copy over old data
+		memcpy( VertexBuffer, Vertices, VertexCount * sizeof(CVertex));
+		    
+        // Release the memory allocated for the original vertex array
+        FreeVertexArray( Vertices, VertexCapacity );
+		    
+	} // End if old vertices created
 
 	// Store new buffer
-	Vertices    = VertexBuffer;
+	Vertices       = VertexBuffer;
+    VertexCapacity = Capacity;
 
-	// Increment vertex count
-	VertexCount += nVertexCount;
+    // Success
+    return true;
+}
 
-	// Return the base vertex
-	return VertexCount - nVertexCount;
+//-----------------------------------------------------------------------------
+// Name : AllocVertexArray() (Private, Static)
+// Desc : Allocates a vertex array able to hold at least the number of vertices
+//        specified, returning the number it can actually hold.
+// Note : The vertices are not initialized.
+//-----------------------------------------------------------------------------
+CVertex * CPolygon::AllocVertexArray( unsigned long & nCapacity )
+{
+    unsigned long i, Size;
+
+    // Take it from the smallest pool it fits
+    for ( i = 0, Size = 4; i < POLY_VERTEX_POOLS; i++, Size <<= 1 )
+    {
+        if ( nCapacity > Size ) continue;
+        nCapacity = Size;
+        return (CVertex*)m_VertexPools[i].Alloc();
+
+    } // Next Pool
+
+    // Too large for the pools
+    return (CVertex*)::operator new( nCapacity * sizeof(CVertex) );
+}
 
+//-----------------------------------------------------------------------------
+// Name : FreeVertexArray() (Private, Static)
+// Desc : Releases a vertex array allocated by AllocVertexArray.
+//-----------------------------------------------------------------------------
+void CPolygon::FreeVertexArray( CVertex * pVertices, unsigned long nCapacity )
+{
+    unsigned long i, Size;
+
+    // Validate Parameters (a capacity of 0 means we do not own the vertices)
+    if ( !pVertices || nCapacity == 0 ) return;
+
+    // Return it to the pool it came from
+    for ( i = 0, Size = 4; i < POLY_VERTEX_POOLS; i++, Size <<= 1 )
+    {
+        if ( nCapacity != Size ) continue;
+        m_VertexPools[i].Free( pVertices );
+        return;
+
+    } // Next Pool
+
+    // Allocated from the heap
+    ::operator delete( pVertices );
 }
 
 //-----------------------------------------------------------------------------
@@ -383,8 +463,10 @@ bool CPolygon::GenerateFromPlane( const CPlane3& Plane, const CBounds3& Bounds )
 void CPolygon::ReleaseVertices()
 {
     // Clean up after ourselves
-    if ( Vertices ) { delete []Vertices; Vertices = NULL; }
-    VertexCount = 0;
+    FreeVertexArray( Vertices, VertexCapacity );
+    Vertices       = NULL;
+    VertexCount    = 0;
+    VertexCapacity = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -401,41 +483,21 @@ HRESULT CPolygon::Split(const CPlane3& Plane, CPolygon * FrontSplit, CPolygon *
 	unsigned long   CurrentVertex = 0, i = 0;
     unsigned long   InFront = 0, Behind = 0, OnPlane = 0;
     unsigned long   FrontCounter = 0, BackCounter = 0;
-    CLASSIFYTYPE   *PointLocation = NULL, Location;
+    CLASSIFYTYPE    LocationBuffer[ POLY_POOLED_VERTS ];
+    CLASSIFYTYPE   *PointLocation = LocationBuffer, Location;
     CVertex         NewVert;
     float           fDelta;
 
     // Bail if no fragments passed (No-Op).
     if (!FrontSplit && !BackSplit) return BC_OK;
 
-    try 
+    // Only unusually large polygons need a heap buffer for their classifications
+    if ( VertexCount > POLY_POOLED_VERTS )
     {
-        // Allocate temp buffers for split operation
-        PointLocation = new CLASSIFYTYPE[VertexCount];
-        if (!PointLocation) throw std::bad_alloc(); // VC++ Compat
-        
-        if (FrontSplit) 
-        {
-            FrontList = new CVertex[VertexCount + 1];
-            if (!FrontList) throw std::bad_alloc(); // VC++ Compat
-        } // End If
-
-        if ( BackSplit )
-        {
-            BackList = new CVertex[VertexCount + 1];
-            if (!FrontList) throw std::bad_alloc(); // VC++ Compat
-        } // End If
-
-    } // End Try
+        PointLocation = new (std::nothrow) CLASSIFYTYPE[VertexCount];
+        if (!PointLocation) return BCERR_OUTOFMEMORY;
 
-    catch (...) 
-    {
-        // Catch any bad allocation exceptions
-        if (FrontList)      delete []FrontList;
-        if (BackList)       delete []BackList;
-        if (PointLocation)  delete []PointLocation;
-        return BCERR_OUTOFMEMORY;
-    } // End Catch
+    } // End if large polygon
 
     // Determine each points location relative to the plane.
 	for ( i = 0; i < VertexCount; i++)	
@@ -453,64 +515,46 @@ HRESULT CPolygon::Split(const CPlane3& Plane, CPolygon * FrontSplit, CPolygon *
 
 	} // Next Vertex
 
-    // If there are no vertices in front of the plane
-	if (!InFront) 
+    // Return early if no split occured and we were asked to
+    if ( bReturnNoSplit && (!InFront || !Behind) )
+    {
+        if ( PointLocation != LocationBuffer ) delete []PointLocation;
+        return ( !InFront ) ? true : BC_OK;
+
+    } // End if no split
+
+    // The fragments are built directly in their own vertex arrays, which
+    // can never need more than one more vertex than we have.
+    if ( FrontSplit )
     {
-        if ( bReturnNoSplit ) { delete []PointLocation; return true; }
-        if ( BackList )
+        if ( !FrontSplit->ReserveVertices( VertexCount + 1 ) ) goto SplitError;
+        FrontList = FrontSplit->Vertices + FrontSplit->VertexCount;
+
+    } // End If
+
+    if ( BackSplit )
+    {
+        if ( !BackSplit->ReserveVertices( VertexCount + 1 ) ) goto SplitError;
+        BackList = BackSplit->Vertices + BackSplit->VertexCount;
+
+    } // End If
+
+    // If there are no vertices in front of the plane
+	if (!InFront && BackList) 
     {
 		memcpy(BackList, Vertices, VertexCount * sizeof(CVertex));
 		BackCounter = VertexCount;
-        } // End if
 
     } // End if none in front
 
     // If there are no vertices behind the plane
-	if (!Behind) 
-    {
-        if ( bReturnNoSplit ) { delete []PointLocation; return BC_OK; }
-        if ( FrontList )
+	if (!Behind && FrontList) 
     {
 		memcpy(FrontList, Vertices, VertexCount * sizeof(CVertex));
 		FrontCounter = VertexCount;
-        } // End if
 
     } // End if none behind
 
-    // All were onplane
-    if ( !InFront && !Behind && bReturnNoSplit ) { delete []PointLocation; return BC_OK; }
-
-    // We can allocate the memory here if we want to return when no split occured
-    if ( bReturnNoSplit )
-    {
-        try 
-        {
-            // Allocate these only if we need them
-            if (FrontSplit) 
-            {
-                FrontList = new CVertex[VertexCount + 1];
-                if (!FrontList) throw std::bad_alloc(); // VC++ Compat
-            } // End If
-
-            if ( BackSplit )
-            {
-                BackList = new CVertex[VertexCount + 1];
-                if (!BackList) throw std::bad_alloc(); // VC++ Compat
-            } // End If
-
-        } // End Try
-
-        catch (...) 
-        {
-            // Catch any bad allocation exceptions
-            if (FrontList)      delete []FrontList;
-            if (BackList)       delete []BackList;
-            if (PointLocation)  delete []PointLocation;
-            return BCERR_OUTOFMEMORY;
-        } // End Catch
-
-    } // End if we're returning if no split occured
-
     // Compute the split if there are verts both in front and behind
 	if (InFront && Behind) 
     {
@@ -562,31 +606,20 @@ HRESULT CPolygon::Split(const CPlane3& Plane, CPolygon * FrontSplit, CPolygon *
 
     } // End if spanning
 
-    // Allocate front face
-    if (FrontCounter && FrontSplit) 
-    {
-        // Copy over the vertices into the new poly
-        FrontSplit->AddVertices( FrontCounter );
-        memcpy(FrontSplit->Vertices, FrontList, FrontCounter * sizeof(CVertex));
-
-    } // End If
-
-    // Allocate back face
-    if (BackCounter && BackSplit) 
-    {
-        // Copy over the vertices into the new poly
-        BackSplit->AddVertices( BackCounter );
-        memcpy(BackSplit->Vertices, BackList, BackCounter * sizeof(CVertex));
-
-    } // End If
+    // Store the final vertex counts
+    if ( FrontSplit ) FrontSplit->VertexCount += FrontCounter;
+    if ( BackSplit  ) BackSplit->VertexCount  += BackCounter;
 
     // Clean up
-    if (FrontList)      delete []FrontList;
-    if (BackList)       delete []BackList;
-    if (PointLocation)  delete []PointLocation;
+    if ( PointLocation != LocationBuffer ) delete []PointLocation;
 
     // Success!!
     return BC_OK;
+
+SplitError:
+    // Catch any bad allocations
+    if ( PointLocation != LocationBuffer ) delete []PointLocation;
+    return BCERR_OUTOFMEMORY;
 }
 
 //-----------------------------------------------------------------------------
@@ -6,10 +6,11 @@
 //-----------------------------------------------------------------------------
 // CBSPTree Specific Includes
 //-----------------------------------------------------------------------------
-#include "..\\Support Source\\Common.h"
-#include "..\\Support Source\\CVector.h"
-#include "..\\Support Source\\CMatrix.h"
-#include "..\\Support Source\\CBounds.h"
+#include "../Support Source/Common.h"
+#include "../Support Source/CVector.h"
+#include "../Support Source/CMatrix.h"
+#include "../Support Source/CBounds.h"
+#include "MemoryPool.h"
 
 //-----------------------------------------------------------------------------
 // Forward Declarations
@@ -26,6 +27,12 @@ class CBSPTree;
 #define BSP_TYPE_NONSPLIT   0
 #define BSP_TYPE_SPLIT      1
 
+#define BSP_HEURISTIC_BALANCE   0       // Balance the front / back face counts, penalizing splits
+#define BSP_HEURISTIC_COST      1       // Minimize the expected traversal and leaf test cost (SAH style)
+
+#define POLY_VERTEX_POOLS   5       // Vertex array pools, holding 4, 8, 16, 32 and 64 vertices
+#define POLY_POOLED_VERTS   64      // Largest vertex array taken from the pools, anything larger uses the heap
+
 #define FRONT_OWNER         0
 #define BACK_OWNER          1
 #define NO_OWNER            2
@@ -35,29 +42,51 @@ class CBSPTree;
 //-----------------------------------------------------------------------------
 typedef struct _HSROPTIONS {            // Hidden Surface Removal Options
     bool            Enabled;            // Process Enabled ?
+    unsigned long   ThreadCount;        // Mesh clipping worker threads (0 = one per hardware thread)
 } HSROPTIONS;
 
+typedef struct _MAPOPTIONS {            // Map Loading Options
+    bool            BrushCache;         // Read / write the parsed brushes from a cache file next to the map ?
+    unsigned long   ThreadCount;        // Brush polygon and CSG worker threads (0 = one per hardware thread)
+} MAPOPTIONS;
+
 typedef struct _BSPOPTIONS {            // BSP Compilation Options
     bool            Enabled;            // Process Enabled ?
     unsigned long   TreeType;           // What type of tree to compile ?
     float           SplitHeuristic;     // Split vs Balance Importance
     unsigned long   SplitterSample;     // Number of splitters to sample
+    unsigned long   Heuristic;          // Splitter selection heuristic (BSP_HEURISTIC_*)
+    float           TraversalCost;      // Cost heuristic, cost of stepping through a node relative to testing a face
+    bool            CompareHeuristics;  // Also build the tree using the other heuristic, and log both trees' statistics
     bool            RemoveBackLeaves;   // Remove illegal back leaves
     bool            AddBoundingPolys;   // Add inverted scene-bounding polgons
+    unsigned long   ThreadCount;        // Subtree build threads (0 = one per hardware thread, 1 = serial)
+    unsigned long   ForkThreshold;      // Minimum faces in a subtree before it may be built on another thread
+    unsigned long   ScoreThreshold;     // Minimum vertex tests at a node before splitter scoring is threaded (0 = never)
 } BSPOPTIONS;
 
 typedef struct _PRTOPTIONS {            // Portal Compilation Options
     bool            Enabled;            // Process Enabled ?
+    unsigned long   ThreadCount;        // Portal clipping worker threads (0 = one per hardware thread)
+    bool            MergeCoplanar;      // Merge adjacent coplanar portals between the same pair of leaves
+    float           MergeTolerance;     // Distance within which merged portal vertices / edges are considered equal
 } PRTOPTIONS;
 
 typedef struct _PVSOPTIONS {            // PVS Compilation Options
     bool            Enabled;            // Process Enabled ?
     bool            FullCompile;        // Perform Full PVS Compile
     unsigned char   ClipTestCount;      // Number of portal clip tests to perform
+    unsigned long   ThreadCount;        // Full compile worker threads (0 = one per hardware thread)
+    unsigned long   MaxFlowDepth;       // Draft vis, max portal hops before flow stops (0 = unlimited)
+    float           MaxFlowDistance;    // Draft vis, max distance from the source portal (0 = unlimited)
+    bool            ClusterLeaves;      // Group adjacent leaves into vis clusters before export
+    float           ClusterSize;        // Maximum extents of a vis cluster along any axis
 } PVSOPTIONS;
 
 typedef struct _TJROPTIONS {            // T-Junction Repair Options
     bool            Enabled;            // Process Enabled ?
+    bool            SpatialGrid;        // Find neighbouring polygons with a uniform grid rather than testing every pair ?
+    bool            Validate;           // Check the repaired tree faces against those the engine's load time repair would produce ?
 } TJROPTIONS;
 
 typedef struct _LIGTHMAPOPTIONS {
@@ -67,6 +96,7 @@ typedef struct _LIGTHMAPOPTIONS {
 	unsigned int lm_width, lm_height;
 	unsigned int sampleCount;
 	float sampleDistanceFactor;
+	char OutputFolder[MAX_PATH];	// Folder the light and cluster maps are written to
 } LIGHTMAPOPTIONS;
 
 //-----------------------------------------------------------------------------
@@ -127,11 +157,13 @@ public:
 	//-------------------------------------------------------------------------
 	CVertex		   *Vertices;				// Polygon vertices
 	unsigned long   VertexCount;			// Vertices in this poly
+    unsigned long   VertexCapacity;         // Vertices allocated in the array (0 if not owned)
 
 	//-------------------------------------------------------------------------
 	// Public Functions for This Class
 	//-------------------------------------------------------------------------
 	long            AddVertices( unsigned long nVertexCount = 1 );
+    bool            ReserveVertices( unsigned long nVertexCount );
     long            InsertVertex( unsigned long nVertexPos );
     void            ReleaseVertices();
 
@@ -141,6 +173,18 @@ public:
     virtual HRESULT Split( const CPlane3& Plane, CPolygon * FrontSplit, CPolygon * BackSplit, bool bReturnNoSplit = false );
     virtual bool    GenerateFromPlane( const CPlane3& Plane, const CBounds3& Bounds );
 
+private:
+    //-------------------------------------------------------------------------
+	// Private Static Functions for This Class
+	//-------------------------------------------------------------------------
+    static CVertex *AllocVertexArray( unsigned long & nCapacity );
+    static void     FreeVertexArray ( CVertex * pVertices, unsigned long nCapacity );
+
+    //-------------------------------------------------------------------------
+	// Private Static Variables for This Class
+	//-------------------------------------------------------------------------
+    static CMemoryPool m_VertexPools[ POLY_VERTEX_POOLS ];  // Vertex arrays of each pooled size
+
 };
 
 //-----------------------------------------------------------------------------
@@ -204,7 +248,7 @@ public:
 	//-------------------------------------------------------------------------
 	long            AddFaces( unsigned long nFaceCount = 1 );
     void            ReleaseFaces();
-    bool            BuildFromBSPTree( const CBSPTree * pTree, bool Reset = false );
+    bool            BuildFromBSPTree( const CBSPTree * pTree, bool Reset = false, bool CalcBounds = true );
     const CBounds3& CalculateBoundingBox();
 
 };
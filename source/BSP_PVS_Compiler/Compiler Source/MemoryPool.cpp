@@ -0,0 +1,351 @@
+//-----------------------------------------------------------------------------
+// File: MemoryPool.cpp
+//
+// Desc: Fixed size slab allocator used for the many small, short lived
+//       objects created by the compiler (BSP faces, portals and their vertex
+//       arrays).
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// CMemoryPool Specific Includes
+//-----------------------------------------------------------------------------
+#include "MemoryPool.h"
+#include <new>
+
+//-----------------------------------------------------------------------------
+// Name : _MEMPOOLTHREAD (Struct)
+// Desc : Holds the calling thread's cache for every pool. When the thread
+//        exits any items it still holds are handed back to their pools.
+//-----------------------------------------------------------------------------
+struct _MEMPOOLTHREAD
+{
+    MEMPOOLCACHE Caches[ MEMPOOL_MAX_POOLS ];
+
+    _MEMPOOLTHREAD( )  { ZeroMemory( Caches, sizeof(Caches) ); }
+    ~_MEMPOOLTHREAD( )
+    {
+        for ( ULONG i = 0; i < CMemoryPool::m_PoolCount; i++ )
+        {
+            if ( CMemoryPool::m_pPools[i] ) CMemoryPool::m_pPools[i]->Flush( Caches[i] );
+
+        } // Next Pool
+    }
+};
+
+//-----------------------------------------------------------------------------
+// Static Member Definitions
+//-----------------------------------------------------------------------------
+CMemoryPool *CMemoryPool::m_pPools[ MEMPOOL_MAX_POOLS ] = { NULL };
+ULONG        CMemoryPool::m_PoolCount = 0;
+std::atomic<bool> CMemoryPool::m_TrimEnabled( true );
+std::atomic<bool> CMemoryPool::m_StatsEnabled( true );
+
+static thread_local _MEMPOOLTHREAD t_PoolThread;
+
+//-----------------------------------------------------------------------------
+// Name : CMemoryPool () (Constructor)
+// Desc : CMemoryPool Class Constructor
+// Note : Pools are expected to be created during static initialization, no
+//        more than MEMPOOL_MAX_POOLS may exist.
+//-----------------------------------------------------------------------------
+CMemoryPool::CMemoryPool( LPCTSTR strName, size_t ItemSize )
+{
+    // Items must be able to hold the free list link
+    if ( ItemSize < sizeof(void*) ) ItemSize = sizeof(void*);
+
+    // Reset / Clear all required values
+    m_strName       = strName;
+    m_ItemSize      = (ItemSize + (MEMPOOL_ALIGNMENT - 1)) & ~(size_t)(MEMPOOL_ALIGNMENT - 1);
+    m_pFree         = NULL;
+    m_Generation    = 1;
+    m_Live          = 0;
+    m_PeakLive      = 0;
+    m_Allocations   = 0;
+
+    // Register the pool
+    m_Index = m_PoolCount++;
+    m_pPools[ m_Index ] = this;
+}
+
+//-----------------------------------------------------------------------------
+// Name : ~CMemoryPool () (Destructor)
+// Desc : CMemoryPool Class Destructor
+// Note : If any items are still allocated the slabs are deliberately leaked.
+//-----------------------------------------------------------------------------
+CMemoryPool::~CMemoryPool( )
+{
+    Trim();
+    m_pPools[ m_Index ] = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Name : Alloc ()
+// Desc : Allocates a single item from the pool.
+// Note : Throws std::bad_alloc on failure, as operator new would.
+//-----------------------------------------------------------------------------
+void * CMemoryPool::Alloc( )
+{
+    MEMPOOLCACHE & Cache = t_PoolThread.Caches[ m_Index ];
+    void         * pItem;
+    long           Live, Peak;
+
+    // Reuse an item released by this thread if we can
+    if ( Cache.pFree && Cache.Generation == m_Generation.load( std::memory_order_relaxed ) )
+    {
+        pItem       = Cache.pFree;
+        Cache.pFree = *(void**)pItem;
+
+    } // End if cached
+    else
+    {
+        pItem = AllocSlow( Cache );
+
+    } // End if not cached
+
+    // Track usage
+    m_Allocations.fetch_add( 1, std::memory_order_relaxed );
+    Live = m_Live.fetch_add( 1, std::memory_order_relaxed ) + 1;
+    Peak = m_PeakLive.load( std::memory_order_relaxed );
+    while ( Live > Peak && !m_PeakLive.compare_exchange_weak( Peak, Live, std::memory_order_relaxed ) );
+
+    // Success
+    return pItem;
+}
+
+//-----------------------------------------------------------------------------
+// Name : Free ()
+// Desc : Releases an item previously allocated from this pool.
+// Note : The item may be released by any thread, not only the one which
+//        allocated it.
+//-----------------------------------------------------------------------------
+void CMemoryPool::Free( void * pItem )
+{
+    MEMPOOLCACHE & Cache = t_PoolThread.Caches[ m_Index ];
+    ULONG          Generation = m_Generation.load( std::memory_order_relaxed );
+
+    // Validate Parameters
+    if ( !pItem ) return;
+
+    // Discard anything cached from slabs which have since been released
+    if ( Cache.Generation != Generation )
+    {
+        ZeroMemory( &Cache, sizeof(MEMPOOLCACHE) );
+        Cache.Generation = Generation;
+
+    } // End if out of date
+
+    // Push it on to this thread's free list
+    *(void**)pItem = Cache.pFree;
+    Cache.pFree    = pItem;
+    m_Live.fetch_sub( 1, std::memory_order_relaxed );
+}
+
+//-----------------------------------------------------------------------------
+// Name : AllocSlow () (Private)
+// Desc : Called when the thread's free list is empty. Items are carved from
+//        the thread's current slab, then taken from those handed back by
+//        threads which have exited, and only then is a new slab allocated.
+//-----------------------------------------------------------------------------
+void * CMemoryPool::AllocSlow( MEMPOOLCACHE & Cache )
+{
+    ULONG   Generation = m_Generation.load( std::memory_order_relaxed );
+    UCHAR * pSlab      = NULL;
+    void  * pItem;
+
+    // Discard anything cached from slabs which have since been released
+    if ( Cache.Generation != Generation )
+    {
+        ZeroMemory( &Cache, sizeof(MEMPOOLCACHE) );
+        Cache.Generation = Generation;
+
+    } // End if out of date
+
+    // Carve from the current slab
+    if ( Cache.pNext && Cache.pNext + m_ItemSize <= Cache.pEnd )
+    {
+        pItem        = Cache.pNext;
+        Cache.pNext += m_ItemSize;
+        return pItem;
+
+    } // End if room in slab
+
+    std::lock_guard<std::mutex> Lock( m_Lock );
+
+    // Take over everything handed back by exited threads
+    if ( m_pFree )
+    {
+        pItem       = m_pFree;
+        Cache.pFree = *(void**)pItem;
+        m_pFree     = NULL;
+        return pItem;
+
+    } // End if shared items
+
+    // Allocate a brand new slab
+    try
+    {
+        pSlab = (UCHAR*)::operator new( MEMPOOL_SLAB_SIZE );
+        m_vpSlabs.push_back( pSlab );
+
+    } // End Try Block
+
+    catch ( std::bad_alloc )
+    {
+        if ( pSlab ) ::operator delete( pSlab );
+        throw;
+
+    } // End Catch Block
+
+    // The first item is returned, the rest are carved as required
+    Cache.pNext = pSlab + m_ItemSize;
+    Cache.pEnd  = pSlab + (MEMPOOL_SLAB_SIZE / m_ItemSize) * m_ItemSize;
+    return pSlab;
+}
+
+//-----------------------------------------------------------------------------
+// Name : Flush () (Private)
+// Desc : Hands every item held by the cache back to the pool, so that it can
+//        be used by other threads.
+//-----------------------------------------------------------------------------
+void CMemoryPool::Flush( MEMPOOLCACHE & Cache )
+{
+    void * pTail;
+
+    // Anything cached from slabs which have since been released is discarded
+    if ( Cache.Generation == m_Generation.load( std::memory_order_relaxed ) )
+    {
+        // Anything not yet carved from the slab joins the free list
+        for ( ; Cache.pNext && Cache.pNext + m_ItemSize <= Cache.pEnd; Cache.pNext += m_ItemSize )
+        {
+            *(void**)Cache.pNext = Cache.pFree;
+            Cache.pFree          = Cache.pNext;
+
+        } // Next Item
+
+        // Splice this thread's list on to the shared list
+        if ( Cache.pFree )
+        {
+            for ( pTail = Cache.pFree; *(void**)pTail; pTail = *(void**)pTail );
+
+            std::lock_guard<std::mutex> Lock( m_Lock );
+            *(void**)pTail = m_pFree;
+            m_pFree        = Cache.pFree;
+
+        } // End if any items
+
+    } // End if current
+
+    ZeroMemory( &Cache, sizeof(MEMPOOLCACHE) );
+}
+
+//-----------------------------------------------------------------------------
+// Name : Trim () (Private)
+// Desc : Releases every slab back to the heap, providing nothing allocated
+//        from the pool is still in use.
+// Note : Must not be called while other threads are using the pool.
+//-----------------------------------------------------------------------------
+bool CMemoryPool::Trim( )
+{
+    std::lock_guard<std::mutex> Lock( m_Lock );
+
+    // Is anything still allocated?
+    if ( m_Live.load() != 0 ) return false;
+
+    // Release the slabs in one go
+    for ( ULONG i = 0; i < m_vpSlabs.size(); i++ ) ::operator delete( m_vpSlabs[i] );
+    m_vpSlabs.clear();
+    m_vpSlabs.shrink_to_fit();
+    m_pFree = NULL;
+
+    // Invalidate anything still held in any thread's cache
+    m_Generation++;
+    m_PeakLive = 0;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name : GetStats ()
+// Desc : Retrieves the usage statistics for this pool.
+//-----------------------------------------------------------------------------
+void CMemoryPool::GetStats( MEMPOOLSTATS & Stats ) const
+{
+    std::lock_guard<std::mutex> Lock( m_Lock );
+
+    Stats.Name        = m_strName;
+    Stats.ItemSize    = (ULONG)m_ItemSize;
+    Stats.Allocations = m_Allocations.load();
+    Stats.Live        = (ULONG)max( 0L, m_Live.load() );
+    Stats.PeakLive    = (ULONG)max( 0L, m_PeakLive.load() );
+    Stats.SlabBytes   = (ULONG)(m_vpSlabs.size() * MEMPOOL_SLAB_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+// Name : ResetStats ()
+// Desc : Resets the allocation count and peak, so that the next statistics
+//        retrieved cover only what happens from here on.
+//-----------------------------------------------------------------------------
+void CMemoryPool::ResetStats( )
+{
+    m_Allocations = 0;
+    m_PeakLive    = m_Live.load();
+}
+
+//-----------------------------------------------------------------------------
+// Name : LogStatistics () (Static)
+// Desc : Writes the statistics for every pool used since the last call to the
+//        log channel specified, then resets them ready for the next stage.
+// Note : The statistics are shared by every compiler. When several compilers
+//        run at once they would mix the stages of different maps, so they are
+//        disabled through SetStatsEnabled(), and the call does nothing.
+//-----------------------------------------------------------------------------
+void CMemoryPool::LogStatistics( ILogger * pLogger, ULONG Channel )
+{
+    MEMPOOLSTATS Stats;
+    ULONG        i, Allocations = 0, PeakBytes = 0, SlabBytes = 0;
+
+    if ( !m_StatsEnabled ) return;
+
+    for ( i = 0; i < m_PoolCount; i++ )
+    {
+        if ( !m_pPools[i] ) continue;
+        m_pPools[i]->GetStats( Stats );
+        m_pPools[i]->ResetStats();
+
+        Allocations += Stats.Allocations;
+        PeakBytes   += Stats.PeakLive * Stats.ItemSize;
+        SlabBytes   += Stats.SlabBytes;
+        if ( !pLogger || Stats.Allocations == 0 ) continue;
+
+        pLogger->LogWrite( Channel, 0, true, _T("  %-16s %9i allocations, peak %8i live (%i KB)"), Stats.Name,
+                           Stats.Allocations, Stats.PeakLive, (Stats.PeakLive * Stats.ItemSize) / 1024 );
+
+    } // Next Pool
+
+    // Log the totals
+    if ( pLogger )
+    {
+        pLogger->LogWrite( Channel, 0, true, _T("Memory pools: %i allocations, peak %i KB in use, %i KB reserved"),
+                           Allocations, PeakBytes / 1024, SlabBytes / 1024 );
+
+    } // End if logger
+}
+
+//-----------------------------------------------------------------------------
+// Name : TrimAll () (Static)
+// Desc : Returns the slabs of every pool no longer in use back to the heap.
+// Note : Must not be called while other threads are using the pools. When
+//        several compilers run at once trimming is disabled through
+//        SetTrimEnabled(), and the call does nothing.
+//-----------------------------------------------------------------------------
+void CMemoryPool::TrimAll( )
+{
+    if ( !m_TrimEnabled ) return;
+
+    for ( ULONG i = 0; i < m_PoolCount; i++ )
+    {
+        if ( m_pPools[i] ) m_pPools[i]->Trim();
+
+    } // Next Pool
+}
@@ -0,0 +1,124 @@
+//-----------------------------------------------------------------------------
+// File: MemoryPool.h
+//
+// Desc: Fixed size slab allocator used for the many small, short lived
+//       objects created by the compiler (BSP faces, portals and their vertex
+//       arrays). Items are carved from large slabs and recycled through a free
+//       list held by each thread, so no allocation or release ever reaches the
+//       heap once the pool has grown to its working size.
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+#ifndef _MEMORYPOOL_H_
+#define _MEMORYPOOL_H_
+
+//-----------------------------------------------------------------------------
+// CMemoryPool Specific Includes
+//-----------------------------------------------------------------------------
+#include "../Support Source/Common.h"
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Miscellaneous Definitions
+//-----------------------------------------------------------------------------
+#define MEMPOOL_MAX_POOLS       16              // Maximum number of pools which may exist
+#define MEMPOOL_SLAB_SIZE       (256 * 1024)    // Size of each slab allocated by a pool in bytes
+#define MEMPOOL_ALIGNMENT       16              // All items are aligned to (and sized in multiples of) this many bytes
+
+//-----------------------------------------------------------------------------
+// Typedefs, structures & enumerators
+//-----------------------------------------------------------------------------
+typedef struct _MEMPOOLSTATS            // Usage statistics for a single pool
+{
+    LPCTSTR         Name;               // Name used for logging
+    ULONG           ItemSize;           // Size of each item in bytes
+    ULONG           Allocations;        // Items allocated since the statistics were last reset
+    ULONG           Live;               // Items currently allocated
+    ULONG           PeakLive;           // Most items allocated at once since the statistics were last reset
+    ULONG           SlabBytes;          // Bytes currently held by the pool's slabs
+
+} MEMPOOLSTATS;
+
+typedef struct _MEMPOOLCACHE            // A single thread's cached items for one pool
+{
+    void           *pFree;              // Items released by this thread, ready for reuse
+    UCHAR          *pNext;              // Next unused item in the slab this thread is carving
+    UCHAR          *pEnd;               // End of the slab this thread is carving
+    ULONG           Generation;         // Pool generation the cached items belong to
+
+} MEMPOOLCACHE;
+
+//-----------------------------------------------------------------------------
+// Main Class Definitions
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// Name : CMemoryPool (Class)
+// Desc : Allocates items of a single fixed size from large slabs. Each thread
+//        keeps its own free list, items released by a thread are simply
+//        pushed on to it and are reused by that thread's next allocation.
+// Note : Slabs are only returned to the heap in bulk by TrimAll, and only
+//        once every item allocated from the pool has been released.
+//-----------------------------------------------------------------------------
+class CMemoryPool
+{
+public:
+    //-------------------------------------------------------------------------
+	// Constructors & Destructors for This Class
+	//-------------------------------------------------------------------------
+             CMemoryPool( LPCTSTR strName, size_t ItemSize );
+            ~CMemoryPool( );
+
+    //-------------------------------------------------------------------------
+	// Public Functions for This Class
+	//-------------------------------------------------------------------------
+    void           *Alloc           ( );
+    void            Free            ( void * pItem );
+    size_t          GetItemSize     ( ) const { return m_ItemSize; }
+    void            GetStats        ( MEMPOOLSTATS & Stats ) const;
+    void            ResetStats      ( );
+
+    //-------------------------------------------------------------------------
+	// Public Static Functions for This Class
+	//-------------------------------------------------------------------------
+    static void     LogStatistics   ( ILogger * pLogger, ULONG Channel );
+    static void     TrimAll         ( );
+    static void     SetTrimEnabled  ( bool Enabled ) { m_TrimEnabled = Enabled; }
+    static void     SetStatsEnabled ( bool Enabled ) { m_StatsEnabled = Enabled; }
+
+private:
+    //-------------------------------------------------------------------------
+	// Private Functions for This Class
+	//-------------------------------------------------------------------------
+    void           *AllocSlow       ( MEMPOOLCACHE & Cache );
+    void            Flush           ( MEMPOOLCACHE & Cache );
+    bool            Trim            ( );
+
+    //-------------------------------------------------------------------------
+	// Private Variables for This Class
+	//-------------------------------------------------------------------------
+    ULONG               m_Index;        // This pool's index into the thread cache array
+    LPCTSTR             m_strName;      // Name used for logging
+    size_t              m_ItemSize;     // Size of each item (aligned)
+    mutable std::mutex  m_Lock;         // Guards the slab list and shared free list
+    std::vector<UCHAR*> m_vpSlabs;      // Every slab allocated by this pool
+    void               *m_pFree;        // Items handed back by threads which have exited
+    std::atomic<ULONG>  m_Generation;   // Incremented each time the slabs are released
+    std::atomic<long>   m_Live;         // Items currently allocated
+    std::atomic<long>   m_PeakLive;     // Peak items allocated since the last reset
+    std::atomic<ULONG>  m_Allocations;  // Items allocated since the last reset
+
+    //-------------------------------------------------------------------------
+	// Private Static Variables for This Class
+	//-------------------------------------------------------------------------
+    static CMemoryPool         *m_pPools[ MEMPOOL_MAX_POOLS ];
+    static ULONG                m_PoolCount;
+    static std::atomic<bool>    m_TrimEnabled;  // Cleared while several compilers share the pools
+    static std::atomic<bool>    m_StatsEnabled; // Cleared while several compilers share the pools
+
+    friend struct _MEMPOOLTHREAD;
+};
+
+#endif // _MEMORYPOOL_H_
@@ -13,6 +13,8 @@
 #include "ProcessHSR.h"
 #include "CCompiler.h"
 #include "CBSPTree.h"
+#include <thread>
+#include <algorithm>
 
 //-----------------------------------------------------------------------------
 // Name : CProcessHSR () (Constructor)
@@ -86,30 +88,30 @@ bool CProcessHSR::AddMesh( CMesh * pMesh )
 //-----------------------------------------------------------------------------
 // Name : Process ()
 // Desc : Begins the processing operation which will remove all hidden surfaces
+// Note : Each mesh ends up clipped against every mesh it intersects, in
+//        ascending mesh order, and clipping only ever reads the nodes of the
+//        clipping tree. The meshes are therefore shared out between a number
+//        of threads for each stage, with a bounding volume hierarchy over the
+//        mesh bounds used to find the candidate meshes for the intersection
+//        tests. The result is identical to that of a serial pass.
 //-----------------------------------------------------------------------------
 HRESULT CProcessHSR::Process()
 {
-    HRESULT     hRet;
-    BSPOPTIONS  Options;
-    int         i, a, b;
-    CBSPTree ** BSPTrees  = NULL;
-    long        MeshCount = m_vpMeshList.size();
-    CBounds3    BoundsA, BoundsB;
-
-    // Build the option set which will be used for all Mini-BSP Trees
-    ZeroMemory( &Options, sizeof(BSPOPTIONS));
-    Options.TreeType          = BSP_TYPE_NONSPLIT;
-    Options.Enabled           = true;
-    Options.RemoveBackLeaves  = true;
-    Options.SplitHeuristic    = 3.0f;
-    Options.SplitterSample    = 60;
-    
+    ULONG       i, j, ThreadCount;
+    ULONG       MeshCount = m_vpMeshList.size();
+
+    // Determine how many threads we are going to process with
+    ThreadCount = m_OptionSet.ThreadCount;
+    if ( ThreadCount == 0 ) ThreadCount = std::thread::hardware_concurrency();
+    if ( ThreadCount > MeshCount ) ThreadCount = MeshCount;
+    if ( ThreadCount == 0 ) ThreadCount = 1;
+
     // *************************
     // * Write Log Information *
     // *************************
     if ( m_pLogger )
     {
-        m_pLogger->LogWrite( LOG_HSR, 0, true, _T("Building mesh solid area information \t\t- " ) );
+        m_pLogger->LogWrite( LOG_HSR, 0, true, _T("Building mesh solid area information (%i threads) \t- " ), ThreadCount );
         m_pLogger->SetRewindMarker( LOG_HSR );
         m_pLogger->LogWrite( LOG_HSR, 0, false, _T("0%%" ) );
         m_pLogger->SetProgressRange( MeshCount );
@@ -121,41 +123,64 @@ HRESULT CProcessHSR::Process()
 
     try
     {
-        // Allocate memory for an array pf BSP Trees
-        BSPTrees = new CBSPTree*[ MeshCount ];
-        if (!BSPTrees) throw BCERR_OUTOFMEMORY;
-
-        // Set all pointers to NULL
-        ZeroMemory( BSPTrees, MeshCount * sizeof(CBSPTree*));
-
         // Allocate our result mesh
         m_pResultMesh = new CMesh;
         if (!m_pResultMesh) throw BCERR_OUTOFMEMORY;
 
+        // Set all tree pointers to NULL
+        m_vpTrees.assign( MeshCount, NULL );
+        m_Partners.clear();
+        m_Partners.resize( MeshCount );
+
         // Build a BSP Tree for each mesh.
-        for ( i = 0; i < MeshCount; i++ )
+        RunStage( HSR_STAGE_COMPILE, ThreadCount );
+
+        // *************************
+        // * Write Log Information *
+        // *************************
+        if ( m_pLogger )
         {
-            // Allocate a new tree
-            BSPTrees[i] = new CBSPTree;
-            if (!BSPTrees[i]) throw BCERR_OUTOFMEMORY;
-            BSPTrees[i]->SetOptions( Options );
+            m_pLogger->ProgressSuccess( LOG_HSR );
 
-            // Add the faces from this mesh ready for compile
-            hRet = BSPTrees[i]->AddFaces( m_vpMeshList[i]->Faces, m_vpMeshList[i]->FaceCount );
-            if (FAILED(hRet)) throw hRet;
+            m_pLogger->LogWrite( LOG_HSR, 0, true, _T("Finding intersecting meshes \t\t\t- " ) );
+            m_pLogger->SetRewindMarker( LOG_HSR );
+            m_pLogger->LogWrite( LOG_HSR, 0, false, _T("0%%" ) );
+            m_pLogger->SetProgressRange( MeshCount );
+            m_pLogger->SetProgressValue( 0 );
+        } 
+        // *************************
+        // *    End of Logging     *
+        // *************************
 
-            // Compile the BSP Tree
-            hRet = BSPTrees[i]->CompileTree();
-            if (FAILED(hRet)) throw hRet;
+        // Build the hierarchy over every tree which has something to clip
+        m_BVHNodes.clear();
+        m_BVHMeshes.clear();
+        for ( i = 0; i < MeshCount; i++ )
+        {
+            if ( m_vpTrees[i] && m_vpTrees[i]->GetFaceCount() > 0 ) m_BVHMeshes.push_back( i );
+        
+        } // Next Mesh
+        m_BVHNodes.reserve( m_BVHMeshes.size() * 2 );
+        if ( !m_BVHMeshes.empty() ) BuildBVH( 0, m_BVHMeshes.size() );
 
-            // Update Progress
-            if ( !m_pParent->TestCompilerState() ) break;
-            if ( m_pLogger ) m_pLogger->UpdateProgress( );
+        // Find every pair of intersecting meshes, each stored against the lower mesh
+        RunStage( HSR_STAGE_INTERSECT, ThreadCount );
 
+        // A mesh is clipped against lower meshes first, then higher, each in
+        // ascending order (this is the order the original union pass used).
+        std::vector<vectorULONG> Higher;
+        Higher.swap( m_Partners );
+        m_Partners.resize( MeshCount );
+        for ( i = 0; i < MeshCount; i++ )
+        {
+            for ( j = 0; j < Higher[i].size(); j++ ) m_Partners[ Higher[i][j] ].push_back( i );
+        
+        } // Next Mesh
+        for ( i = 0; i < MeshCount; i++ )
+        {
+            m_Partners[i].insert( m_Partners[i].end(), Higher[i].begin(), Higher[i].end() );
+        
         } // Next Mesh
-
-        // If we're cancelled, throw cancel error (success code) (auto-clean up)
-        if ( m_pParent->GetCompileStatus() == CS_CANCELLED ) throw BC_CANCELLED;
 
         // *************************
         // * Write Log Information *
@@ -175,64 +200,33 @@ HRESULT CProcessHSR::Process()
         // *************************
 
         // Now do the actual Union (HSR) clipping operations
-        for ( a = 0; a < MeshCount; a++ )
-        {
-            // Update progress
-            if ( !m_pParent->TestCompilerState() ) break;
-            if ( m_pLogger ) m_pLogger->UpdateProgress( );
+        RunStage( HSR_STAGE_CLIP, ThreadCount );
 
-            // Skip any NULL bsp objects
-	        if (!BSPTrees[a] || BSPTrees[a]->GetFaceCount() == 0) continue;	 
-
-            // Clip against all other meshes
-            for ( b = 0; b < MeshCount; b++ )
-            {
-                // Skip any NULL bsp objects (i.e. has already been clipped)
-	            if (!BSPTrees[b] || BSPTrees[b]->GetFaceCount() == 0) continue;	 
-		     
-                // Don't Boolean Op the mesh with itself
-                if (a == b) continue;
-            
-                // Skip if the two don't intersect (Bounds test requires a small tolerance)
-                BoundsA = BSPTrees[a]->GetBounds(); BoundsB = BSPTrees[b]->GetBounds();
-                if ( !BoundsA.IntersectedByBounds( BoundsB, CVector3( 0.1f, 0.1f, 0.1f ) ) ) continue;
-                if ( !BSPTrees[a]->IntersectedByTree( BSPTrees[b] ) ) continue;
-			    
-                // TODO : Needs to handle failed return values
-                // Clip tree a to tree b and vice versa
-                BSPTrees[a]->ClipTree( BSPTrees[b], true, false );
-                BSPTrees[b]->ClipTree( BSPTrees[a], true, true  );
-					
-                // Repair Unrequired Splits
-	 			BSPTrees[a]->RepairSplits();
-				BSPTrees[b]->RepairSplits();
-
-            } // Next Mesh b
-
-            // Append all of the faces from our fully clipped tree [a] to our result brush. 
-	        m_pResultMesh->BuildFromBSPTree( BSPTrees[a], false );
-	        
-            // Tree a has now been clipped by all other meshes
-            delete BSPTrees[a]; 
-            BSPTrees[a] = NULL;
-
-        } // Next Mesh a
-
-        // If we're cancelled, throw cancel error (success code) (auto-clean up)
-        if ( m_pParent->GetCompileStatus() == CS_CANCELLED ) throw BC_CANCELLED;
+        // Append all of the faces from our fully clipped trees to our result mesh in order
+        for ( i = 0; i < MeshCount; i++ )
+        {
+            if ( !m_vpTrees[i] || m_vpTrees[i]->GetFaceCount() == 0 ) continue;
+            m_pResultMesh->BuildFromBSPTree( m_vpTrees[i], false, false );
+        
+        } // Next Mesh
+        m_pResultMesh->CalculateBoundingBox();
 
     } // End Try Block
 
-    catch ( HRESULT &e )
+    catch ( std::bad_alloc )
     {
-        if ( BSPTrees )
-        {
-            for ( i = 0; i < MeshCount; i++ ) if ( BSPTrees[i] ) delete BSPTrees[i];
-            delete []BSPTrees;
+        // Failed to allocate
+        ReleaseTrees();
+        if ( m_pResultMesh ) { delete m_pResultMesh; m_pResultMesh = NULL; }
+        if ( m_pLogger ) m_pLogger->ProgressFailure( LOG_HSR );
+        return BCERR_OUTOFMEMORY;
 
-        } // End if we allocated
+    } // End Catch Block
 
-        // Release the result mesh
+    catch ( HRESULT &e )
+    {
+        // Release the trees and the result mesh
+        ReleaseTrees();
         if ( m_pResultMesh ) { delete m_pResultMesh; m_pResultMesh = NULL; }
      
         // Failure??
@@ -243,12 +237,7 @@ HRESULT CProcessHSR::Process()
     } // End Catch Block
 
     // Release the BSP Trees
-    if ( BSPTrees )
-    {
-        for ( i = 0; i < MeshCount; i++ ) if ( BSPTrees[i] ) delete BSPTrees[i];
-        delete []BSPTrees;
-    
-    } // End if we allocated
+    ReleaseTrees();
 
     // Success!
     if ( m_pLogger ) m_pLogger->ProgressSuccess( LOG_HSR );
@@ -256,6 +245,314 @@ HRESULT CProcessHSR::Process()
  
 }
 
+//-----------------------------------------------------------------------------
+// Name : RunStage () (Private)
+// Desc : Runs the specified processing stage over every mesh, either on the
+//        calling thread or shared out between the number of threads given.
+// Note : Throws on cancellation or failure, as with the rest of Process().
+//-----------------------------------------------------------------------------
+void CProcessHSR::RunStage( ULONG Stage, ULONG ThreadCount )
+{
+    ULONG i, MeshCount = m_vpMeshList.size(), MeshesReported = 0;
+
+    if ( ThreadCount == 1 )
+    {
+        for ( i = 0; i < MeshCount; i++ )
+        {
+            // Update progress
+            if ( m_pParent && !m_pParent->TestCompilerState() ) throw BC_CANCELLED;
+            if ( m_pLogger ) m_pLogger->UpdateProgress( );
+
+            // Process this mesh
+            ProcessMesh( Stage, i );
+
+        } // Next Mesh
+
+        return;
+
+    } // End if single threaded
+
+    std::vector<std::thread> Threads;
+
+    // Reset the shared thread state
+    m_NextMesh     = 0;
+    m_MeshesDone   = 0;
+    m_bAbort       = false;
+    m_ThreadResult = BC_OK;
+
+    // Spawn the worker threads, each will claim meshes until there are none left.
+    try
+    {
+        for ( i = 0; i < ThreadCount; i++ ) Threads.push_back( std::thread( &CProcessHSR::StageThread, this, Stage ) );
+    
+    } // End try block
+    catch ( ... )
+    {
+        // Could not spawn all threads, work with what we have
+        if ( Threads.empty() ) throw std::bad_alloc();
+    
+    } // End catch block
+
+    // The calling thread simply monitors progress and compiler state
+    while ( m_MeshesDone < MeshCount && !m_bAbort )
+    {
+        Sleep( 50 );
+
+        // Update Progress
+        if ( m_pParent && !m_pParent->TestCompilerState()) m_bAbort = true;
+        ULONG MeshesDone = m_MeshesDone;
+        if ( m_pLogger && MeshesDone > MeshesReported ) m_pLogger->UpdateProgress( MeshesDone - MeshesReported );
+        MeshesReported = MeshesDone;
+
+    } // Next Update
+
+    // Wait for all threads to complete
+    for ( i = 0; i < Threads.size(); i++ ) Threads[i].join();
+
+    // Did anything go wrong ?
+    if ( m_pParent && m_pParent->GetCompileStatus() == CS_CANCELLED ) throw BC_CANCELLED;
+    if ( m_ThreadResult == BCERR_OUTOFMEMORY ) throw std::bad_alloc();
+    if ( FAILED( m_ThreadResult ) ) throw (HRESULT)m_ThreadResult;
+}
+
+//-----------------------------------------------------------------------------
+// Name : StageThread () (Private)
+// Desc : Worker thread used during a multi-threaded stage. Meshes are claimed
+//        one at a time until there are none left.
+//-----------------------------------------------------------------------------
+void CProcessHSR::StageThread( ULONG Stage )
+{
+    HRESULT Expected = BC_OK;
+    ULONG   Mesh, MeshCount = m_vpMeshList.size();
+
+    try
+    {
+        while ( !m_bAbort )
+        {
+            // Hold here while the compiler is paused
+            while ( m_pParent && m_pParent->GetCompileStatus() == CS_PAUSED && !m_bAbort ) Sleep( 100 );
+            if ( m_pParent && m_pParent->GetCompileStatus() == CS_CANCELLED ) break;
+
+            // Claim the next mesh
+            Mesh = m_NextMesh++;
+            if ( Mesh >= MeshCount ) break;
+
+            // Process it
+            ProcessMesh( Stage, Mesh );
+            m_MeshesDone++;
+
+        } // Next Mesh
+
+    } // End try block
+
+    catch ( std::bad_alloc )
+    {
+        // Record the failure and stop everyone else
+        m_ThreadResult.compare_exchange_strong( Expected, BCERR_OUTOFMEMORY );
+        m_bAbort = true;
+
+    } // End catch block
+
+    catch ( HRESULT& Error )
+    {
+        // Record the failure and stop everyone else
+        m_ThreadResult.compare_exchange_strong( Expected, Error );
+        m_bAbort = true;
+
+    } // End catch block
+
+    catch ( ... )
+    {
+        // Record the failure and stop everyone else
+        m_ThreadResult.compare_exchange_strong( Expected, BCERR_GENERIC );
+        m_bAbort = true;
+
+    } // End catch block
+}
+
+//-----------------------------------------------------------------------------
+// Name : ProcessMesh () (Private)
+// Desc : Performs the work of a single stage for the mesh specified.
+// Note : Only ever writes to the tree belonging to this mesh, so may be called
+//        from any thread.
+//-----------------------------------------------------------------------------
+void CProcessHSR::ProcessMesh( ULONG Stage, ULONG Mesh )
+{
+    HRESULT     hRet;
+    BSPOPTIONS  Options;
+    ULONG       i;
+    CBSPTree  * pTree = m_vpTrees[ Mesh ];
+    vectorULONG Overlaps;
+
+    switch ( Stage )
+    {
+        case HSR_STAGE_COMPILE:
+            // Build the option set which will be used for all Mini-BSP Trees
+            ZeroMemory( &Options, sizeof(BSPOPTIONS));
+            Options.TreeType          = BSP_TYPE_NONSPLIT;
+            Options.Enabled           = true;
+            Options.RemoveBackLeaves  = true;
+            Options.SplitHeuristic    = 3.0f;
+            Options.SplitterSample    = 60;
+            Options.ThreadCount       = 1;
+
+            // Allocate a new tree
+            pTree = new CBSPTree;
+            if (!pTree) throw BCERR_OUTOFMEMORY;
+            m_vpTrees[ Mesh ] = pTree;
+            pTree->SetOptions( Options );
+
+            // Add the faces from this mesh ready for compile
+            hRet = pTree->AddFaces( m_vpMeshList[Mesh]->Faces, m_vpMeshList[Mesh]->FaceCount );
+            if (FAILED(hRet)) throw hRet;
+
+            // Compile the BSP Tree
+            hRet = pTree->CompileTree();
+            if (FAILED(hRet)) throw hRet;
+            break;
+
+        case HSR_STAGE_INTERSECT:
+            // Skip any empty trees
+            if ( !pTree || pTree->GetFaceCount() == 0 ) break;
+
+            // Collect the higher meshes whose bounds overlap, and test them in order. Either
+            // mesh may lie wholly inside the other, so the faces of each are tested.
+            if ( !m_BVHNodes.empty() ) QueryBVH( 0, Mesh, Overlaps );
+            std::sort( Overlaps.begin(), Overlaps.end() );
+            for ( i = 0; i < Overlaps.size(); i++ )
+            {
+                CBSPTree * pOther = m_vpTrees[ Overlaps[i] ];
+                if ( pTree->IntersectedByTree( pOther ) || pOther->IntersectedByTree( pTree ) ) m_Partners[Mesh].push_back( Overlaps[i] );
+            
+            } // Next Overlap
+            break;
+
+        case HSR_STAGE_CLIP:
+            // Clip against all other meshes
+            for ( i = 0; i < m_Partners[Mesh].size(); i++ )
+            {
+                ULONG Other = m_Partners[Mesh][i];
+
+                // Nothing left to clip (ClipTree would reject the empty tree)
+                if ( pTree->GetFaceCount() == 0 ) break;
+
+                // Co-planar faces survive against lower meshes only, so just one copy remains
+                hRet = m_vpTrees[ Other ]->ClipTree( pTree, true, Other > Mesh );
+                if (FAILED(hRet)) throw hRet;
+
+                // Repair Unrequired Splits
+                pTree->RepairSplits();
+
+            } // Next Partner
+            break;
+
+    } // End Stage Switch
+}
+
+//-----------------------------------------------------------------------------
+// Name : BuildBVH () (Private, Recursive)
+// Desc : Builds the hierarchy node for the range of mesh indices specified by
+//        splitting at the median centre along the longest axis. Returns the
+//        index of the node built.
+//-----------------------------------------------------------------------------
+ULONG CProcessHSR::BuildBVH( ULONG First, ULONG Count )
+{
+    HSRBVHNODE  Node;
+    CVector3    Dimensions;
+    ULONG       i, Axis, Index = m_BVHNodes.size();
+
+    // Calculate the bounds of every mesh in this range
+    Node.Bounds = m_vpTrees[ m_BVHMeshes[First] ]->GetBounds();
+    for ( i = First + 1; i < First + Count; i++ )
+    {
+        const CBounds3 & Bounds = m_vpTrees[ m_BVHMeshes[i] ]->GetBounds();
+        Node.Bounds.Min.x = min( Node.Bounds.Min.x, Bounds.Min.x );
+        Node.Bounds.Min.y = min( Node.Bounds.Min.y, Bounds.Min.y );
+        Node.Bounds.Min.z = min( Node.Bounds.Min.z, Bounds.Min.z );
+        Node.Bounds.Max.x = max( Node.Bounds.Max.x, Bounds.Max.x );
+        Node.Bounds.Max.y = max( Node.Bounds.Max.y, Bounds.Max.y );
+        Node.Bounds.Max.z = max( Node.Bounds.Max.z, Bounds.Max.z );
+
+    } // Next Mesh
+
+    // Store as a leaf to begin with
+    Node.Children[0] = Node.Children[1] = 0;
+    Node.First       = First;
+    Node.Count       = Count;
+    m_BVHNodes.push_back( Node );
+    if ( Count <= HSR_BVH_LEAF_SIZE ) return Index;
+
+    // Select the longest axis
+    Dimensions = Node.Bounds.GetDimensions();
+    Axis = 0;
+    if ( Dimensions.y > Dimensions.x ) Axis = 1;
+    if ( Dimensions.z > ((Axis == 0) ? Dimensions.x : Dimensions.y) ) Axis = 2;
+
+    // Partition the meshes about the median centre along that axis
+    std::nth_element( m_BVHMeshes.begin() + First, m_BVHMeshes.begin() + First + Count / 2, m_BVHMeshes.begin() + First + Count,
+                      [this, Axis]( ULONG a, ULONG b )
+    {
+        CVector3 CentreA = m_vpTrees[a]->GetBounds().GetCentre(), CentreB = m_vpTrees[b]->GetBounds().GetCentre();
+        if ( Axis == 0 ) return CentreA.x < CentreB.x;
+        if ( Axis == 1 ) return CentreA.y < CentreB.y;
+        return CentreA.z < CentreB.z;
+    });
+
+    // Build the two halves (the node vector may grow, so store by index)
+    ULONG Front = BuildBVH( First, Count / 2 );
+    ULONG Back  = BuildBVH( First + Count / 2, Count - Count / 2 );
+    m_BVHNodes[Index].Children[0] = Front;
+    m_BVHNodes[Index].Children[1] = Back;
+    m_BVHNodes[Index].Count       = 0;
+    return Index;
+}
+
+//-----------------------------------------------------------------------------
+// Name : QueryBVH () (Private, Recursive)
+// Desc : Collects every mesh with a higher index than the one specified whose
+//        bounds overlap it (with the same small tolerance as before).
+//-----------------------------------------------------------------------------
+void CProcessHSR::QueryBVH( ULONG Node, ULONG Mesh, vectorULONG & Overlaps ) const
+{
+    const HSRBVHNODE & BVHNode = m_BVHNodes[Node];
+    const CBounds3   & Bounds  = m_vpTrees[Mesh]->GetBounds();
+    CVector3           Tolerance( 0.1f, 0.1f, 0.1f );
+
+    // Skip if the two don't intersect (Bounds test requires a small tolerance)
+    if ( !Bounds.IntersectedByBounds( BVHNode.Bounds, Tolerance ) ) return;
+
+    // Recurse into interior nodes
+    if ( BVHNode.Count == 0 )
+    {
+        QueryBVH( BVHNode.Children[0], Mesh, Overlaps );
+        QueryBVH( BVHNode.Children[1], Mesh, Overlaps );
+        return;
+
+    } // End if interior
+
+    // Test each mesh in the leaf
+    for ( ULONG i = BVHNode.First; i < BVHNode.First + BVHNode.Count; i++ )
+    {
+        ULONG Other = m_BVHMeshes[i];
+        if ( Other <= Mesh ) continue;
+        if ( Bounds.IntersectedByBounds( m_vpTrees[Other]->GetBounds(), Tolerance ) ) Overlaps.push_back( Other );
+
+    } // Next Mesh
+}
+
+//-----------------------------------------------------------------------------
+// Name : ReleaseTrees () (Private)
+// Desc : Releases the mini-BSP trees and the intersection data built for them.
+//-----------------------------------------------------------------------------
+void CProcessHSR::ReleaseTrees()
+{
+    for ( ULONG i = 0; i < m_vpTrees.size(); i++ ) if ( m_vpTrees[i] ) delete m_vpTrees[i];
+    m_vpTrees.clear();
+    m_BVHNodes.clear();
+    m_BVHMeshes.clear();
+    m_Partners.clear();
+}
+
 //-----------------------------------------------------------------------------
 // Name : GetResultMesh ()
 // Desc : Retrieves the resulting mesh build during the HSR process.
@@ -5,8 +5,10 @@
 // CProcessHSR Specific Includes
 //-----------------------------------------------------------------------------
 #include <vector>
+#include <atomic>
 #include "CompilerTypes.h"
-#include "..\\Support Source\\Common.h"
+#include "../Support Source/Common.h"
+#include "../Support Source/CBounds.h"
 
 //-----------------------------------------------------------------------------
 // Forward Declarations
@@ -19,12 +21,33 @@ class CCompiler;
 // Miscellaneous Definitions
 //-----------------------------------------------------------------------------
 #define HSR_ARRAY_THRESHOLD     100
+#define HSR_BVH_LEAF_SIZE       4       // Maximum number of meshes stored in a single BVH leaf
+
+// Mesh processing stages, each of which is shared out between the worker threads
+#define HSR_STAGE_COMPILE       0       // Compile the mini-BSP tree for each mesh
+#define HSR_STAGE_INTERSECT     1       // Find the higher indexed meshes which intersect each mesh
+#define HSR_STAGE_CLIP          2       // Clip each mesh against all meshes it intersects
 
 //-----------------------------------------------------------------------------
 // Typedefs utilised for shorthand versions of our STL types.
 //-----------------------------------------------------------------------------
 typedef std::vector<CMesh*>     vectorMesh;
 typedef std::vector<CBSPTree*>  vectorBSPTree;
+typedef std::vector<ULONG>      vectorULONG;
+
+//-----------------------------------------------------------------------------
+// Typedefs, structures & enumerators
+//-----------------------------------------------------------------------------
+typedef struct _HSRBVHNODE              // Single node of the mesh bounding volume hierarchy
+{
+    CBounds3        Bounds;             // Bounds of every mesh beneath this node
+    ULONG           Children[2];        // Child node indices (interior nodes only)
+    ULONG           First;              // First entry in the mesh index list (leaf nodes only)
+    ULONG           Count;              // Number of meshes in this leaf (0 for interior nodes)
+
+} HSRBVHNODE;
+
+typedef std::vector<HSRBVHNODE> vectorBVHNode;
 
 //-----------------------------------------------------------------------------
 // Main Class Definitions
@@ -57,6 +80,16 @@ public:
     void            Release();
 
 private:
+    //-------------------------------------------------------------------------
+    // Private Functions for This Class.
+    //-------------------------------------------------------------------------
+    void            RunStage        ( ULONG Stage, ULONG ThreadCount );
+    void            StageThread     ( ULONG Stage );
+    void            ProcessMesh     ( ULONG Stage, ULONG Mesh );
+    ULONG           BuildBVH        ( ULONG First, ULONG Count );
+    void            QueryBVH        ( ULONG Node, ULONG Mesh, vectorULONG & Overlaps ) const;
+    void            ReleaseTrees    ( );
+
     //-------------------------------------------------------------------------
     // Private Variables for This Class.
     //-------------------------------------------------------------------------
@@ -67,6 +100,16 @@ private:
     ILogger        *m_pLogger;          // Just our logging interface used to log progress etc.
     CCompiler      *m_pParent;          // Parent Compiler Pointer
 
+    vectorBSPTree   m_vpTrees;          // Mini-BSP tree compiled for each mesh
+    vectorBVHNode   m_BVHNodes;         // Bounding volume hierarchy built over the mesh trees
+    vectorULONG     m_BVHMeshes;        // Mesh indices referenced by the BVH leaves
+    std::vector<vectorULONG> m_Partners;// Sorted list of intersecting meshes for each mesh
+
+    std::atomic<ULONG>      m_NextMesh;     // Next mesh to be claimed by a worker thread
+    std::atomic<ULONG>      m_MeshesDone;   // Number of meshes fully processed in this stage
+    std::atomic<bool>       m_bAbort;       // Set to stop all worker threads (cancel / failure)
+    std::atomic<HRESULT>    m_ThreadResult; // First failure code reported by a worker thread
+
 };
 
 #endif // _PROCESSHSR_H_
\ No newline at end of file
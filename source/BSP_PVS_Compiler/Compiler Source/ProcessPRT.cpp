@@ -16,8 +16,10 @@
 #include "ProcessPRT.h"
 #include "CCompiler.h"
 #include "CBSPTree.h"
-#include "..\\Support Source\\CBounds.h"
-#include "..\\Support Source\\CPlane.h"
+#include "../Support Source/CBounds.h"
+#include "../Support Source/CPlane.h"
+#include <thread>
+#include <algorithm>
 
 //-----------------------------------------------------------------------------
 // Name : CProcessPRT () (Constructor)
@@ -44,16 +46,17 @@ CProcessPRT::~CProcessPRT()
 // Desc : Compiles a set of portals by essentially sending a large polygon
 //        per node through the tree clipping them down until they reach empty
 //        space. If they are valid portals, they are added to the master array.
+// Note : Each node's portal is clipped independently of every other, so the
+//        nodes are shared out between a number of threads. The fragments are
+//        held by each thread until all are done, then added in node order so
+//        the portal set is identical to that of a serial compile.
 //-----------------------------------------------------------------------------
 HRESULT CProcessPRT::Process( CBSPTree * pTree )
 {
-    HRESULT      ErrCode;
-    CBounds3     PortalBounds;
-    CBSPPortal * InitialPortal = NULL;
-    CBSPNode   * CurrentNode   = NULL;
-    CBSPNode   * RootNode      = NULL;
-    CPlane3    * NodePlane     = NULL;
-    CBSPPortal * PortalList    = NULL;
+    HRESULT         ErrCode;
+    CBSPPortal    * PortalList = NULL;
+    unsigned long   i, ThreadCount, NodesReported = 0;
+    std::vector<vectorNodePortals> Buffers;
 
     // Validate values
     if (!pTree) return BCERR_INVALIDPARAMS;
@@ -61,6 +64,12 @@ HRESULT CProcessPRT::Process( CBSPTree * pTree )
     // Store tree for compilation
     m_pTree = pTree;
 
+    // Determine how many threads we are going to compile with
+    ThreadCount = m_OptionSet.ThreadCount;
+    if ( ThreadCount == 0 ) ThreadCount = std::thread::hardware_concurrency();
+    if ( ThreadCount > pTree->GetNodeCount() ) ThreadCount = pTree->GetNodeCount();
+    if ( ThreadCount == 0 ) ThreadCount = 1;
+
     try 
     {
         // *************************
@@ -68,7 +77,7 @@ HRESULT CProcessPRT::Process( CBSPTree * pTree )
         // *************************
         if ( m_pLogger )
         {
-            m_pLogger->LogWrite( LOG_PRT, 0, true, _T("Compiling scene portal information \t\t- " ) );
+            m_pLogger->LogWrite( LOG_PRT, 0, true, _T("Compiling scene portal information (%i threads) \t- " ), ThreadCount );
             m_pLogger->SetRewindMarker( LOG_PRT );
             m_pLogger->LogWrite( LOG_PRT, 0, false, _T("0%%" ) );
             m_pLogger->SetProgressRange( pTree->GetNodeCount() );
@@ -78,64 +87,480 @@ HRESULT CProcessPRT::Process( CBSPTree * pTree )
         // *    End of Logging     *
         // *************************
 
-        // Store required values ready for use.
-        if (!(RootNode = m_pTree->GetNode(0))) throw BCERR_BSP_INVALIDTREEDATA;
+        // Validate the tree before we begin
+        if (!m_pTree->GetNode(0)) throw BCERR_BSP_INVALIDTREEDATA;
 
-        // Create a portal for each node
-	    for (unsigned long i = 0; i < pTree->GetNodeCount(); i++) 
+        if ( ThreadCount == 1 )
         {
-            // Update progress
-            if ( m_pParent && !m_pParent->TestCompilerState()) return BC_CANCELLED;
-            if ( m_pLogger ) m_pLogger->UpdateProgress( );
-
-            // Store required values ready for use.
-            if (!(CurrentNode = m_pTree->GetNode(i))) throw BCERR_BSP_INVALIDTREEDATA;
-            if (!(NodePlane   = m_pTree->GetPlane(CurrentNode->Plane))) throw BCERR_BSP_INVALIDTREEDATA;
+            // Create a portal for each node
+	        for ( i = 0; i < pTree->GetNodeCount(); i++ ) 
+            {
+                // Update progress
+                if ( m_pParent && !m_pParent->TestCompilerState()) return BC_CANCELLED;
+                if ( m_pLogger ) m_pLogger->UpdateProgress( );
 
-            // Skip any that have solid space behind them
-            if ( CurrentNode->Back == BSP_SOLID_LEAF ) continue;
-            
-            // Allocate a new initial portal for clipping
-            if (!(InitialPortal = CBSPTree::AllocBSPPortal())) throw BCERR_OUTOFMEMORY;
+                // Clip the node's portal and obtain a list of all fragments
+                PortalList = GenerateNodePortals( i );
             
-            // Use root node for portal bounding box
-            PortalBounds = RootNode->Bounds;
-            
-            // Generate the portal polygon for the current node
-            InitialPortal->GenerateFromPlane( *NodePlane, PortalBounds );
-            InitialPortal->OwnerNode = i;
+                // Add any valid fragments to the final portal list
+                if (PortalList) 
+                {
+                    if (FAILED(ErrCode = AddPortals( PortalList ))) throw ErrCode;
+                } // End If PortalList
 
-            // Clip the portal and obtain a list of all fragments
-		    PortalList = ClipPortal(0, InitialPortal );
+	        } // Next Node
 
-            // Clear the initial portal value, we no longer own this
-            InitialPortal = NULL;
+        } // End if single threaded
+        else
+        {
+            std::vector<std::thread> Threads;
+
+            // Reset the shared thread state
+            m_NextNode     = 0;
+            m_NodesDone    = 0;
+            m_bAbort       = false;
+            m_ThreadResult = BC_OK;
+
+            // Each thread collects its fragments in its own buffer. These must all
+            // exist before any thread starts, as they are referenced by address.
+            Buffers.resize( ThreadCount );
+
+            // Spawn the worker threads, each will claim nodes in order until there
+            // are none left.
+            try
+            {
+                for ( i = 0; i < ThreadCount; i++ ) Threads.push_back( std::thread( &CProcessPRT::PortalThread, this, &Buffers[i] ) );
             
-            // Add any valid fragments to the final portal list
-            if (PortalList) 
+            } // End try block
+            catch ( ... )
             {
-                if (FAILED(ErrCode = AddPortals( PortalList ))) throw ErrCode;
-            } // End If PortalList
+                // Could not spawn all threads, work with what we have
+                if ( Threads.empty() ) throw std::bad_alloc();
+            
+            } // End catch block
+
+            // The calling thread simply monitors progress and compiler state
+            while ( m_NodesDone < pTree->GetNodeCount() && !m_bAbort )
+            {
+                Sleep( 50 );
+
+                // Update Progress
+                if ( m_pParent && !m_pParent->TestCompilerState()) m_bAbort = true;
+                unsigned long NodesDone = m_NodesDone;
+                if ( m_pLogger && NodesDone > NodesReported ) m_pLogger->UpdateProgress( NodesDone - NodesReported );
+                NodesReported = NodesDone;
+
+            } // Next Update
 
-	    } // Next Node
+            // Wait for all threads to complete
+            for ( i = 0; i < Threads.size(); i++ ) Threads[i].join();
+
+            // Did anything go wrong ?
+            if ( m_pParent && m_pParent->GetCompileStatus() == CS_CANCELLED ) throw BC_CANCELLED;
+            if ( m_ThreadResult == BCERR_OUTOFMEMORY ) throw std::bad_alloc();
+            if ( FAILED( m_ThreadResult ) ) throw (HRESULT)m_ThreadResult;
+
+            // Add every thread's fragments to the final portal list
+            if (FAILED(ErrCode = MergePortals( Buffers ))) throw ErrCode;
+
+        } // End if multi-threaded
 
     } // End Try
 
+    catch ( std::bad_alloc )
+    {
+        // Failed to allocate
+        ReleaseBuffers( Buffers );
+        if ( m_pLogger ) m_pLogger->ProgressFailure( LOG_PRT );
+        return BCERR_OUTOFMEMORY;
+
+    } // End Catch
+
     catch ( HRESULT& Error ) 
     {
         // If we dropped here, something failed
-        if ( InitialPortal ) delete InitialPortal;
-        if ( m_pLogger ) m_pLogger->ProgressFailure( LOG_PRT );
+        ReleaseBuffers( Buffers );
+        if ( m_pLogger && FAILED(Error) ) m_pLogger->ProgressFailure( LOG_PRT );
         return Error;
 
     } // End Catch
 
     // Success
     if ( m_pLogger ) m_pLogger->ProgressSuccess( LOG_PRT );
+
+    // Merge adjacent coplanar portals to cut down the work of the PVS compiler
+    if ( m_OptionSet.MergeCoplanar ) return MergeCoplanarPortals();
     return BC_OK;
     
 }
 
+//-----------------------------------------------------------------------------
+// Name : GenerateNodePortals () (Private)
+// Desc : Generates the initial portal for the node specified and clips it
+//        to the tree, returning the list of fragments which survived.
+// Note : Only reads from the tree, so may be called from any thread.
+//-----------------------------------------------------------------------------
+CBSPPortal * CProcessPRT::GenerateNodePortals( unsigned long Node )
+{
+    CBounds3     PortalBounds;
+    CBSPPortal * InitialPortal = NULL;
+    CBSPNode   * CurrentNode   = NULL;
+    CBSPNode   * RootNode      = NULL;
+    CPlane3    * NodePlane     = NULL;
+
+    // Store required values ready for use.
+    if (!(RootNode    = m_pTree->GetNode(0))) throw BCERR_BSP_INVALIDTREEDATA;
+    if (!(CurrentNode = m_pTree->GetNode(Node))) throw BCERR_BSP_INVALIDTREEDATA;
+    if (!(NodePlane   = m_pTree->GetPlane(CurrentNode->Plane))) throw BCERR_BSP_INVALIDTREEDATA;
+
+    // Skip any that have solid space behind them
+    if ( CurrentNode->Back == BSP_SOLID_LEAF ) return NULL;
+    
+    // Allocate a new initial portal for clipping
+    if (!(InitialPortal = CBSPTree::AllocBSPPortal())) throw BCERR_OUTOFMEMORY;
+    
+    // Use root node for portal bounding box
+    PortalBounds = RootNode->Bounds;
+    
+    // Generate the portal polygon for the current node
+    InitialPortal->GenerateFromPlane( *NodePlane, PortalBounds );
+    InitialPortal->OwnerNode = Node;
+
+    // Clip the portal and obtain a list of all fragments (ClipPortal now owns it)
+    return ClipPortal( 0, InitialPortal );
+}
+
+//-----------------------------------------------------------------------------
+// Name : PortalThread () (Private)
+// Desc : Worker thread used during a multi-threaded compile. Nodes are claimed
+//        in ascending order and their fragments stored in the buffer passed,
+//        which therefore also ends up sorted by node.
+//-----------------------------------------------------------------------------
+void CProcessPRT::PortalThread( vectorNodePortals * pBuffer )
+{
+    HRESULT         Expected = BC_OK;
+    unsigned long   Node, NodeCount = m_pTree->GetNodeCount();
+
+    try
+    {
+        while ( !m_bAbort )
+        {
+            // Hold here while the compiler is paused
+            while ( m_pParent && m_pParent->GetCompileStatus() == CS_PAUSED && !m_bAbort ) Sleep( 100 );
+            if ( m_pParent && m_pParent->GetCompileStatus() == CS_CANCELLED ) break;
+
+            // Claim the next node
+            Node = m_NextNode++;
+            if ( Node >= NodeCount ) break;
+
+            // Reserve the entry first, so the fragments are never left unowned
+            PRTNODEPORTALS Entry = { Node, NULL };
+            pBuffer->push_back( Entry );
+            pBuffer->back().pPortals = GenerateNodePortals( Node );
+            if ( !pBuffer->back().pPortals ) pBuffer->pop_back();
+
+            // This node is complete
+            m_NodesDone++;
+
+        } // Next Node
+
+    } // End try block
+
+    catch ( std::bad_alloc )
+    {
+        // Record the failure and stop everyone else
+        m_ThreadResult.compare_exchange_strong( Expected, BCERR_OUTOFMEMORY );
+        m_bAbort = true;
+
+    } // End catch block
+
+    catch ( HRESULT& Error )
+    {
+        // Record the failure and stop everyone else
+        m_ThreadResult.compare_exchange_strong( Expected, Error );
+        m_bAbort = true;
+
+    } // End catch block
+
+    catch ( ... )
+    {
+        // Record the failure and stop everyone else
+        m_ThreadResult.compare_exchange_strong( Expected, BCERR_GENERIC );
+        m_bAbort = true;
+
+    } // End catch block
+}
+
+//-----------------------------------------------------------------------------
+// Name : MergePortals () (Private)
+// Desc : Adds the fragments collected by each thread to the final portal list
+//        in ascending node order, exactly as a serial compile would have.
+// Note : Each buffer is already sorted by node, so we simply take the lowest
+//        node at the head of any buffer each time round.
+//-----------------------------------------------------------------------------
+HRESULT CProcessPRT::MergePortals( std::vector<vectorNodePortals> & Buffers )
+{
+    HRESULT                 ErrCode;
+    long                    Best;
+    unsigned long           i;
+    std::vector<size_t>     Cursors( Buffers.size(), 0 );
+
+    for ( ;; )
+    {
+        // Find the buffer holding the lowest outstanding node
+        for ( Best = -1, i = 0; i < Buffers.size(); i++ )
+        {
+            if ( Cursors[i] >= Buffers[i].size() ) continue;
+            if ( Best < 0 || Buffers[i][Cursors[i]].Node < Buffers[Best][Cursors[Best]].Node ) Best = (long)i;
+
+        } // Next Buffer
+
+        // All done?
+        if ( Best < 0 ) break;
+
+        // Hand this node's fragments over to the tree
+        PRTNODEPORTALS & Entry = Buffers[Best][Cursors[Best]++];
+        CBSPPortal * PortalList = Entry.pPortals;
+        Entry.pPortals = NULL;
+        if (FAILED(ErrCode = AddPortals( PortalList ))) return ErrCode;
+
+    } // Next Node
+
+    // Success
+    return BC_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Name : ReleaseBuffers () (Private)
+// Desc : Destroys any fragments still held in the thread buffers, following
+//        a failed or cancelled compile.
+//-----------------------------------------------------------------------------
+void CProcessPRT::ReleaseBuffers( std::vector<vectorNodePortals> & Buffers )
+{
+    CBSPPortal * Iterator, * NextPortal;
+
+    for ( unsigned long i = 0; i < Buffers.size(); i++ )
+    {
+        for ( unsigned long j = 0; j < Buffers[i].size(); j++ )
+        {
+            for ( Iterator = Buffers[i][j].pPortals; Iterator; Iterator = NextPortal )
+            {
+                NextPortal = Iterator->NextPortal;
+                delete Iterator;
+
+            } // Next Fragment
+
+        } // Next Node
+
+        Buffers[i].clear();
+
+    } // Next Buffer
+}
+
+//-----------------------------------------------------------------------------
+// Name : MergeCoplanarPortals () (Private)
+// Desc : Splitting leaves many small portals lying side by side on the same
+//        plane between the same pair of leaves. Any of these which share an
+//        edge, and whose union is convex, are merged into a single portal.
+// Note : Portals are grouped and merged in index order, and always into the
+//        lowest indexed portal, so the result does not depend on thread count.
+//-----------------------------------------------------------------------------
+HRESULT CProcessPRT::MergeCoplanarPortals( )
+{
+    std::vector<PRTMERGEKEY> Keys;
+    unsigned long   i, j, k, First, Last, Merges = 0;
+    unsigned long   PortalCount = m_pTree->GetPortalCount();
+    CBSPPortal    * pPortal, * pOther;
+    CBSPNode      * pNode;
+    CPlane3       * pPlane;
+    bool            Merged;
+
+    try
+    {
+        // Build the key for each portal
+        Keys.resize( PortalCount );
+        for ( i = 0; i < PortalCount; i++ )
+        {
+            if (!(pPortal = m_pTree->GetPortal(i))) throw BCERR_BSP_INVALIDTREEDATA;
+            if (!(pNode   = m_pTree->GetNode( pPortal->OwnerNode ))) throw BCERR_BSP_INVALIDTREEDATA;
+
+            Keys[i].Plane   = pNode->Plane;
+            Keys[i].Leaf[0] = pPortal->LeafOwner[ FRONT_OWNER ];
+            Keys[i].Leaf[1] = pPortal->LeafOwner[ BACK_OWNER ];
+            Keys[i].Portal  = i;
+
+        } // Next Portal
+
+        // Sort them so that portals which may be merged are grouped together
+        std::sort( Keys.begin(), Keys.end(), []( const PRTMERGEKEY & a, const PRTMERGEKEY & b )
+        {
+            if ( a.Plane   != b.Plane   ) return a.Plane   < b.Plane;
+            if ( a.Leaf[0] != b.Leaf[0] ) return a.Leaf[0] < b.Leaf[0];
+            if ( a.Leaf[1] != b.Leaf[1] ) return a.Leaf[1] < b.Leaf[1];
+            return a.Portal < b.Portal;
+        });
+
+        // Process each group in turn
+        for ( First = 0; First < PortalCount; First = Last )
+        {
+            // Find the end of this group
+            for ( Last = First + 1; Last < PortalCount; Last++ )
+            {
+                if ( Keys[Last].Plane   != Keys[First].Plane   ) break;
+                if ( Keys[Last].Leaf[0] != Keys[First].Leaf[0] ) break;
+                if ( Keys[Last].Leaf[1] != Keys[First].Leaf[1] ) break;
+
+            } // Next Key
+
+            // Nothing to merge with?
+            if ( Last - First < 2 ) continue;
+            if (!(pPlane = m_pTree->GetPlane( Keys[First].Plane ))) throw BCERR_BSP_INVALIDTREEDATA;
+
+            // Keep going until no two portals in the group can be merged (merging
+            // two portals may allow the result to be merged with a third).
+            do
+            {
+                Merged = false;
+                for ( j = First; j < Last; j++ )
+                {
+                    if (!(pPortal = m_pTree->GetPortal( Keys[j].Portal ))) continue;
+                    for ( k = j + 1; k < Last; k++ )
+                    {
+                        if (!(pOther = m_pTree->GetPortal( Keys[k].Portal ))) continue;
+                        if ( !TryMergePortals( pPortal, pOther, pPlane->Normal ) ) continue;
+
+                        // The other portal is now part of this one
+                        m_pTree->SetPortal( Keys[k].Portal, NULL );
+                        delete pOther;
+                        Merges++;
+                        Merged = true;
+
+                    } // Next Other Portal
+
+                } // Next Portal
+
+            } while ( Merged );
+
+        } // Next Group
+
+        // Remove the merged portals from the tree
+        if ( Merges > 0 ) m_pTree->CompactPortals();
+
+    } // End Try
+
+    catch ( std::bad_alloc )
+    {
+        if ( m_pLogger ) m_pLogger->LogWrite( LOG_PRT, LOGF_ERROR, true, _T("Out of memory while merging coplanar portals.") );
+        return BCERR_OUTOFMEMORY;
+
+    } // End Catch
+
+    catch ( HRESULT& Error )
+    {
+        if ( m_pLogger ) m_pLogger->LogWrite( LOG_PRT, LOGF_ERROR, true, _T("Invalid tree data found while merging coplanar portals.") );
+        return Error;
+
+    } // End Catch
+
+    // Report the reduction
+    if ( m_pLogger && PortalCount > 0 )
+    {
+        m_pLogger->LogWrite( LOG_PRT, 0, true, _T("Merged %i coplanar portals, %i reduced to %i (%.1f%% fewer)"), Merges,
+                             PortalCount, PortalCount - Merges, (Merges * 100.0f) / PortalCount );
+
+    } // End if logger
+
+    // Success
+    return BC_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Name : TryMergePortals ()
+// Desc : Attempts to merge the second portal into the first. This succeeds
+//        only if the two share an edge (in opposite directions) and the
+//        resulting polygon remains convex.
+// Note : Vertices made redundant by the merge (lying on a straight edge) are
+//        removed. Both portals must lie on the plane with the normal passed.
+//        Throws std::bad_alloc if the merged vertices cannot be allocated.
+//-----------------------------------------------------------------------------
+bool CProcessPRT::TryMergePortals( CBSPPortal * pPortal, const CBSPPortal * pOther, const CVector3 & Normal ) const
+{
+    unsigned long   i, j, n, Count1 = pPortal->VertexCount, Count2 = pOther->VertexCount;
+    const CVertex * Verts1 = pPortal->Vertices, * Verts2 = pOther->Vertices;
+    float           Tolerance = m_OptionSet.MergeTolerance, Winding, Dist;
+    bool            Keep[2];
+    CVector3        Area( 0, 0, 0 ), Edge;
+
+    // Validate Parameters
+    if ( Count1 < 3 || Count2 < 3 ) return false;
+
+    // Find an edge of the first portal running in the opposite direction in the second
+    for ( i = 0; i < Count1; i++ )
+    {
+        const CVertex & v1 = Verts1[i], & v2 = Verts1[(i + 1) % Count1];
+        for ( j = 0; j < Count2; j++ )
+        {
+            if ( !Verts2[j].FuzzyCompare( v2, Tolerance ) ) continue;
+            if ( Verts2[(j + 1) % Count2].FuzzyCompare( v1, Tolerance ) ) break;
+
+        } // Next Vertex
+        if ( j < Count2 ) break;
+
+    } // Next Vertex
+
+    // No shared edge?
+    if ( i == Count1 ) return false;
+
+    // Determine which way round the portal is wound relative to its plane
+    for ( n = 0; n < Count1; n++ ) Area += Verts1[n].Cross( Verts1[(n + 1) % Count1] );
+    Winding = ( Area.Dot( Normal ) < 0.0f ) ? -1.0f : 1.0f;
+
+    // The shared edge runs from Verts1[i] to Verts1[i + 1], or Verts2[j + 1] to
+    // Verts2[j]. Test the corner formed at each end once the edge is removed.
+    const CVector3 * Corner[2][3] =
+    {
+        { &Verts1[(i + Count1 - 1) % Count1], &Verts1[i],                &Verts2[(j + 2) % Count2] },
+        { &Verts2[(j + Count2 - 1) % Count2], &Verts1[(i + 1) % Count1], &Verts1[(i + 2) % Count1] }
+    };
+    for ( n = 0; n < 2; n++ )
+    {
+        // Distance of the next vertex inside the edge leading to the corner
+        Edge    = Normal.Cross( *Corner[n][1] - *Corner[n][0] );
+        if ( Edge.Length() < 1e-6f ) return false;
+        Edge.Normalize();
+        Dist = ( *Corner[n][2] - *Corner[n][1] ).Dot( Edge ) * Winding;
+
+        // Concave corner, these two cannot be merged
+        if ( Dist < -Tolerance ) return false;
+
+        // A straight corner's vertex is no longer required
+        Keep[n] = ( Dist > Tolerance );
+
+    } // Next Corner
+
+    // Build the merged vertex list, the first portal's vertices starting just
+    // after the shared edge, followed by those of the second skipping the edge.
+    std::vector<CVertex> Merged;
+    Merged.reserve( Count1 + Count2 - 2 );
+    for ( n = 1; n <= Count1; n++ )
+    {
+        unsigned long v = (i + n) % Count1;
+        if ( v == (i + 1) % Count1 && !Keep[1] ) continue;
+        if ( v == i && !Keep[0] ) continue;
+        Merged.push_back( Verts1[v] );
+
+    } // Next Vertex
+    for ( n = 2; n < Count2; n++ ) Merged.push_back( Verts2[(j + n) % Count2] );
+
+    // Replace the first portal's vertices
+    pPortal->ReleaseVertices();
+    if ( pPortal->AddVertices( (unsigned long)Merged.size() ) < 0 ) throw std::bad_alloc();
+    for ( n = 0; n < Merged.size(); n++ ) pPortal->Vertices[n] = Merged[n];
+
+    // Success
+    return true;
+}
+
 //-----------------------------------------------------------------------------
 // Name : ClipPortal () (Recursive) (Private)
 // Desc : This recursive function repeatedly clips the current portal to the 
@@ -232,6 +657,7 @@ CBSPPortal * CProcessPRT::ClipPortal( unsigned long Node, CBSPPortal * pPortal )
                     {
                         // Delete the portal, but continue to the next fragment
                         delete pPortal;
+                        pPortal = NextPortal;
                         continue;
                     
                     } // End If no leaf found
@@ -17,7 +17,9 @@
 // CProcessPRT Specific Includes
 //-----------------------------------------------------------------------------
 #include "CompilerTypes.h"
-#include "..\\Support Source\\Common.h"
+#include "../Support Source/Common.h"
+#include <vector>
+#include <atomic>
 
 //-----------------------------------------------------------------------------
 // Forward Declarations
@@ -31,6 +33,26 @@ class CCompiler;
 //-----------------------------------------------------------------------------
 #define PRT_ARRAY_THRESHOLD     100
 
+//-----------------------------------------------------------------------------
+// Typedefs, structures & enumerators
+//-----------------------------------------------------------------------------
+typedef struct _PRTNODEPORTALS          // Portal fragments produced for a single node
+{
+    unsigned long   Node;               // Node the initial portal was generated from
+    CBSPPortal     *pPortals;           // Linked list of surviving fragments
+
+} PRTNODEPORTALS;
+
+typedef std::vector<PRTNODEPORTALS> vectorNodePortals;
+
+typedef struct _PRTMERGEKEY             // Sort key used to group portals for merging
+{
+    unsigned long   Plane;              // Plane the portal lies on
+    unsigned long   Leaf[2];            // Front / Back leaf owners
+    unsigned long   Portal;             // Index of the portal in the tree
+
+} PRTMERGEKEY;
+
 //-----------------------------------------------------------------------------
 // Main Class Definitions
 //-----------------------------------------------------------------------------
@@ -56,12 +78,18 @@ public:
     void            SetOptions( const PRTOPTIONS& Options ) { m_OptionSet = Options; }
     void            SetLogger ( ILogger * pLogger )         { m_pLogger = pLogger; }
     void            SetParent ( CCompiler * pParent )       { m_pParent = pParent; }
+    bool            TryMergePortals( CBSPPortal * pPortal, const CBSPPortal * pOther, const CVector3 & Normal ) const;
 
 private:
     //-------------------------------------------------------------------------
     // Private Functions for This Class.
     //-------------------------------------------------------------------------
     CBSPPortal     *ClipPortal          ( unsigned long Node, CBSPPortal * pPortal );
+    CBSPPortal     *GenerateNodePortals ( unsigned long Node );
+    void            PortalThread        ( vectorNodePortals * pBuffer );
+    HRESULT         MergePortals        ( std::vector<vectorNodePortals> & Buffers );
+    void            ReleaseBuffers      ( std::vector<vectorNodePortals> & Buffers );
+    HRESULT         MergeCoplanarPortals( );
     bool            FindLeaf            ( unsigned long Leaf, unsigned long Node );
     unsigned long   ClassifyLeaf        ( unsigned long Leaf, unsigned long Node );
     HRESULT         AddPortals          ( CBSPPortal * PortalList );
@@ -74,6 +102,11 @@ private:
     CCompiler      *m_pParent;          // Parent Compiler Pointer
     CBSPTree       *m_pTree;            // The tree used to compile the portal set.
 
+    std::atomic<unsigned long>  m_NextNode;     // Next node to be claimed by a portal thread
+    std::atomic<unsigned long>  m_NodesDone;    // Number of nodes fully processed
+    std::atomic<bool>           m_bAbort;       // Set to stop all portal threads (cancel / failure)
+    std::atomic<HRESULT>        m_ThreadResult; // First failure code reported by a portal thread
+
 };
 
 #endif // _PROCESSPRT_H_
\ No newline at end of file
@@ -16,7 +16,11 @@
 #include "ProcessPVS.h"
 #include "CCompiler.h"
 #include "CBSPTree.h"
-#include "..\\Support Source\\CPlane.h"
+#include "../Support Source/CPlane.h"
+#include "VisBits.h"
+#include <thread>
+#include <chrono>
+#include <unordered_map>
 
 //-----------------------------------------------------------------------------
 // Desc : CPVSPortal member functions
@@ -29,6 +33,7 @@ CPVSPortal::CPVSPortal()
 {
 	// Initialise any class specific items
     Status              = PS_NOTPROCESSED;
+    ProcessOrder        = -1;
     Plane               = -1;
     NeighbourLeaf       = -1;
     PossibleVisCount    = 0;
@@ -67,6 +72,7 @@ CPortalPoints::CPortalPoints()
     // Initialise any class specific items
     OwnsVertices = false;
     OwnerPortal  = NULL;
+    FrameDepth   = -1;
 }
 
 //-----------------------------------------------------------------------------
@@ -78,6 +84,7 @@ CPortalPoints::CPortalPoints( const CPolygon * pPolygon, bool Duplicate )
     // Initialise any class specific items
     OwnsVertices = false;
     OwnerPortal  = NULL;
+    FrameDepth   = -1;
     if (!pPolygon) return;
 
     // Store or duplicate verts
@@ -199,6 +206,305 @@ HRESULT CPortalPoints::Split( const CPlane3& Plane, CPortalPoints * FrontSplit,
     return BC_OK;
 }
 
+//-----------------------------------------------------------------------------
+// Name : ClipFront ()
+// Desc : Builds the fragment of these points which lies in front of the
+//        plane directly into the vertex array of the points specified. This
+//        produces the same vertices as the front split generated by Split,
+//        but requires no allocations.
+// Note : Should only be used when the points are known to span the plane, the
+//        destination must have room for at least VertexCount + 1 vertices.
+//-----------------------------------------------------------------------------
+void CPortalPoints::ClipFront( const CPlane3& Plane, CPortalPoints * FrontSplit ) const
+{
+    CLASSIFYTYPE    Location, NextLocation, FirstLocation;
+    CVertex         NewVert;
+    float           fDelta;
+    ULONG           i, NextVertex, FrontCounter = 0;
+
+    // Classify the first point, each following point is classified as we reach it
+    FirstLocation = Location = Plane.ClassifyPoint( Vertices[0] );
+    
+    // Build the front list
+    for ( i = 0; i < VertexCount; i++ )
+    {
+        // Classify the next vertex remembering to MOD with number of vertices.
+        NextVertex   = (i + 1) % VertexCount;
+        NextLocation = (NextVertex == 0) ? FirstLocation : Plane.ClassifyPoint( Vertices[NextVertex] );
+
+        // Keep anything on the plane or in front
+        if ( Location != CLASSIFY_BEHIND ) FrontSplit->Vertices[ FrontCounter++ ] = Vertices[i];
+
+        // If the next vertex is causing us to span the plane, store the intersection
+        if ( Location != CLASSIFY_ONPLANE && NextLocation != CLASSIFY_ONPLANE && NextLocation != Location )
+        {
+            Plane.GetRayIntersect( Vertices[i], Vertices[NextVertex], NewVert, &fDelta );
+            FrontSplit->Vertices[ FrontCounter++ ] = NewVert;
+
+        } // End if spanning
+
+        // Move on
+        Location = NextLocation;
+
+    } // Next Vertex
+
+    // Store the final count
+    FrontSplit->VertexCount = FrontCounter;
+}
+
+//-----------------------------------------------------------------------------
+// Desc : CPVSThreadData member functions
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// Name : CPVSThreadData () (Constructor)
+// Desc : Constructor for this class.
+//-----------------------------------------------------------------------------
+CPVSThreadData::CPVSThreadData( ULONG VisBytesPerSet )
+{
+    // Initialise any class specific items
+    CurrentOrder    = -1;
+    ScheduleTime    = 0.0;
+    ClipTime        = 0.0;
+    FrameAllocs     = 0;
+    WindingAllocs   = 0;
+    PeakDepth       = 0;
+    DraftCutoffs    = 0;
+    m_Depth         = 0;
+    m_VisBytes      = VisBytesPerSet;
+}
+
+//-----------------------------------------------------------------------------
+// Name : ~CPVSThreadData () (Destructor)
+// Desc : Destructor for this class.
+//-----------------------------------------------------------------------------
+CPVSThreadData::~CPVSThreadData()
+{
+    // Release all scratch frames
+    for ( ULONG i = 0; i < m_vpFrames.size(); i++ )
+    {
+        if ( m_vpFrames[i]->VisBits ) delete []m_vpFrames[i]->VisBits;
+        delete m_vpFrames[i];
+
+    } // Next Frame
+
+    // Clear vectors
+    m_vpFrames.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Name : PushFrame ()
+// Desc : Steps one flow depth deeper, returning the scratch frame to be
+//        used at that depth. Frames are only allocated the first time a depth
+//        is reached, and are reused from then on.
+//-----------------------------------------------------------------------------
+PVSFRAME * CPVSThreadData::PushFrame( )
+{
+    PVSFRAME * pFrame = NULL;
+
+    // Grow the frame stack if this is the deepest we have been
+    if ( m_Depth == m_vpFrames.size() )
+    {
+        try
+        {
+            pFrame = new PVSFRAME;
+            pFrame->VisBits = NULL;
+            pFrame->VisBits = new UCHAR[ m_VisBytes ];
+
+            // Link the windings to their inline vertex storage
+            for ( ULONG i = 0; i < PVS_FRAME_WINDINGS; i++ )
+            {
+                pFrame->Windings[i].Vertices     = pFrame->Vertices[i];
+                pFrame->Windings[i].OwnsVertices = false;
+                pFrame->Windings[i].FrameDepth   = (long)m_Depth;
+            
+            } // Next Winding
+
+            // Store the frame
+            pFrame->Depth = m_Depth;
+            m_vpFrames.push_back( pFrame );
+            FrameAllocs += 2;
+
+        } // End try block
+
+        catch (...)
+        {
+            if ( pFrame && pFrame->VisBits ) delete []pFrame->VisBits;
+            if ( pFrame ) delete pFrame;
+            throw std::bad_alloc();
+
+        } // End catch block
+
+    } // End if new depth
+
+    // Retrieve the frame and step in
+    pFrame = m_vpFrames[ m_Depth++ ];
+    pFrame->WindingsUsed = 0;
+    return pFrame;
+}
+
+//-----------------------------------------------------------------------------
+// Name : PopFrame ()
+// Desc : Steps back out of the current flow depth.
+//-----------------------------------------------------------------------------
+void CPVSThreadData::PopFrame( )
+{
+    if ( m_Depth > 0 ) m_Depth--;
+}
+
+//-----------------------------------------------------------------------------
+// Name : AllocPoints ()
+// Desc : Retrieve an empty set of points, able to hold the number of vertices
+//        specified, from the current scratch frame. Should the frame be full
+//        or the winding too large we fall back to the heap.
+//-----------------------------------------------------------------------------
+CPortalPoints * CPVSThreadData::AllocPoints( ULONG VertexCount )
+{
+    PVSFRAME      * pFrame = m_vpFrames[ m_Depth - 1 ];
+    CPortalPoints * pPoints;
+    ULONG           i;
+
+    // Search for a free winding
+    if ( VertexCount <= PVS_MAX_WINDING_POINTS )
+    {
+        for ( i = 0; i < PVS_FRAME_WINDINGS; i++ )
+        {
+            if ( pFrame->WindingsUsed & (1 << i) ) continue;
+
+            // Claim this winding
+            pFrame->WindingsUsed |= (1 << i);
+            pPoints = &pFrame->Windings[i];
+            pPoints->VertexCount = 0;
+            return pPoints;
+
+        } // Next Winding
+
+    } // End if fits
+
+    // Fall back to the heap
+    pPoints = new CPortalPoints;
+    if ( pPoints->AddVertices( VertexCount ) < 0 ) { delete pPoints; throw std::bad_alloc(); }
+    pPoints->OwnsVertices = true;
+    pPoints->FrameDepth   = (long)pFrame->Depth;
+    pPoints->VertexCount  = 0;
+    WindingAllocs += 2;
+
+    // Return the points
+    return pPoints;
+}
+
+//-----------------------------------------------------------------------------
+// Name : FreePoints ()
+// Desc : Releases a set of points previously retrieved from AllocPoints.
+// Note : Points belonging to portals or to other flow depths are ignored.
+//-----------------------------------------------------------------------------
+void CPVSThreadData::FreePoints( CPortalPoints * pPoints )
+{
+    PVSFRAME * pFrame = m_vpFrames[ m_Depth - 1 ];
+
+    // Validate Parameters
+    if ( !pPoints || pPoints->FrameDepth != (long)pFrame->Depth ) return;
+
+    // Release the winding, or the heap allocation
+    if ( pPoints >= pFrame->Windings && pPoints < pFrame->Windings + PVS_FRAME_WINDINGS )
+        pFrame->WindingsUsed &= ~(1 << (pPoints - pFrame->Windings));
+    else
+        delete pPoints;
+}
+
+//-----------------------------------------------------------------------------
+// Desc : CPortalQueue member functions
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// Name : Build ()
+// Desc : Builds the heap from every portal which has not yet been processed.
+//-----------------------------------------------------------------------------
+void CPortalQueue::Build( const vectorPVSPortal * pPortals )
+{
+    ULONG i;
+
+    // Store the portals and collect all unprocessed entries
+    m_pPortals = pPortals;
+    m_Heap.clear();
+    m_Heap.reserve( pPortals->size() );
+    for ( i = 0; i < pPortals->size(); i++ )
+    {
+        if ( (*pPortals)[i]->Status == PS_NOTPROCESSED ) m_Heap.push_back( i );
+    
+    } // Next Portal
+
+    // Heapify (bottom up)
+    for ( i = (ULONG)m_Heap.size() / 2; i > 0; i-- ) SiftDown( i - 1 );
+}
+
+//-----------------------------------------------------------------------------
+// Name : Pop ()
+// Desc : Removes and returns the least complex portal still waiting to be
+//        processed, or -1 if none remain.
+// Note : Portals which have been claimed by other means (i.e. their status is
+//        no longer PS_NOTPROCESSED) are simply discarded.
+//-----------------------------------------------------------------------------
+long CPortalQueue::Pop( )
+{
+    while ( !m_Heap.empty() )
+    {
+        // Remove the root
+        ULONG PortalIndex = m_Heap[0];
+        m_Heap[0] = m_Heap.back();
+        m_Heap.pop_back();
+        if ( !m_Heap.empty() ) SiftDown( 0 );
+
+        // Skip if someone else has taken this portal
+        if ( (*m_pPortals)[PortalIndex]->Status == PS_NOTPROCESSED ) return (long)PortalIndex;
+
+    } // Next Entry
+
+    // Nothing left
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Name : Less () (Private)
+// Desc : Heap ordering, returns true if Portal1 should be processed first.
+//-----------------------------------------------------------------------------
+bool CPortalQueue::Less( ULONG Portal1, ULONG Portal2 ) const
+{
+    long Count1 = (*m_pPortals)[Portal1]->PossibleVisCount;
+    long Count2 = (*m_pPortals)[Portal2]->PossibleVisCount;
+    
+    // Lowest index wins a tie (matches the original linear scan)
+    if ( Count1 != Count2 ) return Count1 < Count2;
+    return Portal1 < Portal2;
+}
+
+//-----------------------------------------------------------------------------
+// Name : SiftDown () (Private)
+// Desc : Moves the entry at the specified position down to restore heap order.
+//-----------------------------------------------------------------------------
+void CPortalQueue::SiftDown( ULONG Position )
+{
+    ULONG Count = (ULONG)m_Heap.size();
+    ULONG Entry = m_Heap[ Position ];
+
+    for ( ;; )
+    {
+        // Select the smaller child
+        ULONG Child = Position * 2 + 1;
+        if ( Child >= Count ) break;
+        if ( Child + 1 < Count && Less( m_Heap[Child + 1], m_Heap[Child] ) ) Child++;
+
+        // Are we in the correct place ?
+        if ( !Less( m_Heap[Child], Entry ) ) break;
+
+        // Move the child up
+        m_Heap[ Position ] = m_Heap[ Child ];
+        Position = Child;
+
+    } // Next Level
+
+    // Store the entry
+    m_Heap[ Position ] = Entry;
+}
+
 //-----------------------------------------------------------------------------
 // Desc : CProcessPVS member functions
 //-----------------------------------------------------------------------------
@@ -213,6 +519,16 @@ CProcessPVS::CProcessPVS()
     m_pLogger           = NULL;
     m_pTree             = NULL;
     m_pParent           = NULL;
+    m_NextOrder         = 0;
+    m_ScheduleTime      = 0.0;
+    m_ClipTime          = 0.0;
+    m_FrameAllocs       = 0;
+    m_WindingAllocs     = 0;
+    m_PeakDepth         = 0;
+    m_DraftCutoffs      = 0;
+    m_PortalsDone       = 0;
+    m_bAbortVis         = false;
+    m_ThreadResult      = BC_OK;
 }
 
 //-----------------------------------------------------------------------------
@@ -254,8 +570,12 @@ HRESULT CProcessPVS::Process( CBSPTree * pTree )
 	// vis array in BIT form (i.e 8 leafs vis per byte uncompressed)
     m_PVSBytesPerSet = (pTree->GetLeafCount() + 7) / 8;
 
-	// 32 bit align the bytes per set to allow for our early out long conversion
-	m_PVSBytesPerSet = (m_PVSBytesPerSet * 3 + 3) & 0xFFFFFFFC;
+	// 64 bit align the bytes per set as required by the vis bit kernels
+	m_PVSBytesPerSet = CVisBits::AlignSetSize( m_PVSBytesPerSet );
+
+    #if ( PVS_BENCHMARK_VISBITS )
+        CVisBits::Benchmark( m_pLogger, LOG_PVS, pTree->GetLeafCount() );
+    #endif
 
     // Retrieve all of our one way portals
 	hRet = GeneratePVSPortals();
@@ -272,6 +592,16 @@ HRESULT CProcessPVS::Process( CBSPTree * pTree )
     if ( FAILED( hRet ) ) return hRet;
     if ( m_pParent->GetCompileStatus() == CS_CANCELLED ) return BC_CANCELLED;
 
+    // Group adjacent leaves into vis clusters if requested
+    m_vLeafClusters.clear();
+    m_vClusterLeaves.clear();
+    if ( m_OptionSet.ClusterLeaves )
+    {
+        hRet = BuildLeafClusters();
+        if ( FAILED( hRet ) ) return hRet;
+
+    } // End if clustering
+
     // Export the visibility set to the final BSP Tree master array
     hRet = ExportPVS( pTree );
     if ( FAILED( hRet ) ) return hRet;
@@ -447,9 +777,11 @@ HRESULT CProcessPVS::InitialPortalVis()
             // from the source portal through into the neighbour leaf
             // and flag any leaves which are visible (the leaves which
             // remain set to 0 can never possibly be seen from this portal)
-            pPortal1->PossibleVisCount = 0;
             PortalFlood( pPortal1, PortalVis, pPortal1->NeighbourLeaf );
 
+            // The portal's 'Complexity' level is the number of leaves it may see
+            pPortal1->PossibleVisCount = CVisBits::PopCount( pPortal1->PossibleVis, m_PVSBytesPerSet );
+
         } // Next Portal
 
         // If we're cancelled, clean up and return
@@ -497,9 +829,6 @@ void CProcessPVS::PortalFlood( CPVSPortal * SourcePortal, unsigned char PortalVi
     // Set the possible visibility bit for this leaf
     SetPVSBit( SourcePortal->PossibleVis, Leaf );
 
-    // Increase portals 'Complexity' level
-    SourcePortal->PossibleVisCount++;
-
     // Loop through all portals in this leaf (remember the portal numbering
     // in the leaves match up with the originals, not our PVS portals )
     for ( ULONG i = 0; i < pLeaf->PortalIndices.size(); i++)	
@@ -519,13 +848,11 @@ void CProcessPVS::PortalFlood( CPVSPortal * SourcePortal, unsigned char PortalVi
 
 //-------------------------------------------------------------------------------------
 // Name : CalcPortalVis() 
-// Desc : Top level PVS calculation function which starts the recursion for each portal
+// Desc : Top level PVS calculation function which starts the portal flow for each portal
 //-------------------------------------------------------------------------------------
 HRESULT CProcessPVS::CalcPortalVis()
 {
-    ULONG   i;
-    HRESULT hRet;
-    PVSDATA PVSData;
+    ULONG           i, ThreadCount, PortalsReported = 0;
     
     // If we want to perform a quick vis (not at all accurate) we can
 	// simply use the possible vis bits array as our pvs bytes.
@@ -543,12 +870,31 @@ HRESULT CProcessPVS::CalcPortalVis()
 
 	} // End if !FullCompile
 
+    // Determine how many threads we are going to compile with
+    ThreadCount = m_OptionSet.ThreadCount;
+    if ( ThreadCount == 0 ) ThreadCount = std::thread::hardware_concurrency();
+    if ( ThreadCount == 0 ) ThreadCount = 1;
+    if ( ThreadCount > GetPVSPortalCount() ) ThreadCount = GetPVSPortalCount();
+
+    // Reset scheduling state and build our portal queue
+    m_PortalQueue.Build( &m_vpPVSPortals );
+    m_NextOrder     = 0;
+    m_ScheduleTime  = 0.0;
+    m_ClipTime      = 0.0;
+    m_FrameAllocs   = 0;
+    m_WindingAllocs = 0;
+    m_PeakDepth     = 0;
+    m_DraftCutoffs  = 0;
+    m_PortalsDone   = 0;
+    m_bAbortVis     = false;
+    m_ThreadResult  = BC_OK;
+
     // *************************
     // * Write Log Information *
     // *************************
     if ( m_pLogger )
     {
-        m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Full PVS compile progress \t\t\t- " ) );
+        m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Full PVS compile progress (%i threads) \t\t- " ), ThreadCount );
         m_pLogger->SetRewindMarker( LOG_PVS );
         m_pLogger->LogWrite( LOG_PVS, 0, false, _T("0%%" ) );
         m_pLogger->SetProgressRange( GetPVSPortalCount() );
@@ -560,38 +906,71 @@ HRESULT CProcessPVS::CalcPortalVis()
 
     try
     {
-        // Clear out our PVSData struct
-        ZeroMemory( &PVSData, sizeof(PVSDATA) );
+        if ( ThreadCount == 1 )
+        {
+            CPVSThreadData ThreadData( m_PVSBytesPerSet );
+
+            // Lets process those portal bad boys!! ;)
+            while ( (i = ClaimNextPortal( ThreadData )) != -1 )
+            {
+                // Update Progress
+                if (!m_pParent->TestCompilerState()) throw BC_CANCELLED;
+                if (m_pLogger) m_pLogger->UpdateProgress();
+
+                // Step in and begin processing this portal
+                ProcessPortal( i, ThreadData );
 
-        // Lets process those portal bad boys!! ;)
-        for ( i = 0; i != -1; i = GetNextPortal() )
+            } // Next Portal
+
+            // Store timings and allocation counts
+            m_ScheduleTime  = ThreadData.ScheduleTime;
+            m_ClipTime      = ThreadData.ClipTime;
+            m_FrameAllocs   = ThreadData.FrameAllocs;
+            m_WindingAllocs = ThreadData.WindingAllocs;
+            m_PeakDepth     = ThreadData.PeakDepth;
+            m_DraftCutoffs  = ThreadData.DraftCutoffs;
+
+        } // End if single threaded
+        else
         {
-            CPVSPortal * pPortal = GetPVSPortal( i );
-        
-            // Update Progress
-            if (!m_pParent->TestCompilerState()) throw BC_CANCELLED;
-            if (m_pLogger) m_pLogger->UpdateProgress();
-
-            // Fill our our initial data structure
-            PVSData.SourcePoints    = pPortal->Points;
-            PVSData.VisBits         = pPortal->PossibleVis;
-            GetPortalPlane( pPortal, PVSData.TargetPlane );
-		    
-            // Allocate the portals actual visibility array
-            pPortal->ActualVis = new UCHAR[ m_PVSBytesPerSet ];
-            if (!pPortal->ActualVis) throw std::bad_alloc(); // VC++ Compat
-
-            // Set initial visibility to off for all leaves
-            ZeroMemory( pPortal->ActualVis, m_PVSBytesPerSet );
+            std::vector<std::thread> Threads;
 
-            // Step in and begin processing this portal
-            hRet = RecursePVS( pPortal->NeighbourLeaf, pPortal, PVSData );
-            if ( FAILED( hRet ) ) throw hRet;
+            // Spawn the worker threads, each will claim portals in order of complexity
+            // until there are none left.
+            try
+            {
+                for ( i = 0; i < ThreadCount; i++ ) Threads.push_back( std::thread( &CProcessPVS::PortalVisThread, this ) );
+            
+            } // End try block
+            catch ( ... )
+            {
+                // Could not spawn all threads, work with what we have
+                if ( Threads.empty() ) { m_bAbortVis = true; throw std::bad_alloc(); }
+            
+            } // End catch block
 
-            // We've finished processing this portal
-            pPortal->Status = PS_PROCESSED;
+            // The calling thread simply monitors progress and compiler state
+            while ( m_PortalsDone < GetPVSPortalCount() && !m_bAbortVis )
+            {
+                Sleep( 50 );
 
-        } // Next Portal
+                // Update Progress
+                if (!m_pParent->TestCompilerState()) m_bAbortVis = true;
+                ULONG PortalsDone = m_PortalsDone;
+                if (m_pLogger && PortalsDone > PortalsReported) m_pLogger->UpdateProgress( PortalsDone - PortalsReported );
+                PortalsReported = PortalsDone;
+
+            } // Next Update
+
+            // Wait for all threads to complete
+            for ( i = 0; i < Threads.size(); i++ ) Threads[i].join();
+
+            // Did anything go wrong ?
+            if ( m_pParent->GetCompileStatus() == CS_CANCELLED ) throw BC_CANCELLED;
+            if ( m_ThreadResult == BCERR_OUTOFMEMORY ) throw std::bad_alloc();
+            if ( FAILED( m_ThreadResult ) ) throw (HRESULT)m_ThreadResult;
+
+        } // End if multi-threaded
 
     } // End Try Block
 
@@ -613,37 +992,171 @@ HRESULT CProcessPVS::CalcPortalVis()
     } // End if
 
     // Success!!
-    if ( m_pLogger ) m_pLogger->ProgressSuccess( LOG_PVS );
+    if ( m_pLogger ) 
+    {
+        m_pLogger->ProgressSuccess( LOG_PVS );
+        m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Portal scheduling time %.3f sec, clipping time %.3f sec (summed over all threads)"), m_ScheduleTime, m_ClipTime );
+        m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Vis bit kernels in use : %s"), CVisBits::GetKernelName() );
+        m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Heap allocations during portal flow %i (%i scratch frame, %i oversized winding)"), m_FrameAllocs + m_WindingAllocs, m_FrameAllocs, m_WindingAllocs );
+        m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Peak portal flow depth %i"), m_PeakDepth );
+        if ( m_OptionSet.MaxFlowDepth > 0 || m_OptionSet.MaxFlowDistance > 0.0f )
+            m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Draft vis enabled (max depth %i, max distance %.1f), %i flows cut off"), m_OptionSet.MaxFlowDepth, m_OptionSet.MaxFlowDistance, m_DraftCutoffs );
+    
+    } // End if logger
     return BC_OK;
 }
 
 //-------------------------------------------------------------------------------------
-// Name : GetNextPortal() 
-// Desc : Function that returns the next portal in order of complexity.
-// Note : This means that all the least complex portals are processed first so that
-//        these portal's vis info can be used in the early out system in RecursePVS
-//        to help speed things up.
+// Name : PortalVisThread() 
+// Desc : Worker thread entry point for the multi-threaded full PVS compile. Keeps
+//        claiming the next least complex portal until there are none left.
 //-------------------------------------------------------------------------------------
-ULONG CProcessPVS::GetNextPortal( )
+void CProcessPVS::PortalVisThread( )
+{
+    CPVSThreadData  ThreadData( m_PVSBytesPerSet );
+    ULONG           PortalIndex;
+
+    try
+    {
+        while ( !m_bAbortVis )
+        {
+            // Hold here while the compiler is paused
+            while ( m_pParent->GetCompileStatus() == CS_PAUSED && !m_bAbortVis ) Sleep( 100 );
+            if ( m_pParent->GetCompileStatus() == CS_CANCELLED ) break;
+
+            // Claim the next portal
+            PortalIndex = ClaimNextPortal( ThreadData );
+            if ( PortalIndex == -1 ) break;
+
+            // Step in and begin processing this portal
+            ProcessPortal( PortalIndex, ThreadData );
+
+        } // Next Portal
+
+    } // End try block
+
+    catch ( std::bad_alloc )
+    {
+        // Record the failure and stop everyone else
+        m_ThreadResult = BCERR_OUTOFMEMORY;
+        m_bAbortVis    = true;
+
+    } // End catch block
+
+    catch ( ... )
+    {
+        // Record the failure and stop everyone else
+        m_ThreadResult = BCERR_GENERIC;
+        m_bAbortVis    = true;
+
+    } // End catch block
+
+    // Add our timings to the totals
+    std::lock_guard<std::mutex> Lock( m_ScheduleLock );
+    m_ScheduleTime  += ThreadData.ScheduleTime;
+    m_ClipTime      += ThreadData.ClipTime;
+    m_FrameAllocs   += ThreadData.FrameAllocs;
+    m_WindingAllocs += ThreadData.WindingAllocs;
+    m_DraftCutoffs  += ThreadData.DraftCutoffs;
+    if ( ThreadData.PeakDepth > m_PeakDepth ) m_PeakDepth = ThreadData.PeakDepth;
+}
+
+//-------------------------------------------------------------------------------------
+// Name : ClaimNextPortal() 
+// Desc : Selects the next portal to be processed and marks it as in progress. The
+//        order in which the portal was claimed is stored in the thread data.
+// Note : The order is used during the portal flow to decide whether another portal's
+//        ActualVis may be used for the early out. Only portals claimed before the
+//        current one are used (waiting on them if need be), which is exactly what
+//        the serial compile sees, so the result does not depend on thread count.
+//-------------------------------------------------------------------------------------
+ULONG CProcessPVS::ClaimNextPortal( CPVSThreadData & ThreadData )
 {
-    CPVSPortal * pPortal;
-	long PortalIndex = -1, Min = 999999, i;
+    std::chrono::high_resolution_clock::time_point Start = std::chrono::high_resolution_clock::now();
+    ULONG PortalIndex;
 
-    // Loop through all portals
-	for ( i = 0; i < (signed)GetPVSPortalCount(); i++ ) 
     {
-        pPortal = GetPVSPortal(i);
+        std::lock_guard<std::mutex> Lock( m_ScheduleLock );
 
-		// If this portal's complexity is the lowest and it has 
-        // not already been processed then we could use it.
-		if ( pPortal->PossibleVisCount < Min && pPortal->Status == PS_NOTPROCESSED) 
+        // The serial compile has always started at portal zero, retain that ordering
+        if ( m_NextOrder == 0 )
         {
-			Min = pPortal->PossibleVisCount;
-			PortalIndex = i;
+            PortalIndex = 0;
+            GetPVSPortal( PortalIndex )->Status = PS_PROCESSING;
+        
+        } // End if first portal
+        else
+        {
+            PortalIndex = GetNextPortal();
+        
+        } // End if subsequent portal
+
+        // Record the processing order
+        if ( PortalIndex != -1 )
+        {
+            ThreadData.CurrentOrder = m_NextOrder++;
+            GetPVSPortal( PortalIndex )->ProcessOrder = ThreadData.CurrentOrder;
+        
+        } // End if claimed
+
+    } // Release Lock
 
-		} // End if Least Complex
+    // Record the time spent here
+    ThreadData.ScheduleTime += std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - Start ).count();
 
-	} // Next Portal
+    // Return the claimed portal
+    return PortalIndex;
+}
+
+//-------------------------------------------------------------------------------------
+// Name : ProcessPortal() 
+// Desc : Calculates the actual visibility of a single (previously claimed) portal.
+//-------------------------------------------------------------------------------------
+void CProcessPVS::ProcessPortal( ULONG PortalIndex, CPVSThreadData & ThreadData )
+{
+    HRESULT         hRet;
+    PVSDATA         PVSData;
+    CPVSPortal    * pPortal = GetPVSPortal( PortalIndex );
+    std::chrono::high_resolution_clock::time_point Start = std::chrono::high_resolution_clock::now();
+
+    // Clear out our PVSData struct
+    ZeroMemory( &PVSData, sizeof(PVSDATA) );
+
+    // Fill our our initial data structure
+    PVSData.SourcePoints    = pPortal->Points;
+    PVSData.VisBits         = pPortal->PossibleVis;
+    GetPortalPlane( pPortal, PVSData.TargetPlane );
+    
+    // Allocate the portals actual visibility array
+    pPortal->ActualVis = new UCHAR[ m_PVSBytesPerSet ];
+    if (!pPortal->ActualVis) throw std::bad_alloc(); // VC++ Compat
+
+    // Set initial visibility to off for all leaves
+    ZeroMemory( pPortal->ActualVis, m_PVSBytesPerSet );
+
+    // Step in and begin processing this portal
+    hRet = FlowPortalPVS( pPortal, PVSData, ThreadData );
+    if ( FAILED( hRet ) ) throw hRet;
+
+    // Record the time spent clipping
+    ThreadData.ClipTime += std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - Start ).count();
+
+    // We've finished processing this portal (this publishes ActualVis to other threads)
+    pPortal->Status = PS_PROCESSED;
+    m_PortalsDone++;
+}
+
+//-------------------------------------------------------------------------------------
+// Name : GetNextPortal() 
+// Desc : Function that returns the next portal in order of complexity.
+// Note : This means that all the least complex portals are processed first so that
+//        these portal's vis info can be used in the early out system in FlowPortalPVS
+//        to help speed things up. The portals are pulled from a min-heap built
+//        at the start of CalcPortalVis, rather than scanning the whole list.
+//-------------------------------------------------------------------------------------
+ULONG CProcessPVS::GetNextPortal( )
+{
+	long PortalIndex = m_PortalQueue.Pop();
 
 	// Set our status flag to currently being worked on =)
 	if ( PortalIndex > -1) GetPVSPortal( PortalIndex )->Status = PS_PROCESSING;
@@ -653,164 +1166,272 @@ ULONG CProcessPVS::GetNextPortal( )
 }
 
 //-------------------------------------------------------------------------------------
-// Name : RecursePVS() 
-// Desc : PVS recursion function, steps through the portals and calcs true visibility
+// Name : FlowPortalPVS()
+// Desc : Flows the source portal's visibility out through the portals of every leaf
+//        it can reach, clipping as it goes, to calculate its true visibility.
+// Note : Rather than recursing once per portal hop, the state of each level is held
+//        in the thread's work stack, so deep flows on large open maps do not eat the
+//        native stack. All working memory (vis bits and clipped windings) is taken
+//        from the thread's scratch frame for each depth.
 //-------------------------------------------------------------------------------------
-HRESULT CProcessPVS::RecursePVS( ULONG Leaf, CPVSPortal * SourcePortal, PVSDATA & PrevData )
+HRESULT CProcessPVS::FlowPortalPVS( CPVSPortal * SourcePortal, PVSDATA & InitialData, CPVSThreadData & ThreadData )
 {
-    ULONG           i,j;
-    bool            More;
-    ULONG          *Test, *Possible, *Vis;
+    ULONG           i, NextLeaf;
+    bool            StepIn;
+    UCHAR          *Test;
 
     PVSDATA         Data;
+    PVSLEVEL        NewLevel;
     CPVSPortal     *GeneratorPortal;
     CPlane3         ReverseGenPlane, SourcePlane;
-    CPortalPoints  *SourcePoints, *GeneratorPoints, *NewPoints;
-
-    // Store the leaf for easy access
-    CBSPLeaf * pLeaf = m_pTree->GetLeaf( Leaf );
-
-    // Mark this leaf as visible
-    SetPVSBit( SourcePortal->ActualVis, Leaf );
-
-    // Allocate our current visibility buffer
-    Data.VisBits = new UCHAR[ m_PVSBytesPerSet ];
-    if (!Data.VisBits) throw std::bad_alloc(); // VC++ Compat
+    CVector3        SourceCentre( 0.0f, 0.0f, 0.0f );
+    CPortalPoints  *SourcePoints, *GeneratorPoints;
+    std::vector<PVSLEVEL> & Levels = ThreadData.Levels;
 
     // Store data we will be using inside the loop
-    Possible    = (ULONG*)Data.VisBits;
-    Vis         = (ULONG*)SourcePortal->ActualVis;
     GetPortalPlane( SourcePortal, SourcePlane );
+    for ( i = 0; i < SourcePortal->Points->VertexCount; i++ ) SourceCentre += SourcePortal->Points->Vertices[i];
+    SourceCentre /= (float)SourcePortal->Points->VertexCount;
+
+    // We start by stepping into the source portal's neighbour leaf
+    Levels.clear();
+    Data        = InitialData;
+    NextLeaf    = SourcePortal->NeighbourLeaf;
+    StepIn      = true;
 
-    // Check all portals for flow into other leaves
-    for ( i = 0; i < pLeaf->PortalIndices.size(); i++ )
+    do
     {
-        // Find correct portal index (the one IN this leaf (not Neighbouring))
-        ULONG PortalIndex = pLeaf->PortalIndices[ i ] * 2;
-        if ( GetPVSPortal( PortalIndex )->NeighbourLeaf == Leaf ) PortalIndex++;
+        // Step into the next leaf if we found a portal to flow through
+        if ( StepIn )
+        {
+            // Mark this leaf as visible
+            SetPVSBit( SourcePortal->ActualVis, NextLeaf );
+
+            // Retrieve our scratch frame, this holds the new level's visibility buffer
+            NewLevel.Leaf           = NextLeaf;
+            NewLevel.NextPortal     = 0;
+            NewLevel.pFrame         = ThreadData.PushFrame();
+            NewLevel.Data           = Data;
+            NewLevel.FreeSource     = NULL;
+            NewLevel.FreeGenerator  = NULL;
+            Levels.push_back( NewLevel );
+            if ( Levels.size() > ThreadData.PeakDepth ) ThreadData.PeakDepth = (ULONG)Levels.size();
+            StepIn = false;
+
+        } // End if step in
+
+        // Store the current level for easy access
+        PVSLEVEL & Level    = Levels.back();
+        PVSDATA  & PrevData = Level.Data;
+        CBSPLeaf * pLeaf    = m_pTree->GetLeaf( Level.Leaf );
+        Data.VisBits        = Level.pFrame->VisBits;
+
+        // Release the points clipped for the level we have just stepped back out of
+        if ( Level.FreeSource )    { ThreadData.FreePoints( Level.FreeSource );    Level.FreeSource    = NULL; }
+        if ( Level.FreeGenerator ) { ThreadData.FreePoints( Level.FreeGenerator ); Level.FreeGenerator = NULL; }
+
+        // Anything flowing out of this leaf is a subset of what flowed in, so once
+        // all of that has been seen the remaining portals cannot add anything.
+        if ( Level.NextPortal < pLeaf->PortalIndices.size() &&
+             !CVisBits::AnyNewBits( PrevData.VisBits, SourcePortal->ActualVis, m_PVSBytesPerSet ) )
+        {
+            Level.NextPortal = (ULONG)pLeaf->PortalIndices.size();
 
-        // Store the portal for easy access
-        GeneratorPortal = GetPVSPortal( PortalIndex );
+        } // End if nothing new
 
-        // We can't possibly recurse through this portal if it's neighbour
-        // leaf is set to invisible in the target portals PVS
-        if ( !GetPVSBit( PrevData.VisBits, GeneratorPortal->NeighbourLeaf ) ) continue;
+        // Check the remaining portals for flow into other leaves
+        while ( Level.NextPortal < pLeaf->PortalIndices.size() )
+        {
+            // Find correct portal index (the one IN this leaf (not Neighbouring))
+            ULONG PortalIndex = pLeaf->PortalIndices[ Level.NextPortal++ ] * 2;
+            if ( GetPVSPortal( PortalIndex )->NeighbourLeaf == Level.Leaf ) PortalIndex++;
 
-        // If the portal can't see anything we haven't already seen, skip it
-        if ( GeneratorPortal->Status == PS_PROCESSED ) 
-            Test = (ULONG*)GeneratorPortal->ActualVis;
-        else
-            Test = (ULONG*)GeneratorPortal->PossibleVis;
+            // Store the portal for easy access
+            GeneratorPortal = GetPVSPortal( PortalIndex );
 
-        More = false;
-        // Check to see if we have processed as much as we need to
-        // this is an early out system. We check in 32 bit chunks to
-        // help speed the process up a little.
-        for ( j = 0; j < m_PVSBytesPerSet / sizeof(ULONG); j++ )
-        {
-            Possible[j] = ((ULONG*)PrevData.VisBits)[j] & Test[j];
-            if ( Possible[j] & ~Vis[j] ) More = true;
+            // We can't possibly flow through this portal if it's neighbour
+            // leaf is set to invisible in the target portals PVS
+            if ( !GetPVSBit( PrevData.VisBits, GeneratorPortal->NeighbourLeaf ) ) continue;
 
-        } // Next 32 bit Chunk
+            // If the portal can't see anything we haven't already seen, skip it. We
+            // may only use the actual vis of portals claimed before our own, if one
+            // of those is still being processed by another thread we wait for it.
+            if ( GeneratorPortal->ProcessOrder >= 0 && GeneratorPortal->ProcessOrder < ThreadData.CurrentOrder )
+            {
+                while ( GeneratorPortal->Status != PS_PROCESSED && !m_bAbortVis ) std::this_thread::yield();
+                Test = (GeneratorPortal->Status == PS_PROCESSED) ? GeneratorPortal->ActualVis : GeneratorPortal->PossibleVis;
+            }
+            else
+            {
+                Test = GeneratorPortal->PossibleVis;
+            }
 
-        // Can we see anything new ??
-        if ( !More ) continue;
+            // Build the vis bits which may flow through this generator and check
+            // to see if we have processed as much as we need to (early out).
+            // Can we see anything new ??
+            if ( !CVisBits::AndTestNew( Data.VisBits, PrevData.VisBits, Test, SourcePortal->ActualVis, m_PVSBytesPerSet ) ) continue;
 
-        // The current generator plane will become the next recursions target plane
-        GetPortalPlane( GeneratorPortal, Data.TargetPlane );
+            // The current generator plane will become the next level's target plane
+            GetPortalPlane( GeneratorPortal, Data.TargetPlane );
 
-        // We can't recurse out of a coplanar face, so check it
-        ReverseGenPlane.Normal   = -Data.TargetPlane.Normal;
-        ReverseGenPlane.Distance = -Data.TargetPlane.Distance;
-        if ( ReverseGenPlane.Normal.FuzzyCompare( PrevData.TargetPlane.Normal, 0.001f ) ) continue;
+            // We can't flow out of a coplanar face, so check it
+            ReverseGenPlane.Normal   = -Data.TargetPlane.Normal;
+            ReverseGenPlane.Distance = -Data.TargetPlane.Distance;
+            if ( ReverseGenPlane.Normal.FuzzyCompare( PrevData.TargetPlane.Normal, 0.001f ) ) continue;
 
-        // Clip the generator portal to the source. If none remains, continue.
-        GeneratorPoints = GeneratorPortal->Points->Clip( SourcePlane, false );
-        if ( GeneratorPoints != GeneratorPortal->Points ) FreePortalPoints( GeneratorPortal->Points );
-        if (!GeneratorPoints) continue;
+            // Clip the generator portal to the source. If none remains, continue.
+            GeneratorPoints = ClipPoints( GeneratorPortal->Points, SourcePlane, ThreadData );
+            if (!GeneratorPoints) continue;
 
-        // The second leaf can only be blocked if coplanar
-        if ( !PrevData.TargetPoints )
-        {
-            Data.SourcePoints = PrevData.SourcePoints;
-            Data.TargetPoints = GeneratorPoints;
-            RecursePVS( GeneratorPortal->NeighbourLeaf, SourcePortal, Data );
-            FreePortalPoints( GeneratorPoints );
-            continue;
+            // The second leaf can only be blocked if coplanar, so the source is passed straight through
+            SourcePoints = NULL;
+            if ( PrevData.TargetPoints )
+            {
+                // Clip the generator portal to the previous target. If none remains, continue.
+                GeneratorPoints = ClipPoints( GeneratorPoints, PrevData.TargetPlane, ThreadData );
+                if (!GeneratorPoints) continue;
+
+                // Clip the source portal (the previous depth's points are never released
+                // here, so unlike the generator these do not need to be duplicated first)
+                SourcePoints = ClipPoints( PrevData.SourcePoints, ReverseGenPlane, ThreadData );
 
-        } // End if Previous Points
+                // If none remains, continue to the next portal
+                if ( !SourcePoints ) { ThreadData.FreePoints( GeneratorPoints ); continue; }
 
-        // Clip the generator portal to the previous target. If none remains, continue.
-        NewPoints = GeneratorPoints->Clip( PrevData.TargetPlane, false );
-        if ( NewPoints != GeneratorPoints ) FreePortalPoints( GeneratorPoints );
-        GeneratorPoints = NewPoints;
-        if (!GeneratorPoints) continue;
+                // Lets go Clipping :)
+                if ( m_OptionSet.ClipTestCount > 0 )
+                {
+                    GeneratorPoints = ClipToAntiPenumbra( SourcePoints, PrevData.TargetPoints, GeneratorPoints, false, ThreadData );
+                    if (!GeneratorPoints) { ThreadData.FreePoints( SourcePoints ); continue; }
 
-        // Make a copy of the source portals points
-        SourcePoints = new CPortalPoints( PrevData.SourcePoints, true );
+                } // End if 1 Clip Test
 
-        // Clip the source portal
-        NewPoints = SourcePoints->Clip( ReverseGenPlane, false );
-        if ( NewPoints != SourcePoints ) FreePortalPoints( SourcePoints );
-        SourcePoints = NewPoints;
+                if ( m_OptionSet.ClipTestCount > 1 )
+                {
+                    GeneratorPoints = ClipToAntiPenumbra( PrevData.TargetPoints, SourcePoints, GeneratorPoints, true, ThreadData );
+                    if (!GeneratorPoints) { ThreadData.FreePoints( SourcePoints ); continue; }
 
-        // If none remains, continue to the next portal
-        if ( !SourcePoints ) { FreePortalPoints(  GeneratorPoints ); continue; }
+                } // End if 2 Clip Tests
 
-        // Lets go Clipping :)
-        if ( m_OptionSet.ClipTestCount > 0 )
-        {
-            GeneratorPoints = ClipToAntiPenumbra( SourcePoints, PrevData.TargetPoints, GeneratorPoints, false ); 
-            if (!GeneratorPoints) { FreePortalPoints( SourcePoints ); continue; }
-        
-        } // End if 1 Clip Test
+                if ( m_OptionSet.ClipTestCount > 2 )
+                {
+                    SourcePoints = ClipToAntiPenumbra( GeneratorPoints, PrevData.TargetPoints, SourcePoints, false, ThreadData );
+                    if (!SourcePoints) { ThreadData.FreePoints( GeneratorPoints ); continue; }
 
-        if ( m_OptionSet.ClipTestCount > 1 )
-        {
-            GeneratorPoints = ClipToAntiPenumbra( PrevData.TargetPoints, SourcePoints, GeneratorPoints, true ); 
-            if (!GeneratorPoints) { FreePortalPoints( SourcePoints ); continue; }
-        
-        } // End if 2 Clip Tests
+                } // End if 3 Clip Test
 
-        if ( m_OptionSet.ClipTestCount > 2 )
-        {
-            SourcePoints = ClipToAntiPenumbra( GeneratorPoints, PrevData.TargetPoints, SourcePoints, false ); 
-            if (!SourcePoints) { FreePortalPoints( GeneratorPoints ); continue; }
-        
-        } // End if 3 Clip Test
+                if ( m_OptionSet.ClipTestCount > 3 )
+                {
+                    SourcePoints = ClipToAntiPenumbra( PrevData.TargetPoints, GeneratorPoints, SourcePoints, true, ThreadData );
+                    if (!SourcePoints) { ThreadData.FreePoints( GeneratorPoints ); continue; }
 
-        if ( m_OptionSet.ClipTestCount > 3 )
-        {
-            SourcePoints = ClipToAntiPenumbra( PrevData.TargetPoints, GeneratorPoints, SourcePoints, true ); 
-            if (!SourcePoints) { FreePortalPoints( GeneratorPoints ); continue; }
-        
-        } // End if 4 Clip Test
+                } // End if 4 Clip Test
 
-        // Store data for next recursion
-        Data.SourcePoints = SourcePoints;
-        Data.TargetPoints = GeneratorPoints;
+            } // End if Previous Points
 
-        // Flow through it for real
-        RecursePVS( GeneratorPortal->NeighbourLeaf, SourcePortal, Data );
+            // In draft mode, rather than flowing any further we simply assume that
+            // everything which may still flow through this portal is visible.
+            if ( IsDraftCutoff( GeneratorPortal, SourceCentre, (ULONG)Levels.size() + 1 ) )
+            {
+                CVisBits::OrMerge( SourcePortal->ActualVis, Data.VisBits, m_PVSBytesPerSet );
+                ThreadData.FreePoints( SourcePoints );
+                ThreadData.FreePoints( GeneratorPoints );
+                ThreadData.DraftCutoffs++;
+                continue;
 
-        // Clean up
-        FreePortalPoints( SourcePoints );
-        FreePortalPoints( GeneratorPoints );
+            } // End if cut off
 
-    } // Next Portal
+            // Store data for the next level, the points are released once we return to this one
+            Data.SourcePoints   = (SourcePoints) ? SourcePoints : PrevData.SourcePoints;
+            Data.TargetPoints   = GeneratorPoints;
+            Level.FreeSource    = SourcePoints;
+            Level.FreeGenerator = GeneratorPoints;
+
+            // Flow through it for real
+            NextLeaf = GeneratorPortal->NeighbourLeaf;
+            StepIn   = true;
+            break;
+
+        } // Next Portal
+
+        // Once every portal has been tested, step back out of this level
+        if ( !StepIn )
+        {
+            ThreadData.PopFrame();
+            Levels.pop_back();
+
+        } // End if level complete
+
+    } while ( !Levels.empty() );
 
-    // Clean up
-    if (Data.VisBits) delete []Data.VisBits;
-        
     // Success
     return BC_OK;
 }
 
+//-------------------------------------------------------------------------------------
+// Name : IsDraftCutoff()
+// Desc : Determines whether the draft vis limits prevent the flow from stepping
+//        through the generator portal into the specified depth.
+//-------------------------------------------------------------------------------------
+bool CProcessPVS::IsDraftCutoff( const CPVSPortal * GeneratorPortal, const CVector3& SourceCentre, ULONG Depth ) const
+{
+    // Limit the number of portal hops
+    if ( m_OptionSet.MaxFlowDepth > 0 && Depth > m_OptionSet.MaxFlowDepth ) return true;
+
+    // Limit the distance from the source portal to the nearest generator point
+    if ( m_OptionSet.MaxFlowDistance > 0.0f )
+    {
+        const CPortalPoints * pPoints = GeneratorPortal->Points;
+        float MaxDistanceSq = m_OptionSet.MaxFlowDistance * m_OptionSet.MaxFlowDistance;
+
+        for ( ULONG i = 0; i < pPoints->VertexCount; i++ )
+        {
+            if ( (pPoints->Vertices[i] - SourceCentre).SquareLength() <= MaxDistanceSq ) return false;
+
+        } // Next Vertex
+        return true;
+
+    } // End if distance limited
+
+    return false;
+}
+
+//-------------------------------------------------------------------------------------
+// Name : ClipPoints() 
+// Desc : Clips the points passed to the front of the plane. If the points span
+//        the plane, the result is built in the thread's current scratch frame.
+//        Points which were consumed (clipped away or replaced) are released.
+// Note : May return the points passed in, this should be tested.
+//-------------------------------------------------------------------------------------
+CPortalPoints * CProcessPVS::ClipPoints( CPortalPoints * pPoints, const CPlane3& Plane, CPVSThreadData & ThreadData )
+{
+    CPortalPoints * NewPoints = NULL;
+
+    // Classify the points
+    switch ( Plane.ClassifyPoly( pPoints->Vertices, pPoints->VertexCount, sizeof(CVertex) ) )
+    {
+        case CLASSIFY_INFRONT:
+            // All were in front, simply return the original
+            return pPoints;
+
+        case CLASSIFY_SPANNING:
+            // Clip the points into a new winding
+            NewPoints = ThreadData.AllocPoints( pPoints->VertexCount + 1 );
+            pPoints->ClipFront( Plane, NewPoints );
+            break;
+
+    } // End Switch
+
+    // Release the original points and return the result
+    ThreadData.FreePoints( pPoints );
+    return NewPoints;
+}
+
 //-------------------------------------------------------------------------------------
 // Name : ClipToAntiPenumbra() 
 // Desc : Clips the portals to one another using the generated Anti-Penumbra.
 //-------------------------------------------------------------------------------------
-CPortalPoints * CProcessPVS::ClipToAntiPenumbra( CPortalPoints * Source, CPortalPoints * Target, CPortalPoints * Generator, bool ReverseClip )
+CPortalPoints * CProcessPVS::ClipToAntiPenumbra( CPortalPoints * Source, CPortalPoints * Target, CPortalPoints * Generator, bool ReverseClip, CPVSThreadData & ThreadData )
 {
     CPlane3         Plane;
     CVector3        v1, v2;
@@ -818,7 +1439,6 @@ CPortalPoints * CProcessPVS::ClipToAntiPenumbra( CPortalPoints * Source, CPortal
     ULONG           Counts[3];
     ULONG           i, j, k, l;
     bool            ReverseTest;
-    CPortalPoints  *NewPoints;
 
     // Check all combinations
     for ( i = 0; i < Source->VertexCount; i++ )
@@ -912,9 +1532,7 @@ CPortalPoints * CProcessPVS::ClipToAntiPenumbra( CPortalPoints * Source, CPortal
             if ( ReverseClip ) { Plane.Normal = -Plane.Normal; Plane.Distance = -Plane.Distance; }
 
             // Clip the target by the separating plane
-            NewPoints = Generator->Clip( Plane, false );
-            if ( NewPoints != Generator ) FreePortalPoints( Generator );
-            Generator = NewPoints;
+            Generator = ClipPoints( Generator, Plane, ThreadData );
 
             // Target is not visible ?
             if (!Generator) return NULL;
@@ -928,16 +1546,26 @@ CPortalPoints * CProcessPVS::ClipToAntiPenumbra( CPortalPoints * Source, CPortal
 }
 
 //-------------------------------------------------------------------------------------
-// Name : ExportPVS() 
+// Name : ExportPVS()
 // Desc : Exports all calculated PVS information and stores it within the specified
 //        BSP Tree object.
+// Note : If the leaves were grouped into vis clusters one set is exported for each
+//        cluster (with one bit per cluster), and every leaf in the cluster shares it.
+//        Identical rows are only stored once, with each leaf's PVSIndex referencing
+//        the shared copy.
 //-------------------------------------------------------------------------------------
 HRESULT CProcessPVS::ExportPVS( CBSPTree * pTree )
 {
     UCHAR * PVSData = NULL;
     UCHAR * LeafPVS = NULL;
-    ULONG   PVSWritePtr = 0, i, p, j;
-    
+    UCHAR * ClusterPVS = NULL;
+    UCHAR * SetPVS;
+    ULONG   PVSWritePtr = 0, RowPtr, RowSize, UniqueRows = 0, i, j, p;
+    bool    Clustered   = !m_vClusterLeaves.empty();
+    ULONG   SetCount    = (Clustered) ? (ULONG)m_vClusterLeaves.size() : pTree->GetLeafCount();
+    ULONG   SetBytes    = (Clustered) ? CVisBits::AlignSetSize( (SetCount + 7) / 8 ) : m_PVSBytesPerSet;
+    PVSROWTABLE RowTable;
+
     try
     {
         // *************************
@@ -954,79 +1582,112 @@ HRESULT CProcessPVS::ExportPVS( CBSPTree * pTree )
 
             m_pLogger->SetRewindMarker( LOG_PVS );
             m_pLogger->LogWrite( LOG_PVS, 0, false, _T("0%%" ) );
-            m_pLogger->SetProgressRange( pTree->GetLeafCount() );
+            m_pLogger->SetProgressRange( SetCount );
             m_pLogger->SetProgressValue( 0 );
-        } 
+        }
         // *************************
         // *    End of Logging     *
         // *************************
 
-        // Reserve Enough Space to hold every leafs PVS set
-        PVSData = new UCHAR[pTree->GetLeafCount() * (m_PVSBytesPerSet * 2)];
+        // Reserve Enough Space to hold every set
+        PVSData = new UCHAR[SetCount * (SetBytes * 2)];
         if (!PVSData) throw std::bad_alloc();
 
         // Set all visibility initially to off
-        ZeroMemory( PVSData, pTree->GetLeafCount() * (m_PVSBytesPerSet * 2));
+        ZeroMemory( PVSData, SetCount * (SetBytes * 2));
 
         // Allocate enough memory for a single leaf set
         LeafPVS = new UCHAR[ m_PVSBytesPerSet ];
         if (!LeafPVS) throw std::bad_alloc();
 
-        // Loop round each leaf and collect the vis info
+        // Allocate enough memory for a single cluster set
+        if ( Clustered )
+        {
+            ClusterPVS = new UCHAR[ SetBytes ];
+            if (!ClusterPVS) throw std::bad_alloc();
+
+        } // End if clustered
+
+        // Loop round each leaf (or cluster) and collect the vis info
         // this is all OR'd together and ZRLE compressed
         // Then finally stored in the master array
-        for ( i = 0; i < pTree->GetLeafCount(); i++ ) 
+        for ( i = 0; i < SetCount; i++ )
         {
-            CBSPLeaf * pLeaf = pTree->GetLeaf(i);
-            
             // Update progress
             if (!m_pParent->TestCompilerState()) break;
             if ( m_pLogger ) m_pLogger->UpdateProgress( );
 
             // Clear Temp PVS Array Buffer
             ZeroMemory( LeafPVS, m_PVSBytesPerSet );
-            pLeaf->PVSIndex = PVSWritePtr;
-        
-            // Current leaf is always visible
-            SetPVSBit( LeafPVS, i );
-            
-            // Loop through all portals in this leaf
-            for ( p = 0; p < pLeaf->PortalIndices.size(); p++ ) 
+
+            if ( Clustered )
             {
-                // Find correct portal index (the one IN this leaf)
-                ULONG PortalIndex = pLeaf->PortalIndices[ p ] * 2;
-                if ( GetPVSPortal( PortalIndex )->NeighbourLeaf == i ) PortalIndex++;
+                const std::vector<ULONG> & Leaves = m_vClusterLeaves[i];
+
+                // Everything visible from any leaf in the cluster is visible from the cluster
+                for ( p = 0; p < Leaves.size(); p++ ) MergeLeafPVS( Leaves[p], LeafPVS );
 
-                // Or the vis bits together
-                for ( j = 0; j < m_PVSBytesPerSet; j++ ) 
+                // Reduce the leaf set to one bit per cluster
+                ZeroMemory( ClusterPVS, SetBytes );
+                for ( j = 0; j < pTree->GetLeafCount(); j++ )
                 {
-	                LeafPVS[j] |= GetPVSPortal( PortalIndex )->ActualVis[j];
-                
-                } // Next PVS Byte
+                    // Skip empty bytes quickly
+                    if ( !LeafPVS[ j >> 3 ] ) { j |= 7; continue; }
+                    if ( GetPVSBit( LeafPVS, j ) ) SetPVSBit( ClusterPVS, m_vLeafClusters[j] );
 
-            } // Next Portal
+                } // Next Leaf
+
+                SetPVS = ClusterPVS;
+
+            } // End if clustered
+            else
+            {
+                MergeLeafPVS( i, LeafPVS );
+                SetPVS = LeafPVS;
+
+            } // End if leaves
 
             #if ( PVS_COMPRESSDATA )
-     
-                // Compress the leaf set here and update our master write pointer
-                PVSWritePtr += CompressLeafSet( PVSData, LeafPVS, PVSWritePtr );
+
+                // Compress the set onto the end of the master array
+                RowSize = CompressLeafSet( PVSData, SetPVS, PVSWritePtr, SetBytes );
 
             #else
 
                 // Copy the data into the Master PVS Set
-                memcpy( &PVSData[ PVSWritePtr ], LeafPVS, m_PVSBytesPerSet );
-                PVSWritePtr += m_PVSBytesPerSet;
+                memcpy( &PVSData[ PVSWritePtr ], SetPVS, SetBytes );
+                RowSize = SetBytes;
 
             #endif
 
-        } // Next Leaf
+            // If an identical row has already been written use that instead, otherwise
+            // keep the new row and update our master write pointer
+            RowPtr = FindSharedRow( RowTable, PVSData, PVSWritePtr, RowSize );
+            if ( RowPtr == PVSWritePtr ) { PVSWritePtr += RowSize; UniqueRows++; }
+
+            // Store the row index in every leaf using this set
+            if ( Clustered )
+            {
+                for ( p = 0; p < m_vClusterLeaves[i].size(); p++ ) pTree->GetLeaf( m_vClusterLeaves[i][p] )->PVSIndex = RowPtr;
+            
+            } // End if clustered
+            else
+            {
+                pTree->GetLeaf(i)->PVSIndex = RowPtr;
+
+            } // End if leaves
+
+        } // Next Set
 
         // Clean up after ourselves
         delete []LeafPVS;
         LeafPVS = NULL;
+        if ( ClusterPVS ) delete []ClusterPVS;
+        ClusterPVS = NULL;
 
         // Pass this data off to the BSP Tree (data, size, compressed)
-        if (FAILED(pTree->SetPVSData( PVSData, PVSWritePtr, PVS_COMPRESSDATA ))) throw std::bad_alloc();
+        if (FAILED(pTree->SetPVSData( PVSData, PVSWritePtr, PVS_COMPRESSDATA, PVS_COMPRESSDATA && PVS_COMPRESSFULLRUNS ))) throw std::bad_alloc();
+        pTree->SetPVSClusters( m_vLeafClusters, (ULONG)m_vClusterLeaves.size() );
 
         // Free our PVS buffer
         delete []PVSData;
@@ -1040,14 +1701,137 @@ HRESULT CProcessPVS::ExportPVS( CBSPTree * pTree )
     {
         // Clean up and return (Failure)
         if ( LeafPVS ) delete []LeafPVS;
+        if ( ClusterPVS ) delete []ClusterPVS;
         if ( PVSData ) delete []PVSData;
         if ( m_pLogger ) m_pLogger->ProgressFailure( LOG_PVS );
         return BCERR_OUTOFMEMORY;
-    
+
     } // End Catch Block
 
     // Success!!
-    if ( m_pLogger ) m_pLogger->ProgressSuccess( LOG_PVS );
+    if ( m_pLogger )
+    {
+        m_pLogger->ProgressSuccess( LOG_PVS );
+        m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Exported %i PVS sets (%i unique rows), raw size %i bytes, compressed size %i bytes (%.1f%%)"),
+                             SetCount, UniqueRows, SetCount * SetBytes, PVSWritePtr, (SetCount * SetBytes) != 0 ? (PVSWritePtr * 100.0) / (SetCount * SetBytes) : 0.0 );
+
+    } // End if logger
+    return BC_OK;
+}
+
+//-------------------------------------------------------------------------------------
+// Name : MergeLeafPVS () (Private)
+// Desc : OR's the leaf's visibility (that of all portals in the leaf, plus the leaf
+//        itself) into the uncompressed vis bit array passed in.
+//-------------------------------------------------------------------------------------
+void CProcessPVS::MergeLeafPVS( ULONG Leaf, UCHAR VisArray[] )
+{
+    CBSPLeaf * pLeaf = m_pTree->GetLeaf( Leaf );
+
+    // Current leaf is always visible
+    SetPVSBit( VisArray, Leaf );
+
+    // Loop through all portals in this leaf
+    for ( ULONG p = 0; p < pLeaf->PortalIndices.size(); p++ )
+    {
+        // Find correct portal index (the one IN this leaf)
+        ULONG PortalIndex = pLeaf->PortalIndices[ p ] * 2;
+        if ( GetPVSPortal( PortalIndex )->NeighbourLeaf == Leaf ) PortalIndex++;
+
+        // Or the vis bits together
+        CVisBits::OrMerge( VisArray, GetPVSPortal( PortalIndex )->ActualVis, m_PVSBytesPerSet );
+
+    } // Next Portal
+}
+
+//-------------------------------------------------------------------------------------
+// Name : BuildLeafClusters () (Private)
+// Desc : Groups adjacent leaves into vis clusters. Starting from each leaf not yet
+//        assigned, neighbouring leaves (those sharing a portal) are flooded into the
+//        cluster for as long as the cluster's bounds stay within the cluster size.
+// Note : Clusters are built after the full leaf PVS has been calculated, and each
+//        cluster's set is the union of its leaves' sets, so the result is always
+//        conservative. Large leaves simply end up in a cluster of their own.
+//-------------------------------------------------------------------------------------
+HRESULT CProcessPVS::BuildLeafClusters( )
+{
+    ULONG               i, j, LeafCount = m_pTree->GetLeafCount();
+    std::vector<ULONG>  Open;
+    CBounds3            Bounds, Combined;
+
+    try
+    {
+        m_vLeafClusters.assign( LeafCount, (ULONG)-1 );
+        m_vClusterLeaves.clear();
+
+        for ( i = 0; i < LeafCount; i++ )
+        {
+            // Skip leaves which already belong to a cluster
+            if ( m_vLeafClusters[i] != (ULONG)-1 ) continue;
+
+            // Start a new cluster from this leaf
+            ULONG Cluster = (ULONG)m_vClusterLeaves.size();
+            m_vClusterLeaves.push_back( std::vector<ULONG>() );
+            m_vClusterLeaves[ Cluster ].push_back( i );
+            m_vLeafClusters[i] = Cluster;
+            Bounds = m_pTree->GetLeaf(i)->Bounds;
+
+            // Flood out through the portals of each leaf added
+            Open.clear();
+            Open.push_back( i );
+            while ( !Open.empty() )
+            {
+                CBSPLeaf * pLeaf = m_pTree->GetLeaf( Open.back() );
+                ULONG      Leaf  = Open.back();
+                Open.pop_back();
+
+                for ( j = 0; j < pLeaf->PortalIndices.size(); j++ )
+                {
+                    CBSPPortal * pPortal = m_pTree->GetPortal( pLeaf->PortalIndices[j] );
+                    ULONG Neighbour = ( pPortal->LeafOwner[ FRONT_OWNER ] == Leaf ) ? pPortal->LeafOwner[ BACK_OWNER ] : pPortal->LeafOwner[ FRONT_OWNER ];
+                    if ( Neighbour >= LeafCount || m_vLeafClusters[ Neighbour ] != (ULONG)-1 ) continue;
+
+                    // Would the cluster grow too large ?
+                    const CBounds3 & LeafBounds = m_pTree->GetLeaf( Neighbour )->Bounds;
+                    Combined.Min.x = min( Bounds.Min.x, LeafBounds.Min.x ); Combined.Max.x = max( Bounds.Max.x, LeafBounds.Max.x );
+                    Combined.Min.y = min( Bounds.Min.y, LeafBounds.Min.y ); Combined.Max.y = max( Bounds.Max.y, LeafBounds.Max.y );
+                    Combined.Min.z = min( Bounds.Min.z, LeafBounds.Min.z ); Combined.Max.z = max( Bounds.Max.z, LeafBounds.Max.z );
+                    CVector3 Size = Combined.GetDimensions();
+                    if ( Size.x > m_OptionSet.ClusterSize || Size.y > m_OptionSet.ClusterSize || Size.z > m_OptionSet.ClusterSize ) continue;
+
+                    // Add the neighbour to this cluster
+                    m_vLeafClusters[ Neighbour ] = Cluster;
+                    m_vClusterLeaves[ Cluster ].push_back( Neighbour );
+                    Bounds = Combined;
+                    Open.push_back( Neighbour );
+
+                } // Next Portal
+
+            } // Next Open Leaf
+
+        } // Next Leaf
+
+    } // End Try Block
+
+    catch ( std::bad_alloc )
+    {
+        m_vLeafClusters.clear();
+        m_vClusterLeaves.clear();
+        return BCERR_OUTOFMEMORY;
+
+    } // End Catch Block
+
+    // Log the reduction
+    if ( m_pLogger )
+    {
+        ULONG LeafBytes    = m_PVSBytesPerSet;
+        ULONG ClusterBytes = CVisBits::AlignSetSize( ((ULONG)m_vClusterLeaves.size() + 7) / 8 );
+        m_pLogger->LogWrite( LOG_PVS, 0, true, _T("Grouped %i leaves into %i vis clusters (uncompressed PVS %i -> %i bytes)"), LeafCount,
+                             (ULONG)m_vClusterLeaves.size(), LeafCount * LeafBytes, (ULONG)m_vClusterLeaves.size() * ClusterBytes );
+
+    } // End if logger
+
+    // Success!!
     return BC_OK;
 }
 
@@ -1056,10 +1840,13 @@ HRESULT CProcessPVS::ExportPVS( CBSPTree * pTree )
 // Desc : ZRLE Compresses the uncompressed vis bit array which was passed in, and
 //        compresses and adds it to the master PVS Array, this function returns
 //        the size of the compressed set so we can update our write pointer.
+// Note : With PVS_COMPRESSFULLRUNS, runs of 0xFF bytes (8 visible leaves) are also
+//        stored as the byte followed by a repeat count, just as zero runs are.
 //-------------------------------------------------------------------------------------
-ULONG CProcessPVS::CompressLeafSet ( UCHAR MasterPVS[], const UCHAR VisArray[], ULONG WritePos)
+ULONG CProcessPVS::CompressLeafSet ( UCHAR MasterPVS[], const UCHAR VisArray[], ULONG WritePos, ULONG SetBytes )
 {
 	ULONG   RepeatCount;
+	UCHAR   Value;
 	UCHAR  *pDest = &MasterPVS[ WritePos ];
 	UCHAR  *pDest_p;
 	
@@ -1067,20 +1854,25 @@ ULONG CProcessPVS::CompressLeafSet ( UCHAR MasterPVS[], const UCHAR VisArray[],
     pDest_p = pDest;
 	
     // Loop through and compress the set
-	for ( ULONG j = 0; j < m_PVSBytesPerSet; j++ ) 
+	for ( ULONG j = 0; j < SetBytes; j++ ) 
     {
         // Store the current 8 leaves
 		*pDest_p++ = VisArray[j];
 
-        // Don't compress if all bits are not zero
-		if ( VisArray[j] ) continue;
+        // Don't compress if all bits are not zero (or all one)
+        Value = VisArray[j];
+        #if ( PVS_COMPRESSFULLRUNS )
+            if ( Value != 0x00 && Value != 0xFF ) continue;
+        #else
+            if ( Value ) continue;
+        #endif
 
-        // Count the number of 0 bytes
+        // Count the number of repeated bytes
 		RepeatCount = 1;
-		for ( j++; j < m_PVSBytesPerSet; j++ ) 
+		for ( j++; j < SetBytes; j++ ) 
         {
-            // Keep counting until byte != 0 or we reach our max repeat count
-			if ( VisArray[j] || RepeatCount == 255) break; else RepeatCount++;
+            // Keep counting until the byte changes or we reach our max repeat count
+			if ( VisArray[j] != Value || RepeatCount == 255) break; else RepeatCount++;
 		
         } // Next Byte
 		
@@ -1097,6 +1889,36 @@ ULONG CProcessPVS::CompressLeafSet ( UCHAR MasterPVS[], const UCHAR VisArray[],
 	return pDest_p - pDest;
 }
 
+//-------------------------------------------------------------------------------------
+// Name : FindSharedRow () (Private)
+// Desc : Searches the rows already written to the master PVS array for one which
+//        is identical to the row just written at WritePos. Returns the position
+//        of the identical row, or WritePos if this row has not been seen before
+//        (in which case it is added to the table).
+//-------------------------------------------------------------------------------------
+ULONG CProcessPVS::FindSharedRow( PVSROWTABLE & RowTable, const UCHAR MasterPVS[], ULONG WritePos, ULONG RowSize )
+{
+    unsigned long long Hash = 14695981039346656037ULL;
+    ULONG              i;
+
+    // FNV-1a hash of the row, including its size
+    for ( i = 0; i < RowSize; i++ ) Hash = (Hash ^ MasterPVS[ WritePos + i ]) * 1099511628211ULL;
+    Hash = (Hash ^ RowSize) * 1099511628211ULL;
+
+    // Compare against each row with a matching hash
+    auto Range = RowTable.equal_range( Hash );
+    for ( auto Row = Range.first; Row != Range.second; ++Row )
+    {
+        if ( Row->second.second != RowSize ) continue;
+        if ( memcmp( &MasterPVS[ Row->second.first ], &MasterPVS[ WritePos ], RowSize ) == 0 ) return Row->second.first;
+
+    } // Next Row
+
+    // This is a new row
+    RowTable.insert( std::make_pair( Hash, std::make_pair( WritePos, RowSize ) ) );
+    return WritePos;
+}
+
 //-------------------------------------------------------------------------------------
 // Name : GetPortalPlane() 
 // Desc : Calculates the correct plane orientation for the specified portal
@@ -17,9 +17,12 @@
 // CProcessPVS Specific Includes
 //-----------------------------------------------------------------------------
 #include "CompilerTypes.h"
-#include "..\\Support Source\\Common.h"
-#include "..\\Support Source\\CPlane.h"
+#include "../Support Source/Common.h"
+#include "../Support Source/CPlane.h"
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 
 //-----------------------------------------------------------------------------
 // Forward Declarations
@@ -39,10 +42,15 @@ class CCompiler;
 #define PS_PROCESSING			1       // Portal is currently being processed
 #define PS_PROCESSED			2       // Portal has been processed
 
+#define PVS_MAX_WINDING_POINTS  32      // Inline vertex capacity of each scratch winding
+#define PVS_FRAME_WINDINGS      4       // Scratch windings available to each flow depth
+
 //-----------------------------------------------------------------------------
 // Compilation Pre-Processor Flags
 //-----------------------------------------------------------------------------
 #define PVS_COMPRESSDATA        1       // 1 = ZRLE Compress, 0 = Don't Compress
+#define PVS_COMPRESSFULLRUNS    1       // 1 = Also run length encode 0xFF bytes when compressing
+#define PVS_BENCHMARK_VISBITS   0       // 1 = Benchmark the vis bit kernels before compiling
 
 //-----------------------------------------------------------------------------
 // Typedefs, structures & enumerators
@@ -55,6 +63,8 @@ typedef struct _PVSDATA                 // Structure to hold pvs processing data
 	UCHAR              *VisBits;        // Visible Bits being calculated
 } PVSDATA;
 
+typedef std::unordered_multimap<unsigned long long, std::pair<ULONG, ULONG>> PVSROWTABLE; // Row hash -> (position, size) of exported PVS rows
+
 //-----------------------------------------------------------------------------
 // Main Class Definitions
 //-----------------------------------------------------------------------------
@@ -78,6 +88,7 @@ public:
 	// Public Functions for This Class
 	//-------------------------------------------------------------------------
     CPortalPoints *     Clip( const CPlane3& Plane, bool KeepOnPlane );
+    void                ClipFront( const CPlane3& Plane, CPortalPoints * FrontSplit ) const;
 
     //-------------------------------------------------------------------------
 	// Public Virtual Functions for This Class
@@ -89,7 +100,81 @@ public:
 	//-------------------------------------------------------------------------
     bool                OwnsVertices;           // Do we own the vertices stored here ?
     CPVSPortal         *OwnerPortal;            // Pointer to this points parent portal ;)
+    long                FrameDepth;             // Flow depth of the scratch frame owning these points (-1 = none)
+
+};
+
+//-----------------------------------------------------------------------------
+// Name : PVSFRAME (Struct)
+// Desc : Scratch memory used by a single depth of the portal flow. The
+//        windings store their vertices inline so that clipping requires no
+//        heap allocations.
+//-----------------------------------------------------------------------------
+typedef struct _PVSFRAME
+{
+    ULONG           Depth;                          // The flow depth this frame serves
+    UCHAR          *VisBits;                        // Visible bits being calculated at this depth
+    ULONG           WindingsUsed;                   // Bit mask of the windings currently in use
+    CPortalPoints   Windings[PVS_FRAME_WINDINGS];   // Scratch windings
+    CVertex         Vertices[PVS_FRAME_WINDINGS][PVS_MAX_WINDING_POINTS]; // Inline winding vertices
+} PVSFRAME;
+
+//-----------------------------------------------------------------------------
+// Name : PVSLEVEL (Struct)
+// Desc : State of a single level of the portal flow work stack, i.e. what was
+//        held in the locals of one call when the flow was recursive.
+//-----------------------------------------------------------------------------
+typedef struct _PVSLEVEL
+{
+    ULONG           Leaf;               // The leaf being flowed through
+    ULONG           NextPortal;         // Index of the next leaf portal to test
+    PVSFRAME       *pFrame;             // Scratch frame used by this level
+    PVSDATA         Data;               // Flow data passed in from the previous level
+    CPortalPoints  *FreeSource;         // Clipped source to release when the next level returns
+    CPortalPoints  *FreeGenerator;      // Clipped generator to release when the next level returns
+} PVSLEVEL;
+
+//-----------------------------------------------------------------------------
+// Name : CPVSThreadData (Class)
+// Desc : Per thread state used during the full PVS compile, including the
+//        portal flow work stack and its scratch frames (one per depth).
+//-----------------------------------------------------------------------------
+class CPVSThreadData
+{
+public:
+    //-------------------------------------------------------------------------
+	// Constructors / Destructors for this Class
+	//-------------------------------------------------------------------------
+             CPVSThreadData( ULONG VisBytesPerSet );
+    virtual ~CPVSThreadData( );
+
+    //-------------------------------------------------------------------------
+	// Public Functions for This Class
+	//-------------------------------------------------------------------------
+    PVSFRAME       *PushFrame   ( );
+    void            PopFrame    ( );
+    CPortalPoints  *AllocPoints ( ULONG VertexCount );
+    void            FreePoints  ( CPortalPoints * pPoints );
+
+    //-------------------------------------------------------------------------
+	// Public Variables for This Class
+	//-------------------------------------------------------------------------
+    long            CurrentOrder;   // Processing order of the portal being flowed
+    double          ScheduleTime;   // Seconds spent selecting portals (including lock waits)
+    double          ClipTime;       // Seconds spent in the portal flow / clipping
+    ULONG           FrameAllocs;    // Heap allocations made growing the frame stack
+    ULONG           WindingAllocs;  // Heap allocations made for windings which did not fit a frame
+    ULONG           PeakDepth;      // Deepest level reached by the portal flow
+    ULONG           DraftCutoffs;   // Flows stopped early by the draft depth / distance limits
+    std::vector<PVSLEVEL> Levels;   // Portal flow work stack (contiguous, reused between portals)
 
+private:
+    //-------------------------------------------------------------------------
+	// Private Variables for This Class
+	//-------------------------------------------------------------------------
+    std::vector<PVSFRAME*>  m_vpFrames;     // Scratch frames, indexed by depth
+    ULONG                   m_Depth;        // Current flow depth
+    ULONG                   m_VisBytes;     // Size of each frame's vis bit set
 };
 
 //-----------------------------------------------------------------------------
@@ -108,7 +193,8 @@ public:
     //-------------------------------------------------------------------------
 	// Public Variables for This Class
 	//-------------------------------------------------------------------------
-    UCHAR             Status;               // The compilation status of this portal
+    std::atomic<UCHAR> Status;              // The compilation status of this portal (shared between vis threads)
+    std::atomic<long> ProcessOrder;         // Order in which this portal was claimed (-1 = unclaimed)
     UCHAR             Side;                 // Which direction does this portal point
     long              Plane;                // The plane on which this portal lies
     long              NeighbourLeaf;        // The leaf into which this portal points
@@ -125,6 +211,42 @@ public:
 //-----------------------------------------------------------------------------
 typedef std::vector<CPVSPortal*> vectorPVSPortal;
 
+//-----------------------------------------------------------------------------
+// Name : CPortalQueue (Class)
+// Desc : Binary min-heap of PVS portal indices keyed on portal complexity
+//        (PossibleVisCount, ties broken by lowest index). Used to schedule
+//        portals for the full compile without rescanning the portal list.
+//-----------------------------------------------------------------------------
+class CPortalQueue
+{
+public:
+    //-------------------------------------------------------------------------
+	// Constructors / Destructors for this Class
+	//-------------------------------------------------------------------------
+    CPortalQueue( ) { m_pPortals = NULL; }
+
+    //-------------------------------------------------------------------------
+	// Public Functions for This Class
+	//-------------------------------------------------------------------------
+    void            Build ( const vectorPVSPortal * pPortals );
+    long            Pop   ( );
+    void            Clear ( )       { m_Heap.clear(); }
+    bool            IsEmpty( ) const { return m_Heap.empty(); }
+
+private:
+    //-------------------------------------------------------------------------
+	// Private Functions for This Class
+	//-------------------------------------------------------------------------
+    bool            Less    ( ULONG Portal1, ULONG Portal2 ) const;
+    void            SiftDown( ULONG Position );
+
+    //-------------------------------------------------------------------------
+	// Private Variables for This Class
+	//-------------------------------------------------------------------------
+    const vectorPVSPortal  *m_pPortals;     // The portals being scheduled
+    std::vector<ULONG>      m_Heap;         // Heap ordered portal indices
+};
+
 //-----------------------------------------------------------------------------
 // Name : CProcessPVS (Class)
 // Desc : This is the primary potential visibility set compiler.
@@ -159,10 +281,18 @@ private:
     void            PortalFlood( CPVSPortal * SourcePortal, unsigned char PortalVis[], unsigned long Leaf );
     HRESULT         ExportPVS( CBSPTree * pTree );
     void            GetPortalPlane( const CPVSPortal * pPortal, CPlane3& Plane );
-    ULONG           CompressLeafSet ( UCHAR MasterPVS[], const UCHAR VisArray[], ULONG WritePos);
+    ULONG           CompressLeafSet ( UCHAR MasterPVS[], const UCHAR VisArray[], ULONG WritePos, ULONG SetBytes );
+    ULONG           FindSharedRow( PVSROWTABLE & RowTable, const UCHAR MasterPVS[], ULONG WritePos, ULONG RowSize );
+    void            MergeLeafPVS( ULONG Leaf, UCHAR VisArray[] );
+    HRESULT         BuildLeafClusters( );
     ULONG           GetNextPortal();
-    HRESULT         RecursePVS( ULONG Leaf, CPVSPortal * SourcePortal, PVSDATA & PrevData );
-    CPortalPoints * ClipToAntiPenumbra( CPortalPoints * Source, CPortalPoints * Target, CPortalPoints * Generator, bool ReverseClip );
+    ULONG           ClaimNextPortal( CPVSThreadData & ThreadData );
+    void            ProcessPortal( ULONG PortalIndex, CPVSThreadData & ThreadData );
+    void            PortalVisThread( );
+    HRESULT         FlowPortalPVS( CPVSPortal * SourcePortal, PVSDATA & InitialData, CPVSThreadData & ThreadData );
+    bool            IsDraftCutoff( const CPVSPortal * GeneratorPortal, const CVector3& SourceCentre, ULONG Depth ) const;
+    CPortalPoints * ClipToAntiPenumbra( CPortalPoints * Source, CPortalPoints * Target, CPortalPoints * Generator, bool ReverseClip, CPVSThreadData & ThreadData );
+    CPortalPoints * ClipPoints( CPortalPoints * pPoints, const CPlane3& Plane, CPVSThreadData & ThreadData );
 
     //-------------------------------------------------------------------------
     // Private Static Functions for This Class.
@@ -182,6 +312,21 @@ private:
     CBSPTree       *m_pTree;            // The tree used to compile the PVS.
     ULONG           m_PVSBytesPerSet;   // Number of Bytes required to describe a single leaf's visibility
     vectorPVSPortal m_vpPVSPortals;     // Vector storage of pointers to CPVSPortal objects
+    std::vector<ULONG>              m_vLeafClusters;    // Vis cluster owning each leaf (empty if not clustered)
+    std::vector<std::vector<ULONG>> m_vClusterLeaves;   // Leaves belonging to each vis cluster
+
+    std::mutex              m_ScheduleLock;     // Guards portal selection between vis threads
+    CPortalQueue            m_PortalQueue;      // Portals remaining, ordered by complexity
+    long                    m_NextOrder;        // Processing order handed to the next claimed portal
+    double                  m_ScheduleTime;     // Total time spent scheduling portals (all threads)
+    double                  m_ClipTime;         // Total time spent clipping portals (all threads)
+    ULONG                   m_FrameAllocs;      // Total heap allocations growing scratch frames
+    ULONG                   m_WindingAllocs;    // Total heap allocations for oversized windings
+    ULONG                   m_PeakDepth;        // Deepest portal flow level reached (all threads)
+    ULONG                   m_DraftCutoffs;     // Total flows stopped by the draft vis limits
+    std::atomic<ULONG>      m_PortalsDone;      // Number of portals fully processed
+    std::atomic<bool>       m_bAbortVis;        // Set to stop all vis threads (cancel / failure)
+    std::atomic<HRESULT>    m_ThreadResult;     // First failure code reported by a vis thread
 
 };
 
@@ -10,6 +10,8 @@
 //-----------------------------------------------------------------------------
 #include "ProcessTJR.h"
 #include "CCompiler.h"
+#include "CBSPTree.h"
+#include <algorithm>
 
 //-----------------------------------------------------------------------------
 // Name : CProcessTJR () (Constructor)
@@ -20,6 +22,8 @@ CProcessTJR::CProcessTJR()
     // Reset / Clear all required values
     m_pParent     = NULL;
     m_pLogger     = NULL;
+    m_CellSize    = 1.0f;
+    m_GridSize[0] = m_GridSize[1] = m_GridSize[2] = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -37,9 +41,10 @@ CProcessTJR::~CProcessTJR()
 //-----------------------------------------------------------------------------
 HRESULT CProcessTJR::Process( CPolygon ** ppPolys, ULONG PolyCount )
 {
-    ULONG      i, k;
+    ULONG      i, k, c, TestCount;
     CBounds3  *pBounds = NULL;
     CPolygon  *pCurrentPoly, *pTestPoly;
+    std::vector<ULONG> Candidates;
 
     // Validate values
     if (!ppPolys || !PolyCount) return BCERR_INVALIDPARAMS;
@@ -85,6 +90,9 @@ HRESULT CProcessTJR::Process( CPolygon ** ppPolys, ULONG PolyCount )
             pBounds[i].Max.x += 0.1f; pBounds[i].Max.y += 0.1f; pBounds[i].Max.z += 0.1f;
         } // Next Bounds
 
+        // Bin the polygons in to a uniform grid so that we can quickly find those nearby
+        if ( m_OptionSet.SpatialGrid ) BuildPolygonGrid( pBounds, PolyCount );
+
         // *************************
         // * Write Log Information *
         // *************************
@@ -112,9 +120,17 @@ HRESULT CProcessTJR::Process( CPolygon ** ppPolys, ULONG PolyCount )
             pCurrentPoly = ppPolys[ i ];
             if (!pCurrentPoly) continue;
 
-            // Test against every other face in the tree
-            for ( k = 0; k < PolyCount; k++ ) 
+            // Only faces sharing a grid cell with this one can intersect it, otherwise
+            // we must test against every other face in the tree.
+            if ( m_OptionSet.SpatialGrid ) GetCandidates( i, pBounds, Candidates );
+            TestCount = (m_OptionSet.SpatialGrid) ? (ULONG)Candidates.size() : PolyCount;
+
+            // Note : Candidates are visited in ascending order, exactly as the exhaustive
+            //        search would, so that vertices are inserted in the same order either way.
+            for ( c = 0; c < TestCount; c++ ) 
             {
+                k = (m_OptionSet.SpatialGrid) ? Candidates[c] : c;
+
                 // Don't against test self
                 if (i == k) continue;
 
@@ -145,13 +161,25 @@ HRESULT CProcessTJR::Process( CPolygon ** ppPolys, ULONG PolyCount )
     {
         // Clean up and return (failure)
         if (pBounds) delete []pBounds;
+        ReleaseGrid();
         if ( m_pLogger && FAILED(e) ) m_pLogger->ProgressFailure( LOG_TJR );
         return e;
     
     } // End Catch Block
 
+    catch ( std::bad_alloc )
+    {
+        // Failed to allocate
+        if (pBounds) delete []pBounds;
+        ReleaseGrid();
+        if ( m_pLogger ) m_pLogger->ProgressFailure( LOG_TJR );
+        return BCERR_OUTOFMEMORY;
+
+    } // End Catch Block
+
     // Release used memory
     if (pBounds) delete []pBounds;
+    ReleaseGrid();
 
     // Success!
     if ( m_pLogger ) m_pLogger->ProgressSuccess( LOG_TJR );
@@ -159,6 +187,168 @@ HRESULT CProcessTJR::Process( CPolygon ** ppPolys, ULONG PolyCount )
  
 }
 
+//-----------------------------------------------------------------------------
+// Name : Validate ()
+// Desc : Repairs the unrepaired copies of the tree faces in the same way the
+//        engine does when it loads a level without repaired faces, and
+//        confirms that every vertex the engine would insert is already
+//        present in the faces repaired by Process. The number of faces for
+//        which this is not the case is returned in Mismatches.
+// Note : As in the engine, each face is repaired only against the faces of
+//        those leaves which its bounds intersect, and deleted faces (which
+//        never reach the engine) are ignored. Because the engine tests the
+//        exact polygon bounds it misses some junctions which Process repairs,
+//        such faces are reported but are not mismatches.
+//-----------------------------------------------------------------------------
+HRESULT CProcessTJR::Validate( const CBSPTree * pTree, CPolygon ** ppOriginal, ULONG PolyCount, ULONG & Mismatches )
+{
+    ULONG       i, j, k, Face, Extra = 0;
+    CBounds3   *pBounds = NULL;
+    CBSPLeaf   *pLeaf;
+    CVector3    Tolerance( EPSILON, EPSILON, EPSILON );
+
+    // Validate values
+    Mismatches = 0;
+    if ( !pTree || !ppOriginal || PolyCount != pTree->GetFaceCount() ) return BCERR_INVALIDPARAMS;
+
+    try
+    {
+        // *************************
+        // * Write Log Information *
+        // *************************
+        if ( m_pLogger )
+        {
+            m_pLogger->LogWrite( LOG_TJR, 0, true, _T("Validating against load time repair 	- " ) );
+            m_pLogger->SetRewindMarker( LOG_TJR );
+            m_pLogger->LogWrite( LOG_TJR, 0, false, _T("0%%" ) );
+            m_pLogger->SetProgressRange( PolyCount );
+            m_pLogger->SetProgressValue( 0 );
+        } 
+        // *************************
+        // *    End of Logging     *
+        // *************************
+
+        // The engine uses the exact polygon bounds
+        pBounds = new CBounds3[PolyCount];
+        for ( i = 0; i < PolyCount; i++ )
+        {
+            pBounds[i].CalculateFromPolygon( ppOriginal[ i ]->Vertices, ppOriginal[ i ]->VertexCount, sizeof(CVertex) );
+
+        } // Next Face
+
+        // Repair each face in turn
+        for ( i = 0; i < PolyCount; i++ )
+        {
+            // Update Progress
+            if (!m_pParent->TestCompilerState()) throw BC_CANCELLED;
+            if ( m_pLogger ) m_pLogger->UpdateProgress();
+            if ( pTree->GetFace( i )->Deleted ) continue;
+
+            // Test against the faces in every leaf this face's bounds intersect
+            for ( j = 0; j < pTree->GetLeafCount(); j++ )
+            {
+                pLeaf = pTree->GetLeaf( j );
+                if ( !pLeaf->Bounds.IntersectedByBounds( pBounds[i], Tolerance ) ) continue;
+
+                for ( k = 0; k < pLeaf->FaceIndices.size(); k++ )
+                {
+                    Face = (ULONG)pLeaf->FaceIndices[ k ];
+                    if ( Face == i || Face >= PolyCount || pTree->GetFace( Face )->Deleted ) continue;
+                    if ( !pBounds[i].IntersectedByBounds( pBounds[Face] ) ) continue;
+
+                    // Only this face is repaired, the other takes its own turn
+                    if (!(RepairTJunctions( ppOriginal[ i ], ppOriginal[ Face ] ))) throw BCERR_OUTOFMEMORY;
+
+                } // Next Leaf Face
+
+            } // Next Leaf
+
+        } // Next Face
+
+        // Compare the results
+        for ( i = 0; i < PolyCount; i++ )
+        {
+            if ( pTree->GetFace( i )->Deleted ) continue;
+            if ( !ContainsVertexSet( pTree->GetFace( i ), ppOriginal[ i ] ) ) Mismatches++;
+            else if ( pTree->GetFace( i )->VertexCount != ppOriginal[ i ]->VertexCount ) Extra++;
+
+        } // Next Face
+
+    } // End Try Block
+
+    catch ( HRESULT &e )
+    {
+        // Clean up and return (failure)
+        if (pBounds) delete []pBounds;
+        if ( m_pLogger && FAILED(e) ) m_pLogger->ProgressFailure( LOG_TJR );
+        return e;
+    
+    } // End Catch Block
+
+    catch ( std::bad_alloc )
+    {
+        // Failed to allocate
+        if (pBounds) delete []pBounds;
+        if ( m_pLogger ) m_pLogger->ProgressFailure( LOG_TJR );
+        return BCERR_OUTOFMEMORY;
+
+    } // End Catch Block
+
+    // Release used memory
+    if (pBounds) delete []pBounds;
+
+    // Report the result
+    if ( m_pLogger )
+    {
+        if ( Mismatches == 0 )
+        {
+            m_pLogger->ProgressSuccess( LOG_TJR );
+        
+        } // End if matched
+        else
+        {
+            m_pLogger->ProgressFailure( LOG_TJR );
+            m_pLogger->LogWrite( LOG_TJR, LOGF_WARNING, true, _T("%i of %i faces differ, the engine will repair T-Junctions at load time."),
+                                 Mismatches, PolyCount );
+        
+        } // End if mismatched
+
+        if ( Extra > 0 ) m_pLogger->LogWrite( LOG_TJR, 0, true, _T("%i faces have junctions repaired which load time repair would miss."), Extra );
+
+    } // End if logger
+
+    // Success!
+    return BC_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Name : ContainsVertexSet () (Private, Static)
+// Desc : Determines whether every vertex position in pSubset is also present
+//        (to within EPSILON) in pPoly, in any order.
+//-----------------------------------------------------------------------------
+bool CProcessTJR::ContainsVertexSet( const CPolygon * pPoly, const CPolygon * pSubset )
+{
+    ULONG v1, v2;
+
+    for ( v1 = 0; v1 < pSubset->VertexCount; v1++ )
+    {
+        const CVertex & Vert1 = pSubset->Vertices[v1];
+        for ( v2 = 0; v2 < pPoly->VertexCount; v2++ )
+        {
+            const CVertex & Vert2 = pPoly->Vertices[v2];
+            if ( fabsf( Vert1.x - Vert2.x ) < EPSILON && fabsf( Vert1.y - Vert2.y ) < EPSILON &&
+                 fabsf( Vert1.z - Vert2.z ) < EPSILON ) break;
+        
+        } // Next Vertex
+
+        // No matching vertex?
+        if ( v2 == pPoly->VertexCount ) return false;
+
+    } // Next Vertex
+
+    return true;
+}
+
 //-----------------------------------------------------------------------------
 // Name : RepairTJunctions ()
 // Desc : Tests and repairs one polygon against another.
@@ -169,6 +359,8 @@ bool CProcessTJR::RepairTJunctions( CPolygon *pPoly1, CPolygon *pPoly2 ) const
     float       Percent;
     ULONG      v1, v2, v1a;
     CVertex    Vert1, Vert2, Vert1a;
+    CBounds3   EdgeBounds;
+    CVector3   Tolerance( TJR_EDGE_TOLERANCE, TJR_EDGE_TOLERANCE, TJR_EDGE_TOLERANCE );
     
 
     // Validate Parameters
@@ -183,6 +375,8 @@ bool CProcessTJR::RepairTJunctions( CPolygon *pPoly1, CPolygon *pPoly2 ) const
         // Store verts (Required because indices may change)
         Vert1 = pPoly1->Vertices[v1];
         Vert2 = pPoly1->Vertices[v2];
+        EdgeBounds.CalculateFromPolygon( &Vert1, 1, sizeof(CVertex) );
+        EdgeBounds.CalculateFromPolygon( &Vert2, 1, sizeof(CVertex), false );
 
         // Now loop through each vertex in the test face
         for ( v1a = 0; v1a < pPoly2->VertexCount; v1a++ ) 
@@ -190,6 +384,9 @@ bool CProcessTJR::RepairTJunctions( CPolygon *pPoly1, CPolygon *pPoly2 ) const
             // Store test point for easy access
             Vert1a = pPoly2->Vertices[v1a];
 
+            // Any point on the edge must lie within the edge's bounds, this is far cheaper to test
+            if ( !EdgeBounds.PointInBounds( Vert1a, Tolerance ) ) continue;
+
             // Test if this vertex is close to the test edge
             // (Also returns out of range value if the point is past the line ends)
             if ( Vert1a.DistanceToLine( Vert1, Vert2 ) < EPSILON )
@@ -218,6 +415,8 @@ bool CProcessTJR::RepairTJunctions( CPolygon *pPoly1, CPolygon *pPoly2 ) const
 
                 // Update the edge for which we are testing
                 Vert2 = *pNewVert;
+                EdgeBounds.CalculateFromPolygon( &Vert1, 1, sizeof(CVertex) );
+                EdgeBounds.CalculateFromPolygon( &Vert2, 1, sizeof(CVertex), false );
 
             } // End if on edge
 
@@ -227,4 +426,155 @@ bool CProcessTJR::RepairTJunctions( CPolygon *pPoly1, CPolygon *pPoly2 ) const
 
     // Success!
     return true;
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------------------------
+// Name : BuildPolygonGrid () (Private)
+// Desc : Bins every polygon in to each cell of a uniform grid which its
+//        bounds overlap, so that neighbouring polygons can be found without
+//        testing every possible pair.
+// Note : Cells are sized on the average polygon so that most polygons will
+//        overlap only a handful, unless this would exceed TJR_GRID_MAX_CELLS.
+//-----------------------------------------------------------------------------
+void CProcessTJR::BuildPolygonGrid( const CBounds3 pBounds[], ULONG PolyCount )
+{
+    CBounds3 Extents;
+    CVector3 Size;
+    ULONG    i, x, y, z, Cell, CellCount;
+    ULONG    CellMin[3], CellMax[3];
+    double   Average = 0.0;
+
+    // Calculate the extents of the grid, and the average polygon size
+    Extents.Reset();
+    for ( i = 0; i < PolyCount; i++ )
+    {
+        Extents.CalculateFromPolygon( &pBounds[i].Min, 1, sizeof(CVector3), false );
+        Extents.CalculateFromPolygon( &pBounds[i].Max, 1, sizeof(CVector3), false );
+        Size     = pBounds[i].GetDimensions();
+        Average += max( Size.x, max( Size.y, Size.z ) );
+
+    } // Next Polygon
+
+    // Select the cell size, growing it until the grid is within limits
+    Size       = Extents.GetDimensions();
+    m_CellSize = max( (float)(Average / PolyCount), 1.0f );
+    for ( ; ; )
+    {
+        m_GridSize[0] = (ULONG)(Size.x / m_CellSize) + 1;
+        m_GridSize[1] = (ULONG)(Size.y / m_CellSize) + 1;
+        m_GridSize[2] = (ULONG)(Size.z / m_CellSize) + 1;
+        if ( (double)m_GridSize[0] * m_GridSize[1] * m_GridSize[2] <= TJR_GRID_MAX_CELLS ) break;
+        m_CellSize *= 2.0f;
+
+    } // Next Attempt
+    m_GridOrigin = Extents.Min;
+    CellCount    = m_GridSize[0] * m_GridSize[1] * m_GridSize[2];
+
+    // Count the polygons overlapping each cell
+    m_CellStart.assign( CellCount + 1, 0 );
+    for ( i = 0; i < PolyCount; i++ )
+    {
+        GetCellRange( pBounds[i], CellMin, CellMax );
+        for ( z = CellMin[2]; z <= CellMax[2]; z++ )
+        for ( y = CellMin[1]; y <= CellMax[1]; y++ )
+        for ( x = CellMin[0]; x <= CellMax[0]; x++ )
+            m_CellStart[ (z * m_GridSize[1] + y) * m_GridSize[0] + x + 1 ]++;
+
+    } // Next Polygon
+
+    // Convert the counts in to offsets
+    for ( Cell = 0; Cell < CellCount; Cell++ ) m_CellStart[ Cell + 1 ] += m_CellStart[ Cell ];
+
+    // Store each polygon in its cells. Polygons are added in order, so every
+    // cell's list is sorted (m_CellStart is used as the insertion cursor here).
+    m_CellPolys.resize( m_CellStart[ CellCount ] );
+    for ( i = 0; i < PolyCount; i++ )
+    {
+        GetCellRange( pBounds[i], CellMin, CellMax );
+        for ( z = CellMin[2]; z <= CellMax[2]; z++ )
+        for ( y = CellMin[1]; y <= CellMax[1]; y++ )
+        for ( x = CellMin[0]; x <= CellMax[0]; x++ )
+            m_CellPolys[ m_CellStart[ (z * m_GridSize[1] + y) * m_GridSize[0] + x ]++ ] = i;
+
+    } // Next Polygon
+
+    // Each cursor now points to the start of the following cell, shift them back
+    for ( Cell = CellCount; Cell > 0; Cell-- ) m_CellStart[ Cell ] = m_CellStart[ Cell - 1 ];
+    m_CellStart[ 0 ] = 0;
+
+    // No polygon has yet been collected as a candidate
+    m_PolyStamp.assign( PolyCount, (ULONG)-1 );
+}
+
+//-----------------------------------------------------------------------------
+// Name : GetCellRange () (Private)
+// Desc : Calculates the inclusive range of grid cells overlapped by the
+//        bounding box specified.
+// Note : Both ends are calculated in exactly the same way, so any two boxes
+//        which intersect are guaranteed to share at least one cell.
+//-----------------------------------------------------------------------------
+void CProcessTJR::GetCellRange( const CBounds3 & Bounds, ULONG CellMin[], ULONG CellMax[] ) const
+{
+    const float * pMin    = &Bounds.Min.x;
+    const float * pMax    = &Bounds.Max.x;
+    const float * pOrigin = &m_GridOrigin.x;
+
+    for ( ULONG i = 0; i < 3; i++ )
+    {
+        CellMin[i] = (ULONG)max( 0.0f, (pMin[i] - pOrigin[i]) / m_CellSize );
+        CellMax[i] = (ULONG)max( 0.0f, (pMax[i] - pOrigin[i]) / m_CellSize );
+        if ( CellMin[i] >= m_GridSize[i] ) CellMin[i] = m_GridSize[i] - 1;
+        if ( CellMax[i] >= m_GridSize[i] ) CellMax[i] = m_GridSize[i] - 1;
+
+    } // Next Axis
+}
+
+//-----------------------------------------------------------------------------
+// Name : GetCandidates () (Private)
+// Desc : Collects, in ascending order, every polygon after the one specified
+//        which shares at least one grid cell with it.
+// Note : Earlier polygons have already been repaired against this one, and
+//        so are not collected.
+//-----------------------------------------------------------------------------
+void CProcessTJR::GetCandidates( ULONG Poly, const CBounds3 pBounds[], std::vector<ULONG> & Candidates )
+{
+    ULONG x, y, z, Cell, CellMin[3], CellMax[3];
+
+    Candidates.clear();
+
+    GetCellRange( pBounds[ Poly ], CellMin, CellMax );
+    for ( z = CellMin[2]; z <= CellMax[2]; z++ )
+    for ( y = CellMin[1]; y <= CellMax[1]; y++ )
+    for ( x = CellMin[0]; x <= CellMax[0]; x++ )
+    {
+        Cell = (z * m_GridSize[1] + y) * m_GridSize[0] + x;
+
+        // Skip past the earlier polygons in this cell (the lists are sorted)
+        std::vector<ULONG>::const_iterator Item = std::upper_bound( m_CellPolys.begin() + m_CellStart[ Cell ],
+                                                                    m_CellPolys.begin() + m_CellStart[ Cell + 1 ], Poly );
+        for ( ; Item != m_CellPolys.begin() + m_CellStart[ Cell + 1 ]; ++Item )
+        {
+            // Each polygon is collected only once, however many cells are shared
+            if ( m_PolyStamp[ *Item ] == Poly ) continue;
+            m_PolyStamp[ *Item ] = Poly;
+            Candidates.push_back( *Item );
+
+        } // Next Polygon
+
+    } // Next Cell
+
+    // Visit them in the same order as the exhaustive search
+    std::sort( Candidates.begin(), Candidates.end() );
+}
+
+//-----------------------------------------------------------------------------
+// Name : ReleaseGrid () (Private)
+// Desc : Releases the memory used by the polygon grid.
+//-----------------------------------------------------------------------------
+void CProcessTJR::ReleaseGrid( )
+{
+    std::vector<ULONG>().swap( m_CellStart );
+    std::vector<ULONG>().swap( m_CellPolys );
+    std::vector<ULONG>().swap( m_PolyStamp );
+    m_GridSize[0] = m_GridSize[1] = m_GridSize[2] = 0;
+}
@@ -6,7 +6,8 @@
 // CProcessTJR Specific Includes
 //-----------------------------------------------------------------------------
 #include "CompilerTypes.h"
-#include "..\\Support Source\\Common.h"
+#include "../Support Source/Common.h"
+#include <vector>
 
 //-----------------------------------------------------------------------------
 // Forward Declarations
@@ -18,6 +19,8 @@ class CCompiler;
 // Miscellaneous Definitions
 //-----------------------------------------------------------------------------
 #define TJR_ARRAY_THRESHOLD     100
+#define TJR_GRID_MAX_CELLS      (1 << 20)       // Upper limit on the number of polygon grid cells
+#define TJR_EDGE_TOLERANCE      (EPSILON * 2.0f) // Edge bounds tolerance, generous compared to the on edge test
 
 //-----------------------------------------------------------------------------
 // Main Class Definitions
@@ -43,12 +46,22 @@ public:
     void            SetParent ( CCompiler * pParent )       { m_pParent = pParent; }
 
     HRESULT         Process( CPolygon ** ppPolys, ULONG PolyCount );
+    HRESULT         Validate( const CBSPTree * pTree, CPolygon ** ppOriginal, ULONG PolyCount, ULONG & Mismatches );
 
 private:
     //-------------------------------------------------------------------------
     // Private Functions for This Class.
     //-------------------------------------------------------------------------
     bool            RepairTJunctions( CPolygon *pPoly1, CPolygon *pPoly2 ) const;
+    void            BuildPolygonGrid( const CBounds3 pBounds[], ULONG PolyCount );
+    void            GetCellRange    ( const CBounds3 & Bounds, ULONG CellMin[], ULONG CellMax[] ) const;
+    void            GetCandidates   ( ULONG Poly, const CBounds3 pBounds[], std::vector<ULONG> & Candidates );
+    void            ReleaseGrid     ( );
+
+    //-------------------------------------------------------------------------
+    // Private Static Functions for This Class.
+    //-------------------------------------------------------------------------
+    static bool     ContainsVertexSet( const CPolygon * pPoly, const CPolygon * pSubset );
 
     //-------------------------------------------------------------------------
     // Private Variables for This Class.
@@ -57,6 +70,13 @@ private:
     ILogger        *m_pLogger;          // Just our logging interface used to log progress etc.
     CCompiler      *m_pParent;          // Parent Compiler Pointer
 
+    CVector3            m_GridOrigin;   // Minimum corner of the polygon grid
+    float               m_CellSize;     // Edge length of a single (cubic) grid cell
+    ULONG               m_GridSize[3];  // Number of cells along each axis
+    std::vector<ULONG>  m_CellStart;    // Index of each cell's first entry in m_CellPolys (one extra at the end)
+    std::vector<ULONG>  m_CellPolys;    // Polygon indices overlapping each cell, in ascending order
+    std::vector<ULONG>  m_PolyStamp;    // Last polygon for which each polygon was collected as a candidate
+
 };
 
 #endif // _PROCESSTJR_H_
\ No newline at end of file
@@ -0,0 +1,432 @@
+//-----------------------------------------------------------------------------
+// File: VisBits.cpp
+//
+// Desc: Visibility bit set kernels used by the PVS compiler. Each operation
+//       has a scalar implementation along with SSE2 and AVX2 versions, the
+//       best set supported by the host processor is selected at run time.
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// CVisBits Specific Includes
+//-----------------------------------------------------------------------------
+#include "VisBits.h"
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define VISBITS_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define VISBITS_TARGET_SSE2
+        #define VISBITS_TARGET_AVX2
+    #else
+        #define VISBITS_TARGET_SSE2 __attribute__((target("sse2")))
+        #define VISBITS_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+//-----------------------------------------------------------------------------
+// Local Typedefs
+//-----------------------------------------------------------------------------
+typedef unsigned long long VISWORD;
+
+//-----------------------------------------------------------------------------
+// Local Helper Functions
+//-----------------------------------------------------------------------------
+static inline VISWORD LoadWord( const UCHAR * p )
+{
+    VISWORD Value;
+    memcpy( &Value, p, sizeof(VISWORD) );
+    return Value;
+}
+
+static inline void StoreWord( UCHAR * p, VISWORD Value )
+{
+    memcpy( p, &Value, sizeof(VISWORD) );
+}
+
+static inline ULONG CountWordBits( VISWORD x )
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (ULONG)((x * 0x0101010101010101ULL) >> 56);
+}
+
+//-----------------------------------------------------------------------------
+// Scalar Kernels (also used to finish the tail of the vector kernels)
+//-----------------------------------------------------------------------------
+static bool AndTestNew_Scalar( UCHAR Dest[], const UCHAR Src[], const UCHAR Test[], const UCHAR Vis[], ULONG Bytes, ULONG Start = 0 )
+{
+    VISWORD More = 0;
+    for ( ULONG i = Start; i < Bytes; i += sizeof(VISWORD) )
+    {
+        VISWORD Value = LoadWord( &Src[i] ) & LoadWord( &Test[i] );
+        StoreWord( &Dest[i], Value );
+        More |= Value & ~LoadWord( &Vis[i] );
+
+    } // Next Word
+    return More != 0;
+}
+
+static bool AnyNewBits_Scalar( const UCHAR Bits[], const UCHAR Vis[], ULONG Bytes, ULONG Start = 0 )
+{
+    for ( ULONG i = Start; i < Bytes; i += sizeof(VISWORD) )
+    {
+        if ( LoadWord( &Bits[i] ) & ~LoadWord( &Vis[i] ) ) return true;
+
+    } // Next Word
+    return false;
+}
+
+static void OrMerge_Scalar( UCHAR Dest[], const UCHAR Src[], ULONG Bytes, ULONG Start = 0 )
+{
+    for ( ULONG i = Start; i < Bytes; i += sizeof(VISWORD) )
+    {
+        StoreWord( &Dest[i], LoadWord( &Dest[i] ) | LoadWord( &Src[i] ) );
+
+    } // Next Word
+}
+
+static ULONG PopCount_Scalar( const UCHAR Bits[], ULONG Bytes, ULONG Start = 0 )
+{
+    ULONG Count = 0;
+    for ( ULONG i = Start; i < Bytes; i += sizeof(VISWORD) )
+    {
+        Count += CountWordBits( LoadWord( &Bits[i] ) );
+
+    } // Next Word
+    return Count;
+}
+
+// Adaptors matching the kernel table signatures
+static bool  AndTestNew_ScalarK( UCHAR Dest[], const UCHAR Src[], const UCHAR Test[], const UCHAR Vis[], ULONG Bytes ) { return AndTestNew_Scalar( Dest, Src, Test, Vis, Bytes ); }
+static bool  AnyNewBits_ScalarK( const UCHAR Bits[], const UCHAR Vis[], ULONG Bytes ) { return AnyNewBits_Scalar( Bits, Vis, Bytes ); }
+static void  OrMerge_ScalarK   ( UCHAR Dest[], const UCHAR Src[], ULONG Bytes ) { OrMerge_Scalar( Dest, Src, Bytes ); }
+static ULONG PopCount_ScalarK  ( const UCHAR Bits[], ULONG Bytes ) { return PopCount_Scalar( Bits, Bytes ); }
+
+#if defined(VISBITS_X86)
+
+//-----------------------------------------------------------------------------
+// SSE2 Kernels
+//-----------------------------------------------------------------------------
+VISBITS_TARGET_SSE2 static bool AndTestNew_SSE2( UCHAR Dest[], const UCHAR Src[], const UCHAR Test[], const UCHAR Vis[], ULONG Bytes )
+{
+    ULONG   i;
+    __m128i More = _mm_setzero_si128();
+
+    for ( i = 0; i + 16 <= Bytes; i += 16 )
+    {
+        __m128i Value = _mm_and_si128( _mm_loadu_si128( (const __m128i*)&Src[i] ), _mm_loadu_si128( (const __m128i*)&Test[i] ) );
+        _mm_storeu_si128( (__m128i*)&Dest[i], Value );
+        More = _mm_or_si128( More, _mm_andnot_si128( _mm_loadu_si128( (const __m128i*)&Vis[i] ), Value ) );
+
+    } // Next 128 bit Chunk
+
+    bool bMore = _mm_movemask_epi8( _mm_cmpeq_epi8( More, _mm_setzero_si128() ) ) != 0xFFFF;
+    return AndTestNew_Scalar( Dest, Src, Test, Vis, Bytes, i ) || bMore;
+}
+
+VISBITS_TARGET_SSE2 static bool AnyNewBits_SSE2( const UCHAR Bits[], const UCHAR Vis[], ULONG Bytes )
+{
+    ULONG i;
+
+    for ( i = 0; i + 16 <= Bytes; i += 16 )
+    {
+        __m128i New = _mm_andnot_si128( _mm_loadu_si128( (const __m128i*)&Vis[i] ), _mm_loadu_si128( (const __m128i*)&Bits[i] ) );
+        if ( _mm_movemask_epi8( _mm_cmpeq_epi8( New, _mm_setzero_si128() ) ) != 0xFFFF ) return true;
+
+    } // Next 128 bit Chunk
+
+    return AnyNewBits_Scalar( Bits, Vis, Bytes, i );
+}
+
+VISBITS_TARGET_SSE2 static void OrMerge_SSE2( UCHAR Dest[], const UCHAR Src[], ULONG Bytes )
+{
+    ULONG i;
+
+    for ( i = 0; i + 16 <= Bytes; i += 16 )
+    {
+        __m128i Value = _mm_or_si128( _mm_loadu_si128( (const __m128i*)&Dest[i] ), _mm_loadu_si128( (const __m128i*)&Src[i] ) );
+        _mm_storeu_si128( (__m128i*)&Dest[i], Value );
+
+    } // Next 128 bit Chunk
+
+    OrMerge_Scalar( Dest, Src, Bytes, i );
+}
+
+VISBITS_TARGET_SSE2 static ULONG PopCount_SSE2( const UCHAR Bits[], ULONG Bytes )
+{
+    ULONG   i;
+    __m128i Total = _mm_setzero_si128();
+    const __m128i Mask1 = _mm_set1_epi8( 0x55 );
+    const __m128i Mask2 = _mm_set1_epi8( 0x33 );
+    const __m128i Mask4 = _mm_set1_epi8( 0x0F );
+
+    for ( i = 0; i + 16 <= Bytes; i += 16 )
+    {
+        // Per byte SWAR bit count, then sum the bytes into the two 64 bit lanes
+        __m128i x = _mm_loadu_si128( (const __m128i*)&Bits[i] );
+        x = _mm_sub_epi8( x, _mm_and_si128( _mm_srli_epi16( x, 1 ), Mask1 ) );
+        x = _mm_add_epi8( _mm_and_si128( x, Mask2 ), _mm_and_si128( _mm_srli_epi16( x, 2 ), Mask2 ) );
+        x = _mm_and_si128( _mm_add_epi8( x, _mm_srli_epi16( x, 4 ) ), Mask4 );
+        Total = _mm_add_epi64( Total, _mm_sad_epu8( x, _mm_setzero_si128() ) );
+
+    } // Next 128 bit Chunk
+
+    ULONG Count = (ULONG)_mm_cvtsi128_si32( Total ) + (ULONG)_mm_cvtsi128_si32( _mm_srli_si128( Total, 8 ) );
+    return Count + PopCount_Scalar( Bits, Bytes, i );
+}
+
+//-----------------------------------------------------------------------------
+// AVX2 Kernels
+//-----------------------------------------------------------------------------
+VISBITS_TARGET_AVX2 static bool AndTestNew_AVX2( UCHAR Dest[], const UCHAR Src[], const UCHAR Test[], const UCHAR Vis[], ULONG Bytes )
+{
+    ULONG   i;
+    __m256i More = _mm256_setzero_si256();
+
+    for ( i = 0; i + 32 <= Bytes; i += 32 )
+    {
+        __m256i Value = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)&Src[i] ), _mm256_loadu_si256( (const __m256i*)&Test[i] ) );
+        _mm256_storeu_si256( (__m256i*)&Dest[i], Value );
+        More = _mm256_or_si256( More, _mm256_andnot_si256( _mm256_loadu_si256( (const __m256i*)&Vis[i] ), Value ) );
+
+    } // Next 256 bit Chunk
+
+    bool bMore = !_mm256_testz_si256( More, More );
+    return AndTestNew_Scalar( Dest, Src, Test, Vis, Bytes, i ) || bMore;
+}
+
+VISBITS_TARGET_AVX2 static bool AnyNewBits_AVX2( const UCHAR Bits[], const UCHAR Vis[], ULONG Bytes )
+{
+    ULONG i;
+
+    for ( i = 0; i + 32 <= Bytes; i += 32 )
+    {
+        // testc returns 1 when every bit set in Bits is also set in Vis
+        if ( !_mm256_testc_si256( _mm256_loadu_si256( (const __m256i*)&Vis[i] ), _mm256_loadu_si256( (const __m256i*)&Bits[i] ) ) ) return true;
+
+    } // Next 256 bit Chunk
+
+    return AnyNewBits_Scalar( Bits, Vis, Bytes, i );
+}
+
+VISBITS_TARGET_AVX2 static void OrMerge_AVX2( UCHAR Dest[], const UCHAR Src[], ULONG Bytes )
+{
+    ULONG i;
+
+    for ( i = 0; i + 32 <= Bytes; i += 32 )
+    {
+        __m256i Value = _mm256_or_si256( _mm256_loadu_si256( (const __m256i*)&Dest[i] ), _mm256_loadu_si256( (const __m256i*)&Src[i] ) );
+        _mm256_storeu_si256( (__m256i*)&Dest[i], Value );
+
+    } // Next 256 bit Chunk
+
+    OrMerge_Scalar( Dest, Src, Bytes, i );
+}
+
+VISBITS_TARGET_AVX2 static ULONG PopCount_AVX2( const UCHAR Bits[], ULONG Bytes )
+{
+    ULONG   i;
+    __m256i Total = _mm256_setzero_si256();
+    const __m256i Table = _mm256_setr_epi8( 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 );
+    const __m256i Low  = _mm256_set1_epi8( 0x0F );
+
+    for ( i = 0; i + 32 <= Bytes; i += 32 )
+    {
+        // Nibble table lookup, then sum the bytes into the four 64 bit lanes
+        __m256i x  = _mm256_loadu_si256( (const __m256i*)&Bits[i] );
+        __m256i Lo = _mm256_shuffle_epi8( Table, _mm256_and_si256( x, Low ) );
+        __m256i Hi = _mm256_shuffle_epi8( Table, _mm256_and_si256( _mm256_srli_epi16( x, 4 ), Low ) );
+        Total = _mm256_add_epi64( Total, _mm256_sad_epu8( _mm256_add_epi8( Lo, Hi ), _mm256_setzero_si256() ) );
+
+    } // Next 256 bit Chunk
+
+    __m128i Sum = _mm_add_epi64( _mm256_castsi256_si128( Total ), _mm256_extracti128_si256( Total, 1 ) );
+    ULONG Count = (ULONG)_mm_cvtsi128_si32( Sum ) + (ULONG)_mm_cvtsi128_si32( _mm_srli_si128( Sum, 8 ) );
+    return Count + PopCount_Scalar( Bits, Bytes, i );
+}
+
+#endif // VISBITS_X86
+
+//-----------------------------------------------------------------------------
+// Kernel Tables
+//-----------------------------------------------------------------------------
+static const VISBITSKERNELS g_KernelsScalar = { VBK_SCALAR, _T("Scalar"), AndTestNew_ScalarK, AnyNewBits_ScalarK, OrMerge_ScalarK, PopCount_ScalarK };
+#if defined(VISBITS_X86)
+static const VISBITSKERNELS g_KernelsSSE2   = { VBK_SSE2,   _T("SSE2"),   AndTestNew_SSE2,    AnyNewBits_SSE2,    OrMerge_SSE2,    PopCount_SSE2    };
+static const VISBITSKERNELS g_KernelsAVX2   = { VBK_AVX2,   _T("AVX2"),   AndTestNew_AVX2,    AnyNewBits_AVX2,    OrMerge_AVX2,    PopCount_AVX2    };
+#endif
+
+//-----------------------------------------------------------------------------
+// Static Member Definitions
+//-----------------------------------------------------------------------------
+VISBITSKERNELS CVisBits::m_Kernels = *CVisBits::GetKernels( VBK_AUTO );
+
+//-----------------------------------------------------------------------------
+// Name : IsSupported () (Static)
+// Desc : Determine whether the host processor (and OS) can run the specified
+//        kernel set.
+//-----------------------------------------------------------------------------
+bool CVisBits::IsSupported( VISBITSKERNEL Kernel )
+{
+    switch ( Kernel )
+    {
+        case VBK_AUTO:
+        case VBK_SCALAR:
+            return true;
+
+#if defined(VISBITS_X86)
+    #if defined(_MSC_VER)
+        case VBK_SSE2:
+        case VBK_AVX2:
+        {
+            int Info[4];
+            __cpuid( Info, 0 );
+            int MaxLeaf = Info[0];
+
+            __cpuid( Info, 1 );
+            if ( Kernel == VBK_SSE2 ) return (Info[3] & (1 << 26)) != 0;
+
+            // AVX2 also requires the OS to save the YMM registers
+            if ( !(Info[2] & (1 << 27)) || !(Info[2] & (1 << 28)) || MaxLeaf < 7 ) return false;
+            if ( (_xgetbv( 0 ) & 6) != 6 ) return false;
+            __cpuidex( Info, 7, 0 );
+            return (Info[1] & (1 << 5)) != 0;
+
+        } // End Case
+    #else
+        case VBK_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports( "sse2" ) != 0;
+
+        case VBK_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports( "avx2" ) != 0;
+    #endif
+#endif
+        default:
+            return false;
+
+    } // End Switch
+}
+
+//-----------------------------------------------------------------------------
+// Name : GetKernels () (Static, Private)
+// Desc : Retrieve the kernel table for the specified set. VBK_AUTO returns the
+//        widest set supported by this processor.
+//-----------------------------------------------------------------------------
+const VISBITSKERNELS * CVisBits::GetKernels( VISBITSKERNEL Kernel )
+{
+    if ( !IsSupported( Kernel ) ) return NULL;
+
+    switch ( Kernel )
+    {
+#if defined(VISBITS_X86)
+        case VBK_AUTO:
+            if ( IsSupported( VBK_AVX2 ) ) return &g_KernelsAVX2;
+            if ( IsSupported( VBK_SSE2 ) ) return &g_KernelsSSE2;
+            return &g_KernelsScalar;
+
+        case VBK_SSE2:
+            return &g_KernelsSSE2;
+
+        case VBK_AVX2:
+            return &g_KernelsAVX2;
+#endif
+        default:
+            return &g_KernelsScalar;
+
+    } // End Switch
+}
+
+//-----------------------------------------------------------------------------
+// Name : SelectKernels () (Static)
+// Desc : Select the kernel set used by all subsequent operations.
+// Note : This must not be called while a compile is in progress.
+//-----------------------------------------------------------------------------
+bool CVisBits::SelectKernels( VISBITSKERNEL Kernel /* = VBK_AUTO */ )
+{
+    const VISBITSKERNELS * pKernels = GetKernels( Kernel );
+    if ( !pKernels ) return false;
+
+    m_Kernels = *pKernels;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name : Benchmark () (Static)
+// Desc : Times each supported kernel set against the scalar kernels using
+//        vis sets sized for the specified leaf count, and logs the results.
+//-----------------------------------------------------------------------------
+void CVisBits::Benchmark( ILogger * pLogger, ULONG Channel, ULONG LeafCount )
+{
+    typedef std::chrono::high_resolution_clock Clock;
+
+    if ( !pLogger || LeafCount == 0 ) return;
+
+    ULONG Bytes      = AlignSetSize( (LeafCount + 7) / 8 );
+    ULONG Iterations = (64 * 1024 * 1024) / Bytes;
+    if ( Iterations < 1000 ) Iterations = 1000;
+
+    // Build a set of pseudo random vis sets, Vis has roughly 3/4 of its bits set
+    // so that the early out test has to scan most of the set before failing.
+    std::vector<UCHAR> Src( Bytes ), Test( Bytes ), Vis( Bytes ), Dest( Bytes );
+    ULONG Seed = 0x12345678;
+    for ( ULONG i = 0; i < Bytes; i++ )
+    {
+        Seed = Seed * 1664525 + 1013904223; Src[i]  = (UCHAR)(Seed >> 24);
+        Seed = Seed * 1664525 + 1013904223; Test[i] = (UCHAR)(Seed >> 24);
+        Seed = Seed * 1664525 + 1013904223; Vis[i]  = (UCHAR)(Seed >> 24) | (UCHAR)(Seed >> 16);
+
+    } // Next Byte
+
+    pLogger->LogWrite( Channel, 0, true, _T("Vis bit kernel benchmark (%i leaves, %i bytes per set, %i iterations)"), LeafCount, Bytes, Iterations );
+
+    double  ScalarTime[3] = { 0, 0, 0 };
+    ULONG   Check         = 0;
+    VISBITSKERNEL Sets[]  = { VBK_SCALAR, VBK_SSE2, VBK_AVX2 };
+
+    for ( ULONG k = 0; k < 3; k++ )
+    {
+        const VISBITSKERNELS * pKernels = GetKernels( Sets[k] );
+        if ( !pKernels ) continue;
+
+        double   Time[3];
+        ULONG    Result = 0;
+
+        // AND with test and early out
+        Clock::time_point Start = Clock::now();
+        for ( ULONG n = 0; n < Iterations; n++ ) Result += pKernels->AndTestNew( &Dest[0], &Src[0], &Test[0], &Vis[0], Bytes ) ? 1 : 0;
+        Time[0] = std::chrono::duration<double>( Clock::now() - Start ).count();
+
+        // OR merge
+        Start = Clock::now();
+        for ( ULONG n = 0; n < Iterations; n++ ) pKernels->OrMerge( &Dest[0], &Src[0], Bytes );
+        Time[1] = std::chrono::duration<double>( Clock::now() - Start ).count();
+
+        // Population count
+        Start = Clock::now();
+        for ( ULONG n = 0; n < Iterations; n++ ) Result += pKernels->PopCount( &Dest[0], Bytes );
+        Time[2] = std::chrono::duration<double>( Clock::now() - Start ).count();
+
+        // All sets must agree with the scalar results
+        if ( k == 0 ) { Check = Result; for ( ULONG t = 0; t < 3; t++ ) ScalarTime[t] = Time[t]; }
+
+        pLogger->LogWrite( Channel, 0, true, _T("    %-6s : and/test %.1f ns (%.2fx), or %.1f ns (%.2fx), popcount %.1f ns (%.2fx)%s"), pKernels->Name,
+                           Time[0] * 1e9 / Iterations, ScalarTime[0] / Time[0],
+                           Time[1] * 1e9 / Iterations, ScalarTime[1] / Time[1],
+                           Time[2] * 1e9 / Iterations, ScalarTime[2] / Time[2],
+                           (Result == Check) ? _T("") : _T(" - RESULT MISMATCH") );
+
+        // Reset the destination so each set starts from the same state
+        memset( &Dest[0], 0, Bytes );
+
+    } // Next Kernel Set
+}
\ No newline at end of file
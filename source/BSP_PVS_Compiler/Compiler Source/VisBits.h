@@ -0,0 +1,88 @@
+//-----------------------------------------------------------------------------
+// File: VisBits.h
+//
+// Desc: Visibility bit set kernels used by the PVS compiler. Each operation
+//       has a scalar implementation along with SSE2 and AVX2 versions, the
+//       best set supported by the host processor is selected at run time.
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+#ifndef _VISBITS_H_
+#define _VISBITS_H_
+
+//-----------------------------------------------------------------------------
+// CVisBits Specific Includes
+//-----------------------------------------------------------------------------
+#include "../Support Source/Common.h"
+
+//-----------------------------------------------------------------------------
+// Miscellaneous Definitions
+//-----------------------------------------------------------------------------
+#define VISBITS_SET_ALIGNMENT   8       // All vis sets must be a multiple of this many bytes
+
+//-----------------------------------------------------------------------------
+// Typedefs, structures & enumerators
+//-----------------------------------------------------------------------------
+enum VISBITSKERNEL                      // Available kernel sets
+{
+    VBK_AUTO    = 0,                    // Select the best set supported by the processor
+    VBK_SCALAR  = 1,                    // Portable 64 bit scalar kernels
+    VBK_SSE2    = 2,                    // 128 bit SSE2 kernels
+    VBK_AVX2    = 3                     // 256 bit AVX2 kernels
+};
+
+typedef bool  (*VISANDTESTPROC) ( UCHAR Dest[], const UCHAR Src[], const UCHAR Test[], const UCHAR Vis[], ULONG Bytes );
+typedef bool  (*VISANYNEWPROC)  ( const UCHAR Bits[], const UCHAR Vis[], ULONG Bytes );
+typedef void  (*VISORMERGEPROC) ( UCHAR Dest[], const UCHAR Src[], ULONG Bytes );
+typedef ULONG (*VISPOPCOUNTPROC)( const UCHAR Bits[], ULONG Bytes );
+
+typedef struct _VISBITSKERNELS          // A complete set of kernel functions
+{
+    VISBITSKERNEL       Kernel;         // Which set this is
+    LPCTSTR             Name;           // Name used for logging
+    VISANDTESTPROC      AndTestNew;     // Dest = Src & Test, returns true if Dest has bits not in Vis
+    VISANYNEWPROC       AnyNewBits;     // Returns true if Bits has bits not in Vis
+    VISORMERGEPROC      OrMerge;        // Dest |= Src
+    VISPOPCOUNTPROC     PopCount;       // Returns the number of set bits
+} VISBITSKERNELS;
+
+//-----------------------------------------------------------------------------
+// Main Class Definitions
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// Name : CVisBits (Static Class)
+// Desc : Dispatches the vis bit set operations to the selected kernel set.
+// Note : All sizes passed must be a multiple of VISBITS_SET_ALIGNMENT bytes,
+//        no alignment requirement is placed on the array addresses.
+//-----------------------------------------------------------------------------
+class CVisBits
+{
+public:
+    //-------------------------------------------------------------------------
+	// Public Static Functions for This Class
+	//-------------------------------------------------------------------------
+    static bool         AndTestNew      ( UCHAR Dest[], const UCHAR Src[], const UCHAR Test[], const UCHAR Vis[], ULONG Bytes ) { return m_Kernels.AndTestNew( Dest, Src, Test, Vis, Bytes ); }
+    static bool         AnyNewBits      ( const UCHAR Bits[], const UCHAR Vis[], ULONG Bytes ) { return m_Kernels.AnyNewBits( Bits, Vis, Bytes ); }
+    static void         OrMerge         ( UCHAR Dest[], const UCHAR Src[], ULONG Bytes ) { m_Kernels.OrMerge( Dest, Src, Bytes ); }
+    static ULONG        PopCount        ( const UCHAR Bits[], ULONG Bytes ) { return m_Kernels.PopCount( Bits, Bytes ); }
+
+    static ULONG        AlignSetSize    ( ULONG Bytes ) { return (Bytes + (VISBITS_SET_ALIGNMENT - 1)) & ~(ULONG)(VISBITS_SET_ALIGNMENT - 1); }
+    static bool         IsSupported     ( VISBITSKERNEL Kernel );
+    static bool         SelectKernels   ( VISBITSKERNEL Kernel = VBK_AUTO );
+    static LPCTSTR      GetKernelName   ( ) { return m_Kernels.Name; }
+    static void         Benchmark       ( ILogger * pLogger, ULONG Channel, ULONG LeafCount );
+
+private:
+    //-------------------------------------------------------------------------
+	// Private Static Functions for This Class
+	//-------------------------------------------------------------------------
+    static const VISBITSKERNELS * GetKernels( VISBITSKERNEL Kernel );
+
+    //-------------------------------------------------------------------------
+	// Private Static Variables for This Class
+	//-------------------------------------------------------------------------
+    static VISBITSKERNELS   m_Kernels;          // The currently selected kernel set
+};
+
+#endif // _VISBITS_H_
\ No newline at end of file
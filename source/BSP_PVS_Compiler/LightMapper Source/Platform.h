@@ -53,6 +53,7 @@
 
 //#include <limits.h>
 #include <float.h>
+#include <stddef.h>
 
 namespace LightMapper {
 
@@ -66,7 +67,6 @@ namespace LightMapper {
 	typedef unsigned int uint32;
 	typedef   signed int  int32;
 
-#include <stddef.h>
 	typedef ptrdiff_t intptr;
 
 #ifdef _WIN32
@@ -0,0 +1,501 @@
+////////////////////////////////////////////////////////////////////
+// Filename:	BrushCache.cpp
+//
+// Description:	Binary cache of parsed .MAP files, so unchanged maps
+//				do not have to be tokenized and CSG merged again.
+////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "BrushCache.h"
+#include "MappedFile.h"
+#include "ParserMath.h"
+
+//
+// The build defines the stamp as a hash of the parser sources, so any
+// change to the tokenizer or CSG code invalidates old caches. Without
+// it, fall back to when this file was compiled.
+//
+#ifndef BRUSH_CACHE_PARSER_STAMP
+#define BRUSH_CACHE_PARSER_STAMP	__DATE__ " " __TIME__
+#endif
+
+const unsigned int BRUSH_CACHE_ID = ('B' | 'R' << 8 | 'C' << 16 | 'H' << 24);
+const unsigned int BRUSH_CACHE_MAX_STRING = 65536;	// Longer strings mean the cache is corrupt
+
+
+////////////////////////////////////////////////////////////////////
+// Stream helpers
+////////////////////////////////////////////////////////////////////
+
+template <class T> static void WriteValue(ofstream &ofsFile_, const T &Value_)
+{
+	ofsFile_.write((const char *)&Value_, sizeof(T));
+}
+
+
+static void WriteString(ofstream &ofsFile_, const char *pcString_)
+{
+	unsigned int ui = (pcString_ != NULL) ? (unsigned int)strlen(pcString_) : 0;
+
+	WriteValue(ofsFile_, ui);
+	ofsFile_.write(pcString_, ui);
+}
+
+
+template <class T> static bool ReadValue(ifstream &ifsFile_, T &Value_)
+{
+	return ifsFile_.read((char *)&Value_, sizeof(T)).good();
+}
+
+
+static bool ReadString(ifstream &ifsFile_, string &String_)
+{
+	unsigned int ui = 0;
+
+	if ((!ReadValue(ifsFile_, ui)) || (ui > BRUSH_CACHE_MAX_STRING))
+	{
+		return false;
+	}
+
+	String_.resize(ui);
+
+	return (ui == 0) || ifsFile_.read(&String_[0], ui).good();
+}
+
+
+////////////////////////////////////////////////////////////////////
+// BrushCache member functions
+////////////////////////////////////////////////////////////////////
+
+unsigned long long BrushCache::HashData(const void *pData_, size_t uiSize_)
+{
+	//
+	// FNV-1a, one byte at a time
+	//
+	const unsigned char	*pData = (const unsigned char *)pData_;
+	unsigned long long	ullHash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < uiSize_; i++)
+	{
+		ullHash ^= pData[i];
+		ullHash *= 1099511628211ULL;
+	}
+
+	return ullHash;
+}
+
+
+unsigned long long BrushCache::GetParserStamp()
+{
+	//
+	// The parsed polygons also depend on the parser itself, so the key
+	// carries the parser sources' stamp and the compile time constants
+	// that shape its output
+	//
+	ostringstream	ossStamp;
+
+	ossStamp << BRUSH_CACHE_PARSER_STAMP << ' ' << scale << ' ' << MAX_TEXTURE_NAME_LENGTH << ' '
+		<< sizeof(Vertex) << ' ' << sizeof(Poly::TextureID) << ' ' << sizeof(Plane::d);
+
+	string Stamp = ossStamp.str();
+
+	return HashData(Stamp.data(), Stamp.length());
+}
+
+
+void BrushCache::SetMap(const char *pcFile_, const void *pData_, size_t uiSize_)
+{
+	m_CacheFile = pcFile_;
+	m_CacheFile += ".cache";
+
+	m_Map.Name = pcFile_;
+	m_Map.ullSize = uiSize_;
+	m_Map.ullHash = HashData(pData_, uiSize_);
+
+	m_vWADs.clear();
+}
+
+
+void BrushCache::AddWAD(const char *pcFile_, const void *pData_, size_t uiSize_)
+{
+	Source	WAD;
+
+	WAD.Name = pcFile_;
+	WAD.ullSize = uiSize_;
+	WAD.ullHash = HashData(pData_, uiSize_);
+
+	m_vWADs.push_back(WAD);
+}
+
+
+bool BrushCache::ReadSources(ifstream &ifsFile_) const
+{
+	unsigned int		ui;
+	unsigned long long	ullSize, ullHash;
+
+	if ((!ReadValue(ifsFile_, ui)) || (ui != BRUSH_CACHE_ID))
+	{
+		return false;
+	}
+
+	if ((!ReadValue(ifsFile_, ui)) || (ui != BRUSH_CACHE_VERSION))
+	{
+		return false;
+	}
+
+	if ((!ReadValue(ifsFile_, ullHash)) || (ullHash != GetParserStamp()))
+	{	// Written by a different build of the parser
+		return false;
+	}
+
+	if ((!ReadValue(ifsFile_, ullSize)) || (!ReadValue(ifsFile_, ullHash)))
+	{
+		return false;
+	}
+
+	if ((ullSize != m_Map.ullSize) || (ullHash != m_Map.ullHash))
+	{	// Map has changed
+		return false;
+	}
+
+	//
+	// Every WAD the map was parsed with must still be the same
+	//
+	unsigned int uiWADs;
+
+	if (!ReadValue(ifsFile_, uiWADs))
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < uiWADs; i++)
+	{
+		string		Name;
+		MappedFile	WAD;
+
+		if ((!ReadString(ifsFile_, Name)) || (!ReadValue(ifsFile_, ullSize)) || (!ReadValue(ifsFile_, ullHash)))
+		{
+			return false;
+		}
+
+		if ((!WAD.Open(Name.c_str())) || (WAD.GetSize() != ullSize))
+		{
+			return false;
+		}
+
+		if (HashData(WAD.GetData(), WAD.GetSize()) != ullHash)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+bool BrushCache::ReadLists(ifstream &ifsFile_, Entity *&pEntityList_, Texture *&pTextureList_) const
+{
+	//
+	// Everything read is linked into the lists as soon as it is
+	// allocated, so the caller can free a partial read
+	//
+	Entity			*pEntityTail = NULL;
+	Texture			*pTextureTail = NULL;
+	unsigned int	uiCount, i, j, k;
+	string			Name, Value;
+
+	//
+	// Textures
+	//
+	if (!ReadValue(ifsFile_, uiCount))
+	{
+		return false;
+	}
+
+	for (i = 0; i < uiCount; i++)
+	{
+		int	iWidth, iHeight;
+
+		Texture	*pTexture = new Texture;
+
+		if (pTextureList_ == NULL)
+		{
+			pTextureList_ = pTexture;
+		}
+		else
+		{
+			pTextureTail->SetNext(pTexture);
+		}
+
+		pTextureTail = pTexture;
+
+		if ((!ReadString(ifsFile_, Name)) || (Name.length() > MAX_TEXTURE_NAME_LENGTH) ||
+			(!ReadValue(ifsFile_, pTexture->uiID)) || (!ReadValue(ifsFile_, iWidth)) || (!ReadValue(ifsFile_, iHeight)))
+		{
+			return false;
+		}
+
+		strcpy(pTexture->name, Name.c_str());
+		pTexture->SetSize(iWidth, iHeight);
+	}
+
+	//
+	// Entities
+	//
+	if (!ReadValue(ifsFile_, uiCount))
+	{
+		return false;
+	}
+
+	for (i = 0; i < uiCount; i++)
+	{
+		Entity	*pEntity = new Entity;
+
+		if (pEntityList_ == NULL)
+		{
+			pEntityList_ = pEntity;
+		}
+		else
+		{
+			pEntityTail->m_pNext = pEntity;
+		}
+
+		pEntityTail = pEntity;
+
+		unsigned int	uiProperties, uiPolys;
+		Property		*pPropertyTail = NULL;
+		Poly			*pPolyTail = NULL;
+
+		if (!ReadValue(ifsFile_, uiProperties))
+		{
+			return false;
+		}
+
+		for (j = 0; j < uiProperties; j++)
+		{
+			Property *pProperty = new Property;
+
+			if (pEntity->m_pProperties == NULL)
+			{
+				pEntity->m_pProperties = pProperty;
+			}
+			else
+			{
+				pPropertyTail->SetNext(pProperty);
+			}
+
+			pPropertyTail = pProperty;
+
+			if ((!ReadString(ifsFile_, Name)) || (!ReadString(ifsFile_, Value)))
+			{
+				return false;
+			}
+
+			pProperty->SetName(Name.c_str());
+			pProperty->SetValue(Value.c_str());
+		}
+
+		if (!ReadValue(ifsFile_, uiPolys))
+		{
+			return false;
+		}
+
+		for (j = 0; j < uiPolys; j++)
+		{
+			Poly *pPoly = new Poly;
+
+			if (pEntity->m_pPolys == NULL)
+			{
+				pEntity->m_pPolys = pPoly;
+			}
+			else
+			{
+				pPolyTail->SetNext(pPoly);
+			}
+
+			pPolyTail = pPoly;
+
+			unsigned int uiVertices;
+
+			if ((!ReadValue(ifsFile_, pPoly->TextureID)) ||
+				(!ReadValue(ifsFile_, pPoly->plane.n.x)) || (!ReadValue(ifsFile_, pPoly->plane.n.y)) ||
+				(!ReadValue(ifsFile_, pPoly->plane.n.z)) || (!ReadValue(ifsFile_, pPoly->plane.d)) ||
+				(!ReadValue(ifsFile_, uiVertices)) || (uiVertices > BRUSH_CACHE_MAX_STRING))
+			{
+				return false;
+			}
+
+			pPoly->verts = new Vertex[uiVertices];
+			pPoly->m_iNumberOfVertices = uiVertices;
+
+			for (k = 0; k < uiVertices; k++)
+			{
+				Vertex &v = pPoly->verts[k];
+
+				if ((!ReadValue(ifsFile_, v.p.x)) || (!ReadValue(ifsFile_, v.p.y)) || (!ReadValue(ifsFile_, v.p.z)) ||
+					(!ReadValue(ifsFile_, v.tex[0])) || (!ReadValue(ifsFile_, v.tex[1])))
+				{
+					return false;
+				}
+			}
+		}
+	}
+
+	//
+	// The cache is only complete if it was closed by its id
+	//
+	unsigned int ui;
+
+	return ReadValue(ifsFile_, ui) && (ui == BRUSH_CACHE_ID);
+}
+
+
+bool BrushCache::Read(Entity **ppEntities_, Texture **ppTextures_) const
+{
+	ifstream	ifsFile(m_CacheFile.c_str(), ios::in | ios::binary);
+
+	if ((!ifsFile.is_open()) || (!ReadSources(ifsFile)))
+	{
+		return false;
+	}
+
+	Entity	*pEntityList = NULL;
+	Texture	*pTextureList = NULL;
+
+	if (!ReadLists(ifsFile, pEntityList, pTextureList))
+	{
+		delete pEntityList;
+		delete pTextureList;
+
+		return false;
+	}
+
+	*ppEntities_ = pEntityList;
+	*ppTextures_ = pTextureList;
+
+	return true;
+}
+
+
+bool BrushCache::Write(const Entity *pEntities_, const Texture *pTextures_) const
+{
+	ofstream	ofsFile(m_CacheFile.c_str(), ios::out | ios::binary | ios::trunc);
+
+	if (!ofsFile.is_open())
+	{
+		return false;
+	}
+
+	unsigned int	ui;
+	size_t			i;
+
+	//
+	// Key
+	//
+	WriteValue(ofsFile, BRUSH_CACHE_ID);
+	WriteValue(ofsFile, BRUSH_CACHE_VERSION);
+	WriteValue(ofsFile, GetParserStamp());
+	WriteValue(ofsFile, m_Map.ullSize);
+	WriteValue(ofsFile, m_Map.ullHash);
+
+	ui = (unsigned int)m_vWADs.size();
+	WriteValue(ofsFile, ui);
+
+	for (i = 0; i < m_vWADs.size(); i++)
+	{
+		WriteString(ofsFile, m_vWADs[i].Name.c_str());
+		WriteValue(ofsFile, m_vWADs[i].ullSize);
+		WriteValue(ofsFile, m_vWADs[i].ullHash);
+	}
+
+	//
+	// Textures
+	//
+	const Texture *pTexture;
+
+	for (ui = 0, pTexture = pTextures_; pTexture != NULL; pTexture = pTexture->GetNext())
+	{
+		ui++;
+	}
+
+	WriteValue(ofsFile, ui);
+
+	for (pTexture = pTextures_; pTexture != NULL; pTexture = pTexture->GetNext())
+	{
+		int iWidth = pTexture->GetWidth(), iHeight = pTexture->GetHeight();
+
+		WriteString(ofsFile, pTexture->name);
+		WriteValue(ofsFile, pTexture->uiID);
+		WriteValue(ofsFile, iWidth);
+		WriteValue(ofsFile, iHeight);
+	}
+
+	//
+	// Entities
+	//
+	const Entity *pEntity;
+
+	for (ui = 0, pEntity = pEntities_; pEntity != NULL; pEntity = pEntity->GetNext())
+	{
+		ui++;
+	}
+
+	WriteValue(ofsFile, ui);
+
+	for (pEntity = pEntities_; pEntity != NULL; pEntity = pEntity->GetNext())
+	{
+		const Property	*pProperty;
+		const Poly		*pPoly;
+
+		ui = pEntity->GetNumberOfProperties();
+		WriteValue(ofsFile, ui);
+
+		for (pProperty = pEntity->m_pProperties; pProperty != NULL; pProperty = pProperty->GetNext())
+		{
+			WriteString(ofsFile, pProperty->GetName());
+			WriteString(ofsFile, pProperty->GetValue());
+		}
+
+		ui = pEntity->GetNumberOfPolys();
+		WriteValue(ofsFile, ui);
+
+		for (pPoly = pEntity->GetPolys(); pPoly != NULL; pPoly = pPoly->GetNext())
+		{
+			WriteValue(ofsFile, pPoly->TextureID);
+			WriteValue(ofsFile, pPoly->plane.n.x);
+			WriteValue(ofsFile, pPoly->plane.n.y);
+			WriteValue(ofsFile, pPoly->plane.n.z);
+			WriteValue(ofsFile, pPoly->plane.d);
+
+			ui = (unsigned int)pPoly->GetNumberOfVertices();
+			WriteValue(ofsFile, ui);
+
+			for (int k = 0; k < pPoly->GetNumberOfVertices(); k++)
+			{
+				const Vertex &v = pPoly->verts[k];
+
+				WriteValue(ofsFile, v.p.x);
+				WriteValue(ofsFile, v.p.y);
+				WriteValue(ofsFile, v.p.z);
+				WriteValue(ofsFile, v.tex[0]);
+				WriteValue(ofsFile, v.tex[1]);
+			}
+		}
+	}
+
+	WriteValue(ofsFile, BRUSH_CACHE_ID);
+
+	ofsFile.close();
+
+	if (ofsFile.fail())
+	{
+		remove(m_CacheFile.c_str());
+
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+const unsigned int BRUSH_CACHE_VERSION = 3;
+
+////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "ParserStructures.h"
+
+////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////
+
+//
+// Binary copy of a parsed .MAP file (entities with their merged
+// polygons and the resolved textures), stored next to the map. It is
+// keyed on the parser build, and on the size and content hash of the map
+// and of every WAD the map used, so any change to them makes the parser
+// read the map again.
+//
+class BrushCache
+{
+private:
+	struct Source
+	{
+		string				Name;
+		unsigned long long	ullSize;
+		unsigned long long	ullHash;
+	};
+
+	string			m_CacheFile;
+	Source			m_Map;
+	vector<Source>	m_vWADs;
+
+	bool ReadSources(ifstream &ifsFile_) const;
+	bool ReadLists(ifstream &ifsFile_, Entity *&pEntityList_, Texture *&pTextureList_) const;
+
+public:
+	static unsigned long long HashData(const void *pData_, size_t uiSize_);
+	static unsigned long long GetParserStamp();
+
+	void SetMap(const char *pcFile_, const void *pData_, size_t uiSize_);
+	void AddWAD(const char *pcFile_, const void *pData_, size_t uiSize_);
+
+	bool Read(Entity **ppEntities_, Texture **ppTextures_) const;
+	bool Write(const Entity *pEntities_, const Texture *pTextures_) const;
+};
@@ -0,0 +1,193 @@
+////////////////////////////////////////////////////////////////////
+// Filename:	MappedFile.cpp
+//
+// Description:	Read only, memory mapped view of a whole file with a
+//				Win32 and a POSIX implementation.
+////////////////////////////////////////////////////////////////////
+
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+MappedFile::MappedFile()
+{
+	m_pcData = NULL;
+	m_uiSize = 0;
+	m_bMapped = false;
+}
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+bool MappedFile::Open(const char *pcFile_, bool bSequential_)
+{
+	Close();
+
+	if (pcFile_ == NULL)
+	{
+		return false;
+	}
+
+#ifndef _WIN32
+	//
+	// Paths in .MAP files (WAD lists) are usually written on Windows
+	//
+	std::string Path(pcFile_);
+
+	std::replace(Path.begin(), Path.end(), '\\', '/');
+	pcFile_ = Path.c_str();
+#endif
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(pcFile_, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		bSequential_ ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+	{	// Failed to open file
+		return false;
+	}
+
+	LARGE_INTEGER liSize;
+
+	if ((GetFileSizeEx(hFile, &liSize) == FALSE) || ((ULONGLONG)liSize.QuadPart != (size_t)liSize.QuadPart))
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	m_uiSize = (size_t)liSize.QuadPart;
+
+	if (m_uiSize == 0)
+	{	// Nothing to map, an empty file is still valid
+		CloseHandle(hFile);
+		return true;
+	}
+
+	HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (hMapping != NULL)
+	{
+		m_pcData = (const char *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+
+		// The view keeps the mapping alive
+		CloseHandle(hMapping);
+	}
+
+	CloseHandle(hFile);
+#else
+	int iFile = open(pcFile_, O_RDONLY);
+
+	if (iFile < 0)
+	{	// Failed to open file
+		return false;
+	}
+
+	struct stat st;
+
+	if ((fstat(iFile, &st) != 0) || (st.st_size < 0))
+	{
+		close(iFile);
+		return false;
+	}
+
+	m_uiSize = (size_t)st.st_size;
+
+	if (m_uiSize == 0)
+	{	// Nothing to map, an empty file is still valid
+		close(iFile);
+		return true;
+	}
+
+	void *pView = mmap(NULL, m_uiSize, PROT_READ, MAP_PRIVATE, iFile, 0);
+
+	if (pView != MAP_FAILED)
+	{
+		madvise(pView, m_uiSize, bSequential_ ? MADV_SEQUENTIAL : MADV_RANDOM);
+		m_pcData = (const char *)pView;
+	}
+
+	// The mapping stays valid once the descriptor is closed
+	close(iFile);
+#endif
+
+	if (m_pcData != NULL)
+	{
+		m_bMapped = true;
+		return true;
+	}
+
+	//
+	// Could not map the file, read it in one go instead
+	//
+	return ReadWhole(pcFile_);
+}
+
+
+bool MappedFile::ReadWhole(const char *pcFile_)
+{
+	FILE *pFile = fopen(pcFile_, "rb");
+
+	if (pFile == NULL)
+	{
+		m_uiSize = 0;
+		return false;
+	}
+
+	char *pcBuffer = (char *)malloc(m_uiSize);
+
+	if ((pcBuffer == NULL) || (fread(pcBuffer, 1, m_uiSize, pFile) != m_uiSize))
+	{
+		free(pcBuffer);
+		fclose(pFile);
+		m_uiSize = 0;
+		return false;
+	}
+
+	fclose(pFile);
+
+	m_pcData = pcBuffer;
+	m_bMapped = false;
+
+	return true;
+}
+
+
+void MappedFile::Close()
+{
+	if (m_pcData != NULL)
+	{
+		if (m_bMapped)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(m_pcData);
+#else
+			munmap((void *)m_pcData, m_uiSize);
+#endif
+		}
+		else
+		{
+			free((void *)m_pcData);
+		}
+	}
+
+	m_pcData = NULL;
+	m_uiSize = 0;
+	m_bMapped = false;
+}
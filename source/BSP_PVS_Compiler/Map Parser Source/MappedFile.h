@@ -0,0 +1,36 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+
+////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////
+
+//
+// Read only view of an entire file. The file is memory mapped
+// (CreateFileMapping on Win32, mmap elsewhere) and falls back to
+// reading it into a single heap buffer if it cannot be mapped.
+//
+class MappedFile
+{
+private:
+	const char	*m_pcData;
+	size_t		m_uiSize;
+	bool		m_bMapped;
+
+	bool ReadWhole(const char *pcFile_);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const char *pcFile_, bool bSequential_ = true);	// Hint whether the file is read front to back
+	void Close();
+
+	const char *GetData() const { return m_pcData; }
+	size_t GetSize() const { return m_uiSize; }
+};
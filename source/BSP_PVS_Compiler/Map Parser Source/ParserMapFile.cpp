@@ -10,20 +10,40 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cmath>
+#include <cctype>
+#include <cstring>
+#include <chrono>
+#include <thread>
 
 using namespace std;
 
 #include "WAD3.h"
-#include "ParserMAPFile.h"
+#include "ParserMapFile.h"
 
-static wchar_t *convertCharArrayToLPCWSTR(const char* charArray)
+ParserMAPFile::ParserMAPFile()
 {
-	wchar_t* wString = new wchar_t[4096];
-	MultiByteToWideChar(CP_ACP, 0, charArray, -1, wString, 4096);
-	return wString;
+	m_uiThreads = 0;
+	m_bBrushCache = false;
+	m_pfnMessage = NULL;
+	m_pMessageContext = NULL;
 }
 
+
+void ParserMAPFile::Message(bool bError_, const string &Message_) const
+{
+	if (m_pfnMessage != NULL)
+	{
+		m_pfnMessage(m_pMessageContext, bError_, Message_.c_str());
+	}
+	else
+	{
+		cout << Message_ << endl;
+	}
+}
+
+
 ParserMAPFile::Result ParserMAPFile::ParseEntity(Entity **ppEntity_)
 {
 	//
@@ -51,9 +71,9 @@ ParserMAPFile::Result ParserMAPFile::ParseEntity(Entity **ppEntity_)
 		return RESULT_FAIL;
 	}
 
-	if (strcmp("{", m_acToken) != 0)
+	if (!TokenIs("{"))
 	{
-		cout << "Expected:\t{\nFound:\t" << m_acToken << endl;
+		Message(true, string("Expected:\t{\nFound:\t") + TokenString());
 
 		return RESULT_FAIL;
 	}
@@ -65,20 +85,7 @@ ParserMAPFile::Result ParserMAPFile::ParseEntity(Entity **ppEntity_)
 
 	while (true)
 	{
-		char	c = 0;
-		DWORD	dwRead = 0;
-
-		if (ReadFile(m_hFile, &c, 1, &dwRead, NULL) == FALSE)
-		{
-			cout << "File read error!" << endl;
-
-			delete pEntity;
-			pEntity = NULL;
-
-			return RESULT_FAIL;
-		}
-
-		SetFilePointer(m_hFile, -1, NULL, FILE_CURRENT);
+		char	c = PeekChar();
 
 		if (c == '"')
 		{	// Property
@@ -88,8 +95,9 @@ ParserMAPFile::Result ParserMAPFile::ParseEntity(Entity **ppEntity_)
 
 			if (result != RESULT_SUCCEED)
 			{
-				cout << "Error parsing property!" << endl;
+				Message(true, "Error parsing property!");
 
+				ReleaseBrushes();
 				delete pEntity;
 				pEntity = NULL;
 
@@ -106,8 +114,9 @@ ParserMAPFile::Result ParserMAPFile::ParseEntity(Entity **ppEntity_)
 
 			if (result != RESULT_SUCCEED)
 			{
-				cout << "Error parsing brush!" << endl;
+				Message(true, "Error parsing brush!");
 
+				ReleaseBrushes();
 				delete pEntity;
 				pEntity = NULL;
 
@@ -133,12 +142,23 @@ ParserMAPFile::Result ParserMAPFile::ParseEntity(Entity **ppEntity_)
 		else if (c == '}')
 		{	// End of entity
 
+			//
+			// Build the polygons of every brush
+			//
+			if (BuildBrushes() != RESULT_SUCCEED)
+			{
+				delete pEntity;
+				pEntity = NULL;
+
+				return RESULT_FAIL;
+			}
+
 			//
 			// Perform CSG union
 			//
 			if (pBrushes != NULL)
 			{
-				pEntity->AddPoly(pBrushes->MergeList());
+				pEntity->AddPoly(pBrushes->MergeList(m_uiThreads));
 
 				delete pBrushes;
 
@@ -172,8 +192,9 @@ ParserMAPFile::Result ParserMAPFile::ParseEntity(Entity **ppEntity_)
 		}
 		else
 		{	// Error
-			cout << "Expected:\t\", {, or }\nFound:\t" << c << endl;
+			Message(true, string("Expected:\t\", {, or }\nFound:\t") + c);
 
+			ReleaseBrushes();
 			delete pEntity;
 			pEntity = NULL;
 
@@ -188,7 +209,7 @@ ParserMAPFile::Result ParserMAPFile::ParseEntity(Entity **ppEntity_)
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading entity!" << endl;
+		Message(true, "Error reading entity!");
 
 		delete pEntity;
 		pEntity = NULL;
@@ -230,7 +251,7 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 
 		if (result != RESULT_SUCCEED)
 		{
-			cout << "Error reading plane definition!" << endl;
+			Message(true, "Error reading plane definition!");
 
 			delete pFace;
 			pFace = NULL;
@@ -250,7 +271,7 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading texture name!" << endl;
+		Message(true, "Error reading texture name!");
 
 		delete pFace;
 		pFace = NULL;
@@ -258,71 +279,12 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 		return RESULT_FAIL;
 	}
 
-	Texture			*pTexture = NULL;
-	int				iWAD = 0;
-	bool			bFound = false;
-	Texture::eGT	Result;
+	char	*pcTexture = TokenString();
+	Texture	*pTexture = ResolveTexture(pcTexture);
 
-	if (m_pTextureList == NULL)
+	if (pTexture == NULL)
 	{
-		m_pTextureList = new Texture;
-
-		while ((!bFound) && (iWAD < m_iWADFiles))
-		{
-			pTexture = m_pTextureList->GetTexture(m_acToken, m_pWAD[iWAD], m_pWADSize[iWAD], Result);
-
-			if (Result == Texture::eGT::GT_LOADED)
-			{
-				pTexture->uiID = m_iTextures;
-				m_iTextures++;
-
-				bFound = true;
-			}
-			else
-			{
-				iWAD++;
-			}
-		}
-
-		m_pTextureList->SetNext(NULL);
-
-		delete m_pTextureList;
-
-		m_pTextureList = pTexture;
-	}
-	else
-	{
-		while ((!bFound) && (iWAD < m_iWADFiles))
-		{
-			pTexture = m_pTextureList->GetTexture(m_acToken, m_pWAD[iWAD], m_pWADSize[iWAD], Result);
-
-			if (Result == Texture::eGT::GT_LOADED)
-			{
-				//
-				// Texture had to be loaded from the WAD file
-				//
-				pTexture->uiID = m_iTextures;
-				m_iTextures++;
-
-				bFound = true;
-			}
-			else if (Result == Texture::eGT::GT_FOUND)
-			{
-				//
-				// Texture was already in texture list
-				//
-				bFound = true;
-			}
-			else
-			{
-				iWAD++;
-			}
-		}
-	}
-
-	if (!bFound)
-	{
-		cout << "Unable to find texture " << m_acToken << "!" << endl;
+		Message(true, string("Unable to find texture ") + pcTexture + "!");
 
 		delete pFace;
 		pFace = NULL;
@@ -345,7 +307,7 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 
 		if (result != RESULT_SUCCEED)
 		{
-			cout << "Error reading texture axis! (Wrong WorldCraft version?)" << endl;
+			Message(true, "Error reading texture axis! (Wrong WorldCraft version?)");
 
 			delete pFace;
 			pFace = NULL;
@@ -363,7 +325,7 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading rotation!" << endl;
+		Message(true, "Error reading rotation!");
 
 		delete pFace;
 		pFace = NULL;
@@ -378,7 +340,7 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading U scale!" << endl;
+		Message(true, "Error reading U scale!");
 
 		delete pFace;
 		pFace = NULL;
@@ -386,13 +348,13 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 		return RESULT_FAIL;
 	}
 
-	pFace->texScale[0] = atof(m_acToken) / scale;
+	pFace->texScale[0] = TokenToDouble() / scale;
 
 	result = GetToken();
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading V scale!" << endl;
+		Message(true, "Error reading V scale!");
 
 		delete pFace;
 		pFace = NULL;
@@ -400,7 +362,7 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 		return RESULT_FAIL;
 	}
 
-	pFace->texScale[1] = atof(m_acToken) / scale;
+	pFace->texScale[1] = TokenToDouble() / scale;
 
 	/*  // commented out for correctly parsing jackhammer map files, for hammer, remove comment
 	// the difference is in a final " " space character after each face line
@@ -409,7 +371,7 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 
 	if (result != RESULT_SUCCEED)
 	{
-	cout << "Error reading face!" << endl;
+	Message(true, "Error reading face!");
 
 	delete pFace;
 	pFace = NULL;
@@ -424,6 +386,90 @@ ParserMAPFile::Result ParserMAPFile::ParseFace(Face **ppFace_)
 }
 
 
+static void LowerCaseName(const char *pcName_, size_t uiLength_, string &rName_)
+{
+	rName_.assign(pcName_, uiLength_);
+
+	for (size_t i = 0; i < uiLength_; i++)
+	{
+		rName_[i] = (char)tolower((unsigned char)rName_[i]);
+	}
+}
+
+
+Texture *ParserMAPFile::ResolveTexture(const char *pcTexture_)
+{
+	chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+
+	string		Name;
+	Texture		*pTexture = NULL;
+
+	LowerCaseName(pcTexture_, strlen(pcTexture_), Name);
+
+	unordered_map<string, Texture *>::const_iterator itTexture = m_TextureMap.find(Name);
+
+	if (itTexture != m_TextureMap.end())
+	{
+		//
+		// Texture was already in texture list
+		//
+		pTexture = itTexture->second;
+	}
+	else
+	{
+		//
+		// Load it from the first WAD file which has it
+		//
+		for (size_t iWAD = 0; iWAD < m_vpWADs.size(); iWAD++)
+		{
+			const WAD3_LUMP *lpLump = m_vpWADs[iWAD]->FindMip(Name);
+
+			if (lpLump == NULL)
+			{
+				continue;
+			}
+
+			const WAD3_MIP *lpMip = m_vpWADs[iWAD]->GetMip(lpLump);
+
+			pTexture = new Texture;
+			pTexture->LoadFromMip(pcTexture_, lpMip);
+
+			pTexture->uiID = m_iTextures;
+			m_iTextures++;
+
+			if (m_pTextureList == NULL)
+			{
+				m_pTextureList = pTexture;
+			}
+			else
+			{
+				m_pTextureTail->SetNext(pTexture);
+			}
+
+			m_pTextureTail = pTexture;
+			m_TextureMap[Name] = pTexture;
+
+			break;
+		}
+	}
+
+	m_dTextureSeconds += chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+
+	return pTexture;
+}
+
+
+void ParserMAPFile::ReleaseWADs()
+{
+	for (size_t i = 0; i < m_vpWADs.size(); i++)
+	{
+		delete m_vpWADs[i];
+	}
+
+	m_vpWADs.clear();
+}
+
+
 ParserMAPFile::Result ParserMAPFile::ParseBrush(Brush **ppBrush_)
 {
 	//
@@ -442,14 +488,14 @@ ParserMAPFile::Result ParserMAPFile::ParseBrush(Brush **ppBrush_)
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading brush!" << endl;
+		Message(true, "Error reading brush!");
 
 		return RESULT_FAIL;
 	}
 
-	if (strcmp("{", m_acToken))
+	if (!TokenIs("{"))
 	{
-		cout << "Expected:\t{\nFound:\t" << m_acToken << endl;
+		Message(true, string("Expected:\t{\nFound:\t") + TokenString());
 
 		return RESULT_FAIL;
 	}
@@ -464,26 +510,7 @@ ParserMAPFile::Result ParserMAPFile::ParseBrush(Brush **ppBrush_)
 
 	while (true)
 	{
-		char	c = 0;
-		DWORD	dwRead = 0;
-
-		if (ReadFile(m_hFile, &c, 1, &dwRead, NULL) == FALSE)
-		{
-			cout << "Error reading brush!" << endl;
-
-			delete pBrush;
-			pBrush = NULL;
-
-			if (pFaces)
-			{
-				delete pFaces;
-				pFaces = NULL;
-			}
-
-			return RESULT_FAIL;
-		}
-
-		SetFilePointer(m_hFile, -1, NULL, FILE_CURRENT);
+		char	c = PeekChar();
 
 		if (c == '(')
 		{	// Face
@@ -493,7 +520,7 @@ ParserMAPFile::Result ParserMAPFile::ParseBrush(Brush **ppBrush_)
 
 			if (result != RESULT_SUCCEED)
 			{
-				cout << "Error parsing face!" << endl;
+				Message(true, "Error parsing face!");
 
 				delete pBrush;
 				pBrush = NULL;
@@ -524,7 +551,7 @@ ParserMAPFile::Result ParserMAPFile::ParseBrush(Brush **ppBrush_)
 		}
 		else
 		{
-			cout << "Expected:\t( or }\nFound:\t" << c << endl;
+			Message(true, string("Expected:\t( or }\nFound:\t") + c);
 
 			delete pBrush;
 			pBrush = NULL;
@@ -543,7 +570,7 @@ ParserMAPFile::Result ParserMAPFile::ParseBrush(Brush **ppBrush_)
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading brush!" << endl;
+		Message(true, "Error reading brush!");
 
 		delete pBrush;
 		pBrush = NULL;
@@ -551,15 +578,115 @@ ParserMAPFile::Result ParserMAPFile::ParseBrush(Brush **ppBrush_)
 		return RESULT_FAIL;
 	}
 
-	Poly *pPolyList = pFaces->GetPolys();
+	//
+	// The polygons are built later on, along with the rest of the
+	// entity's brushes (see BuildBrushes)
+	//
+	PendingBrush	Pending = { pBrush, pFaces, uiFaces };
+
+	m_vPendingBrushes.push_back(Pending);
+
+	*ppBrush_ = pBrush;
+
+	return RESULT_SUCCEED;
+}
+
+
+ParserMAPFile::Result ParserMAPFile::BuildBrushes()
+{
+	size_t			uiBrushes = m_vPendingBrushes.size();
+	unsigned int	uiThreads = m_uiThreads;
+
+	//
+	// Each brush only depends on its own faces, so they are shared out
+	// between the threads. The brushes are already linked in file order.
+	//
+	if (uiThreads == 0)
+	{
+		uiThreads = thread::hardware_concurrency();
+	}
+
+	if (uiThreads > uiBrushes / MIN_BRUSHES_PER_THREAD)
+	{
+		uiThreads = (unsigned int)(uiBrushes / MIN_BRUSHES_PER_THREAD);
+	}
+
+	m_uiNextBrush = 0;
+	m_bBrushFailed = false;
+
+	vector<thread>	vThreads;
+
+	try
+	{
+		for (unsigned int i = 1; i < uiThreads; i++)
+		{
+			vThreads.push_back(thread(&ParserMAPFile::BrushThread, this));
+		}
+	}
+	catch (...)
+	{
+		// Could not start every thread, work with what we have
+	}
+
+	//
+	// The calling thread builds brushes too
+	//
+	BrushThread();
+
+	for (size_t i = 0; i < vThreads.size(); i++)
+	{
+		vThreads[i].join();
+	}
+
+	bool bFailed = m_bBrushFailed;
+
+	ReleaseBrushes();
+
+	if (bFailed)
+	{
+		Message(true, "Error building brush polygons!");
+
+		return RESULT_FAIL;
+	}
+
+	return RESULT_SUCCEED;
+}
+
+
+void ParserMAPFile::BrushThread()
+{
+	try
+	{
+		while (!m_bBrushFailed)
+		{
+			size_t uiBrush = m_uiNextBrush++;
+
+			if (uiBrush >= m_vPendingBrushes.size())
+			{
+				break;
+			}
+
+			BuildBrush(m_vPendingBrushes[uiBrush]);
+		}
+	}
+	catch (...)
+	{
+		m_bBrushFailed = true;
+	}
+}
+
+
+void ParserMAPFile::BuildBrush(PendingBrush &rBrush_)
+{
+	Poly *pPolyList = rBrush_.pFaces->GetPolys();
 
 	//
 	// Sort vertices and calculate texture coordinates for every polygon
 	//
 	Poly	*pi = pPolyList;
-	Face	*pFace = pFaces;
+	Face	*pFace = rBrush_.pFaces;
 
-	for (unsigned int c = 0; c < uiFaces; c++)
+	for (unsigned int c = 0; c < rBrush_.uiFaces; c++)
 	{
 		pi->plane = pFace->plane;
 		pi->TextureID = pFace->pTexture->uiID;
@@ -574,18 +701,28 @@ ParserMAPFile::Result ParserMAPFile::ParseBrush(Brush **ppBrush_)
 		pi = pi->GetNext();
 	}
 
-	pBrush->AddPoly(pPolyList);
-	pBrush->CalculateAABB();
+	rBrush_.pBrush->AddPoly(pPolyList);
+	rBrush_.pBrush->CalculateAABB();
 
-	if (pFaces != NULL)
+	delete rBrush_.pFaces;
+	rBrush_.pFaces = NULL;
+}
+
+
+void ParserMAPFile::ReleaseBrushes()
+{
+	//
+	// Free the faces of any brush which was never built
+	//
+	for (size_t i = 0; i < m_vPendingBrushes.size(); i++)
 	{
-		delete pFaces;
-		pFaces = NULL;
+		if (m_vPendingBrushes[i].pFaces != NULL)
+		{
+			delete m_vPendingBrushes[i].pFaces;
+		}
 	}
 
-	*ppBrush_ = pBrush;
-
-	return RESULT_SUCCEED;
+	m_vPendingBrushes.clear();
 }
 
 
@@ -607,14 +744,14 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading property name!" << endl;
+		Message(true, "Error reading property name!");
 
 		return RESULT_FAIL;
 	}
 
 	Property *pProperty = new Property;
 
-	if (strcmp("mapversion", m_acToken) == 0)	// check version 220
+	if (TokenIs("mapversion"))	// check version 220
 	{
 		//
 		// Read value
@@ -623,7 +760,7 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 
 		if (result != RESULT_SUCCEED)
 		{
-			cout << "Error reading value of " << pProperty->GetName() << "!" << endl;
+			Message(true, string("Error reading value of ") + pProperty->GetName() + "!");
 
 			delete pProperty;
 			pProperty = NULL;
@@ -631,9 +768,9 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 			return RESULT_FAIL;
 		}
 
-		if (strcmp("220", m_acToken) != 0)
+		if (!TokenIs("220"))
 		{
-			cout << "Wrong map version!" << endl;
+			Message(true, "Wrong map version!");
 
 			delete pProperty;
 			return RESULT_FAIL;
@@ -646,9 +783,9 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 	}
 
 
-	if (strcmp("wad", m_acToken) == 0)
+	if (TokenIs("wad"))
 	{
-		pProperty->SetName(m_acToken);
+		pProperty->SetName(TokenString());
 
 		//
 		// Read value
@@ -657,7 +794,7 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 
 		if (result != RESULT_SUCCEED)
 		{
-			cout << "Error reading value of " << pProperty->GetName() << "!" << endl;
+			Message(true, string("Error reading value of ") + pProperty->GetName() + "!");
 
 			delete pProperty;
 			pProperty = NULL;
@@ -665,7 +802,7 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 			return RESULT_FAIL;
 		}
 
-		pProperty->SetValue(m_acToken);
+		pProperty->SetValue(TokenString());
 		memset(m_acToken, 0, MAX_TOKEN_LENGTH + 1);
 
 		const char	*pWAD = pProperty->GetValue();
@@ -675,40 +812,17 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 		{
 			if ((pWAD[i] == ';') || (pWAD[i] == 0x00))
 			{
-				if (m_pWAD == NULL)
-				{
-					m_pWAD = new LPVOID[m_iWADFiles + 1];
-					m_pWADSize = new DWORD[m_iWADFiles + 1];
-				}
-				else
-				{
-					LPVOID *pOldWAD = new LPVOID[m_iWADFiles];
-					memcpy(pOldWAD, m_pWAD, sizeof(LPVOID) * (m_iWADFiles));
-					delete m_pWAD;
-
-					m_pWAD = new LPVOID[m_iWADFiles + 1];
-					memcpy(m_pWAD, pOldWAD, sizeof(LPVOID) * (m_iWADFiles));
+				WAD3File *pWADFile = new WAD3File;
 
-					delete[] pOldWAD;
+				m_vpWADs.push_back(pWADFile);
+				pWADFile->Open(m_acToken);
 
-					DWORD *pOldSize = new DWORD[m_iWADFiles];
-					memcpy(pOldSize, m_pWADSize, sizeof(DWORD) * (m_iWADFiles));
-					delete m_pWADSize;
-
-					m_pWADSize = new DWORD[m_iWADFiles + 1];
-					memcpy(m_pWADSize, pOldSize, sizeof(DWORD) * (m_iWADFiles));
-
-					delete[] pOldSize;
+				if (m_bBrushCache)
+				{
+					m_Cache.AddWAD(m_acToken, pWADFile->GetData(), pWADFile->GetSize());
 				}
 
-				//wchar_t *fileName = convertCharArrayToLPCWSTR(m_acToken);
-				//ParserMAPFile(fileName, &m_pWAD[m_iWADFiles], &m_pWADSize[m_iWADFiles]);			
-				//delete[] fileName;
-
-				WAD3MapFile(m_acToken, &m_pWAD[m_iWADFiles], &m_pWADSize[m_iWADFiles]);
-
 				iToken = 0;
-				m_iWADFiles++;
 				memset(m_acToken, 0, MAX_TOKEN_LENGTH + 1);
 			}
 			else
@@ -723,7 +837,7 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 		return RESULT_SUCCEED;
 	}
 
-	pProperty->SetName(m_acToken);
+	pProperty->SetName(TokenString());
 
 	//
 	// Read value
@@ -732,7 +846,7 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 
 	if (result != RESULT_SUCCEED)
 	{
-		cout << "Error reading value of " << pProperty->GetName() << "!" << endl;
+		Message(true, string("Error reading value of ") + pProperty->GetName() + "!");
 
 		delete pProperty;
 		pProperty = NULL;
@@ -740,7 +854,7 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 		return RESULT_FAIL;
 	}
 
-	pProperty->SetValue(m_acToken);
+	pProperty->SetValue(TokenString());
 
 	*ppProperty_ = pProperty;
 
@@ -748,7 +862,7 @@ ParserMAPFile::Result ParserMAPFile::ParseProperty(Property **ppProperty_)
 }
 
 
-bool ParserMAPFile::Load(LPCSTR pcFile_, Entity **ppEntities_, Texture **ppTextures_)
+bool ParserMAPFile::Load(const char *pcFile_, Entity **ppEntities_, Texture **ppTextures_)
 {
 	//
 	// Check if parameters are valid
@@ -770,31 +884,80 @@ bool ParserMAPFile::Load(LPCSTR pcFile_, Entity **ppEntities_, Texture **ppTextu
 	}
 
 
-	m_pWAD = NULL;
-	m_pWADSize = NULL;
+	ReleaseWADs();
+
 	m_pTextureList = NULL;
+	m_pTextureTail = NULL;
+
+	m_TextureMap.clear();
+	m_dTextureSeconds = 0.0;
 
 	m_iEntities = 0;
 	m_iPolygons = 0;
 	m_iTextures = 0;
 
-	m_iWADFiles = 0;
-
 	//
 	// Open .MAP file
 	//
 
-	m_hFile = CreateFile(pcFile_, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
-
-	if (m_hFile == INVALID_HANDLE_VALUE)
+	if (!m_File.Open(pcFile_))
 	{	// Failed to open file
 		return false;
 	}
 
+	m_pcData = m_File.GetData();
+	m_uiSize = m_File.GetSize();
+	m_uiPos = 0;
+
+	m_pcToken = m_pcData;
+	m_uiTokenLength = 0;
+
+	chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+
+	Entity	*pEntityList = NULL;
+
+	//
+	// Use the cache if neither the map nor its WADs changed
+	//
+	if (m_bBrushCache)
+	{
+		m_Cache.SetMap(pcFile_, m_pcData, m_uiSize);
+
+		if (m_Cache.Read(&pEntityList, &m_pTextureList))
+		{
+			for (Entity *pEntity = pEntityList; pEntity != NULL; pEntity = pEntity->GetNext())
+			{
+				m_iEntities++;
+				m_iPolygons += pEntity->GetNumberOfPolys();
+			}
+
+			for (Texture *pTexture = m_pTextureList; pTexture != NULL; pTexture = pTexture->GetNext())
+			{
+				m_iTextures++;
+			}
+
+			ostringstream	ossStats;
+
+			ossStats << "Read From Cache: " << endl;
+			ossStats << "Entities:\t" << m_iEntities << endl;
+			ossStats << "Polygons:\t" << m_iPolygons << endl;
+			ossStats << "Textures:\t" << m_iTextures << endl;
+			ossStats << "Cache read:\t" << chrono::duration<double>(chrono::steady_clock::now() - tStart).count() << " s";
+
+			Message(false, ossStats.str());
+
+			m_File.Close();
+
+			*ppEntities_ = pEntityList;
+			*ppTextures_ = m_pTextureList;
+
+			return true;
+		}
+	}
+
 	//
 	// Parse file
 	//
-	Entity	*pEntityList = NULL;
 
 	while (true)
 	{
@@ -807,7 +970,8 @@ bool ParserMAPFile::Load(LPCSTR pcFile_, Entity **ppEntities_, Texture **ppTextu
 		}
 		else if (result == RESULT_FAIL)
 		{
-			CloseHandle(m_hFile);
+			m_File.Close();
+			ReleaseWADs();
 
 			if (pEntity != NULL)
 			{
@@ -840,22 +1004,38 @@ bool ParserMAPFile::Load(LPCSTR pcFile_, Entity **ppEntities_, Texture **ppTextu
 	//
 	// Clean up and return
 	//
-	cout << "Read From File: " << endl;
-	cout << "Entities:\t" << m_iEntities << endl;
-	cout << "Polygons:\t" << m_iPolygons << endl;
-	cout << "Textures:\t" << m_iTextures << endl;
+	ostringstream	ossStats;
+
+	ossStats << "Read From File: " << endl;
+	ossStats << "Entities:\t" << m_iEntities << endl;
+	ossStats << "Polygons:\t" << m_iPolygons << endl;
+	ossStats << "Textures:\t" << m_iTextures << endl;
 
+	double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+	double dMegabytes = (double)m_uiSize / (1024.0 * 1024.0);
 
+	ossStats << "Parsed:\t\t" << dMegabytes << " MB in " << dSeconds << " s";
 
-	for (int i = 0; i < m_iWADFiles; i++)
+	if (dSeconds > 0.0)
 	{
-		UnmapViewOfFile(m_pWAD[i]);
+		ossStats << " (" << (dMegabytes / dSeconds) << " MB/s)";
 	}
 
-	delete[] m_pWAD;
-	delete[] m_pWADSize;
+	ossStats << endl;
+	ossStats << "Texture lookup:\t" << m_dTextureSeconds << " s";
+
+	Message(false, ossStats.str());
+
+
+
+	ReleaseWADs();
 
-	CloseHandle(m_hFile);
+	m_File.Close();
+
+	if ((m_bBrushCache) && (!m_Cache.Write(pEntityList, m_pTextureList)))
+	{
+		Message(false, "Unable to write brush cache!");
+	}
 
 	*ppEntities_ = pEntityList;
 	*ppTextures_ = m_pTextureList;
@@ -873,7 +1053,7 @@ ParserMAPFile::Result ParserMAPFile::ParsePlane(Plane &p_)
 		return RESULT_FAIL;
 	}
 
-	if (strcmp("[", m_acToken))
+	if (!TokenIs("["))
 	{
 		return RESULT_FAIL;
 	}
@@ -885,7 +1065,7 @@ ParserMAPFile::Result ParserMAPFile::ParsePlane(Plane &p_)
 		return RESULT_FAIL;
 	}
 
-	p_.n.x = atof(m_acToken);
+	p_.n.x = TokenToDouble();
 
 	result = GetToken();
 
@@ -894,7 +1074,7 @@ ParserMAPFile::Result ParserMAPFile::ParsePlane(Plane &p_)
 		return RESULT_FAIL;
 	}
 
-	p_.n.z = atof(m_acToken);
+	p_.n.z = TokenToDouble();
 
 	result = GetToken();
 
@@ -903,7 +1083,7 @@ ParserMAPFile::Result ParserMAPFile::ParsePlane(Plane &p_)
 		return RESULT_FAIL;
 	}
 
-	p_.n.y = atof(m_acToken);
+	p_.n.y = TokenToDouble();
 
 	result = GetToken();
 
@@ -912,7 +1092,7 @@ ParserMAPFile::Result ParserMAPFile::ParsePlane(Plane &p_)
 		return RESULT_FAIL;
 	}
 
-	p_.d = atof(m_acToken);
+	p_.d = TokenToDouble();
 
 	result = GetToken();
 
@@ -921,7 +1101,7 @@ ParserMAPFile::Result ParserMAPFile::ParsePlane(Plane &p_)
 		return RESULT_FAIL;
 	}
 
-	if (strcmp("]", m_acToken))
+	if (!TokenIs("]"))
 	{
 		return RESULT_FAIL;
 	}
@@ -939,7 +1119,7 @@ ParserMAPFile::Result ParserMAPFile::ParseVector(Vector3 &v_)
 		return RESULT_FAIL;
 	}
 
-	if (strcmp("(", m_acToken))
+	if (!TokenIs("("))
 	{
 		return RESULT_FAIL;
 	}
@@ -951,7 +1131,7 @@ ParserMAPFile::Result ParserMAPFile::ParseVector(Vector3 &v_)
 		return RESULT_FAIL;
 	}
 
-	v_.x = atof(m_acToken) / scale;
+	v_.x = TokenToDouble() / scale;
 
 	result = GetToken();
 
@@ -960,7 +1140,7 @@ ParserMAPFile::Result ParserMAPFile::ParseVector(Vector3 &v_)
 		return RESULT_FAIL;
 	}
 
-	v_.z = atof(m_acToken) / scale;
+	v_.z = TokenToDouble() / scale;
 
 	result = GetToken();
 
@@ -969,7 +1149,7 @@ ParserMAPFile::Result ParserMAPFile::ParseVector(Vector3 &v_)
 		return RESULT_FAIL;
 	}
 
-	v_.y = atof(m_acToken) / scale;
+	v_.y = TokenToDouble() / scale;
 
 	result = GetToken();
 
@@ -978,7 +1158,7 @@ ParserMAPFile::Result ParserMAPFile::ParseVector(Vector3 &v_)
 		return RESULT_FAIL;
 	}
 
-	if (strcmp(")", m_acToken))
+	if (!TokenIs(")"))
 	{
 		return RESULT_FAIL;
 	}
@@ -989,47 +1169,44 @@ ParserMAPFile::Result ParserMAPFile::ParseVector(Vector3 &v_)
 
 ParserMAPFile::Result ParserMAPFile::GetToken()
 {
+	//
+	// Tokens end at a space or a line feed. A carriage return ends the
+	// visible token but the rest of it is still consumed, and a token
+	// longer than MAX_TOKEN_LENGTH is cut up into several tokens.
+	//
 	unsigned int	i = 0;
-	char			c = 0;
-	DWORD			dwRead = 0;
+	unsigned int	uiLength = MAX_TOKEN_LENGTH + 1;
 
-	memset(&m_acToken, 0, sizeof(m_acToken));
+	m_pcToken = m_pcData + m_uiPos;
+	m_uiTokenLength = 0;
 
 	while (i <= MAX_TOKEN_LENGTH)
 	{
-		dwRead = 0;
-
-		if (ReadFile(m_hFile, &c, 1, &dwRead, NULL) == 0)
-		{
-			return RESULT_FAIL;
-		}
-
-		if (dwRead == 0)
+		if (m_uiPos >= m_uiSize)
 		{
 			return RESULT_EOF;
 		}
 
+		char c = m_pcData[m_uiPos++];
+
 		//
 		// Check for token end
 		//
-		if (c == ' ')
+		if ((c == ' ') || (c == 0x0A))
 		{
 			break;
 		}
 
-		if (c == 0x0A)
+		if ((c == 0x0D) && (uiLength > i))
 		{
-			break;
-		}
-
-		if (c != 0x0D)
-		{
-			m_acToken[i] = c;
+			uiLength = i;
 		}
 
 		i++;
 	}
 
+	m_uiTokenLength = (uiLength < i) ? uiLength : i;
+
 	return RESULT_SUCCEED;
 }
 
@@ -1039,33 +1216,33 @@ ParserMAPFile::Result ParserMAPFile::GetString()
 	unsigned int	i = 0;
 	char			c = 0;
 	bool			bFinished = false;
-	DWORD			dwRead = 0;
 
-	memset(&m_acToken, 0, sizeof(m_acToken));
+	m_pcToken = m_pcData + m_uiPos;
+	m_uiTokenLength = 0;
 
 	//
 	// Read first "
 	//
-	if (ReadFile(m_hFile, &c, 1, &dwRead, NULL) == FALSE)
+	if (m_uiPos >= m_uiSize)
 	{
-		if (dwRead == 0)
-		{
-			return RESULT_EOF;
-		}
-
-		return RESULT_FAIL;
+		return RESULT_EOF;
 	}
 
+	m_uiPos++;
+	m_pcToken++;
+
 	//
 	// Parse rest of string
 	//
 	while (i <= MAX_TOKEN_LENGTH)
 	{
-		if (ReadFile(m_hFile, &c, 1, &dwRead, NULL) == FALSE)
+		if (m_uiPos >= m_uiSize)
 		{
 			return RESULT_FAIL;
 		}
 
+		c = m_pcData[m_uiPos++];
+
 		//
 		// Check for token end
 		//
@@ -1074,23 +1251,64 @@ ParserMAPFile::Result ParserMAPFile::GetString()
 			bFinished = true;
 		}
 
-		if (bFinished && (c == ' '))
-		{
-			break;
-		}
-
-		if (bFinished && (c == 0x0A))
+		if (bFinished && ((c == ' ') || (c == 0x0A)))
 		{
 			break;
 		}
 
 		if (!bFinished)
 		{
-			m_acToken[i] = c;
+			m_uiTokenLength++;
 		}
 
 		i++;
 	}
 
 	return RESULT_SUCCEED;
+}
+
+
+bool ParserMAPFile::TokenIs(const char *pcText_) const
+{
+	size_t uiLength = strlen(pcText_);
+
+	return (uiLength == m_uiTokenLength) && (memcmp(m_pcToken, pcText_, uiLength) == 0);
+}
+
+
+double ParserMAPFile::TokenToDouble()
+{
+	//
+	// Parse the number straight out of the mapped file when it is
+	// followed by a terminator, otherwise go through a copy
+	//
+	const char *pcEnd = m_pcToken + m_uiTokenLength;
+
+	if ((m_uiTokenLength > 0) && (pcEnd < m_pcData + m_uiSize) && !isspace((unsigned char)m_pcToken[0]) &&
+		((*pcEnd == ' ') || (*pcEnd == 0x0A) || (*pcEnd == 0x0D)))
+	{
+		char	*pcParsed = NULL;
+		double	dValue = strtod(m_pcToken, &pcParsed);
+
+		if (pcParsed <= pcEnd)
+		{
+			return dValue;
+		}
+	}
+
+	return atof(TokenString());
+}
+
+
+char *ParserMAPFile::TokenString()
+{
+	//
+	// Copy the current token into the token buffer as a C string
+	//
+	unsigned int uiLength = (m_uiTokenLength < MAX_TOKEN_LENGTH) ? m_uiTokenLength : MAX_TOKEN_LENGTH;
+
+	memcpy(m_acToken, m_pcToken, uiLength);
+	m_acToken[uiLength] = 0;
+
+	return m_acToken;
 }
\ No newline at end of file
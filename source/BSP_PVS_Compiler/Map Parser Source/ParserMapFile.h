@@ -1,6 +1,7 @@
 #pragma once
 
 const unsigned int MAX_TOKEN_LENGTH = 512;
+const unsigned int MIN_BRUSHES_PER_THREAD = 32;	// Fewer brushes per thread than this are not worth a thread
 
 ////////////////////////////////////////////////////////////////////
 // Includes
@@ -10,12 +11,17 @@ const unsigned int MAX_TOKEN_LENGTH = 512;
 #include <fstream>
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
 
 using namespace std;
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
-#ifdef _DEBUG
+#if defined(_WIN32) && defined(_DEBUG)
 #include <crtdbg.h>
 
 #ifdef new
@@ -26,8 +32,11 @@ using namespace std;
 
 #endif
 
-#include "Parsermath.h"
+#include "ParserMath.h"
 #include "ParserStructures.h"
+#include "MappedFile.h"
+#include "WAD3.h"
+#include "BrushCache.h"
 
 
 ////////////////////////////////////////////////////////////////////
@@ -36,20 +45,66 @@ using namespace std;
 
 class ParserMAPFile
 {
+public:
+	//
+	// Receives each message the parser writes, errors and statistics alike.
+	// Messages may span several lines.
+	//
+	typedef void (*MessageHandler)(void *pContext_, bool bError_, const char *pcMessage_);
+
 private:
 	enum Result
 	{
 		RESULT_SUCCEED = 0, RESULT_FAIL, RESULT_EOF
 	};
 
-	char	m_acToken[MAX_TOKEN_LENGTH + 1];
+	//
+	// A parsed brush whose polygons have not been built yet
+	//
+	struct PendingBrush
+	{
+		Brush			*pBrush;
+		Face			*pFaces;
+		unsigned int	uiFaces;
+	};
 
-	HANDLE	m_hFile;
+	char	m_acToken[MAX_TOKEN_LENGTH + 1];
 
-	int		m_iWADFiles;
-	LPVOID	*m_pWAD;
-	DWORD	*m_pWADSize;
-	Texture	*m_pTextureList;
+	//
+	// The whole .MAP file is mapped and tokens are views into it
+	//
+	MappedFile		m_File;
+	const char		*m_pcData;
+	size_t			m_uiSize;
+	size_t			m_uiPos;
+
+	const char		*m_pcToken;
+	unsigned int	m_uiTokenLength;
+
+	vector<WAD3File *>	m_vpWADs;
+	Texture				*m_pTextureList;
+	Texture				*m_pTextureTail;
+
+	//
+	// Textures already in m_pTextureList, keyed on the lower case name
+	//
+	unordered_map<string, Texture *>	m_TextureMap;
+	double								m_dTextureSeconds;
+
+	//
+	// Brushes of the current entity, built on several threads once
+	// the whole entity has been read
+	//
+	vector<PendingBrush>	m_vPendingBrushes;
+	atomic<size_t>			m_uiNextBrush;
+	atomic<bool>			m_bBrushFailed;
+	unsigned int			m_uiThreads;
+
+	BrushCache		m_Cache;
+	bool			m_bBrushCache;
+
+	MessageHandler	m_pfnMessage;
+	void			*m_pMessageContext;
 
 	unsigned int		m_iEntities;
 	unsigned int		m_iPolygons;
@@ -59,6 +114,11 @@ private:
 	Result GetToken();
 	Result GetString();
 
+	char PeekChar() const { return (m_uiPos < m_uiSize) ? m_pcData[m_uiPos] : 0; }
+	bool TokenIs(const char *pcText_) const;
+	double TokenToDouble();
+	char *TokenString();
+
 	Result ParseEntity(Entity **ppEntity_);
 	Result ParseProperty(Property **ppProperty_);
 	Result ParseBrush(Brush **ppBrush_);
@@ -66,6 +126,21 @@ private:
 	Result ParseVector(Vector3 &v_);
 	Result ParsePlane(Plane &p_);
 
+	void Message(bool bError_, const string &Message_) const;	// To the message handler, or cout without one
+
+	Texture *ResolveTexture(const char *pcTexture_);
+	void ReleaseWADs();
+
+	Result BuildBrushes();
+	void BrushThread();
+	void ReleaseBrushes();
+	static void BuildBrush(PendingBrush &rBrush_);
+
 public:
-	bool Load(LPCSTR pcFile_, Entity **ppEntities_, Texture **pTexture_);
+	ParserMAPFile();
+
+	bool Load(const char *pcFile_, Entity **ppEntities_, Texture **pTexture_);
+	void SetThreadCount(unsigned int uiThreads_) { m_uiThreads = uiThreads_; }	// 0 = one per hardware thread
+	void SetBrushCache(bool bEnabled_) { m_bBrushCache = bEnabled_; }			// Read and write <map>.cache
+	void SetMessageHandler(MessageHandler pfnHandler_, void *pContext_) { m_pfnMessage = pfnHandler_; m_pMessageContext = pContext_; }	// NULL = cout
 };
@@ -1,138 +1,30 @@
-#include "..\..\Library\BSPTree.h"
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <exception>
 
 #include "WAD3.h"
 #include "ParserStructures.h"
+#include "../Compiler Source/MemoryPool.h"
 
 using namespace std;
 
+CMemoryPool Poly::m_Pool(_T("Map Polygons"), sizeof(Poly));
+
 
 ////////////////////////////////////////////////////////////////////
 // Texture member functions
 ////////////////////////////////////////////////////////////////////
 
-Texture* Texture::GetTexture(char *pacTexture_, LPVOID lpView_, DWORD dwFileSize_, Texture::eGT &rResult_)
+void Texture::LoadFromMip(const char *pacTexture_, const WAD3_MIP *lpMip_)
 {
-	rResult_ = eGT::GT_ERROR;
-
-	//
-	// Check if texture already exists
-	//
-	if (_stricmp(name, pacTexture_) == 0)
-	{
-		rResult_ = eGT::GT_FOUND;
-
-		return this;
-	}
+	strcpy(name, pacTexture_);
 
-	if (!IsLast())
-	{
-		return m_pNext->GetTexture(pacTexture_, lpView_, dwFileSize_, rResult_);
-	}
-
-	//
-	// Load texture information
-	//
-	Texture			*pTexture = new Texture;
-	LPWAD3_HEADER	lpHeader = NULL;
-	LPWAD3_LUMP		lpLump = NULL;
-	LPWAD3_MIP		lpMip = NULL;
-
-	DWORD			dwNumLumps = 0;
-	DWORD			dwTableOffset = 0;
-	DWORD			dwFilePos = 0;
-	DWORD			dwPaletteOffset = 0;
-	WORD			wPaletteSize = 0;
-	DWORD			dwWidth = 0;
-	DWORD			dwHeight = 0;
-
-	// Make sure it's at least big enough to manipulate the header
-	if (dwFileSize_ < sizeof(WAD3_HEADER))
-	{
-		CorruptWAD3("WAD3 file is malformed.", lpView_);
-
-		delete pTexture;
-
-		return NULL;
-	}
-
-	lpHeader = (LPWAD3_HEADER)lpView_;
-
-	if (lpHeader->identification != WAD3_ID)
-	{
-		CorruptWAD3("Invalid WAD3 header id.", lpView_);
-
-		delete pTexture;
-
-		return NULL;
-	}
-
-	dwNumLumps = lpHeader->numlumps;
-	dwTableOffset = lpHeader->infotableofs;
-
-	// Make sure our table is really there
-	if (((dwNumLumps * sizeof(WAD3_LUMP)) + dwTableOffset) > dwFileSize_)
-	{
-		CorruptWAD3("WAD3 file is malformed.", lpView_);
-
-		delete pTexture;
-
-		return NULL;
-	}
-
-	// Point at the first table entry
-	lpLump = (LPWAD3_LUMP)((LPBYTE)lpView_ + dwTableOffset);
-
-	bool	bFound = false;
-	DWORD	j = 0;
-
-	while ((!bFound) && (j < dwNumLumps))
-	{
-		if (lpLump->type == WAD3_TYPE_MIP)
-		{
-			if (_stricmp(lpLump->name, pacTexture_) == 0)
-			{
-				// Find out where the MIP actually is
-				dwFilePos = lpLump->filepos;
-
-				// Make sure it's in bounds
-				if (dwFilePos >= dwFileSize_)
-				{
-					CorruptWAD3("Invalid lump entry; filepos is malformed.", lpView_);
-
-					delete pTexture;
-
-					return NULL;
-				}
-
-				// Point at the mip
-				lpMip = (LPWAD3_MIP)((LPBYTE)lpView_ + dwFilePos);
-
-				strcpy(pTexture->name, pacTexture_);
-
-				pTexture->m_iWidth = lpMip->width;
-				pTexture->m_iHeight = lpMip->height;
-				bFound = true;
-			}
-		}
-
-		j++;
-		lpLump++;
-	}
-
-	if (!bFound)
-	{
-		delete pTexture;
-
-		return NULL;
-	}
-
-	m_pNext = pTexture;
-
-	rResult_ = eGT::GT_LOADED;
-
-	return pTexture;
+	m_iWidth = lpMip_->width;
+	m_iHeight = lpMip_->height;
 }
 
 
@@ -994,6 +886,30 @@ bool Poly::IsLast() const
 }
 
 
+void *Poly::operator new(size_t Size_)
+{
+	if (Size_ > m_Pool.GetItemSize())
+	{
+		return ::operator new(Size_);
+	}
+
+	return m_Pool.Alloc();
+}
+
+
+void Poly::operator delete(void *pPoly_, size_t Size_)
+{
+	if (Size_ > m_Pool.GetItemSize())
+	{
+		::operator delete(pPoly_);
+
+		return;
+	}
+
+	m_Pool.Free(pPoly_);
+}
+
+
 Poly::Poly()
 {
 	m_pNext = NULL;
@@ -1200,19 +1116,34 @@ unsigned int Entity::GetNumberOfPolys() const
 void Brush::ClipToBrush(Brush *pBrush_, bool bClipOnPlane_)
 {
 	Poly *pPolyList = NULL;
+	Poly *pPolyTail = NULL;
 	Poly *pPoly = m_pPolys;
 
-	for (unsigned int i = 0; i < GetNumberOfPolys(); i++)
+	while (pPoly != NULL)
 	{
 		Poly *pClippedPoly = pBrush_->GetPolys()->ClipToList(pPoly, bClipOnPlane_);
 
-		if (pPolyList == NULL)
-		{
-			pPolyList = pClippedPoly;
-		}
-		else
+		if (pClippedPoly != NULL)
 		{
-			pPolyList->AddPoly(pClippedPoly);
+			if (pPolyList == NULL)
+			{
+				pPolyList = pClippedPoly;
+			}
+			else
+			{
+				pPolyTail->SetNext(pClippedPoly);
+			}
+
+			//
+			// Keep track of the end of the list, appending by walking
+			// it from the start is quadratic in big brushes
+			//
+			pPolyTail = pClippedPoly;
+
+			while (!pPolyTail->IsLast())
+			{
+				pPolyTail = pPolyTail->GetNext();
+			}
 		}
 
 		pPoly = pPoly->GetNext();
@@ -1223,103 +1154,219 @@ void Brush::ClipToBrush(Brush *pBrush_, bool bClipOnPlane_)
 }
 
 
-Poly *Brush::MergeList()
+//
+// Brushes of an entity being clipped against each other, shared
+// between the threads of Brush::MergeList
+//
+struct MergeJob
 {
-	Brush			*pClippedList = CopyList();
-	Brush			*pClip = pClippedList;
-	Brush			*pBrush = NULL;
-	Poly			*pPolyList = NULL;
+	vector<Brush *>					vBrushes;		// Original brushes in file order, only ever read
+	vector<Brush *>					vClipped;		// Copy of each brush which gets clipped
+	vector<vector<unsigned int> >	vCandidates;	// Brushes whose AABB touches each brush, in file order
+	atomic<size_t>					uiNext;
+	atomic<bool>					bFailed;
+	exception_ptr					pException;
+};
 
-	bool			bClipOnPlane = false;
-	unsigned int	uiBrushes = GetNumberOfBrushes();
 
-	for (unsigned int i = 0; i < uiBrushes; i++)
+static void MergeThread(MergeJob *pJob_)
+{
+	try
 	{
-		pBrush = this;
-		bClipOnPlane = false;
-
-		for (unsigned int j = 0; j < uiBrushes; j++)
+		while (!pJob_->bFailed)
 		{
-			if (i == j)
+			size_t i = pJob_->uiNext++;
+
+			if (i >= pJob_->vClipped.size())
 			{
-				bClipOnPlane = true;
+				break;
 			}
-			else
+
+			//
+			// Same order as clipping against every brush of the list,
+			// only the brushes which lie after this one in the file
+			// clip its polygons which are on their planes
+			//
+			Brush						*pClip = pJob_->vClipped[i];
+			const vector<unsigned int>	&vCandidates = pJob_->vCandidates[i];
+
+			for (size_t c = 0; c < vCandidates.size(); c++)
 			{
-				if (pClip->AABBIntersect(pBrush))
-				{
-					pClip->ClipToBrush(pBrush, bClipOnPlane);
-				}
+				pClip->ClipToBrush(pJob_->vBrushes[vCandidates[c]], (vCandidates[c] > i));
 			}
-
-			pBrush = pBrush->GetNext();
 		}
+	}
+	catch (...)
+	{
+		if (!pJob_->bFailed.exchange(true))
+		{
+			pJob_->pException = current_exception();
+		}
+	}
+}
+
+
+Poly *Brush::MergeList(unsigned int uiThreads_)
+{
+	MergeJob		Job;
+	Poly			*pPolyList = NULL;
+	Poly			*pPolyTail = NULL;
+	unsigned int	uiBrushes = GetNumberOfBrushes();
+	unsigned int	i, k;
+
+	for (Brush *pBrush = this; pBrush != NULL; pBrush = pBrush->GetNext())
+	{
+		Job.vBrushes.push_back(pBrush);
+	}
+
+	//
+	// Sweep and prune along x to find the brushes whose AABBs touch,
+	// instead of testing every brush against every other one
+	//
+	vector<unsigned int> vSorted(uiBrushes);
 
-		pClip = pClip->GetNext();
+	for (i = 0; i < uiBrushes; i++)
+	{
+		vSorted[i] = i;
 	}
 
-	pClip = pClippedList;
+	sort(vSorted.begin(), vSorted.end(), [&Job](unsigned int a, unsigned int b)
+	{
+		return Job.vBrushes[a]->min.x < Job.vBrushes[b]->min.x;
+	});
+
+	Job.vCandidates.resize(uiBrushes);
 
-	while (pClip != NULL)
+	for (i = 0; i < uiBrushes; i++)
 	{
-		if (pClip->GetNumberOfPolys() != 0)
+		Brush *pBrush = Job.vBrushes[vSorted[i]];
+
+		for (k = i + 1; k < uiBrushes; k++)
 		{
-			//
-			// Extract brushes left over polygons and add them to the list
-			//
-			Poly *pPoly = pClip->GetPolys()->CopyList();
+			Brush *pOther = Job.vBrushes[vSorted[k]];
 
-			if (pPolyList == NULL)
+			if (pOther->min.x > pBrush->max.x)
 			{
-				pPolyList = pPoly;
+				break;
 			}
-			else
+
+			if (pBrush->AABBIntersect(pOther))
 			{
-				pPolyList->AddPoly(pPoly);
+				Job.vCandidates[vSorted[i]].push_back(vSorted[k]);
+				Job.vCandidates[vSorted[k]].push_back(vSorted[i]);
 			}
+		}
+	}
+
+	for (i = 0; i < uiBrushes; i++)
+	{
+		sort(Job.vCandidates[i].begin(), Job.vCandidates[i].end());
+	}
+
+	//
+	// Each copy is only clipped by the original brushes, so the copies
+	// can be clipped independently of each other
+	//
+	Job.vClipped.resize(uiBrushes, NULL);
 
-			pClip = pClip->GetNext();
+	try
+	{
+		for (i = 0; i < uiBrushes; i++)
+		{
+			Job.vClipped[i] = new Brush;
+			Job.vClipped[i]->m_pPolys = Job.vBrushes[i]->m_pPolys->CopyList();
 		}
-		else
+	}
+	catch (...)
+	{
+		for (i = 0; i < uiBrushes; i++)
 		{
-			//
-			// Brush has no polygons and should be deleted
-			//
-			if (pClip == pClippedList)
-			{
-				pClip = pClippedList->GetNext();
+			delete Job.vClipped[i];
+		}
 
-				pClippedList->SetNext(NULL);
+		throw;
+	}
 
-				delete pClippedList;
+	if (uiThreads_ == 0)
+	{
+		uiThreads_ = thread::hardware_concurrency();
+	}
 
-				pClippedList = pClip;
-			}
-			else
-			{
-				Brush	*pTemp = pClippedList;
+	if (uiThreads_ > uiBrushes / MIN_MERGES_PER_THREAD)
+	{
+		uiThreads_ = uiBrushes / MIN_MERGES_PER_THREAD;
+	}
 
-				while (pTemp != NULL)
-				{
-					if (pTemp->GetNext() == pClip)
-					{
-						break;
-					}
+	Job.uiNext = 0;
+	Job.bFailed = false;
 
-					pTemp = pTemp->GetNext();
-				}
+	vector<thread>	vThreads;
 
-				pTemp->m_pNext = pClip->GetNext();
-				pClip->SetNext(NULL);
+	try
+	{
+		for (i = 1; i < uiThreads_; i++)
+		{
+			vThreads.push_back(thread(MergeThread, &Job));
+		}
+	}
+	catch (...)
+	{
+		// Could not start every thread, work with what we have
+	}
 
-				delete pClip;
+	//
+	// The calling thread clips brushes too
+	//
+	MergeThread(&Job);
 
-				pClip = pTemp->GetNext();
-			}
+	for (i = 0; i < vThreads.size(); i++)
+	{
+		vThreads[i].join();
+	}
+
+	//
+	// Extract the left over polygons of every brush, in file order.
+	// Brushes without any polygons left simply add nothing.
+	//
+	for (i = 0; i < uiBrushes; i++)
+	{
+		Poly *pPoly = Job.vClipped[i]->m_pPolys;
+
+		Job.vClipped[i]->m_pPolys = NULL;
+		delete Job.vClipped[i];
+
+		if (Job.bFailed)
+		{
+			delete pPoly;
+			continue;
+		}
+
+		if (pPoly == NULL)
+		{
+			continue;
+		}
+
+		if (pPolyList == NULL)
+		{
+			pPolyList = pPoly;
+		}
+		else
+		{
+			pPolyTail->SetNext(pPoly);
+		}
+
+		pPolyTail = pPoly;
+
+		while (!pPolyTail->IsLast())
+		{
+			pPolyTail = pPolyTail->GetNext();
 		}
 	}
 
-	delete pClippedList;
+	if (Job.bFailed)
+	{
+		rethrow_exception(Job.pException);
+	}
 
 	return pPolyList;
 }
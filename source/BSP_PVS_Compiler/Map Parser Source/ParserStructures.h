@@ -1,9 +1,12 @@
 #pragma once
 
-#include <Windows.h>
 #include "ParserMath.h"
+#include "WAD3.h"
 
 const unsigned int MAX_TEXTURE_NAME_LENGTH = 32;
+const unsigned int MIN_MERGES_PER_THREAD = 16;	// Fewer brushes per thread than this are not worth a thread in CSG
+
+class CMemoryPool;
 
 ////////////////////////////////////////////////////////////////////
 // Class definitions
@@ -25,8 +28,6 @@ private:
 	int				m_iHeight;
 
 public:
-	enum eGT { GT_FOUND = 0, GT_LOADED, GT_ERROR };
-
 	uint16_t	uiID;
 	bool isNullTex = false;
 	char			name[MAX_TEXTURE_NAME_LENGTH + 1];
@@ -34,12 +35,13 @@ public:
 	Texture();
 	~Texture();
 
-	Texture* GetTexture(char *pacTexture_, LPVOID lpView_, DWORD dwFileSize_, eGT &rResult_);
+	void LoadFromMip(const char *pacTexture_, const WAD3_MIP *lpMip_);
 	Texture* GetNext() const { return m_pNext; }
 
 	bool IsLast() const;
 	int GetHeight() const { return m_iHeight; }
 	int GetWidth() const { return m_iWidth; }
+	void SetSize(int iWidth_, int iHeight_) { m_iWidth = iWidth_; m_iHeight = iHeight_; }
 
 	void SetNext(Texture* pTexture_);
 };
@@ -70,13 +72,23 @@ public:
 	void SortVerticesCW();
 	void ToLeftHanded();
 	void CalculateTextureCoordinates(int texWidth, int texHeight, Plane texAxis[2], double texScale[2]);
-	void Poly::SplitPoly(Poly *pPoly_, Poly **ppFront_, Poly **ppBack_);
+	void SplitPoly(Poly *pPoly_, Poly **ppFront_, Poly **ppBack_);
 	eCP ClassifyPoly(Poly *pPoly_);
 
 	bool IsLast() const;
 
 	const bool operator == (const Poly &arg_) const;
 
+	//
+	// Polygons come from a pool which keeps a free list per thread,
+	// as brushes are built on several threads at once
+	//
+#pragma push_macro("new")
+#undef new
+	static void *operator new(size_t Size_);
+	static void operator delete(void *pPoly_, size_t Size_);
+#pragma pop_macro("new")
+
 	Poly();
 	~Poly();
 
@@ -85,6 +97,9 @@ public:
 	uint16_t	TextureID;
 	Poly	       *m_pNext;
 	unsigned long	m_iNumberOfVertices;
+
+private:
+	static CMemoryPool	m_Pool;
 };
 
 
@@ -180,7 +195,7 @@ public:
 	void SetNext(Brush *pBrush_);
 	void AddPoly(Poly *pPoly_);
 
-	Poly *MergeList();
+	Poly *MergeList(unsigned int uiThreads_ = 1);	// 0 = one per hardware thread
 	void ClipToBrush(Brush *pBrush_, bool bClipOnPlane_);
 	void CalculateAABB();
 
@@ -38,92 +38,135 @@
 
 #include "WAD3.h"
 #include "stdio.h"
+#include <cctype>
+#include <cstring>
 
-void WAD3MapFile(LPCTSTR szFileName, LPVOID *pView, LPDWORD pdwFileSize)
+WAD3File::WAD3File()
 {
-	HANDLE hFile = NULL;
-	HANDLE hFileMapping = NULL;
-	LPVOID lpView = NULL;
-	DWORD dwFileSize = 0;
-	DWORD dwError = 0;
-
-	hFile = CreateFile(
-		szFileName,					// Name of file
-		GENERIC_READ,				// Desired access
-		FILE_SHARE_READ,			// Share mode
-		NULL,						// Security attributes
-		OPEN_EXISTING,				// Creation disposition
-		FILE_FLAG_SEQUENTIAL_SCAN,	// Attributes and flags
-		NULL);						// Template file	
-
-	if (hFile == INVALID_HANDLE_VALUE)
+	m_pLumps = NULL;
+	m_dwNumLumps = 0;
+}
+
+WAD3File::~WAD3File()
+{
+	Close();
+}
+
+void WAD3File::Open(const char *szFileName)
+{
+	Close();
+
+	// Lumps are looked up all over the file, don't read ahead
+	if (!m_File.Open(szFileName, false))
 	{
-		int r = GetLastError();
-		throw CWADException();
+		throw CWADException("Unable to open WAD3 file.", szFileName);
 	}
 
-	// Store this away for now...
-	dwFileSize = GetFileSize(hFile, NULL);
+	const uint8_t *lpView = (const uint8_t *)m_File.GetData();
+	size_t dwFileSize = m_File.GetSize();
 
-	if (dwFileSize == -1)
+	// Make sure it's at least big enough to manipulate the header
+	if (dwFileSize < sizeof(WAD3_HEADER))
 	{
-		dwError = ::GetLastError();
-		CloseHandle(hFile);
-		throw CWADException(dwError);
+		Corrupt("WAD3 file is malformed.");
 	}
 
-	hFileMapping = CreateFileMapping(
-		hFile,						// Handle to file
-		NULL,						// Security attributes
-		PAGE_READONLY,				// Protection
-		0,							// Max size high
-		0,							// Max size low
-		NULL);						// Name of mapping object	
+	const WAD3_HEADER *lpHeader = (const WAD3_HEADER *)lpView;
+
+	if (lpHeader->identification != WAD3_ID)
+	{
+		Corrupt("Invalid WAD3 header id.");
+	}
 
-	if (hFileMapping == NULL)
+	// Make sure our table is really there
+	if ((lpHeader->infotableofs > dwFileSize) ||
+		(lpHeader->numlumps > (dwFileSize - lpHeader->infotableofs) / sizeof(WAD3_LUMP)))
 	{
-		dwError = ::GetLastError();
-		CloseHandle(hFile);
-		throw CWADException();
+		Corrupt("WAD3 file is malformed.");
 	}
 
-	// We don't need this anymore
-	CloseHandle(hFile);
+	m_pLumps = (const WAD3_LUMP *)(lpView + lpHeader->infotableofs);
+	m_dwNumLumps = lpHeader->numlumps;
 
-	// Map to the entire file
-	lpView = MapViewOfFile(
-		hFileMapping,				// Handle to the mapping
-		FILE_MAP_READ,				// Desired access
-		0,							// Offset high
-		0,							// Offset low
-		0);							// Number of bytes
+	m_MipLumps.reserve(m_dwNumLumps);
 
-	if (lpView == NULL)
+	string Name;
+
+	for (uint32_t j = 0; j < m_dwNumLumps; j++)
 	{
-		dwError = ::GetLastError();
-		CloseHandle(hFileMapping);
-		throw CWADException(dwError);
+		const WAD3_LUMP *lpLump = &m_pLumps[j];
+
+		if (lpLump->type != WAD3_TYPE_MIP)
+		{
+			continue;
+		}
+
+		// Names should be null terminated, but don't trust it
+		Name.assign(lpLump->name, strnlen(lpLump->name, sizeof(lpLump->name)));
+
+		for (size_t i = 0; i < Name.length(); i++)
+		{
+			Name[i] = (char)tolower((unsigned char)Name[i]);
+		}
+
+		// The first lump of a given name wins, as a scan of the table would
+		m_MipLumps.insert(make_pair(Name, lpLump));
 	}
+}
+
+void WAD3File::Close()
+{
+	m_MipLumps.clear();
+	m_pLumps = NULL;
+	m_dwNumLumps = 0;
 
-	// We don't need this anymore
-	CloseHandle(hFileMapping);
+	m_File.Close();
+}
 
-	if (pView)
+const WAD3_LUMP *WAD3File::FindMip(const string &LowerCaseName) const
+{
+	unordered_map<string, const WAD3_LUMP *>::const_iterator it = m_MipLumps.find(LowerCaseName);
+
+	if (it == m_MipLumps.end())
+	{
+		return NULL;
+	}
+
+	return it->second;
+}
+
+WAD3_SPAN WAD3File::GetLumpData(const WAD3_LUMP *lpLump) const
+{
+	size_t dwFileSize = m_File.GetSize();
+
+	// Make sure it's in bounds
+	if ((lpLump->filepos >= dwFileSize) || (lpLump->disksize > dwFileSize - lpLump->filepos))
 	{
-		*pView = lpView;
+		throw CWADException("Invalid lump entry; filepos is malformed.");
 	}
 
-	if (pdwFileSize)
+	WAD3_SPAN Span;
+
+	Span.pData = (const uint8_t *)m_File.GetData() + lpLump->filepos;
+	Span.uiSize = lpLump->disksize;
+
+	return Span;
+}
+
+const WAD3_MIP *WAD3File::GetMip(const WAD3_LUMP *lpLump) const
+{
+	WAD3_SPAN Span = GetLumpData(lpLump);
+
+	if (Span.uiSize < sizeof(WAD3_MIP))
 	{
-		*pdwFileSize = dwFileSize;
+		throw CWADException("Invalid lump entry; mip is truncated.");
 	}
+
+	return (const WAD3_MIP *)Span.pData;
 }
 
-int CorruptWAD3(LPCTSTR szErrorMessage, LPVOID lpView)
+void WAD3File::Corrupt(const char *szErrorMessage)
 {
-	UnmapViewOfFile(lpView);
+	Close();
 	throw CWADException(szErrorMessage);
-
-	// We never actually get here, but oh well
-	return 1;
-}
\ No newline at end of file
+}
@@ -2,7 +2,11 @@
 
 // WAD3 (Half-Life) Header and mip structs
 #include <iostream>
-#include <windows.h>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+#include "MappedFile.h"
 
 using namespace std;
 
@@ -38,80 +42,103 @@ Last lump entry
 
 typedef struct
 {
-	DWORD		identification;
-	DWORD		numlumps;
-	DWORD		infotableofs;			// Lump table
+	uint32_t	identification;
+	uint32_t	numlumps;
+	uint32_t	infotableofs;			// Lump table
 } WAD3_HEADER, *LPWAD3_HEADER;
 
 typedef struct
 {
-	DWORD		filepos;
-	DWORD		disksize;
-	DWORD		size;					// uncompressed
-	BYTE		type;
-	BYTE		compression;
-	BYTE		pad1, pad2;
+	uint32_t	filepos;
+	uint32_t	disksize;
+	uint32_t	size;					// uncompressed
+	uint8_t		type;
+	uint8_t		compression;
+	uint8_t		pad1, pad2;
 	char		name[16];				// must be null terminated
 } WAD3_LUMP, *LPWAD3_LUMP;
 
 typedef struct
 {
 	char		name[16];
-	DWORD		width, height;
-	DWORD		offsets[4];		// four mip maps stored
+	uint32_t	width, height;
+	uint32_t	offsets[4];		// four mip maps stored
 } WAD3_MIP, *LPWAD3_MIP;
 
-extern void WAD3MapFile(LPCTSTR szFileName, LPVOID *pView, LPDWORD pdwFileSize);
-extern int CorruptWAD3(LPCTSTR szErrorMessage, LPVOID lpView);
+////////////////////////////////////////////////////////////////////////////////
+// Exceptions
+////////////////////////////////////////////////////////////////////////////////
 
 class CWADException
 {
 private:
-	DWORD m_dwError;
-	LPCTSTR m_szErrorMessage;
+	string m_ErrorMessage;
 
 public:
-	CWADException()
+	CWADException(const char *szErrorMessage)
 	{
-		m_szErrorMessage = NULL;
-		m_dwError = ::GetLastError();
+		m_ErrorMessage = szErrorMessage;
 	}
-	CWADException(DWORD dwError)
+	CWADException(const char *szErrorMessage, const char *szFileName)
 	{
-		m_szErrorMessage = NULL;
-		m_dwError = dwError;
-	}
-	CWADException(LPCTSTR szErrorMessage)
-	{
-		m_dwError = 0;
-		m_szErrorMessage = szErrorMessage;
+		m_ErrorMessage = szErrorMessage;
+		m_ErrorMessage += " (";
+		m_ErrorMessage += szFileName;
+		m_ErrorMessage += ")";
 	}
 	~CWADException() {};
 
+	const char *GetMessage() const { return m_ErrorMessage.c_str(); }
+
 	void PrintError()
 	{
-		if (m_dwError)
-		{
-			LPVOID lpMsgBuf;
-			FormatMessage(
-				FORMAT_MESSAGE_ALLOCATE_BUFFER |
-				FORMAT_MESSAGE_FROM_SYSTEM |
-				FORMAT_MESSAGE_IGNORE_INSERTS,
-				NULL,
-				m_dwError,
-				MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), // Default language
-				(LPTSTR)&lpMsgBuf,
-				0,
-				NULL
-				);
-			cout << "Whoops, something went wrong.  GetLastError() = " << m_dwError << endl << (LPTSTR)lpMsgBuf << endl;
-
-			LocalFree(lpMsgBuf);
-		}
-
-		if (m_szErrorMessage)
-		{
-			cout << "Whoops, something went wrong. " << endl << m_szErrorMessage << endl;
-		}
+		cout << "Whoops, something went wrong. " << endl << m_ErrorMessage << endl;
 	}
 };
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Reader
+////////////////////////////////////////////////////////////////////////////////
+
+//
+// Bytes of a lump inside the mapped WAD, never copied
+//
+struct WAD3_SPAN
+{
+	const uint8_t	*pData;
+	size_t		uiSize;
+};
+
+//
+// Memory mapped WAD3 file. The lump table is validated and the MIP lumps are
+// indexed by their lower case name once, when the file is opened. Every
+// pointer handed out stays valid until the file is closed.
+//
+class WAD3File
+{
+private:
+	MappedFile									m_File;
+	const WAD3_LUMP								*m_pLumps;
+	uint32_t									m_dwNumLumps;
+	unordered_map<string, const WAD3_LUMP *>	m_MipLumps;
+
+	void Corrupt(const char *szErrorMessage);
+
+public:
+	WAD3File();
+	~WAD3File();
+
+	void Open(const char *szFileName);		// Throws CWADException
+	void Close();
+
+	const uint8_t *GetData() const { return (const uint8_t *)m_File.GetData(); }
+	size_t GetSize() const { return m_File.GetSize(); }
+
+	const WAD3_LUMP *GetLumps() const { return m_pLumps; }
+	uint32_t GetNumberOfLumps() const { return m_dwNumLumps; }
+
+	const WAD3_LUMP *FindMip(const string &LowerCaseName) const;
+	WAD3_SPAN GetLumpData(const WAD3_LUMP *lpLump) const;		// Throws CWADException
+	const WAD3_MIP *GetMip(const WAD3_LUMP *lpLump) const;		// Throws CWADException
+};
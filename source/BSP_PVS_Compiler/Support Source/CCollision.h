@@ -1,5 +1,9 @@
 #pragma once
+#ifdef _WIN32
 #include <DirectXMath.h>
+#else
+#include "PortableXM.h"
+#endif
 using namespace DirectX;
 
 bool RayIntersectTriangle(const XMFLOAT3 & Origin, const XMFLOAT3 & Velocity, const XMFLOAT3 & v1, const XMFLOAT3 & v2, const XMFLOAT3 & v3, const XMFLOAT3 & TriNormal, bool BiDirectional);
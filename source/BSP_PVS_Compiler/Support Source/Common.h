@@ -12,8 +12,12 @@
 //-----------------------------------------------------------------------------
 // App Specific Includes
 //-----------------------------------------------------------------------------
+#ifdef _WIN32
 #include <tchar.h>
 #include <wtypes.h> // Warning may include windows.h.. Beware when using in MFC
+#else
+#include "Portable.h"
+#endif
 #include <math.h>
 #include "AppError.h"
 
@@ -46,10 +50,13 @@
 // Process Number Definitions
 //--------------------------------------------------------------
 #define PROCESS_HSR         0   // Hidden Surface Removal
+#define PROCESS_MAP         1   // Map Loading
 #define PROCESS_BSP         2   // Binary Space Partition
 #define PROCESS_PRT         3   // Portals
 #define PROCESS_PVS         4   // Potential Visibility Set
 #define PROCESS_TJR         5   // T-Junction Repair
+#define PROCESS_LMP         6   // Light Mapping
+#define PROCESS_COUNT       7   // Number of process slots
 
 //-----------------------------------------------------------------------------
 // Main Class Definitions
@@ -0,0 +1,74 @@
+//-----------------------------------------------------------------------------
+// File: Portable.h
+//
+// Desc: Stand ins for the small set of Win32 types, macros and functions that
+//       the compiler relies upon, allowing it to be built without <tchar.h>
+//       and <wtypes.h>. Included by Common.h only when _WIN32 is not defined.
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+#ifndef _PORTABLE_H_
+#define _PORTABLE_H_
+
+#ifndef _WIN32
+
+//-----------------------------------------------------------------------------
+// Portable Specific Includes
+//-----------------------------------------------------------------------------
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Win32 Type Definitions
+//-----------------------------------------------------------------------------
+typedef int32_t             LONG;       // Must remain 32 bit, HRESULT is a LONG
+typedef unsigned long       ULONG;
+typedef uint32_t            DWORD;
+typedef int                 BOOL;
+typedef unsigned char       UCHAR;
+typedef unsigned char       BYTE;
+typedef unsigned short      USHORT;
+typedef unsigned short      WORD;
+typedef unsigned int        UINT;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef void               *LPVOID;
+typedef void               *HANDLE;
+typedef char                TCHAR;
+typedef char               *LPSTR;
+typedef const char         *LPCSTR;
+typedef char               *LPTSTR;
+typedef const char         *LPCTSTR;
+
+//-----------------------------------------------------------------------------
+// Win32 Macros & Constants
+//-----------------------------------------------------------------------------
+#define TRUE                1
+#define FALSE               0
+#define MAX_PATH            260
+
+#define _T(x)               x
+#define _tcsrchr            strrchr
+#define _tcsdup             strdup
+#define _strdup             strdup
+#define _stricmp            strcasecmp
+
+#define ZeroMemory(Dest,Length) memset((Dest), 0, (Length))
+
+// windows.h provides these as macros, the compiler uses them unqualified
+using std::min;
+using std::max;
+
+//-----------------------------------------------------------------------------
+// Win32 Function Replacements
+//-----------------------------------------------------------------------------
+inline void Sleep( DWORD Milliseconds ) { usleep( (useconds_t)Milliseconds * 1000 ); }
+
+#endif // !_WIN32
+
+#endif // _PORTABLE_H_
@@ -0,0 +1,98 @@
+//-----------------------------------------------------------------------------
+// File: PortableXM.h
+//
+// Desc: Scalar implementation of the few DirectXMath types and functions used
+//       by the collision routines, for platforms without <DirectXMath.h>.
+//       Included by CCollision.h only when _WIN32 is not defined.
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+#ifndef _PORTABLEXM_H_
+#define _PORTABLEXM_H_
+
+namespace DirectX
+{
+//-----------------------------------------------------------------------------
+// Type Definitions
+//-----------------------------------------------------------------------------
+struct XMFLOAT3
+{
+    float x, y, z;
+
+    XMFLOAT3( ) = default;
+    XMFLOAT3( float _x, float _y, float _z ) : x( _x ), y( _y ), z( _z ) {}
+};
+
+struct XMVECTOR
+{
+    float v[4];
+};
+
+typedef const XMVECTOR FXMVECTOR;
+
+//-----------------------------------------------------------------------------
+// Load & Store
+//-----------------------------------------------------------------------------
+inline XMVECTOR XMLoadFloat3( const XMFLOAT3 * pSource )
+{
+    XMVECTOR Result = { { pSource->x, pSource->y, pSource->z, 0.0f } };
+    return Result;
+}
+
+inline void XMStoreFloat3( XMFLOAT3 * pDestination, FXMVECTOR V )
+{
+    pDestination->x = V.v[0];
+    pDestination->y = V.v[1];
+    pDestination->z = V.v[2];
+}
+
+//-----------------------------------------------------------------------------
+// Vector Operations
+//-----------------------------------------------------------------------------
+inline XMVECTOR XMVectorReplicate( float Value )
+{
+    XMVECTOR Result = { { Value, Value, Value, Value } };
+    return Result;
+}
+
+inline float XMVectorGetX( FXMVECTOR V )
+{
+    return V.v[0];
+}
+
+inline XMVECTOR XMVectorAdd( FXMVECTOR V1, FXMVECTOR V2 )
+{
+    XMVECTOR Result = { { V1.v[0] + V2.v[0], V1.v[1] + V2.v[1], V1.v[2] + V2.v[2], V1.v[3] + V2.v[3] } };
+    return Result;
+}
+
+inline XMVECTOR XMVectorSubtract( FXMVECTOR V1, FXMVECTOR V2 )
+{
+    XMVECTOR Result = { { V1.v[0] - V2.v[0], V1.v[1] - V2.v[1], V1.v[2] - V2.v[2], V1.v[3] - V2.v[3] } };
+    return Result;
+}
+
+inline XMVECTOR XMVectorMultiplyAdd( FXMVECTOR V1, FXMVECTOR V2, FXMVECTOR V3 )
+{
+    XMVECTOR Result = { { V1.v[0] * V2.v[0] + V3.v[0], V1.v[1] * V2.v[1] + V3.v[1],
+                          V1.v[2] * V2.v[2] + V3.v[2], V1.v[3] * V2.v[3] + V3.v[3] } };
+    return Result;
+}
+
+inline XMVECTOR XMVector3Dot( FXMVECTOR V1, FXMVECTOR V2 )
+{
+    return XMVectorReplicate( V1.v[0] * V2.v[0] + V1.v[1] * V2.v[1] + V1.v[2] * V2.v[2] );
+}
+
+inline XMVECTOR XMVector3Cross( FXMVECTOR V1, FXMVECTOR V2 )
+{
+    XMVECTOR Result = { { V1.v[1] * V2.v[2] - V1.v[2] * V2.v[1],
+                          V1.v[2] * V2.v[0] - V1.v[0] * V2.v[2],
+                          V1.v[0] * V2.v[1] - V1.v[1] * V2.v[0], 0.0f } };
+    return Result;
+}
+
+} // End Namespace DirectX
+
+#endif // _PORTABLEXM_H_
@@ -0,0 +1,124 @@
+//-----------------------------------------------------------------------------
+// File: CBSPTreeTest.cpp
+//
+// Desc: Checks that the BSP compiler's plane pool recognises matching and
+//       opposite planes whose normals lie close to a tie between two axes,
+//       where the canonical orientation of a plane may go either way.
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// CBSPTreeTest Specific Includes
+//-----------------------------------------------------------------------------
+#include "../Compiler Source/CBSPTree.h"
+#include "../Support Source/CPlane.h"
+#include <stdio.h>
+
+//-----------------------------------------------------------------------------
+// Module Local Variables
+//-----------------------------------------------------------------------------
+static ULONG g_Failures = 0;
+
+//-----------------------------------------------------------------------------
+// Name : Check () (Local)
+// Desc : Records and reports a failed test condition.
+//-----------------------------------------------------------------------------
+static void Check( bool Condition, LPCSTR Test, LPCSTR Description )
+{
+    if ( Condition ) return;
+    printf( "FAILED: %s: %s\n", Test, Description );
+    g_Failures++;
+}
+
+//-----------------------------------------------------------------------------
+// Name : MakePlane () (Local)
+// Desc : Builds a plane from an unnormalized normal and a distance.
+//-----------------------------------------------------------------------------
+static CPlane3 MakePlane( float x, float y, float z, float Distance )
+{
+    CVector3 Normal( x, y, z );
+    Normal.Normalize();
+    return CPlane3( Normal, Distance );
+}
+
+//-----------------------------------------------------------------------------
+// Name : Negate () (Local)
+// Desc : Returns the plane facing the opposite way.
+//-----------------------------------------------------------------------------
+static CPlane3 Negate( const CPlane3 & Plane )
+{
+    return CPlane3( -Plane.Normal, -Plane.Distance );
+}
+
+//-----------------------------------------------------------------------------
+// Name : TestTiePair () (Local)
+// Desc : Adds a pair of planes which match within the pool's tolerance but
+//        whose dominant normal axes differ, then their opposites, and checks
+//        that they were merged and linked.
+//-----------------------------------------------------------------------------
+static void TestTiePair( LPCSTR Test, const CPlane3 & A, const CPlane3 & B )
+{
+    CBSPTree Tree;
+    bool     Flipped;
+    long     IndexA, IndexB, IndexNegB, Found;
+
+    // The pair are the same plane
+    IndexA = Tree.AddPlane( A );
+    IndexB = Tree.AddPlane( B );
+    Check( IndexA >= 0 && IndexB == IndexA, Test, "matching plane was added twice" );
+    Check( Tree.GetPlaneCount() == 1, Test, "plane pool holds duplicates" );
+
+    // Each faces the opposite way to the other's negation
+    IndexNegB = Tree.AddPlane( Negate( B ) );
+    Check( IndexNegB >= 0 && IndexNegB != IndexA, Test, "opposite plane was merged" );
+    Check( Tree.GetOppositePlane( IndexA ) == IndexNegB, Test, "plane not linked to its opposite" );
+    Check( Tree.GetOppositePlane( IndexNegB ) == IndexA, Test, "opposite not linked back to the plane" );
+    Check( Tree.AddPlane( Negate( A ) ) == IndexNegB, Test, "opposite plane was added twice" );
+
+    // Either orientation of either plane is found
+    Found = Tree.FindPlane( B, Flipped );
+    Check( Found == IndexA && !Flipped, Test, "FindPlane missed the matching plane" );
+    Found = Tree.FindPlane( Negate( A ), Flipped );
+    Check( Found == IndexNegB && !Flipped, Test, "FindPlane missed the opposite plane" );
+
+    // With only one orientation in the pool, the other is found flipped
+    CBSPTree Single;
+    IndexA = Single.AddPlane( A );
+    Found  = Single.FindPlane( Negate( B ), Flipped );
+    Check( Found == IndexA && Flipped, Test, "FindPlane missed the flipped plane" );
+}
+
+//-----------------------------------------------------------------------------
+// Name : main ()
+// Desc : Runs every test, returning non zero if any failed.
+//-----------------------------------------------------------------------------
+int main( )
+{
+    const float Tie = 2e-6f;      // Well within BSP_PLANE_NORMAL_EPSILON
+
+    // Exact diagonal, which canonicalises about either axis
+    CPlane3 Diagonal = MakePlane( 1.0f, -1.0f, 0.0f, 64.0f );
+    TestTiePair( "diagonal", Diagonal, Diagonal );
+
+    // Either side of a two axis tie, with opposite signs
+    TestTiePair( "xy tie", MakePlane( 1.0f + Tie, -(1.0f - Tie), 0.0f, 64.0f ),
+                           MakePlane( 1.0f - Tie, -(1.0f + Tie), 0.0f, 64.0f ) );
+    TestTiePair( "yz tie", MakePlane( 0.0f, -(1.0f + Tie), 1.0f - Tie, -32.0f ),
+                           MakePlane( 0.0f, -(1.0f - Tie), 1.0f + Tie, -32.0f ) );
+
+    // Either side of a three axis tie, with the dominant axes of opposite signs
+    TestTiePair( "xyz tie", MakePlane( 1.0f + Tie, 1.0f, -(1.0f - Tie), 128.0f ),
+                            MakePlane( 1.0f - Tie, 1.0f, -(1.0f + Tie), 128.0f ) );
+
+    // Close to a tie, but too far apart to match
+    CBSPTree Tree;
+    long     First  = Tree.AddPlane( MakePlane( 1.0f + 1e-3f, -1.0f, 0.0f, 64.0f ) );
+    long     Second = Tree.AddPlane( MakePlane( 1.0f, -(1.0f + 1e-3f), 0.0f, 64.0f ) );
+    Check( First >= 0 && Second >= 0 && First != Second, "distinct", "distinct planes were merged" );
+    Check( Tree.GetOppositePlane( First ) < 0, "distinct", "distinct plane was linked as opposite" );
+
+    if ( g_Failures ) printf( "%lu check(s) failed\n", g_Failures );
+    else printf( "All plane pool checks passed\n" );
+    return ( g_Failures ) ? 1 : 0;
+}
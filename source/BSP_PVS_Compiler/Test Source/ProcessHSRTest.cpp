@@ -0,0 +1,220 @@
+//-----------------------------------------------------------------------------
+// File: ProcessHSRTest.cpp
+//
+// Desc: Checks the hidden surface removal pass on meshes built from boxes,
+//       including a box nested wholly inside another, and that the result
+//       mesh is the same whether the pass runs on one thread or several.
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// ProcessHSRTest Specific Includes
+//-----------------------------------------------------------------------------
+#include "../Compiler Source/CBSPTree.h"
+#include "../Compiler Source/ProcessHSR.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Module Local Variables
+//-----------------------------------------------------------------------------
+static ULONG g_Failures = 0;
+
+//-----------------------------------------------------------------------------
+// Name : Check () (Local)
+// Desc : Records and reports a failed test condition.
+//-----------------------------------------------------------------------------
+static void Check( bool Condition, LPCSTR Test, LPCSTR Description )
+{
+    if ( Condition ) return;
+    printf( "FAILED: %s: %s\n", Test, Description );
+    g_Failures++;
+}
+
+//-----------------------------------------------------------------------------
+// Name : MakeBox () (Local)
+// Desc : Builds a mesh of the six outward facing sides of an axis aligned box.
+//-----------------------------------------------------------------------------
+static CMesh * MakeBox( const CVector3 & Min, const CVector3 & Max )
+{
+    // Corner selection (0 = Min, 1 = Max) for each side, wound anti-clockwise
+    // when viewed from outside the box
+    static const int Sides[6][4][3] =
+    {
+        { { 0,0,0 }, { 0,0,1 }, { 0,1,1 }, { 0,1,0 } },     // -X
+        { { 1,0,0 }, { 1,1,0 }, { 1,1,1 }, { 1,0,1 } },     // +X
+        { { 0,0,0 }, { 1,0,0 }, { 1,0,1 }, { 0,0,1 } },     // -Y
+        { { 0,1,0 }, { 0,1,1 }, { 1,1,1 }, { 1,1,0 } },     // +Y
+        { { 0,0,0 }, { 0,1,0 }, { 1,1,0 }, { 1,0,0 } },     // -Z
+        { { 0,0,1 }, { 1,0,1 }, { 1,1,1 }, { 0,1,1 } }      // +Z
+    };
+    static const float Normals[6][3] =
+    {
+        { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 }
+    };
+
+    CMesh * pMesh = new CMesh;
+    pMesh->AddFaces( 6 );
+    for ( ULONG i = 0; i < 6; i++ )
+    {
+        CFace * pFace = pMesh->Faces[i];
+        pFace->Normal = CVector3( Normals[i][0], Normals[i][1], Normals[i][2] );
+        pFace->AddVertices( 4 );
+        for ( ULONG v = 0; v < 4; v++ )
+        {
+            pFace->Vertices[v] = CVertex( Sides[i][v][0] ? Max.x : Min.x,
+                                          Sides[i][v][1] ? Max.y : Min.y,
+                                          Sides[i][v][2] ? Max.z : Min.z );
+            pFace->Vertices[v].Normal = pFace->Normal;
+
+        } // Next Vertex
+
+    } // Next Side
+
+    pMesh->CalculateBoundingBox();
+    return pMesh;
+}
+
+//-----------------------------------------------------------------------------
+// Name : RunHSR () (Local)
+// Desc : Runs the HSR pass over the meshes with the thread count specified,
+//        returning the result mesh (NULL on failure).
+//-----------------------------------------------------------------------------
+static CMesh * RunHSR( const std::vector<CMesh*> & Meshes, ULONG ThreadCount )
+{
+    CProcessHSR Processor;
+    HSROPTIONS  Options;
+
+    Options.Enabled     = true;
+    Options.ThreadCount = ThreadCount;
+    Processor.SetOptions( Options );
+
+    for ( ULONG i = 0; i < Meshes.size(); i++ ) Processor.AddMesh( Meshes[i] );
+    if ( FAILED( Processor.Process() ) ) return NULL;
+    return Processor.GetResultMesh();
+}
+
+//-----------------------------------------------------------------------------
+// Name : SameMesh () (Local)
+// Desc : Determines whether two meshes hold exactly the same faces.
+//-----------------------------------------------------------------------------
+static bool SameMesh( const CMesh * pA, const CMesh * pB )
+{
+    if ( pA->FaceCount != pB->FaceCount ) return false;
+    for ( ULONG i = 0; i < pA->FaceCount; i++ )
+    {
+        const CFace * pFaceA = pA->Faces[i], * pFaceB = pB->Faces[i];
+        if ( pFaceA->VertexCount != pFaceB->VertexCount ) return false;
+        for ( ULONG v = 0; v < pFaceA->VertexCount; v++ )
+        {
+            const CVertex & a = pFaceA->Vertices[v], & b = pFaceB->Vertices[v];
+            if ( a.x != b.x || a.y != b.y || a.z != b.z ) return false;
+
+        } // Next Vertex
+
+    } // Next Face
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Name : TestNested () (Local)
+// Desc : A box wholly inside another loses all of its faces, while the outer
+//        box is left untouched, whichever of the two is added first.
+//-----------------------------------------------------------------------------
+static void TestNested( LPCSTR Test, ULONG ThreadCount, bool InnerFirst )
+{
+    std::vector<CMesh*> Meshes;
+    Meshes.push_back( MakeBox( CVector3( -4, -4, -4 ), CVector3( 4, 4, 4 ) ) );
+    Meshes.insert( InnerFirst ? Meshes.begin() : Meshes.end(), MakeBox( CVector3( -1, -1, -1 ), CVector3( 1, 1, 1 ) ) );
+
+    CMesh * pResult = RunHSR( Meshes, ThreadCount );
+    Check( pResult != NULL, Test, "HSR failed" );
+    if ( pResult )
+    {
+        bool Outer = true;
+        for ( ULONG i = 0; i < pResult->FaceCount; i++ )
+        {
+            const CFace * pFace = pResult->Faces[i];
+            for ( ULONG v = 0; v < pFace->VertexCount; v++ )
+            {
+                const CVertex & Vertex = pFace->Vertices[v];
+                if ( fabsf( Vertex.x ) < 4.0f && fabsf( Vertex.y ) < 4.0f && fabsf( Vertex.z ) < 4.0f ) Outer = false;
+
+            } // Next Vertex
+
+        } // Next Face
+        Check( pResult->FaceCount == 6, Test, "expected only the outer box's faces" );
+        Check( Outer, Test, "a face of the inner box survived" );
+        delete pResult;
+
+    } // End if result
+
+    for ( ULONG i = 0; i < Meshes.size(); i++ ) delete Meshes[i];
+}
+
+//-----------------------------------------------------------------------------
+// Name : TestThreads () (Local)
+// Desc : Clips a grid of overlapping boxes, along with one nested inside
+//        another, and compares the result of each thread count with serial.
+//-----------------------------------------------------------------------------
+static void TestThreads( )
+{
+    std::vector<CMesh*> Meshes;
+    CMesh * pSerial, * pResult;
+    int     x, y, z;
+
+    for ( z = 0; z < 2; z++ )
+    {
+        for ( y = 0; y < 3; y++ )
+        {
+            for ( x = 0; x < 3; x++ )
+            {
+                CVector3 Min( x * 3.0f, y * 3.0f + x * 0.5f, z * 3.0f + y * 0.25f );
+                Meshes.push_back( MakeBox( Min, Min + CVector3( 4, 4, 4 ) ) );
+
+            } // Next Column
+
+        } // Next Row
+
+    } // Next Layer
+    Meshes.push_back( MakeBox( CVector3( 1, 1, 1 ), CVector3( 2, 2, 2 ) ) );
+
+    pSerial = RunHSR( Meshes, 1 );
+    Check( pSerial != NULL, "threads", "serial HSR failed" );
+    if ( pSerial )
+    {
+        Check( pSerial->FaceCount > 0, "threads", "serial HSR removed every face" );
+        for ( ULONG ThreadCount = 2; ThreadCount <= 8; ThreadCount *= 2 )
+        {
+            pResult = RunHSR( Meshes, ThreadCount );
+            Check( pResult != NULL, "threads", "threaded HSR failed" );
+            if ( !pResult ) continue;
+            Check( SameMesh( pSerial, pResult ), "threads", "threaded result differs from serial" );
+            delete pResult;
+
+        } // Next Thread Count
+        delete pSerial;
+
+    } // End if serial result
+
+    for ( ULONG i = 0; i < Meshes.size(); i++ ) delete Meshes[i];
+}
+
+//-----------------------------------------------------------------------------
+// Name : main ()
+// Desc : Runs every test, returning non zero if any failed.
+//-----------------------------------------------------------------------------
+int main( )
+{
+    TestNested( "nested serial", 1, false );
+    TestNested( "nested threaded", 2, false );
+    TestNested( "nested inner first serial", 1, true );
+    TestNested( "nested inner first threaded", 2, true );
+    TestThreads();
+
+    if ( g_Failures ) printf( "%lu check(s) failed\n", g_Failures );
+    else printf( "All hidden surface removal checks passed\n" );
+    return ( g_Failures ) ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+//-----------------------------------------------------------------------------
+// File: ProcessPRTTest.cpp
+//
+// Desc: Checks the coplanar portal merge on hand built portals, and that the
+//       tree's portal array and leaf portal indices are closed up afterwards.
+//
+// Copyright (c) 1997-2002 Daedalus Developments. All rights reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// ProcessPRTTest Specific Includes
+//-----------------------------------------------------------------------------
+#include "../Compiler Source/CBSPTree.h"
+#include "../Compiler Source/ProcessPRT.h"
+#include <stdio.h>
+
+//-----------------------------------------------------------------------------
+// Module Local Variables
+//-----------------------------------------------------------------------------
+static ULONG g_Failures = 0;
+
+//-----------------------------------------------------------------------------
+// Name : Check () (Local)
+// Desc : Records and reports a failed test condition.
+//-----------------------------------------------------------------------------
+static void Check( bool Condition, LPCSTR Test, LPCSTR Description )
+{
+    if ( Condition ) return;
+    printf( "FAILED: %s: %s\n", Test, Description );
+    g_Failures++;
+}
+
+//-----------------------------------------------------------------------------
+// Name : MakePortal () (Local)
+// Desc : Builds a portal on the z = 0 plane from a list of x, y pairs.
+//-----------------------------------------------------------------------------
+static CBSPPortal * MakePortal( const float Points[][2], unsigned long Count )
+{
+    CBSPPortal * pPortal = new CBSPPortal;
+    pPortal->AddVertices( Count );
+    for ( unsigned long i = 0; i < Count; i++ ) pPortal->Vertices[i] = CVertex( Points[i][0], Points[i][1], 0.0f );
+    return pPortal;
+}
+
+//-----------------------------------------------------------------------------
+// Name : HasVertex () (Local)
+// Desc : Determines whether the portal has a vertex at the point specified.
+//-----------------------------------------------------------------------------
+static bool HasVertex( const CBSPPortal * pPortal, float x, float y )
+{
+    for ( unsigned long i = 0; i < pPortal->VertexCount; i++ )
+    {
+        if ( pPortal->Vertices[i].FuzzyCompare( CVector3( x, y, 0.0f ), 1e-4f ) ) return true;
+
+    } // Next Vertex
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Name : TestMerge () (Local)
+// Desc : Attempts to merge the second portal into the first, checking the
+//        result and the number of vertices left in the merged portal.
+//-----------------------------------------------------------------------------
+static CBSPPortal * TestMerge( LPCSTR Test, const float A[][2], unsigned long CountA,
+                               const float B[][2], unsigned long CountB, bool Expected, unsigned long ExpectedCount )
+{
+    CProcessPRT Processor;
+    PRTOPTIONS  Options;
+
+    Options.Enabled        = true;
+    Options.ThreadCount    = 1;
+    Options.MergeCoplanar  = true;
+    Options.MergeTolerance = EPSILON;
+    Processor.SetOptions( Options );
+
+    CBSPPortal * pPortal = MakePortal( A, CountA );
+    CBSPPortal * pOther  = MakePortal( B, CountB );
+    bool         Merged  = Processor.TryMergePortals( pPortal, pOther, CVector3( 0.0f, 0.0f, 1.0f ) );
+
+    Check( Merged == Expected, Test, Expected ? "portals were not merged" : "portals were merged" );
+    Check( pPortal->VertexCount == ExpectedCount, Test, "wrong number of vertices" );
+
+    delete pOther;
+    return pPortal;
+}
+
+//-----------------------------------------------------------------------------
+// Name : TestCompact () (Local)
+// Desc : Removes a portal from a small tree and checks that the portal array
+//        and each leaf's portal indices are closed up.
+//-----------------------------------------------------------------------------
+static void TestCompact( )
+{
+    const float Square[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+    CBSPTree    Tree;
+    CBSPPortal *pPortals[3];
+    unsigned long i;
+
+    for ( i = 0; i < 3; i++ )
+    {
+        pPortals[i] = MakePortal( Square, 4 );
+        Tree.IncreasePortalCount();
+        Tree.SetPortal( i, pPortals[i] );
+
+    } // Next Portal
+
+    Tree.IncreaseLeafCount();
+    Tree.IncreaseLeafCount();
+    for ( i = 0; i < 3; i++ ) Tree.GetLeaf( 0 )->AddPortal( i );
+    Tree.GetLeaf( 1 )->AddPortal( 1 );
+    Tree.GetLeaf( 1 )->AddPortal( 2 );
+
+    // Remove the middle portal as if it had been merged
+    Tree.SetPortal( 1, NULL );
+    delete pPortals[1];
+    Tree.CompactPortals();
+
+    const std::vector<long> & Leaf0 = Tree.GetLeaf( 0 )->PortalIndices;
+    const std::vector<long> & Leaf1 = Tree.GetLeaf( 1 )->PortalIndices;
+    Check( Tree.GetPortalCount() == 2, "compact", "portal array was not closed up" );
+    Check( Tree.GetPortal( 0 ) == pPortals[0] && Tree.GetPortal( 1 ) == pPortals[2], "compact", "portal order changed" );
+    Check( Leaf0.size() == 2 && Leaf0[0] == 0 && Leaf0[1] == 1, "compact", "first leaf indices not renumbered" );
+    Check( Leaf1.size() == 1 && Leaf1[0] == 1, "compact", "second leaf indices not renumbered" );
+}
+
+//-----------------------------------------------------------------------------
+// Name : main ()
+// Desc : Runs every test, returning non zero if any failed.
+//-----------------------------------------------------------------------------
+int main( )
+{
+    const float Square[4][2]    = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+    const float Right[4][2]     = { { 1, 0 }, { 2, 0 }, { 2, 1 }, { 1, 1 } };
+    const float SquareCW[4][2]  = { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 0 } };
+    const float RightCW[4][2]   = { { 1, 0 }, { 1, 1 }, { 2, 1 }, { 2, 0 } };
+    const float Wedge[3][2]     = { { 1, 1 }, { 1, 0 }, { 2, 0.5f } };
+    const float Spike[3][2]     = { { 1, 1 }, { 1, 0 }, { 2, 2 } };
+    const float Offset[4][2]    = { { 1, 0.5f }, { 2, 0.5f }, { 2, 1.5f }, { 1, 1.5f } };
+    CBSPPortal *pPortal;
+
+    // Two squares side by side become a rectangle, the vertices left on the straight edges are dropped
+    pPortal = TestMerge( "rectangle", Square, 4, Right, 4, true, 4 );
+    Check( HasVertex( pPortal, 0, 0 ) && HasVertex( pPortal, 2, 0 ) && HasVertex( pPortal, 2, 1 ) && HasVertex( pPortal, 0, 1 ),
+           "rectangle", "merged portal has the wrong corners" );
+    delete pPortal;
+
+    // Either winding may be merged
+    delete TestMerge( "rectangle cw", SquareCW, 4, RightCW, 4, true, 4 );
+
+    // A convex union keeps every corner
+    pPortal = TestMerge( "wedge", Square, 4, Wedge, 3, true, 5 );
+    Check( HasVertex( pPortal, 2, 0.5f ), "wedge", "merged portal lost the wedge point" );
+    delete pPortal;
+
+    // The union would be concave
+    delete TestMerge( "spike", Square, 4, Spike, 3, false, 4 );
+
+    // Touching, but without a shared edge
+    delete TestMerge( "offset", Square, 4, Offset, 4, false, 4 );
+
+    TestCompact();
+
+    if ( g_Failures ) printf( "%lu check(s) failed\n", g_Failures );
+    else printf( "All portal merge checks passed\n" );
+    return ( g_Failures ) ? 1 : 0;
+}
@@ -482,6 +482,9 @@ Library::BSPEngine::BSPTree::BSPTree(D3DApp *app, const char * FileName)
 	m_pPVSData = NULL;
 	m_nPVSSize = 0;
 	m_bPVSCompressed = false;
+	m_bPVSFullRuns = false;
+	m_bTJRepaired = false;
+	m_pvsListCacheSize = 0;
 
 	// Make a copy of the file name
 	m_strFileName = _strdup(FileName);
@@ -540,6 +543,9 @@ Library::BSPEngine::BSPTree::~BSPTree()
 	m_pPVSData = NULL;
 	m_nPVSSize = 0;
 	m_bPVSCompressed = false;
+	m_bTJRepaired = false;
+	m_clusterLeaves.clear();
+	ReleasePVSLeafLists();
 	
 	auto PolyIterator = m_Polygons.begin();
 	auto BinIterator = m_LeafBins.begin();
@@ -715,18 +721,37 @@ bool Library::BSPEngine::BSPTree::Load(FILE * file)
 		AddLeaf(leaf);
 	}
 
-	// PVS
+	// PVS (older files store a single 'compressed' bool in place of the flags)
 	uint32_t pvsSize;
-	bool isCompressed;
+	uint8_t pvsFlags;
 	fread(&pvsSize, sizeof(uint32_t), 1, file);
-	fread(&isCompressed, sizeof(bool), 1, file);
+	fread(&pvsFlags, sizeof(uint8_t), 1, file);
 
 	m_nPVSSize = pvsSize;
-	m_bPVSCompressed = isCompressed;
+	m_bPVSCompressed = (pvsFlags & PVS_FLAG_COMPRESSED) != 0;
+	m_bPVSFullRuns = m_bPVSCompressed && (pvsFlags & PVS_FLAG_FULLRUNS) != 0;
+	m_bTJRepaired = (pvsFlags & PVS_FLAG_TJR_REPAIRED) != 0;
+
+	// Read the leaf to vis cluster table and build each cluster's leaf list
+	m_clusterLeaves.clear();
+	if (pvsFlags & PVS_FLAG_CLUSTERED) {
+		uint32_t numClusters;
+		fread(&numClusters, sizeof(uint32_t), 1, file);
+		m_clusterLeaves.resize(numClusters);
+
+		for (uint32_t i = 0; i != numLeaves; ++i) {
+			uint32_t cluster;
+			fread(&cluster, sizeof(uint32_t), 1, file);
+			if (cluster < numClusters) m_clusterLeaves[cluster].push_back(m_Leaves[i]);
+		}
+	}
 
 	m_pPVSData = new UCHAR[m_nPVSSize];
 	fread(m_pPVSData, m_nPVSSize, 1, file);
 
+	// Decode the visible leaf lists up front (if enabled)
+	BuildPVSLeafLists();
+
 	return true;
 }
 
@@ -872,16 +897,41 @@ void Library::BSPEngine::BSPTree::ProcessVisibilityLeaves(const LeafVector &leav
 
 void Library::BSPEngine::BSPTree::ProcessVisibilityPVS(BSPTreeLeaf * pCurrentLeaf)
 {
+	// If this leaf's row has been decoded into a leaf list, simply walk it
+	const uint32_t *pList;
+	size_t count;
+	if (m_PVSLeafLists && GetPVSLeafList(pCurrentLeaf, pList, count)) {
+		for (size_t i = 0; i < count; ++i) MarkPVSLeaf(m_Leaves[pList[i]]);
+		return;
+	}
 
-	// We are in a valid leaf, let's test its PVS.
+	// We are in a valid leaf, let's test its PVS. If the leaves were grouped into
+	// vis clusters then each bit represents a cluster rather than a single leaf.
 	UCHAR *pPVS = &m_pPVSData[pCurrentLeaf->m_nPVSIndex];
-	size_t LeafCount = m_Leaves.size();
+	bool bClustered = !m_clusterLeaves.empty();
+	size_t SetCount = bClustered ? m_clusterLeaves.size() : m_Leaves.size();
 
 	// Loop through and render applicable leaves
-	for (size_t LeafIndex = 0; LeafIndex < LeafCount; )
+	for (size_t SetIndex = 0; SetIndex < SetCount; )
 	{
+		// Is this a compressed run of fully visible bytes ?
+		if (*pPVS == 0xFF && m_bPVSFullRuns)
+		{
+			// Step to the run length byte, and mark run length * 8 leaves
+			pPVS++;
+			size_t RunEnd = min(SetIndex + (*pPVS) * 8, SetCount);
+			for (; SetIndex < RunEnd; ++SetIndex) {
+				if (bClustered) {
+					const LeafVector &clusterLeaves = m_clusterLeaves[SetIndex];
+					for (size_t j = 0; j < clusterLeaves.size(); ++j) MarkPVSLeaf(clusterLeaves[j]);
+				}
+				else {
+					MarkPVSLeaf(m_Leaves[SetIndex]);
+				}
+			}
+		} // End if full run
 		// Is this a non 0 PVS byte (or ZRLE not used) ?
-		if (*pPVS != 0)
+		else if (*pPVS != 0)
 		{
 			// Check the 8 bits in this byte
 			for (int i = 0; i < 8; i++)
@@ -889,26 +939,23 @@ void Library::BSPEngine::BSPTree::ProcessVisibilityPVS(BSPTreeLeaf * pCurrentLea
 				UCHAR Mask = 1 << i;
 				UCHAR Data = *pPVS;
 
-				// Is this leaf visible ?
+				// Is this leaf (or cluster) visible ?
 				if (Data & Mask)
 				{
-					BSPTreeLeaf * pVisibleLeaf = m_Leaves[LeafIndex];
-					if (!pVisibleLeaf) continue;
-					
-					if (m_sortLeavesFrontToBack) {
-						MarkLeafAncestors(pVisibleLeaf);
+					if (bClustered) {
+						const LeafVector &clusterLeaves = m_clusterLeaves[SetIndex];
+						for (size_t j = 0; j < clusterLeaves.size(); ++j) MarkPVSLeaf(clusterLeaves[j]);
 					}
 					else {
-						// or add leaf in pvs order
-						AddVisibleLeaf(pVisibleLeaf);
+						MarkPVSLeaf(m_Leaves[SetIndex]);
 					}
 				} // End if leaf visible
 
 				  // Move on to the next leaf
-				LeafIndex++;
+				SetIndex++;
 
 				// Break out if we are about to overflow
-				if (LeafIndex == LeafCount) break;
+				if (SetIndex == SetCount) break;
 
 			} // Next Leaf in Byte
 
@@ -923,12 +970,12 @@ void Library::BSPEngine::BSPTree::ProcessVisibilityPVS(BSPTreeLeaf * pCurrentLea
 				// This is a ZRLE Compressed Packet, read run length * 8 leaves (8 bits per byte)
 				size_t RunLength = (*pPVS) * 8;
 				// Skip this amount of leaves
-				LeafIndex += RunLength;
+				SetIndex += RunLength;
 			} // Compressed
 			else
 			{
 				// Simply skip 8 leaves
-				LeafIndex += 8;
+				SetIndex += 8;
 			} // Uncompressed
 		} // End if ZRLE Packet
 
@@ -937,6 +984,146 @@ void Library::BSPEngine::BSPTree::ProcessVisibilityPVS(BSPTreeLeaf * pCurrentLea
 	}
 }
 
+void Library::BSPEngine::BSPTree::MarkPVSLeaf(BSPTreeLeaf * pVisibleLeaf)
+{
+	if (!pVisibleLeaf) return;
+
+	if (m_sortLeavesFrontToBack) {
+		MarkLeafAncestors(pVisibleLeaf);
+	}
+	else {
+		// or add leaf in pvs order
+		AddVisibleLeaf(pVisibleLeaf);
+	}
+}
+
+void Library::BSPEngine::BSPTree::DecodePVSRow(size_t pvsIndex, std::vector<uint32_t> &leaves) const
+{
+	// Decodes the row starting at pvsIndex, appending the index of every visible leaf
+	const UCHAR *pPVS = &m_pPVSData[pvsIndex];
+	bool bClustered = !m_clusterLeaves.empty();
+	size_t SetCount = bClustered ? m_clusterLeaves.size() : m_Leaves.size();
+
+	auto AddSet = [&](size_t SetIndex) {
+		if (bClustered) {
+			const LeafVector &clusterLeaves = m_clusterLeaves[SetIndex];
+			for (size_t j = 0; j < clusterLeaves.size(); ++j) leaves.push_back((uint32_t)clusterLeaves[j]->m_index);
+		}
+		else {
+			leaves.push_back((uint32_t)SetIndex);
+		}
+	};
+
+	for (size_t SetIndex = 0; SetIndex < SetCount; ++pPVS)
+	{
+		uint32_t Data = *pPVS;
+
+		// Compressed run of fully visible bytes
+		if (Data == 0xFF && m_bPVSFullRuns) {
+			size_t RunEnd = min(SetIndex + (*++pPVS) * 8, SetCount);
+			for (; SetIndex < RunEnd; ++SetIndex) AddSet(SetIndex);
+			continue;
+		}
+
+		// ZRLE compressed run of invisible bytes
+		if (Data == 0 && m_bPVSCompressed) {
+			SetIndex += (*++pPVS) * 8;
+			continue;
+		}
+
+		// Visit only the set bits, lowest first
+		while (Data) {
+			unsigned long Bit;
+			_BitScanForward(&Bit, Data);
+			Data &= Data - 1;
+			if (SetIndex + Bit < SetCount) AddSet(SetIndex + Bit);
+		}
+		SetIndex += 8;
+	}
+}
+
+void Library::BSPEngine::BSPTree::BuildPVSLeafLists()
+{
+	ReleasePVSLeafLists();
+	if (!m_PVSLeafLists || !m_pPVSData) return;
+
+	// Leaves sharing a PVS row (identical rows, or the same vis cluster) share one list
+	size_t budget = m_PVSLeafListBudget / sizeof(uint32_t);
+	size_t rowCount = 0;
+	std::vector<uint32_t> leaves;
+	for (size_t i = 0; i < m_Leaves.size(); ++i) {
+		size_t pvsIndex = m_Leaves[i]->m_nPVSIndex;
+		if (m_pvsListRanges.find(pvsIndex) != m_pvsListRanges.end()) continue;
+
+		leaves.clear();
+		DecodePVSRow(pvsIndex, leaves);
+		rowCount++;
+
+		// Too large to hold every list ? Decode on demand instead, caching as many
+		// average sized rows as the budget allows.
+		if (m_pvsListData.size() + leaves.size() > budget) {
+			size_t averageRow = max((m_pvsListData.size() + leaves.size()) / rowCount, (size_t)1);
+			m_pvsListCacheSize = max(budget / averageRow, (size_t)8);
+			m_pvsListData.clear();
+			m_pvsListData.shrink_to_fit();
+			m_pvsListRanges.clear();
+			return;
+		}
+
+		m_pvsListRanges[pvsIndex] = std::make_pair(m_pvsListData.size(), leaves.size());
+		m_pvsListData.insert(m_pvsListData.end(), leaves.begin(), leaves.end());
+	}
+}
+
+void Library::BSPEngine::BSPTree::ReleasePVSLeafLists()
+{
+	m_pvsListData.clear();
+	m_pvsListRanges.clear();
+	m_pvsListCache.clear();
+	m_pvsListLookup.clear();
+	m_pvsListCacheSize = 0;
+}
+
+bool Library::BSPEngine::BSPTree::GetPVSLeafList(BSPTreeLeaf * pLeaf, const uint32_t *&pList, size_t &count)
+{
+	size_t pvsIndex = pLeaf->m_nPVSIndex;
+
+	// Decoded at load time ?
+	auto range = m_pvsListRanges.find(pvsIndex);
+	if (range != m_pvsListRanges.end()) {
+		pList = m_pvsListData.data() + range->second.first;
+		count = range->second.second;
+		return true;
+	}
+	if (m_pvsListCacheSize == 0) return false;
+
+	// Recently visited ? Move it to the front, otherwise decode it now
+	// reusing the least recently used entry once the cache is full.
+	auto cached = m_pvsListLookup.find(pvsIndex);
+	if (cached != m_pvsListLookup.end()) {
+		m_pvsListCache.splice(m_pvsListCache.begin(), m_pvsListCache, cached->second);
+	}
+	else {
+		if (m_pvsListCache.size() >= m_pvsListCacheSize) {
+			m_pvsListLookup.erase(m_pvsListCache.back().pvsIndex);
+			m_pvsListCache.splice(m_pvsListCache.begin(), m_pvsListCache, std::prev(m_pvsListCache.end()));
+		}
+		else {
+			m_pvsListCache.emplace_front();
+		}
+
+		PVSLeafList &list = m_pvsListCache.front();
+		list.pvsIndex = pvsIndex;
+		list.leaves.clear();
+		DecodePVSRow(pvsIndex, list.leaves);
+		m_pvsListLookup[pvsIndex] = m_pvsListCache.begin();
+	}
+
+	pList = m_pvsListCache.front().leaves.data();
+	count = m_pvsListCache.front().leaves.size();
+	return true;
+}
+
 void Library::BSPEngine::BSPTree::MarkLeafAncestors(BSPTreeLeaf * pLeaf)
 {
 	BSPTreeNode *pNode = pLeaf->m_pParentNode;
@@ -1291,7 +1478,8 @@ bool Library::BSPEngine::BSPTree::BuildRenderData()
 	if (m_Leaves.size() == 0) return false;
 
 	// First thing we need to do is repair any T-Junctions created during the build
-	Repair();
+	// (unless the compiler has already done so)
+	if (!m_bTJRepaired) Repair();
 
 	// Retrieve the leaf list in TRAVERSAL order to ensure that the 
 	// render batching works as efficiently as possible
@@ -3,6 +3,7 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include "Common.h"
 
 
@@ -12,6 +13,11 @@
 #define BSP_SOLID_LEAF      0x80000000
 #define MESH_DETAIL         0x1
 
+#define PVS_FLAG_COMPRESSED   0x01  // PVS rows are ZRLE compressed
+#define PVS_FLAG_CLUSTERED    0x02  // PVS rows are per vis cluster, leaf to cluster table follows
+#define PVS_FLAG_FULLRUNS     0x04  // Runs of 0xFF bytes are also compressed (as zero runs are)
+#define PVS_FLAG_TJR_REPAIRED 0x08  // Polygons were T-Junction repaired by the compiler, Repair() is not required
+
 #define MAX_LIGHTS_PER_LEAF 16
 //#define PRINT_VISIBILITY_INFO
 //#define PRINT_OCCLUSION_INFO
@@ -539,6 +545,11 @@ namespace Library
 			void    ProcessVisibility();
 			void    ProcessVisibilityLeaves(const LeafVector &leaves);
 			void    ProcessVisibilityPVS(BSPTreeLeaf * pCurrentLeaf);
+			void    MarkPVSLeaf(BSPTreeLeaf * pVisibleLeaf);
+			void    DecodePVSRow(size_t pvsIndex, std::vector<uint32_t> &leaves) const;
+			void    BuildPVSLeafLists();
+			void    ReleasePVSLeafLists();
+			bool    GetPVSLeafList(BSPTreeLeaf * pLeaf, const uint32_t *&pList, size_t &count);
 			void	MarkLeafAncestors(BSPTreeLeaf * pLeaf);
 			void    SortLeavesFrontToBack();
 			//void    ResetRenderBinData();
@@ -553,6 +564,8 @@ namespace Library
 			void    RenderDoors(CXMMATRIX tMat);
 			
 			bool m_PVSEnabled = true;      // Is PVS culling enabled in this application?
+			bool m_PVSLeafLists = true;    // Decode each PVS row into a leaf index list at load time?
+			size_t m_PVSLeafListBudget = 16 * 1024 * 1024; // Max bytes of decoded lists, above this rows are decoded on demand
 			bool m_FrustumEnabled = true;  // Is Frustum culling enabled in this application?
 			
 			bool m_sortLeavesFrontToBack = true;
@@ -599,6 +612,20 @@ namespace Library
 			UCHAR         *m_pPVSData;          // The actual visibility bit array
 			size_t          m_nPVSSize;          // The size of the PVS array
 			bool           m_bPVSCompressed;    // Is the PVS set ZRLE compressed?
+			bool           m_bPVSFullRuns;      // Are runs of 0xFF bytes compressed too?
+			bool           m_bTJRepaired;       // Were the polygons T-Junction repaired by the compiler?
+			std::vector<LeafVector> m_clusterLeaves; // Leaves in each vis cluster (empty = one PVS bit per leaf)
+
+			struct PVSLeafList
+			{
+				size_t pvsIndex;                // The PVS row this list was decoded from
+				std::vector<uint32_t> leaves;   // Indices of the visible leaves
+			};
+			std::vector<uint32_t> m_pvsListData;    // Decoded leaf indices of every PVS row (when within budget)
+			std::unordered_map<size_t, std::pair<size_t, size_t>> m_pvsListRanges; // PVS row -> (first, count) in m_pvsListData
+			std::list<PVSLeafList> m_pvsListCache;  // Rows decoded on demand, most recently used first
+			std::unordered_map<size_t, std::list<PVSLeafList>::iterator> m_pvsListLookup; // PVS row -> cache entry
+			size_t m_pvsListCacheSize;              // Max rows held in the cache (0 = no on demand decoding)
 			bool		   m_useLighting;
 			XMFLOAT3 m_cachedCameraPos;
 